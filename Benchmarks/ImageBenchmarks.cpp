@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BMPImage.h"
+#include "BufferPool.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "TiledImage.h"
+
+// Timings of the image operations across sizes, bit counts and thread counts, written as CSV or JSON.
+// Usage: ImageBenchmarks [--sizes VGA,HD,FHD,4K,8K,16K] [--bits 1,8,24,32] [--threads 1,8] [--repeat 3]
+//                        [--format csv|json] [--output file]
+
+namespace
+{
+	// Every allocation of the process goes through the replaced operator new below
+	std::atomic<uint64_t> allocationCount{0};
+	std::atomic<uint64_t> allocatedBytes{0};
+}
+
+void* operator new(const size_t size)
+{
+	allocationCount++;
+	allocatedBytes += size;
+	if (void* memory = std::malloc(size != 0 ? size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+namespace
+{
+	struct Size {
+		std::string name;
+		int32_t width;
+		int32_t height;
+	};
+
+	const std::vector<Size> SIZES = {
+		{"VGA", 640, 480},
+		{"HD", 1280, 720},
+		{"FHD", 1920, 1080},
+		{"4K", 3840, 2160},
+		{"8K", 7680, 4320},
+		{"16K", 15360, 8640},
+	};
+
+	constexpr int16_t MANDELBROT_ITERATIONS = 150;
+	constexpr uint32_t BLUR_RADIUS = 8;
+
+	struct Options {
+		std::vector<Size> sizes;
+		std::vector<uint16_t> bitCounts;
+		std::vector<unsigned> threadCounts;
+		int repetitions;
+		bool json;
+		std::string output;
+	};
+
+	struct Result {
+		std::string operation;
+		std::string size;
+		int32_t width;
+		int32_t height;
+		uint16_t bitCount;
+		unsigned threadCount;
+		int repetitions;
+		double seconds;				// Median of the repetitions
+		size_t bytes;				// Pixels or file bytes processed by one run
+		uint64_t allocations;		// Of one run
+		uint64_t allocatedBytes;
+	};
+
+	std::vector<std::string> split(const std::string& list)
+	{
+		std::vector<std::string> items;
+		std::istringstream stream(list);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			if (!item.empty())
+			{
+				items.push_back(item);
+			}
+		}
+		return items;
+	}
+
+	Options parseOptions(const int argc, char* argv[])
+	{
+		Options options{{SIZES[0], SIZES[1], SIZES[3]}, {1, 8, 24, 32}, {1, std::max(1u, std::thread::hardware_concurrency())}, 3, false, ""};
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+			const std::string value = i + 1 < argc ? argv[i + 1] : "";
+			if (argument == "--sizes")
+			{
+				options.sizes.clear();
+				for (const std::string& name : split(value))
+				{
+					const auto found = std::find_if(SIZES.begin(), SIZES.end(), [&name](const Size& size) { return size.name == name; });
+					if (found == SIZES.end())
+					{
+						throw std::invalid_argument("Unknown size " + name);
+					}
+					options.sizes.push_back(*found);
+				}
+			}
+			else if (argument == "--bits")
+			{
+				options.bitCounts.clear();
+				for (const std::string& bitCount : split(value))
+				{
+					options.bitCounts.push_back(static_cast<uint16_t>(std::stoi(bitCount)));
+				}
+			}
+			else if (argument == "--threads")
+			{
+				options.threadCounts.clear();
+				for (const std::string& threadCount : split(value))
+				{
+					options.threadCounts.push_back(static_cast<unsigned>(std::stoi(threadCount)));
+				}
+			}
+			else if (argument == "--repeat")
+			{
+				options.repetitions = std::max(1, std::stoi(value));
+			}
+			else if (argument == "--format")
+			{
+				options.json = value == "json";
+			}
+			else if (argument == "--output")
+			{
+				options.output = value;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown option " + argument);
+			}
+			i++;
+		}
+		// The default thread counts are the same on a single core machine
+		options.threadCounts.erase(std::unique(options.threadCounts.begin(), options.threadCounts.end()), options.threadCounts.end());
+		return options;
+	}
+
+	/// <summary>
+	/// Run an operation a few times on fresh state, setup is not timed
+	/// </summary>
+	template <typename State>
+	Result measure(const std::string& operation, const Size& size, const uint16_t bitCount, const Options& options, const size_t bytes,
+		const std::function<State()>& setup, const std::function<void(State&)>& body)
+	{
+		std::vector<double> seconds;
+		uint64_t allocations = 0;
+		uint64_t allocated = 0;
+		for (int i = 0; i < options.repetitions; i++)
+		{
+			State state = setup();
+			// Pixel buffers come from the buffer pool, not from operator new
+			const BufferPool::Statistics firstPool = BufferPool::instance().getStatistics();
+			const uint64_t firstCount = allocationCount;
+			const uint64_t firstBytes = allocatedBytes;
+			const auto start = std::chrono::steady_clock::now();
+			body(state);
+			const auto end = std::chrono::steady_clock::now();
+			const BufferPool::Statistics pool = BufferPool::instance().getStatistics();
+			allocations = allocationCount - firstCount + (pool.allocations - firstPool.allocations) + (pool.reuses - firstPool.reuses);
+			allocated = allocatedBytes - firstBytes + (pool.usage.totalBytes - firstPool.usage.totalBytes);
+			seconds.push_back(std::chrono::duration<double>(end - start).count());
+		}
+		std::sort(seconds.begin(), seconds.end());
+		return Result{operation, size.name, size.width, size.height, bitCount, ThreadPool::instance().getThreadCount(),
+			options.repetitions, seconds[seconds.size() / 2], bytes, allocations, allocated};
+	}
+
+	/// <summary>
+	/// Vertical bands of colors, drawn with fills so that large images are quick to make
+	/// </summary>
+	BMPImage makeImage(const Size& size, const uint16_t bitCount)
+	{
+		BMPImage image(size.width, size.height, BMPImage::TRUE_COLOR_BIT_SIZE);
+		constexpr int32_t bandCount = 16;
+		for (int32_t band = 0; band < bandCount; band++)
+		{
+			const uint8_t value = static_cast<uint8_t>(band * 255 / (bandCount - 1));
+			image.fillRect(band * size.width / bandCount, 0, size.width / bandCount + 1, size.height, value, 255 - value, value / 2);
+		}
+		if (bitCount != BMPImage::TRUE_COLOR_BIT_SIZE)
+		{
+			image.convertTo(bitCount);
+		}
+		return image;
+	}
+
+	void writeResults(std::ostream& os, const std::vector<Result>& results, const bool json)
+	{
+		if (json)
+		{
+			os << "[\n";
+		}
+		else
+		{
+			os << "operation,size,width,height,bit_count,threads,repetitions,seconds,ns_per_pixel,mb_per_s,allocations,allocated_bytes\n";
+		}
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const Result& result = results[i];
+			const double pixelCount = static_cast<double>(result.width) * result.height;
+			const double nanosecondsPerPixel = result.seconds * 1e9 / pixelCount;
+			const double megabytesPerSecond = result.seconds > 0 ? result.bytes / 1e6 / result.seconds : 0;
+			if (json)
+			{
+				os << "  {\"operation\": \"" << result.operation << "\", \"size\": \"" << result.size << "\", \"width\": " << result.width
+					<< ", \"height\": " << result.height << ", \"bit_count\": " << result.bitCount << ", \"threads\": " << result.threadCount
+					<< ", \"repetitions\": " << result.repetitions << ", \"seconds\": " << result.seconds
+					<< ", \"ns_per_pixel\": " << nanosecondsPerPixel << ", \"mb_per_s\": " << megabytesPerSecond
+					<< ", \"allocations\": " << result.allocations << ", \"allocated_bytes\": " << result.allocatedBytes << "}"
+					<< (i + 1 < results.size() ? ",\n" : "\n");
+			}
+			else
+			{
+				os << result.operation << ',' << result.size << ',' << result.width << ',' << result.height << ',' << result.bitCount << ','
+					<< result.threadCount << ',' << result.repetitions << ',' << result.seconds << ',' << nanosecondsPerPixel << ','
+					<< megabytesPerSecond << ',' << result.allocations << ',' << result.allocatedBytes << '\n';
+			}
+		}
+		if (json)
+		{
+			os << "]\n";
+		}
+	}
+
+	std::vector<Result> run(const Options& options)
+	{
+		const std::string path = (std::filesystem::temp_directory_path() / "ImageBenchmarks.bmp").string();
+		std::vector<Result> results;
+		for (const unsigned threadCount : options.threadCounts)
+		{
+			ThreadPool::instance().setThreadCount(threadCount);
+			for (const Size& size : options.sizes)
+			{
+				for (const uint16_t bitCount : options.bitCounts)
+				{
+					const BMPImage image = makeImage(size, bitCount);
+					const size_t pixelBytes = (static_cast<size_t>(size.width) * bitCount + 7) / 8 * size.height;
+					std::cerr << "Measuring " << size.name << ", " << bitCount << " bits, " << threadCount << " threads\n";
+
+					results.push_back(measure<int>("save", size, bitCount, options, pixelBytes,
+						[] { return 0; }, [&](int&) { image.save(path.c_str()); }));
+					const size_t fileBytes = static_cast<size_t>(std::filesystem::file_size(path));
+					results.back().bytes = fileBytes;
+					results.push_back(measure<int>("load", size, bitCount, options, fileBytes,
+						[] { return 0; }, [&](int&) { BMPImage loaded(path.c_str()); }));
+					results.push_back(measure<BMPImage>("multiplySize", size, bitCount, options, pixelBytes,
+						[&] { return image; }, [](BMPImage& copy) { copy.multiplySize(0.5f); }));
+					results.push_back(measure<BMPImage>("resize", size, bitCount, options, pixelBytes,
+						[&] { return image; }, [&](BMPImage& copy) { copy.resize(size.width * 3 / 4, size.height * 3 / 4); }));
+					results.push_back(measure<BMPImage>("rotate90", size, bitCount, options, pixelBytes,
+						[&] { return image; }, [](BMPImage& copy) { copy.rotate90(); }));
+					if (bitCount == BMPImage::MONOCHROME_BIT_SIZE)
+					{
+						continue;
+					}
+					// The same passes on 64 x 64 tiles, the conversion is measured on its own
+					results.push_back(measure<int>("to_tiled", size, bitCount, options, pixelBytes,
+						[] { return 0; }, [&](int&) { TiledImage tiled(image); }));
+					const TiledImage tiled(image);
+					results.push_back(measure<TiledImage>("rotate90_tiled", size, bitCount, options, pixelBytes,
+						[&] { return tiled; }, [](TiledImage& copy) { copy.rotate90(); }));
+					results.push_back(measure<BMPImage>("blur_vertical", size, bitCount, options, pixelBytes,
+						[&] { return image; }, [](BMPImage& copy) { copy.blurVertical(BLUR_RADIUS); }));
+					results.push_back(measure<TiledImage>("blur_vertical_tiled", size, bitCount, options, pixelBytes,
+						[&] { return tiled; }, [](TiledImage& copy) { copy.blurVertical(BLUR_RADIUS); }));
+				}
+				const size_t fractalBytes = static_cast<size_t>(size.width) * size.height * 3;
+				results.push_back(measure<int>("mandelbrot", size, BMPImage::TRUE_COLOR_BIT_SIZE, options, fractalBytes,
+					[] { return 0; }, [&](int&) { BMPImage::Fractal::mandelbrot(size.width, size.height, MANDELBROT_ITERATIONS); }));
+				results.push_back(measure<int>("mandelbrot_tiled", size, BMPImage::TRUE_COLOR_BIT_SIZE, options, fractalBytes,
+					[] { return 0; }, [&](int&) { TiledImage::mandelbrot(size.width, size.height, MANDELBROT_ITERATIONS); }));
+			}
+		}
+		std::filesystem::remove(path);
+		return results;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	try
+	{
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << "\n"
+			<< "Usage: ImageBenchmarks [--sizes VGA,HD,FHD,4K,8K,16K] [--bits 1,8,24,32] [--threads 1,8] [--repeat 3] "
+			<< "[--format csv|json] [--output file]\n";
+		return 1;
+	}
+
+	// The messages of the operations would be measured with them
+	Log::setLevel(Log::Level::NONE);
+	std::vector<Result> results;
+	try
+	{
+		results = run(options);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Benchmark failed: " << e.what() << "\n";
+		return 1;
+	}
+
+	if (options.output.empty())
+	{
+		writeResults(std::cout, results, options.json);
+	}
+	else
+	{
+		std::ofstream file(options.output);
+		writeResults(file, results, options.json);
+	}
+	return 0;
+}
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BMPImage.h"
+#include "ImageComparison.h"
+#include "ImagePyramid.h"
+#include "Log.h"
+
+// Regression check of the image operations: every demo image goes through each operation, and the result is
+// compared with the golden image stored for it. Round trips through a file format are compared with the source.
+// Usage: ImageGoldens [--images dir] [--goldens dir] [--max-difference 1] [--min-psnr 48] [--diffs dir] [--update]
+
+#ifndef IMAGE_SOURCE_DIR
+#define IMAGE_SOURCE_DIR "."
+#endif
+
+namespace
+{
+	constexpr const char* MANIFEST_NAME = "goldens.txt";
+
+	struct Options {
+		std::string images;
+		std::string goldens;
+		int maxDifference;
+		double minPsnr;
+		std::string diffs;
+		bool update;
+	};
+
+	struct Operation {
+		std::string name;
+		bool roundTrip;		// Compared with the prepared source instead of a golden
+		std::function<void(BMPImage&)> apply;
+		std::function<void(BMPImage&)> prepare = nullptr;	// Applied to the source first, if any
+	};
+
+	// Width, height and bit count of a golden, the files are QOI which does not keep the bit count
+	struct Expected {
+		uint32_t width;
+		uint32_t height;
+		uint16_t bitCount;
+	};
+
+	/// <summary>
+	/// Save the image in the format of the extension and load it back
+	/// </summary>
+	void roundTrip(BMPImage& image, const std::string& extension)
+	{
+		const std::string path = (std::filesystem::temp_directory_path() / ("ImageGoldens" + extension)).string();
+		image.save(path.c_str());
+		image.load(path.c_str());
+		std::filesystem::remove(path);
+	}
+
+	/// <summary>
+	/// Save the image run length encoded and load it back, checking the codes chosen for the file
+	/// </summary>
+	/// <param name="compression">BI_RLE8 or BI_RLE4</param>
+	void runLengthRoundTrip(BMPImage& image, const uint32_t compression)
+	{
+		const std::string path = (std::filesystem::temp_directory_path() / "ImageGoldens.bmp").string();
+		image.setCompressed(true);
+		image.save(path.c_str());
+		const uint32_t saved = BMPImage::probe(path.c_str()).compression;
+		image.load(path.c_str());
+		std::filesystem::remove(path);
+		if (saved != compression)
+		{
+			throw std::runtime_error("File compression is " + std::to_string(saved) + " instead of " + std::to_string(compression));
+		}
+		if (!image.isCompressed())
+		{
+			throw std::runtime_error("RLE compression was not kept");
+		}
+	}
+
+	/// <summary>
+	/// 32 bits image of half the size of another, with color and alpha gradients, to blend or paste over it
+	/// </summary>
+	BMPImage overlayFor(const BMPImage& image)
+	{
+		const uint32_t width = std::max(image.getWidth() / 2, 1u);
+		const uint32_t height = std::max(image.getHeight() / 2, 1u);
+		BMPImage overlay(static_cast<int32_t>(width), static_cast<int32_t>(height), BMPImage::DEEP_COLOR_BIT_SIZE);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				overlay.setPixel(static_cast<uint16_t>(x), static_cast<uint16_t>(y), static_cast<uint8_t>(x * 255 / width),
+					static_cast<uint8_t>(y * 255 / height), 160, static_cast<uint8_t>((x + y) * 255 / (width + height)));
+			}
+		}
+		return overlay;
+	}
+
+	void compositeOver(BMPImage& image, const Blender::Mode mode)
+	{
+		image.composite(overlayFor(image), static_cast<int32_t>(image.getWidth() / 4), static_cast<int32_t>(image.getHeight() / 4), mode);
+	}
+
+	const std::vector<Operation>& operations()
+	{
+		static const std::vector<Operation> list = {
+			{"bmp", true, [](BMPImage& image) { roundTrip(image, ".bmp"); }},
+			{"qoi", true, [](BMPImage& image) { roundTrip(image, ".qoi"); }},
+			{"pam", true, [](BMPImage& image) { roundTrip(image, ".pam"); }},
+			{"rle", true, [](BMPImage& image) { runLengthRoundTrip(image, BMPImage::BI_RLE8); },
+				[](BMPImage& image) { image.convertTo(BMPImage::GRAY_SCALE_BIT_SIZE); }},
+			{"rle4", true, [](BMPImage& image) { runLengthRoundTrip(image, BMPImage::BI_RLE4); },
+				[](BMPImage& image) { image.quantize(16); }},
+			{"half", false, [](BMPImage& image) { image.multiplySize(0.5f); }},
+			{"resize", false, [](BMPImage& image) { image.resize(image.getWidth() * 3 / 4, image.getHeight() * 3 / 4); }},
+			{"gray", false, [](BMPImage& image) { image.convertTo(BMPImage::GRAY_SCALE_BIT_SIZE); }},
+			{"mono", false, [](BMPImage& image) { image.convertTo(BMPImage::MONOCHROME_BIT_SIZE); }},
+			{"deep", false, [](BMPImage& image) { image.convertTo(BMPImage::DEEP_COLOR_BIT_SIZE); }},
+			{"mono24", false, [](BMPImage& image) { image.convertTo(BMPImage::TRUE_COLOR_BIT_SIZE); },
+				[](BMPImage& image) { image.convertTo(BMPImage::MONOCHROME_BIT_SIZE); }},
+			{"quantize", false, [](BMPImage& image) { image.quantize(16, ColorQuantizer::Dithering::FLOYD_STEINBERG); }},
+			{"ordered", false, [](BMPImage& image) { image.quantize(16, ColorQuantizer::Dithering::ORDERED); }},
+			{"invert", false, [](BMPImage& image) { image.invertColors(); }},
+			{"brightness", false, [](BMPImage& image) { image.adjustBrightness(40); }},
+			{"contrast", false, [](BMPImage& image) { image.adjustContrast(1.5f); }},
+			{"gamma", false, [](BMPImage& image) { image.adjustGamma(2.2f); }},
+			{"levels", false, [](BMPImage& image) { image.adjustLevels(20, 230, 1.2f); }},
+			{"swap", false, [](BMPImage& image) { image.swapChannels(ColorLUT::RED_CHANNEL, ColorLUT::BLUE_CHANNEL); }},
+			{"equalize", false, [](BMPImage& image) { image.equalizeHistogram(); }},
+			{"autolevels", false, [](BMPImage& image) { image.autoLevels(); }},
+			{"pyramid", false, [](BMPImage& image) {
+				const ImagePyramid pyramid(image, 2);
+				image = pyramid.getImage(1);
+			}},
+			{"crop", false, [](BMPImage& image) {
+				image.crop(image.getWidth() / 4, image.getHeight() / 4, image.getWidth() / 2, image.getHeight() / 2);
+			}},
+			{"copy", false, [](BMPImage& image) {
+				const BMPImage region = image.copyRegion(0, 0, image.getWidth() / 2, image.getHeight() / 2);
+				image.paste(region, image.getWidth() / 2, image.getHeight() / 2);
+			}},
+			{"paste", false, [](BMPImage& image) { image.paste(overlayFor(image), image.getWidth() / 4, image.getHeight() / 4); }},
+			{"fill", false, [](BMPImage& image) {
+				image.fillRect(image.getWidth() / 8, image.getHeight() / 8, image.getWidth() / 3, image.getHeight() / 4, 200, 40, 90);
+			}},
+			{"over", false, [](BMPImage& image) { compositeOver(image, Blender::Mode::OVER); }},
+			{"multiply", false, [](BMPImage& image) { compositeOver(image, Blender::Mode::MULTIPLY); }},
+			{"screen", false, [](BMPImage& image) { compositeOver(image, Blender::Mode::SCREEN); }},
+			{"additive", false, [](BMPImage& image) { compositeOver(image, Blender::Mode::ADDITIVE); }},
+			{"rotate", false, [](BMPImage& image) { image.rotate90(true); }},
+			{"rotateback", false, [](BMPImage& image) { image.rotate90(false); }},
+			{"blur", false, [](BMPImage& image) { image.blurVertical(4); }},
+		};
+		return list;
+	}
+
+	Options parseOptions(const int argc, char* argv[])
+	{
+		Options options{std::string(IMAGE_SOURCE_DIR) + "/Images/DemoImages", std::string(IMAGE_SOURCE_DIR) + "/Images/Goldens",
+			1, 48.0, "", false};
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+			if (argument == "--update")
+			{
+				options.update = true;
+				continue;
+			}
+			if (i + 1 >= argc)
+			{
+				throw std::invalid_argument("Missing value of " + argument);
+			}
+			const std::string value = argv[++i];
+			if (argument == "--images")
+			{
+				options.images = value;
+			}
+			else if (argument == "--goldens")
+			{
+				options.goldens = value;
+			}
+			else if (argument == "--max-difference")
+			{
+				options.maxDifference = std::stoi(value);
+			}
+			else if (argument == "--min-psnr")
+			{
+				options.minPsnr = std::stod(value);
+			}
+			else if (argument == "--diffs")
+			{
+				options.diffs = value;
+			}
+			else
+			{
+				throw std::invalid_argument("Unknown option " + argument);
+			}
+		}
+		return options;
+	}
+
+	/// <summary>
+	/// One "name width height bitCount" line per golden
+	/// </summary>
+	std::map<std::string, Expected> readManifest(const std::string& path)
+	{
+		std::map<std::string, Expected> manifest;
+		std::ifstream file(path);
+		std::string name;
+		Expected expected{};
+		while (file >> name >> expected.width >> expected.height >> expected.bitCount)
+		{
+			manifest[name] = expected;
+		}
+		return manifest;
+	}
+
+	void writeManifest(const std::string& path, const std::map<std::string, Expected>& manifest)
+	{
+		std::ofstream file(path);
+		for (const auto& [name, expected] : manifest)
+		{
+			file << name << ' ' << expected.width << ' ' << expected.height << ' ' << expected.bitCount << '\n';
+		}
+		if (!file)
+		{
+			throw std::runtime_error("Could not write " + path);
+		}
+	}
+
+	/// <summary>
+	/// Compare a result with its reference, print a line and write the diff mask of a failure
+	/// </summary>
+	/// <returns>True when the result is within the tolerances</returns>
+	bool check(const std::string& name, const BMPImage& result, const BMPImage& reference, const Expected& expected, const Options& options)
+	{
+		std::cout << name << ": ";
+		if (result.getWidth() != expected.width || result.getHeight() != expected.height || result.getBitCount() != expected.bitCount)
+		{
+			std::cout << "FAILED, " << result.getWidth() << 'x' << result.getHeight() << ' ' << result.getBitCount() << " bits instead of "
+				<< expected.width << 'x' << expected.height << ' ' << expected.bitCount << " bits\n";
+			return false;
+		}
+		const ImageComparison::Result comparison = ImageComparison::compare(result, reference);
+		const bool passed = comparison.maxDifference <= options.maxDifference && comparison.psnr >= options.minPsnr;
+		std::cout << (passed ? "ok, " : "FAILED, ") << comparison << '\n';
+		if (!passed && !options.diffs.empty())
+		{
+			std::filesystem::create_directories(options.diffs);
+			const std::string path = options.diffs + "/" + name + ".bmp";
+			ImageComparison::diffMask(result, reference, static_cast<uint8_t>(std::max(0, options.maxDifference))).save(path.c_str());
+			std::cout << "  differences written to " << path << '\n';
+		}
+		return passed;
+	}
+
+	/// <summary>
+	/// Run every operation on every image
+	/// </summary>
+	/// <returns>Number of failed checks</returns>
+	int run(const Options& options)
+	{
+		const std::string manifestPath = options.goldens + "/" + MANIFEST_NAME;
+		std::map<std::string, Expected> manifest = readManifest(manifestPath);
+		if (options.update)
+		{
+			std::filesystem::create_directories(options.goldens);
+		}
+
+		// Files that are not images, like the index written by ImageProject, are left out
+		std::vector<std::filesystem::path> images;
+		for (const auto& entry : std::filesystem::directory_iterator(options.images))
+		{
+			if (!entry.is_regular_file())
+			{
+				continue;
+			}
+			try
+			{
+				BMPImage::probe(entry.path().string().c_str());
+				images.push_back(entry.path());
+			}
+			catch (const std::exception&)
+			{
+			}
+		}
+		std::sort(images.begin(), images.end());
+
+		int failures = 0;
+		for (const std::filesystem::path& path : images)
+		{
+			BMPImage original;
+			try
+			{
+				original.load(path.string().c_str());
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << path.filename().string() << ": FAILED, " << e.what() << '\n';
+				failures++;
+				continue;
+			}
+			for (const Operation& operation : operations())
+			{
+				const std::string name = path.stem().string() + "." + operation.name;
+				BMPImage source = original;
+				if (operation.prepare)
+				{
+					operation.prepare(source);
+				}
+				BMPImage result = source;
+				try
+				{
+					operation.apply(result);
+				}
+				catch (const std::exception& e)
+				{
+					std::cout << name << ": FAILED, " << e.what() << '\n';
+					failures++;
+					continue;
+				}
+
+				if (operation.roundTrip)
+				{
+					const Expected expected{source.getWidth(), source.getHeight(), source.getBitCount()};
+					failures += check(name, result, source, expected, options) ? 0 : 1;
+					continue;
+				}
+				const std::string goldenPath = options.goldens + "/" + name + ".qoi";
+				if (options.update)
+				{
+					result.save(goldenPath.c_str());
+					manifest[name] = Expected{result.getWidth(), result.getHeight(), result.getBitCount()};
+					std::cout << name << ": updated\n";
+					continue;
+				}
+				const auto found = manifest.find(name);
+				if (found == manifest.end() || !std::filesystem::exists(goldenPath))
+				{
+					std::cout << name << ": FAILED, no golden, run with --update to make it\n";
+					failures++;
+					continue;
+				}
+				failures += check(name, result, BMPImage(goldenPath.c_str()), found->second, options) ? 0 : 1;
+			}
+			Log::flush();
+		}
+		if (options.update)
+		{
+			writeManifest(manifestPath, manifest);
+		}
+		return failures;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	try
+	{
+		options = parseOptions(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << "\n"
+			<< "Usage: ImageGoldens [--images dir] [--goldens dir] [--max-difference 1] [--min-psnr 48] [--diffs dir] [--update]\n";
+		return 1;
+	}
+
+	// Only the results are printed
+	Log::setLevel(Log::Level::NONE);
+	int failures = 0;
+	try
+	{
+		failures = run(options);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Regression check failed: " << e.what() << "\n";
+		return 1;
+	}
+	if (!options.update)
+	{
+		std::cout << (failures == 0 ? "All results match the goldens\n" : std::to_string(failures) + " results differ from the goldens\n");
+	}
+	return failures == 0 ? 0 : 1;
+}
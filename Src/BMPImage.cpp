@@ -1,9 +1,27 @@
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <memory>
 #include <cstdlib>
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <mutex>
 
 #include "BMPImage.h"
+#include "ContentHash.h"
+#include "ImagePyramid.h"
+#include "Instrumentation.h"
+#include "Log.h"
+#include "NetpbmCodec.h"
+#include "PixelConverter.h"
+#include "QoiCodec.h"
+#include "RunLengthCodec.h"
+#include "ThreadPool.h"
 
 // <summary>
 /// Convert a value to little-endian (or big-endian) by swapping bytes.
@@ -25,47 +43,84 @@ static T ConvertEndian(T value)
 	return result;
 }
 
+namespace
+{
+	// Stream reads and writes of the BMP reader and writer, counted by the instrumentation
+	void readBytes(std::istream& stream, void* data, const size_t size)
+	{
+		stream.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+		IMAGE_COUNT(READ_CALLS, 1);
+		IMAGE_COUNT(BYTES_READ, stream.gcount());
+	}
+
+	void writeBytes(std::ostream& stream, const void* data, const size_t size)
+	{
+		stream.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		IMAGE_COUNT(WRITE_CALLS, 1);
+		IMAGE_COUNT(BYTES_WRITTEN, size);
+	}
+
+	Log::RepeatedMessage droppedAlpha(Log::Level::WARNING, "pixels had alpha dropped, the image has no alpha channel");
+
+	/// <summary>
+	/// Lumas of the sampled pixels of a row, for the perceptual hashes
+	/// </summary>
+	/// <param name="row">Pixels as in memory, or as in a BMP file with blueFirst (then 4 bits indices are packed)</param>
+	/// <param name="paletteLumas">Of the palette entries of indexed images</param>
+	/// <param name="columns">The PerceptualHash::SAMPLE_COUNT sampled columns</param>
+	void sampleLumas(const uint8_t* row, const uint16_t bitCount, const bool blueFirst, const std::array<uint8_t, 256>& paletteLumas,
+		const std::vector<uint32_t>& columns, float* samples)
+	{
+		const uint16_t byteCount = bitCount / 8;
+		const size_t red = blueFirst ? 2 : 0;
+		const size_t blue = blueFirst ? 0 : 2;
+		for (size_t i = 0; i < columns.size(); i++)
+		{
+			const uint32_t x = columns[i];
+			uint8_t value;
+			switch (bitCount)
+			{
+			case BMPImage::MONOCHROME_BIT_SIZE:
+				value = paletteLumas[(row[x / 8] >> (7 - x % 8)) & 1];
+				break;
+			case BMPImage::SIXTEEN_COLORS_BIT_SIZE:
+				value = paletteLumas[(row[x / 2] >> (x % 2 == 0 ? 4 : 0)) & 0x0F];
+				break;
+			case BMPImage::GRAY_SCALE_BIT_SIZE:
+				value = paletteLumas[row[x]];
+				break;
+			default:
+			{
+				const uint8_t* pixel = row + static_cast<size_t>(x) * byteCount;
+				value = PixelConverter::luma(pixel[red], pixel[1], pixel[blue]);
+				break;
+			}
+			}
+			samples[i] = value;
+		}
+	}
+}
+
 /// <summary>
 ///  Default constructor
 /// </summary>
 /// <param name="bitCount">Color Depth</param>
 BMPImage::BMPImage(uint16_t bitCount)
 {
-	uint32_t info_header_size= 0;
-	uint32_t compression = 0 ;
-	_infoHeader = BMPInfoHeader{
-		info_header_size, 0, 0, COLOR_PLANES_NUMBER, bitCount, compression, 0, BM_DEFAULT_RESOLUTION,
-		BM_DEFAULT_RESOLUTION, 0, 0
-	};
+	if (bitCount != TRUE_COLOR_BIT_SIZE && bitCount != DEEP_COLOR_BIT_SIZE &&
+		bitCount != GRAY_SCALE_BIT_SIZE && bitCount != MONOCHROME_BIT_SIZE)
+	{
+		throw std::invalid_argument("Image Bit Count not handled");
+	}
 	_v4InfoHeader = BMPV4InfoHeader{
-			info_header_size, 0, 0, COLOR_PLANES_NUMBER, bitCount, compression, 0, BM_DEFAULT_RESOLUTION,
+			0, 0, 0, COLOR_PLANES_NUMBER, bitCount, BI_RGB, 0, BM_DEFAULT_RESOLUTION,
 			BM_DEFAULT_RESOLUTION, 0, 0, RED_CHANNEL_BIT_MASK, GREEN_CHANNEL_BIT_MASK,
 			BLUE_CHANNEL_BIT_MASK, ALPHA_CHANNEL_BIT_MASK, LCS_WINDOWS_COLOR_SPACE, 0, 0,
 			0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 	};
-
-	if (bitCount == TRUE_COLOR_BIT_SIZE)
-	{
-		_activeHeader = _infoHeader;
-		info_header_size = BM_INFO_HEADER_SIZE;
-		compression = BI_RGB;
-		
-	}
-	else if (bitCount == DEEP_COLOR_BIT_SIZE)
-	{
-		_activeHeader = _v4InfoHeader;
-		info_header_size = BM_V4_INFO_HEADER_SIZE;
-		compression = BI_BITFIELDS;
-	}
-	else
-	{
-		throw std::invalid_argument("Image Bit Count not handled");
-	}
-	_activeHeader.size = info_header_size;
-	_activeHeader.compression = compression;
-	_fileHeader = BMPFileHeader{
-		BM_SIGNATURE, BM_FILE_HEADER_SIZE + info_header_size, 0, 0, BM_FILE_HEADER_SIZE + info_header_size
-	};
+	_fileHeader = BMPFileHeader{BM_SIGNATURE, 0, 0, 0, 0};
+	_setDefaultPalette();
+	_updateHeaders();
 }
 
 /// <summary>
@@ -79,7 +134,7 @@ BMPImage::BMPImage(int32_t width, int32_t height, uint16_t bitCount) : BMPImage(
 	_activeHeader.width = width;
 	_activeHeader.height = height;
 	_updateHeaders();
-	_pixelData.resize(width * height);
+	_pixelData.resize(_getRowSize() * height);
 }
 
 /// <summary>
@@ -98,10 +153,20 @@ BMPImage::BMPImage(const char* filename)
 BMPImage::BMPImage(const BMPImage& other)
 {
 	_fileHeader = other._fileHeader;
-	_infoHeader = other._infoHeader;
 	_v4InfoHeader = other._v4InfoHeader;
-	_activeHeader = other._activeHeader;
 	_pixelData = other._pixelData;
+	_palette = other._palette;
+	_contentHash = other._contentHash.load();
+}
+
+/// <summary>
+/// Take the pixels of another image object, with their account. The pixels are initialized here so that the default
+/// initializer does not create an account only to drop it.
+/// </summary>
+/// <param name="other"></param>
+BMPImage::BMPImage(BMPImage&& other) noexcept : _fileHeader(other._fileHeader), _v4InfoHeader(other._v4InfoHeader),
+	_pixelData(std::move(other._pixelData)), _palette(std::move(other._palette)), _contentHash(other._contentHash.load())
+{
 }
 
 /// <summary>
@@ -109,16 +174,43 @@ BMPImage::BMPImage(const BMPImage& other)
 /// </summary>
 BMPImage::~BMPImage() = default;
 
+/// <summary>
+/// Bytes of the pixel buffers of the image, the ones it took from moved images included
+/// </summary>
+BufferPool::Usage BMPImage::getMemoryUsage() const
+{
+	// The account goes with the pixels, an image moved from has none
+	const PixelAllocator<uint8_t> allocator = _pixelData.get_allocator();
+	if (!allocator.getAccount())
+	{
+		return BufferPool::Usage{};
+	}
+	return allocator.getAccount()->getUsage();
+}
+
 
 BMPImage& BMPImage::operator=(const BMPImage& other) {
 	if (this == &other) {
 		return *this; 
 	}
 	_fileHeader = other._fileHeader;
-	_infoHeader = other._infoHeader;
 	_v4InfoHeader = other._v4InfoHeader;
-	_activeHeader = other._activeHeader;
 	_pixelData = other._pixelData;
+	_palette = other._palette;
+	_contentHash = other._contentHash.load();
+
+	return *this;
+}
+
+BMPImage& BMPImage::operator=(BMPImage&& other) noexcept {
+	if (this == &other) {
+		return *this;
+	}
+	_fileHeader = other._fileHeader;
+	_v4InfoHeader = other._v4InfoHeader;
+	_pixelData = std::move(other._pixelData);
+	_palette = std::move(other._palette);
+	_contentHash = other._contentHash.load();
 
 	return *this;
 }
@@ -133,6 +225,11 @@ bool BMPImage::_isDeepColor() const
 	return _activeHeader.bitCount == DEEP_COLOR_BIT_SIZE;
 }
 
+bool BMPImage::_isMonochrome() const
+{
+	return _activeHeader.bitCount == MONOCHROME_BIT_SIZE;
+}
+
 uint16_t BMPImage::_getByteCount() const
 {
 	
@@ -141,163 +238,500 @@ uint16_t BMPImage::_getByteCount() const
 	if (_activeHeader.bitCount == TRUE_COLOR_BIT_SIZE)
 		return 3;
 	if (_activeHeader.bitCount == GRAY_SCALE_BIT_SIZE)
-		return 4;
+		return 1;
 	if (_activeHeader.bitCount == MONOCHROME_BIT_SIZE)
 		return 1;
 	throw std::runtime_error("Invalid bit count");
 }
 
-void BMPImage::_readHeaders(std::ifstream& file)
+/// <summary>
+/// Size of a row in memory (rows are not padded in memory)
+/// </summary>
+size_t BMPImage::_getRowSize() const
 {
-	// Read the file header
-	file.read(reinterpret_cast<char*>(&_fileHeader), sizeof(_fileHeader));
-	// Check if it's a BMP file by looking for the "BM" signature
-	if (_fileHeader.fileType != BM_SIGNATURE)
+	return (static_cast<size_t>(_activeHeader.width) * _activeHeader.bitCount + 7) / 8;
+}
+
+/// <summary>
+/// Palette index of a pixel of a 1 or 8 bits image
+/// </summary>
+uint8_t BMPImage::_getIndex(const uint32_t x, const uint32_t y) const
+{
+	const uint8_t* row = _pixelData.data() + y * _getRowSize();
+	if (_isMonochrome())
 	{
-		throw std::runtime_error("File is not a BMP file.");
+		return (row[x / 8] >> (7 - x % 8)) & 1;
 	}
-	// Read the info header
-	if (_fileHeader.offsetData == BM_INFO_HEADER_SIZE + BM_FILE_HEADER_SIZE)
+	return row[x];
+}
+
+void BMPImage::_setIndex(const uint32_t x, const uint32_t y, const uint8_t index)
+{
+	uint8_t* row = _pixelData.data() + y * _getRowSize();
+	if (_isMonochrome())
 	{
-		file.read(reinterpret_cast<char*>(&_infoHeader), sizeof(_infoHeader));
-		// Check if the image is uncompressed
-		if (_infoHeader.compression != BI_RGB)
-		{
-			throw std::runtime_error("Image is compressed. This is not handled by the program");
-		}
-		// Check if the image bit count is valid
-		if (_infoHeader.bitCount != TRUE_COLOR_BIT_SIZE)
+		const uint8_t mask = static_cast<uint8_t>(0x80 >> (x % 8));
+		row[x / 8] = index ? row[x / 8] | mask : row[x / 8] & ~mask;
+		return;
+	}
+	row[x] = index;
+}
+
+/// <summary>
+/// Closest palette entry of a color
+/// </summary>
+uint8_t BMPImage::_findPaletteIndex(const uint8_t r, const uint8_t g, const uint8_t b) const
+{
+	uint8_t best = 0;
+	int bestDistance = INT32_MAX;
+	for (size_t i = 0; i < _palette.size() && bestDistance != 0; i++)
+	{
+		const int dr = _palette[i][0] - r;
+		const int dg = _palette[i][1] - g;
+		const int db = _palette[i][2] - b;
+		const int distance = dr * dr + dg * dg + db * db;
+		if (distance < bestDistance)
 		{
-			throw std::runtime_error("Image bit count is not valid.");
+			bestDistance = distance;
+			best = static_cast<uint8_t>(i);
 		}
-		_activeHeader = _infoHeader;
+	}
+	return best;
+}
 
+/// <summary>
+/// Whether the 8 bits indices are their gray level, as with the default palette
+/// </summary>
+bool BMPImage::_hasGrayRamp() const
+{
+	if (_activeHeader.bitCount != GRAY_SCALE_BIT_SIZE)
+	{
+		return false;
 	}
-	// Read the V4 info header
-	else if (_fileHeader.offsetData == BM_V4_INFO_HEADER_SIZE + BM_FILE_HEADER_SIZE)
+	for (size_t i = 0; i < _palette.size(); i++)
 	{
-		file.read(reinterpret_cast<char*>(&_v4InfoHeader), sizeof(_v4InfoHeader));
-		// Check if the image is uncompressed
-		if (_v4InfoHeader.compression != BI_BITFIELDS)
+		if (_palette[i][0] != i || _palette[i][1] != i || _palette[i][2] != i)
 		{
-			throw std::runtime_error("Image is compressed. This is not handled by the program");
+			return false;
 		}
-		// Check if the image bit count is valid
-		if (_v4InfoHeader.bitCount != DEEP_COLOR_BIT_SIZE)
+	}
+	return true;
+}
+
+/// <summary>
+/// Check that a pixel type of the typed access matches the bit count, 1 bit images have none
+/// </summary>
+/// <param name="pixelSize">Size of the pixel type in bytes</param>
+void BMPImage::_checkPixelType(const size_t pixelSize) const
+{
+	if (pixelSize * 8 != _activeHeader.bitCount)
+	{
+		throw std::logic_error("Pixel type does not match the bit count of the image");
+	}
+}
+
+void BMPImage::_invalidateContentHash()
+{
+	_contentHash.store(0, std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Gray ramp for the 8 bits images, black and white for the 1 bit images
+/// </summary>
+void BMPImage::_setDefaultPalette()
+{
+	_palette.clear();
+	if (_activeHeader.bitCount > GRAY_SCALE_BIT_SIZE)
+	{
+		return;
+	}
+	const size_t colorCount = static_cast<size_t>(1) << _activeHeader.bitCount;
+	for (size_t i = 0; i < colorCount; i++)
+	{
+		const uint8_t value = static_cast<uint8_t>(i * 255 / (colorCount - 1));
+		_palette.push_back({value, value, value, 0});
+	}
+}
+
+void BMPImage::_readHeaders(std::ifstream& file)
+{
+	IMAGE_TIME_PHASE(READ_HEADERS);
+	// Read the file header
+	readBytes(file, &_fileHeader, sizeof(_fileHeader));
+	// Check if it's a BMP file by looking for the "BM" signature
+	if (!file || _fileHeader.fileType != BM_SIGNATURE)
+	{
+		throw std::runtime_error("File is not a BMP file.");
+	}
+	// Read the info header, the V4 and V5 headers start with the same fields
+	readBytes(file, static_cast<BMPInfoHeader*>(&_v4InfoHeader), BM_INFO_HEADER_SIZE);
+	if (!file || _activeHeader.size < BM_INFO_HEADER_SIZE)
+	{
+		throw std::runtime_error("BMP info header is not valid.");
+	}
+	if (_activeHeader.size >= BM_V4_INFO_HEADER_SIZE)
+	{
+		readBytes(file, &_v4InfoHeader.redMask, BM_V4_INFO_HEADER_SIZE - BM_INFO_HEADER_SIZE);
+	}
+	else
+	{
+		_v4InfoHeader.redMask = RED_CHANNEL_BIT_MASK;
+		_v4InfoHeader.greenMask = GREEN_CHANNEL_BIT_MASK;
+		_v4InfoHeader.blueMask = BLUE_CHANNEL_BIT_MASK;
+		_v4InfoHeader.alphaMask = ALPHA_CHANNEL_BIT_MASK;
+		// With a 40 bytes header the bit fields follow it
+		if (_activeHeader.compression == BI_BITFIELDS)
 		{
-			throw std::runtime_error("Image bit count is not valid.");
+			readBytes(file, &_v4InfoHeader.redMask, 3 * sizeof(uint32_t));
 		}
-		_activeHeader = _v4InfoHeader;
+	}
+
+	// Check if the image bit count is valid, 4 bits images are widened to 8 bits when the pixels are read
+	const uint16_t bitCount = _activeHeader.bitCount;
+	if (bitCount != TRUE_COLOR_BIT_SIZE && bitCount != DEEP_COLOR_BIT_SIZE && bitCount != GRAY_SCALE_BIT_SIZE &&
+		bitCount != SIXTEEN_COLORS_BIT_SIZE && bitCount != MONOCHROME_BIT_SIZE)
+	{
+		throw std::runtime_error("Image bit count is not valid.");
+	}
+	// Check if the compression is handled
+	const bool standardMasks = _v4InfoHeader.redMask == RED_CHANNEL_BIT_MASK &&
+		_v4InfoHeader.greenMask == GREEN_CHANNEL_BIT_MASK && _v4InfoHeader.blueMask == BLUE_CHANNEL_BIT_MASK;
+	const uint32_t compression = _activeHeader.compression;
+	if (compression != BI_RGB &&
+		!(compression == BI_BITFIELDS && bitCount == DEEP_COLOR_BIT_SIZE && standardMasks) &&
+		!(compression == BI_RLE8 && bitCount == GRAY_SCALE_BIT_SIZE) &&
+		!(compression == BI_RLE4 && bitCount == SIXTEEN_COLORS_BIT_SIZE))
+	{
+		throw std::runtime_error("Image compression is not handled by the program");
+	}
+	if (_activeHeader.height < 0)
+	{
+		throw std::runtime_error("Top-down images are not handled by the program");
+	}
+	if (!file)
+	{
+		throw std::runtime_error("BMP info header is truncated.");
+	}
+}
 
+/// <summary>
+/// Read the color table following the info header
+/// </summary>
+/// <param name="file"></param>
+void BMPImage::_readPalette(std::ifstream& file)
+{
+	_palette.clear();
+	if (_activeHeader.bitCount > GRAY_SCALE_BIT_SIZE)
+	{
+		return;
+	}
+	const uint32_t maxColorCount = 1u << _activeHeader.bitCount;
+	const uint32_t colorCount = _activeHeader.colorsUsed == 0 ? maxColorCount : _activeHeader.colorsUsed;
+	if (colorCount > maxColorCount)
+	{
+		throw std::runtime_error("Color table is too large for the bit count.");
+	}
+	std::vector<uint8_t> table(colorCount * 4);
+	file.seekg(BM_FILE_HEADER_SIZE + _activeHeader.size);
+	readBytes(file, table.data(), table.size());
+	if (!file)
+	{
+		throw std::runtime_error("Color table is truncated.");
+	}
+	// Stored blue, green, red, reserved
+	for (uint32_t i = 0; i < colorCount; i++)
+	{
+		_palette.push_back({table[i * 4 + 2], table[i * 4 + 1], table[i * 4], 0});
 	}
 }
 
 void BMPImage::_readPixels(std::ifstream& file)
 {
+	IMAGE_TIME_PHASE(READ_PIXELS);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(_activeHeader.width) * _activeHeader.height);
+	// 4 bits indices are one byte each in memory
+	const bool nibbles = _activeHeader.bitCount == SIXTEEN_COLORS_BIT_SIZE;
+	const size_t fileRowSize = _getRowSize();
+	if (nibbles)
+	{
+		_activeHeader.bitCount = GRAY_SCALE_BIT_SIZE;
+	}
 	// Pixel data
+	const uint16_t pixelSize = _getByteCount();
+	const size_t rowSize = _getRowSize();
+	_pixelData.assign(rowSize * _activeHeader.height, 0);
+	file.seekg(_fileHeader.offsetData);
+	if (_activeHeader.compression == BI_RLE8 || _activeHeader.compression == BI_RLE4)
+	{
+		// The encoded size is optional in the header
+		std::vector<uint8_t> encoded;
+		if (_activeHeader.sizeImage != 0)
+		{
+			encoded.resize(_activeHeader.sizeImage);
+			readBytes(file, encoded.data(), encoded.size());
+			encoded.resize(static_cast<size_t>(file.gcount()));
+		}
+		else
+		{
+			encoded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			IMAGE_COUNT(READ_CALLS, 1);
+			IMAGE_COUNT(BYTES_READ, encoded.size());
+		}
+		RunLengthCodec::decode(encoded.data(), encoded.size(), _pixelData.data(), _activeHeader.width, _activeHeader.height, nibbles);
+		return;
+	}
+	const std::streamsize paddingSize = (4 - fileRowSize % 4) % 4;
+	char paddingData[4];
 	for (int i = 0; i < _activeHeader.height; i++)
 	{
-		for (int j = 0; j < _activeHeader.width; j++)
+		uint8_t* row = _pixelData.data() + i * rowSize;
+		readBytes(file, row, fileRowSize);
+		if (paddingSize != 0)
+		{
+			readBytes(file, paddingData, static_cast<size_t>(paddingSize));
+		}
+		if (nibbles)
+		{
+			// Widen from the end, the packed byte of a pixel is never after it
+			for (int32_t x = _activeHeader.width - 1; x >= 0; x--)
+			{
+				row[x] = (row[x / 2] >> (x % 2 == 0 ? 4 : 0)) & 0x0F;
+			}
+		}
+		if (isIndexed())
+		{
+			continue;
+		}
+		// change the order of the pixel data
+		PixelConverter::swapRedBlue(row, row, static_cast<size_t>(_activeHeader.width), pixelSize);
+	}
+	if (!file)
+	{
+		throw std::runtime_error("Pixel data is truncated");
+	}
+	if (_isMonochrome() && _activeHeader.width % 8 != 0)
+	{
+		// Keep the unused bits of each row cleared
+		const uint8_t mask = static_cast<uint8_t>(0xFF << (8 - _activeHeader.width % 8));
+		for (int i = 0; i < _activeHeader.height; i++)
 		{
-			std::uint16_t pixelSize = _getByteCount();
-			auto pixel_ptr = std::make_unique<uint8_t[]>(pixelSize);
-			file.read(reinterpret_cast<char*>(pixel_ptr.get()), pixelSize);
-			// change the order of the pixel data
-			std::swap(pixel_ptr[0], pixel_ptr[2]); // Swap red and blue channels
-			_pixelData.push_back(Pixel(pixelSize, pixel_ptr.get()));
+			_pixelData[i * rowSize + rowSize - 1] &= mask;
 		}
 	}
 }
 
-void BMPImage::_writeHeaders(std::ofstream& file) const
+void BMPImage::_writeHeaders(std::ostream& file, const uint32_t imageSize, const uint32_t compression) const
 {
-	file.write(reinterpret_cast<const char*>(&_fileHeader), sizeof(_fileHeader));
-
-	if (_isTrueColor())
-	{
-		file.write(reinterpret_cast<const char*>(&_infoHeader), sizeof(_infoHeader));
-	}
-	else if (_isDeepColor())
+	BMPFileHeader fileHeader = _fileHeader;
+	BMPV4InfoHeader infoHeader = _v4InfoHeader;
+	fileHeader.fileSize = fileHeader.offsetData + imageSize;
+	infoHeader.sizeImage = imageSize;
+	infoHeader.compression = compression;
+	if (compression == BI_RLE4)
 	{
-		file.write(reinterpret_cast<const char*>(&_v4InfoHeader), sizeof(_v4InfoHeader));
+		infoHeader.bitCount = SIXTEEN_COLORS_BIT_SIZE;
 	}
-	else
+	writeBytes(file, &fileHeader, sizeof(fileHeader));
+
+	// The 40 bytes header is the beginning of the V4 header
+	writeBytes(file, &infoHeader, _activeHeader.size);
+
+	// Color table, stored blue, green, red, reserved
+	for (const std::array<uint8_t, 4>& color : _palette)
 	{
-		throw std::runtime_error("Invalid bit count");
+		const uint8_t entry[4] = {color[2], color[1], color[0], 0};
+		writeBytes(file, entry, sizeof(entry));
 	}
 }
 
 
-void BMPImage::_writePixels(std::ofstream& file) const
+void BMPImage::_writePixels(std::ostream& file) const
 {
+	IMAGE_TIME_PHASE(WRITE_PIXELS);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(_activeHeader.width) * _activeHeader.height);
 	// Write the pixel data
+	const uint16_t pixelSize = _getByteCount();
+	const size_t rowSize = _getRowSize();
+	// Add padding if needed
+	const size_t paddingSize = (4 - rowSize % 4) % 4;
+	std::vector<uint8_t> row(rowSize + paddingSize, 0);
 	for (int i = 0; i < _activeHeader.height; i++)
 	{
-		for (int j = 0; j < _activeHeader.width; j++)
+		const uint8_t* source = _pixelData.data() + i * rowSize;
+		if (isIndexed())
 		{
-			Pixel pixel = _pixelData[i * _activeHeader.width + j];
-			std::streamsize pixelSize = _getByteCount();
-			auto pixel_ptr = std::make_unique<uint8_t[]>(pixelSize);
-			pixel_ptr[0] = pixel.getRed();
-			pixel_ptr[1] = pixel.getGreen();
-			pixel_ptr[2] = pixel.getBlue();
-			if (_isDeepColor())
-			{
-				pixel_ptr[3] = pixel.getAlpha();
-			}
-			std::swap(pixel_ptr[0], pixel_ptr[2]); // Swap red and blue channels
-			file.write(reinterpret_cast<const char*>(pixel_ptr.get()), pixelSize);
+			std::copy(source, source + rowSize, row.data());
 		}
-		
-		// Add padding if needed
-		int paddingSize = (4 - (_activeHeader.width * _getByteCount()) % 4) % 4;
-		uint8_t paddingData[4] = {0, 0, 0, 0};
-		file.write(reinterpret_cast<const char*>(paddingData), paddingSize);
+		else
+		{
+			PixelConverter::swapRedBlue(source, row.data(), static_cast<size_t>(_activeHeader.width), pixelSize); // Swap red and blue channels
+		}
+		writeBytes(file, row.data(), row.size());
 	}
 }
 
+/// <summary>
+/// Recompute the header fields from the dimensions, bit count and palette
+/// </summary>
 void BMPImage::_updateHeaders()
 {
-	_activeHeader.sizeImage = _activeHeader.width * _activeHeader.height * _getByteCount();
-	_fileHeader.fileSize = BM_FILE_HEADER_SIZE + BM_INFO_HEADER_SIZE + _activeHeader.sizeImage;
-	_fileHeader.offsetData = BM_FILE_HEADER_SIZE + BM_INFO_HEADER_SIZE;
-
+	// 32 bits images use the V4 header to describe the alpha channel
+	if (_isDeepColor())
+	{
+		_activeHeader.size = BM_V4_INFO_HEADER_SIZE;
+		_activeHeader.compression = BI_BITFIELDS;
+		_v4InfoHeader.redMask = RED_CHANNEL_BIT_MASK;
+		_v4InfoHeader.greenMask = GREEN_CHANNEL_BIT_MASK;
+		_v4InfoHeader.blueMask = BLUE_CHANNEL_BIT_MASK;
+		_v4InfoHeader.alphaMask = ALPHA_CHANNEL_BIT_MASK;
+		_v4InfoHeader.csType = LCS_WINDOWS_COLOR_SPACE;
+	}
+	else
+	{
+		_activeHeader.size = BM_INFO_HEADER_SIZE;
+		// Run length encoded 8 bits images use 4 bits codes when the palette is small enough
+		const bool runLength = _activeHeader.compression == BI_RLE8 || _activeHeader.compression == BI_RLE4;
+		if (runLength && _activeHeader.bitCount == GRAY_SCALE_BIT_SIZE)
+		{
+			_activeHeader.compression = _palette.size() <= 16 ? BI_RLE4 : BI_RLE8;
+		}
+		else
+		{
+			_activeHeader.compression = BI_RGB;
+		}
+	}
+	_activeHeader.planes = COLOR_PLANES_NUMBER;
+	_activeHeader.colorsUsed = static_cast<uint32_t>(_palette.size());
+	_activeHeader.colorsImportant = 0;
+	const size_t paddedRowSize = (_getRowSize() + 3) & ~static_cast<size_t>(3);
+	_activeHeader.sizeImage = static_cast<uint32_t>(paddedRowSize * _activeHeader.height);
+	_fileHeader.fileType = BM_SIGNATURE;
+	_fileHeader.offsetData = BM_FILE_HEADER_SIZE + _activeHeader.size + static_cast<uint32_t>(_palette.size()) * 4;
+	_fileHeader.fileSize = _fileHeader.offsetData + _activeHeader.sizeImage;
 }
 
 void BMPImage::_resizePixelsData(int32_t newWidth, int32_t newHeight)
 {
-	std::vector<Pixel> newPixelData(newHeight * newWidth);
+	const size_t newRowSize = (static_cast<size_t>(newWidth) * _activeHeader.bitCount + 7) / 8;
+	PixelBuffer newPixelData(newRowSize * newHeight, _pixelData.get_allocator());
+	_copyRows(_pixelData.data(), _getRowSize(), 0, newPixelData.data(), newRowSize, 0,
+		std::min(_activeHeader.width, newWidth), std::min(_activeHeader.height, newHeight), _activeHeader.bitCount);
 
+	// update the headers
+	_activeHeader.height = newHeight;
+	_activeHeader.width = newWidth;
+	_pixelData = std::move(newPixelData);
+
+	_updateHeaders();
+}
+
+/// <summary>
+/// Copy bits of a 1 bit row to another, most significant bit first
+/// </summary>
+void BMPImage::_copyBits(const uint8_t* source, size_t sourceBit, uint8_t* destination, size_t destinationBit, size_t count)
+{
+	const auto copyBit = [&]()
 	{
-		const int32_t minHeight = std::min(_activeHeader.height, newHeight);
-		const int32_t minWidth = std::min(_activeHeader.width, newWidth);
-		const int32_t maxHeight = std::max(_activeHeader.height, newHeight);
-		const int32_t maxWidth = std::max(_activeHeader.width, newWidth);
-		for (int i = 0; i < maxHeight; i++)
+		const uint8_t mask = static_cast<uint8_t>(0x80 >> (destinationBit % 8));
+		if ((source[sourceBit / 8] >> (7 - sourceBit % 8)) & 1)
 		{
-			for (int j = 0; j < maxWidth; j++)
-			{
-				if (i < minHeight && j < minWidth)
-				{
-					newPixelData[i * newWidth + j] = _pixelData[i * _activeHeader.width + j];
-				}
-			}
+			destination[destinationBit / 8] |= mask;
+		}
+		else
+		{
+			destination[destinationBit / 8] &= static_cast<uint8_t>(~mask);
+		}
+		sourceBit++;
+		destinationBit++;
+		count--;
+	};
+	// Single bits until the destination is byte aligned, then whole bytes
+	while (count > 0 && destinationBit % 8 != 0)
+	{
+		copyBit();
+	}
+	const size_t byteCount = count / 8;
+	const unsigned shift = sourceBit % 8;
+	const uint8_t* input = source + sourceBit / 8;
+	uint8_t* output = destination + destinationBit / 8;
+	if (shift == 0)
+	{
+		std::memcpy(output, input, byteCount);
+	}
+	else
+	{
+		for (size_t i = 0; i < byteCount; i++)
+		{
+			output[i] = static_cast<uint8_t>((input[i] << shift) | (input[i + 1] >> (8 - shift)));
 		}
-		// update the headers
-		_activeHeader.height = newHeight;
-		_activeHeader.width = newWidth;
-		// resize the pixel data
-		_pixelData.resize(newHeight * newWidth);
-		// copy the data of the new pixel data to the pixel data
-		Pixel* newPixelDataPtr = newPixelData.data();
-		std::copy(newPixelDataPtr, newPixelDataPtr + newHeight * newWidth, _pixelData.data());
 	}
+	sourceBit += byteCount * 8;
+	destinationBit += byteCount * 8;
+	count -= byteCount * 8;
+	while (count > 0)
+	{
+		copyBit();
+	}
+}
 
-	// copy the data of the new pixel data to the pixel data
-	Pixel* newPixelDataPtr = newPixelData.data();
-	std::copy(newPixelDataPtr, newPixelDataPtr + newHeight * newWidth, _pixelData.data());
+/// <summary>
+/// Set or clear bits of a 1 bit row
+/// </summary>
+void BMPImage::_fillBits(uint8_t* destination, size_t firstBit, size_t count, const bool value)
+{
+	for (; count > 0 && firstBit % 8 != 0; firstBit++, count--)
+	{
+		const uint8_t mask = static_cast<uint8_t>(0x80 >> (firstBit % 8));
+		destination[firstBit / 8] = value ? destination[firstBit / 8] | mask : destination[firstBit / 8] & static_cast<uint8_t>(~mask);
+	}
+	std::memset(destination + firstBit / 8, value ? 0xFF : 0, count / 8);
+	firstBit += count / 8 * 8;
+	count %= 8;
+	if (count > 0)
+	{
+		const uint8_t mask = static_cast<uint8_t>(0xFF << (8 - count));
+		destination[firstBit / 8] = value ? destination[firstBit / 8] | mask : destination[firstBit / 8] & static_cast<uint8_t>(~mask);
+	}
+}
 
-	_updateHeaders();
+/// <summary>
+/// Copy a block of pixels between two buffers of the same color depth, the rows are split over the thread pool
+/// </summary>
+/// <param name="source">First row of the block</param>
+/// <param name="sourceRowSize"></param>
+/// <param name="sourceX">Column of the block in the source</param>
+/// <param name="destination">First row of the block</param>
+/// <param name="destinationRowSize"></param>
+/// <param name="destinationX">Column of the block in the destination</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="bitCount"></param>
+void BMPImage::_copyRows(const uint8_t* source, const size_t sourceRowSize, const size_t sourceX, uint8_t* destination,
+	const size_t destinationRowSize, const size_t destinationX, const size_t width, const size_t height, const uint16_t bitCount)
+{
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+	// Small copies are not worth waking the pool
+	const int64_t minRows = static_cast<int64_t>(std::max<size_t>(1, (1 << 16) / std::max<size_t>(1, width * bitCount / 8)));
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(height), [&](const int64_t begin, const int64_t end)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			const uint8_t* input = source + row * sourceRowSize;
+			uint8_t* output = destination + row * destinationRowSize;
+			if (bitCount == MONOCHROME_BIT_SIZE)
+			{
+				_copyBits(input, sourceX, output, destinationX, width);
+			}
+			else
+			{
+				const size_t pixelSize = bitCount / 8;
+				std::memcpy(output + destinationX * pixelSize, input + sourceX * pixelSize, width * pixelSize);
+			}
+		}
+	}, minRows);
 }
 
 /// <summary>
@@ -324,28 +758,43 @@ void BMPImage::openImage(const std::string& filename)
 /// <param name="filename"></param>
 void BMPImage::load(const char* filename)
 {
+	_invalidateContentHash();
 	std::ifstream file(filename, std::ios::binary);
 	if (!file)
 	{
 		throw std::runtime_error("Could not open file");
 	}
 
+	// QOI and Netpbm images are recognized by their first bytes
+	if (file.peek() != 'B')
+	{
+		read(file);
+		Log::info("Image loaded successfully");
+		return;
+	}
+
 	_readHeaders(file);
 
+	_readPalette(file);
+
 	_readPixels(file);
 
+	_updateHeaders();
+
 	file.close();
-	std::cout << "Image loaded successfully" << std::endl;
+	Log::info("Image loaded successfully");
 }
 
 /// <summary>
 /// save the image into a file
 /// </summary>
 /// <param name="filename"></param>
-void BMPImage::save(const char* filename) const
+/// <param name="showImage">Open BMP files in the default image viewer afterwards</param>
+void BMPImage::save(const char* filename, const bool showImage) const
 {
 	std::string fileStr(filename);
-	if (fileStr.find(".bmp") == std::string::npos)
+	const FileFormat format = formatOf(fileStr);
+	if (format == FileFormat::BMP && fileStr.find(".bmp") == std::string::npos)
 	{
 		fileStr += ".bmp";
 	}
@@ -356,214 +805,1567 @@ void BMPImage::save(const char* filename) const
 		throw std::runtime_error("Could not open file");
 	}
 
-	_writeHeaders(file);
-
-	_writePixels(file);
+	write(file, format);
 
 	file.close();
-	std::cout << "Image saved successfully" << std::endl;
-
-	openImage(fileStr);
+	Log::info("Image saved successfully");
 
+	if (showImage && format == FileFormat::BMP)
+	{
+		openImage(fileStr);
+	}
 }
 
-uint32_t BMPImage::getWidth() const
-{
-	return _activeHeader.width;
-}
+/// <summary>
+/// File format matching the extension of a file name, BMP for unknown extensions
+/// </summary>
+/// <param name="filename"></param>
+/// <returns></returns>
+BMPImage::FileFormat BMPImage::formatOf(const std::string& filename)
+{
+	const size_t dot = filename.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : filename.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](const char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension == "qoi")
+	{
+		return FileFormat::QOI;
+	}
+	if (extension == "pam")
+	{
+		return FileFormat::PAM;
+	}
+	if (extension == "ppm" || extension == "pgm" || extension == "pnm")
+	{
+		return FileFormat::PNM;
+	}
+	return FileFormat::BMP;
+}
+
+/// <summary>
+/// Read the headers of an image file only, to list files without decoding them
+/// </summary>
+/// <param name="filename"></param>
+/// <returns></returns>
+BMPImage::Info BMPImage::probe(const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Could not open file");
+	}
+	const int first = file.peek();
+	if (first == 'q')
+	{
+		const QoiCodec::Header header = QoiCodec::readHeader(file);
+		return Info{FileFormat::QOI, static_cast<int32_t>(header.width), static_cast<int32_t>(header.height),
+			static_cast<uint16_t>(header.channels * 8), BI_RGB, static_cast<uint32_t>(QoiCodec::HEADER_SIZE)};
+	}
+	if (first == 'P')
+	{
+		const NetpbmCodec::Header header = NetpbmCodec::readHeader(file);
+		return Info{header.type == '7' ? FileFormat::PAM : FileFormat::PNM, static_cast<int32_t>(header.width), static_cast<int32_t>(header.height),
+			static_cast<uint16_t>(header.depth * 8), BI_RGB, static_cast<uint32_t>(file.tellg())};
+	}
+	BMPImage image;
+	image._readHeaders(file);
+	return Info{FileFormat::BMP, image._activeHeader.width, image._activeHeader.height, image._activeHeader.bitCount,
+		image._activeHeader.compression, image._fileHeader.offsetData};
+}
+
+/// <summary>
+/// Read a QOI, PAM, PPM or PGM image from a stream, stopping at the end of the image so several images can
+/// follow each other in a pipe. BMP images need a file.
+/// </summary>
+/// <param name="stream"></param>
+void BMPImage::read(std::istream& stream)
+{
+	_invalidateContentHash();
+	const int first = stream.peek();
+	uint32_t width;
+	uint32_t height;
+	uint16_t bitCount;
+	std::function<void(const std::function<uint8_t*(uint32_t)>&)> readRows;
+	bool blackAndWhite = false;
+	if (first == 'q')
+	{
+		const QoiCodec::Header header = QoiCodec::readHeader(stream);
+		width = header.width;
+		height = header.height;
+		bitCount = header.channels == 4 ? DEEP_COLOR_BIT_SIZE : TRUE_COLOR_BIT_SIZE;
+		readRows = [&stream, header](const std::function<uint8_t*(uint32_t)>& row) { QoiCodec::decode(stream, header, row); };
+	}
+	else if (first == 'P')
+	{
+		const NetpbmCodec::Header header = NetpbmCodec::readHeader(stream);
+		if (header.depth == 2)
+		{
+			throw std::runtime_error("Gray images with alpha are not handled by the program");
+		}
+		width = header.width;
+		height = header.height;
+		bitCount = header.depth == 4 ? DEEP_COLOR_BIT_SIZE : header.depth == 3 ? TRUE_COLOR_BIT_SIZE : GRAY_SCALE_BIT_SIZE;
+		blackAndWhite = header.tupleType == "BLACKANDWHITE";
+		readRows = [&stream, header](const std::function<uint8_t*(uint32_t)>& row) { NetpbmCodec::readRows(stream, header, row); };
+	}
+	else
+	{
+		throw std::runtime_error("Image format is not handled by the program");
+	}
+	if (width > INT32_MAX || height > INT32_MAX)
+	{
+		throw std::runtime_error("Image is too large");
+	}
+
+	// Rows are stored from the bottom
+	BMPImage image(static_cast<int32_t>(width), static_cast<int32_t>(height), bitCount);
+	const size_t rowSize = image._getRowSize();
+	uint8_t* data = image._pixelData.data();
+	{
+		IMAGE_TIME_PHASE(READ_PIXELS);
+		IMAGE_COUNT(PIXELS, static_cast<uint64_t>(width) * height);
+#ifdef IMAGE_INSTRUMENTATION
+		// The codecs read the stream in their own way, only the bytes of seekable streams are counted
+		const std::streampos start = stream.tellg();
+		readRows([&](const uint32_t y) { return data + (height - 1 - y) * rowSize; });
+		const std::streampos end = stream.tellg();
+		if (start != std::streampos(-1) && end != std::streampos(-1))
+		{
+			IMAGE_COUNT(BYTES_READ, end - start);
+		}
+#else
+		readRows([&](const uint32_t y) { return data + (height - 1 - y) * rowSize; });
+#endif
+	}
+	if (blackAndWhite)
+	{
+		image.convertTo(MONOCHROME_BIT_SIZE);
+	}
+	*this = std::move(image);
+}
+
+/// <summary>
+/// Write the image to a stream. Indexed images become gray when their palette is gray, RGB otherwise,
+/// and PPM drops the alpha channel.
+/// </summary>
+/// <param name="stream"></param>
+/// <param name="format"></param>
+void BMPImage::write(std::ostream& stream, const FileFormat format) const
+{
+	if (format == FileFormat::BMP)
+	{
+		if (isCompressed())
+		{
+			// A color table shrunk under the pixels leaves indices that 4 bits codes can not hold
+			const bool nibbles = _activeHeader.compression == BI_RLE4 &&
+				std::all_of(_pixelData.begin(), _pixelData.end(), [](const uint8_t index) { return index < 16; });
+			const std::vector<uint8_t> encoded = RunLengthCodec::encode(_pixelData.data(), _activeHeader.width, _activeHeader.height, nibbles);
+			_writeHeaders(stream, static_cast<uint32_t>(encoded.size()), nibbles ? BI_RLE4 : BI_RLE8);
+			IMAGE_TIME_PHASE(WRITE_PIXELS);
+			IMAGE_COUNT(PIXELS, static_cast<uint64_t>(_activeHeader.width) * _activeHeader.height);
+			writeBytes(stream, encoded.data(), encoded.size());
+		}
+		else
+		{
+			_writeHeaders(stream, _activeHeader.sizeImage, _activeHeader.compression);
+			_writePixels(stream);
+		}
+		return;
+	}
+
+	const uint32_t width = static_cast<uint32_t>(_activeHeader.width);
+	const uint32_t height = static_cast<uint32_t>(_activeHeader.height);
+	const bool gray = isIndexed() && std::all_of(_palette.begin(), _palette.end(),
+		[](const std::array<uint8_t, 4>& color) { return color[0] == color[1] && color[1] == color[2]; });
+	uint16_t channels = _isDeepColor() ? 4 : 3;
+	if (format == FileFormat::PNM)
+	{
+		channels = 3;
+	}
+	if (gray && format != FileFormat::QOI)
+	{
+		channels = 1;
+	}
+
+	// Rows are read from the top, and go through a row buffer when they change format
+	const size_t rowSize = _getRowSize();
+	const uint8_t* data = _pixelData.data();
+	// 8 bits indices are written as they are with the default gray palette
+	const bool grayRamp = _hasGrayRamp();
+	const bool direct = isIndexed() ? grayRamp && channels == 1 : channels == _getByteCount();
+	std::vector<uint8_t> expandedPalette(256 * 4, 0);
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		std::copy(_palette[i].begin(), _palette[i].begin() + 3, expandedPalette.begin() + i * 4);
+	}
+	std::vector<uint8_t> indices(isIndexed() ? width : 0);
+	std::vector<uint8_t> buffer(direct ? 0 : static_cast<size_t>(width) * channels);
+	const std::function<const uint8_t*(uint32_t)> row = [&](const uint32_t y) -> const uint8_t*
+	{
+		const uint8_t* source = data + (height - 1 - y) * rowSize;
+		if (direct)
+		{
+			return source;
+		}
+		if (!isIndexed())
+		{
+			PixelConverter::rgbaToRgb(source, buffer.data(), width);
+			return buffer.data();
+		}
+		if (_isMonochrome())
+		{
+			PixelConverter::unpackBits(source, indices.data(), width);
+			source = indices.data();
+		}
+		if (channels == 1)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				buffer[x] = expandedPalette[source[x] * 4];
+			}
+		}
+		else
+		{
+			PixelConverter::expandPalette(source, buffer.data(), width, expandedPalette.data(), channels);
+		}
+		return buffer.data();
+	};
+
+	IMAGE_TIME_PHASE(WRITE_PIXELS);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(width) * height);
+#ifdef IMAGE_INSTRUMENTATION
+	// The codecs write the stream in their own way, only the bytes of seekable streams are counted
+	struct WrittenBytes {
+		std::ostream& stream;
+		std::streampos start;
+		~WrittenBytes()
+		{
+			const std::streampos end = stream.tellp();
+			if (start != std::streampos(-1) && end != std::streampos(-1))
+			{
+				IMAGE_COUNT(BYTES_WRITTEN, end - start);
+			}
+		}
+	} writtenBytes{stream, stream.tellp()};
+#endif
+	if (format == FileFormat::QOI)
+	{
+		QoiCodec::encode(stream, QoiCodec::Header{width, height, static_cast<uint8_t>(channels), 0}, row);
+		return;
+	}
+	NetpbmCodec::Header header{format == FileFormat::PAM ? '7' : channels == 1 ? '5' : '6', width, height, channels, 255,
+		channels == 4 ? "RGB_ALPHA" : channels == 3 ? "RGB" : "GRAYSCALE"};
+	NetpbmCodec::writeHeader(stream, header);
+	NetpbmCodec::writeRows(stream, header, row);
+}
+
+uint32_t BMPImage::getWidth() const
+{
+	return _activeHeader.width;
+}
+
+uint32_t BMPImage::getHeight() const
+{
+	return _activeHeader.height;
+}
+
+uint16_t BMPImage::getBitCount() const
+{
+	return _activeHeader.bitCount;
+}
+
+/// <summary>
+/// Whether the pixels are indices in a color table (1 and 8 bits images)
+/// </summary>
+bool BMPImage::isIndexed() const
+{
+	return _activeHeader.bitCount <= GRAY_SCALE_BIT_SIZE;
+}
+
+/// <summary>
+/// Hash of the size, bit count, compression, palette and pixels, kept until the image changes.
+/// Equal images have the same hash on every machine, the resolution is left out.
+/// </summary>
+/// <returns>Never 0</returns>
+uint64_t BMPImage::contentHash() const
+{
+	const uint64_t cached = _contentHash.load(std::memory_order_relaxed);
+	if (cached != 0)
+	{
+		return cached;
+	}
+	const uint64_t pixelHash = ContentHash::hashParallel(_pixelData.data(), _pixelData.size());
+	std::vector<uint8_t> description;
+	for (const uint32_t field : {static_cast<uint32_t>(_activeHeader.width), static_cast<uint32_t>(_activeHeader.height),
+		static_cast<uint32_t>(_activeHeader.bitCount), _activeHeader.compression})
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			description.push_back(static_cast<uint8_t>(field >> (8 * i)));
+		}
+	}
+	for (const std::array<uint8_t, 4>& color : _palette)
+	{
+		description.insert(description.end(), color.begin(), color.begin() + 3);
+	}
+	const uint64_t hash = std::max<uint64_t>(1, ContentHash::hash(description.data(), description.size(), pixelHash));
+	_contentHash.store(hash, std::memory_order_relaxed);
+	return hash;
+}
+
+/// <summary>
+/// Perceptual hash of the image, close images have hashes a few bits apart (see PerceptualHash::distance).
+/// Only SAMPLE_COUNT x SAMPLE_COUNT pixels are read.
+/// </summary>
+/// <param name="kind"></param>
+/// <returns></returns>
+uint64_t BMPImage::perceptualHash(const PerceptualHash::Kind kind) const
+{
+	const uint32_t width = getWidth();
+	const uint32_t height = getHeight();
+	if (width == 0 || height == 0)
+	{
+		throw std::logic_error("An empty image has no perceptual hash");
+	}
+	std::array<uint8_t, 256> paletteLumas{};
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		paletteLumas[i] = PixelConverter::luma(_palette[i][0], _palette[i][1], _palette[i][2]);
+	}
+	constexpr uint32_t sampleCount = PerceptualHash::SAMPLE_COUNT;
+	std::vector<uint32_t> columns(sampleCount);
+	for (uint32_t i = 0; i < sampleCount; i++)
+	{
+		columns[i] = PerceptualHash::samplePosition(i, width);
+	}
+	const size_t rowSize = _getRowSize();
+	std::vector<float> samples(static_cast<size_t>(sampleCount) * sampleCount);
+	for (uint32_t j = 0; j < sampleCount; j++)
+	{
+		// Samples from the top, rows from the bottom
+		const uint32_t y = height - 1 - PerceptualHash::samplePosition(j, height);
+		sampleLumas(_pixelData.data() + y * rowSize, _activeHeader.bitCount, false, paletteLumas, columns,
+			samples.data() + static_cast<size_t>(j) * sampleCount);
+	}
+	return PerceptualHash::compute(samples, kind);
+}
+
+/// <summary>
+/// Perceptual hash of an image file, the same as the one of the loaded image. Only the headers and the sampled rows
+/// of uncompressed BMP files are read, other files are loaded.
+/// </summary>
+/// <param name="filename"></param>
+/// <param name="kind"></param>
+/// <returns></returns>
+uint64_t BMPImage::perceptualHashOf(const char* filename, const PerceptualHash::Kind kind)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Could not open file");
+	}
+	if (file.peek() != 'B')
+	{
+		return BMPImage(filename).perceptualHash(kind);
+	}
+	BMPImage source;
+	source._readHeaders(file);
+	if (source.isCompressed())
+	{
+		return BMPImage(filename).perceptualHash(kind);
+	}
+	source._readPalette(file);
+	const uint32_t width = source.getWidth();
+	const uint32_t height = source.getHeight();
+	const uint16_t bitCount = source._activeHeader.bitCount;
+	if (width == 0 || height == 0)
+	{
+		throw std::logic_error("An empty image has no perceptual hash");
+	}
+	std::array<uint8_t, 256> paletteLumas{};
+	for (size_t i = 0; i < source._palette.size(); i++)
+	{
+		paletteLumas[i] = PixelConverter::luma(source._palette[i][0], source._palette[i][1], source._palette[i][2]);
+	}
+	constexpr uint32_t sampleCount = PerceptualHash::SAMPLE_COUNT;
+	std::vector<uint32_t> columns(sampleCount);
+	for (uint32_t i = 0; i < sampleCount; i++)
+	{
+		columns[i] = PerceptualHash::samplePosition(i, width);
+	}
+	const size_t paddedRowSize = ((static_cast<size_t>(width) * bitCount + 7) / 8 + 3) & ~static_cast<size_t>(3);
+	std::vector<uint8_t> row(paddedRowSize);
+	std::vector<float> samples(static_cast<size_t>(sampleCount) * sampleCount);
+	int64_t readRow = -1;
+	// From the bottom sample up, so the file is read forward
+	for (uint32_t j = sampleCount; j-- > 0;)
+	{
+		const uint32_t y = height - 1 - PerceptualHash::samplePosition(j, height);
+		if (y != readRow)
+		{
+			file.seekg(static_cast<std::streamoff>(source._fileHeader.offsetData + y * paddedRowSize));
+			readBytes(file, row.data(), row.size());
+			if (!file)
+			{
+				throw std::runtime_error("Pixel data is truncated");
+			}
+			readRow = y;
+		}
+		sampleLumas(row.data(), bitCount, true, paletteLumas, columns, samples.data() + static_cast<size_t>(j) * sampleCount);
+	}
+	return PerceptualHash::compute(samples, kind);
+}
+
+/// <summary>
+/// Whether the pixels are run length encoded in the file
+/// </summary>
+bool BMPImage::isCompressed() const
+{
+	return _activeHeader.compression == BI_RLE8 || _activeHeader.compression == BI_RLE4;
+}
+
+/// <summary>
+/// Run length encode the pixels when saving (BI_RLE4 for 16 colors or less and indices below 16, else BI_RLE8).
+/// Converting the image to another color depth turns the compression off.
+/// </summary>
+/// <param name="compressed"></param>
+void BMPImage::setCompressed(const bool compressed)
+{
+	_invalidateContentHash();
+	if (compressed && _activeHeader.bitCount != GRAY_SCALE_BIT_SIZE)
+	{
+		throw std::invalid_argument("Only 8 bits images can be run length encoded");
+	}
+	_activeHeader.compression = compressed ? BI_RLE8 : BI_RGB;
+	_updateHeaders();
+}
+
+const std::vector<std::array<uint8_t, 4>>& BMPImage::getPalette() const
+{
+	return _palette;
+}
+
+/// <summary>
+/// Replace the color table of an indexed image
+/// </summary>
+/// <param name="palette">Colors red first, at most 2^bitCount entries</param>
+void BMPImage::setPalette(const std::vector<std::array<uint8_t, 4>>& palette)
+{
+	_invalidateContentHash();
+	if (!isIndexed())
+	{
+		throw std::logic_error("Only 1 and 8 bits images have a color table");
+	}
+	if (palette.empty() || palette.size() > (static_cast<size_t>(1) << _activeHeader.bitCount))
+	{
+		throw std::invalid_argument("Color table size does not match the bit count");
+	}
+	_palette = palette;
+	_updateHeaders();
+}
+
+/// <summary>
+/// Get the color table index of a pixel of an indexed image
+/// </summary>
+/// <param name="x"></param>
+/// <param name="y"></param>
+uint8_t BMPImage::getPaletteIndex(const uint32_t x, const uint32_t y) const
+{
+	if (!isIndexed())
+	{
+		throw std::logic_error("Only 1 and 8 bits images have a color table");
+	}
+	if (x >= static_cast<uint32_t>(_activeHeader.width) || y >= static_cast<uint32_t>(_activeHeader.height))
+	{
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	}
+	return _getIndex(x, y);
+}
+
+/// <summary>
+/// Set the color table index of a pixel of an indexed image
+/// </summary>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="index"></param>
+void BMPImage::setPaletteIndex(const uint32_t x, const uint32_t y, const uint8_t index)
+{
+	_invalidateContentHash();
+	if (!isIndexed())
+	{
+		throw std::logic_error("Only 1 and 8 bits images have a color table");
+	}
+	if (x >= static_cast<uint32_t>(_activeHeader.width) || y >= static_cast<uint32_t>(_activeHeader.height))
+	{
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	}
+	if (index >= _palette.size())
+	{
+		throw std::out_of_range("Index is out of the color table");
+	}
+	_setIndex(x, y, index);
+}
+
+/// <summary>
+/// Convert the pixels to another color depth.
+/// 24 and 32 bits images become gray when converted to 8 or 1 bit (threshold at mid gray for 1 bit),
+/// 24 bits images become opaque when converted to 32 bits.
+/// </summary>
+/// <param name="bitCount">1, 8, 24 or 32</param>
+void BMPImage::convertTo(const uint16_t bitCount)
+{
+	_invalidateContentHash();
+	if (bitCount != TRUE_COLOR_BIT_SIZE && bitCount != DEEP_COLOR_BIT_SIZE &&
+		bitCount != GRAY_SCALE_BIT_SIZE && bitCount != MONOCHROME_BIT_SIZE)
+	{
+		throw std::invalid_argument("Image Bit Count not handled");
+	}
+	const uint16_t oldBitCount = _activeHeader.bitCount;
+	if (bitCount == oldBitCount)
+	{
+		return;
+	}
+	const size_t pixelCount = static_cast<size_t>(_activeHeader.width) * _activeHeader.height;
+	if (oldBitCount == DEEP_COLOR_BIT_SIZE && bitCount == TRUE_COLOR_BIT_SIZE)
+	{
+		// Shrinks in place, the buffer keeps its capacity for a later conversion back
+		PixelConverter::rgbaToRgb(_pixelData.data(), _pixelData.data(), pixelCount);
+		_pixelData.resize(pixelCount * 3);
+		_activeHeader.bitCount = bitCount;
+		_updateHeaders();
+		return;
+	}
+	if (oldBitCount == TRUE_COLOR_BIT_SIZE && bitCount == DEEP_COLOR_BIT_SIZE)
+	{
+		// Growing in place would need a copy when the buffer is reallocated, so convert to a new buffer by rows
+		PixelBuffer newPixelData(pixelCount * 4, _pixelData.get_allocator());
+		const int64_t width = _activeHeader.width;
+		const uint8_t* source = _pixelData.data();
+		uint8_t* destination = newPixelData.data();
+		ThreadPool::instance().parallelFor(0, _activeHeader.height, [&](const int64_t begin, const int64_t end)
+		{
+			PixelConverter::rgbToRgba(source + begin * width * 3, destination + begin * width * 4, static_cast<size_t>((end - begin) * width), 255);
+		});
+		_pixelData = std::move(newPixelData);
+		_activeHeader.bitCount = bitCount;
+		_updateHeaders();
+		return;
+	}
+
+	const int64_t width = _activeHeader.width;
+	const int64_t height = _activeHeader.height;
+	const size_t oldRowSize = _getRowSize();
+	const size_t newRowSize = (static_cast<size_t>(width) * bitCount + 7) / 8;
+	const uint16_t oldByteCount = _getByteCount();
+	PixelBuffer newPixelData(newRowSize * height, _pixelData.get_allocator());
+	std::vector<std::array<uint8_t, 4>> newPalette;
+
+	// Palette of 256 entries for the expansion, red first
+	std::vector<uint8_t> expandedPalette(256 * 4, 0);
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		std::copy(_palette[i].begin(), _palette[i].begin() + 3, expandedPalette.begin() + i * 4);
+		expandedPalette[i * 4 + 3] = 255;
+	}
+	// Luma of the entries, so indexed images convert to gray without going through RGB
+	std::array<uint8_t, 256> paletteLuma{};
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		paletteLuma[i] = PixelConverter::luma(_palette[i][0], _palette[i][1], _palette[i][2]);
+	}
+
+	const uint8_t* oldData = _pixelData.data();
+	uint8_t* newData = newPixelData.data();
+	const bool monochrome = _isMonochrome();
+	ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+	{
+		std::vector<uint8_t> values(static_cast<size_t>(width));
+		for (int64_t i = begin; i < end; i++)
+		{
+			const uint8_t* source = oldData + i * oldRowSize;
+			uint8_t* destination = newData + i * newRowSize;
+			if (oldBitCount > GRAY_SCALE_BIT_SIZE)
+			{
+				// 24/32 bits to gray or monochrome
+				uint8_t* gray = bitCount == GRAY_SCALE_BIT_SIZE ? destination : values.data();
+				PixelConverter::rgbToGray(source, gray, static_cast<size_t>(width), oldByteCount);
+				if (bitCount == MONOCHROME_BIT_SIZE)
+				{
+					PixelConverter::packBits(gray, destination, static_cast<size_t>(width), 128);
+				}
+				continue;
+			}
+			// Indices of the row, one byte each
+			const uint8_t* indices = source;
+			if (monochrome)
+			{
+				PixelConverter::unpackBits(source, values.data(), static_cast<size_t>(width));
+				indices = values.data();
+			}
+			if (bitCount > GRAY_SCALE_BIT_SIZE)
+			{
+				PixelConverter::expandPalette(indices, destination, static_cast<size_t>(width), expandedPalette.data(), bitCount / 8);
+			}
+			else if (bitCount == GRAY_SCALE_BIT_SIZE)
+			{
+				// 1 bit to 8 bits keeps the two colors
+				std::copy(indices, indices + width, destination);
+			}
+			else
+			{
+				// 8 bits to 1 bit : threshold the luma of the entries
+				for (int64_t j = 0; j < width; j++)
+				{
+					values[j] = paletteLuma[indices[j]];
+				}
+				PixelConverter::packBits(values.data(), destination, static_cast<size_t>(width), 128);
+			}
+		}
+	});
+
+	if (bitCount == GRAY_SCALE_BIT_SIZE && monochrome)
+	{
+		newPalette = _palette;
+	}
+	_pixelData = std::move(newPixelData);
+	_activeHeader.bitCount = bitCount;
+	if (newPalette.empty())
+	{
+		_setDefaultPalette();
+	}
+	else
+	{
+		_palette = std::move(newPalette);
+	}
+	_updateHeaders();
+}
+
+/// <summary>
+/// Reduce the image to an 8 bits palette.
+/// Images that already have few colors keep them exactly, the others get a median cut palette.
+/// </summary>
+/// <param name="colorCount">Maximum number of colors, 2 to 256</param>
+/// <param name="dithering">Spread the quantization error to hide banding</param>
+void BMPImage::quantize(const uint16_t colorCount, const ColorQuantizer::Dithering dithering)
+{
+	_invalidateContentHash();
+	if (colorCount < 2 || colorCount > 256)
+	{
+		throw std::invalid_argument("Color count must be between 2 and 256");
+	}
+	if (isIndexed())
+	{
+		convertTo(TRUE_COLOR_BIT_SIZE);
+	}
+	const uint16_t pixelSize = _getByteCount();
+	const size_t pixelCount = static_cast<size_t>(_activeHeader.width) * _activeHeader.height;
+
+	std::vector<ColorQuantizer::Color> palette;
+	if (!ColorQuantizer::exactPalette(_pixelData.data(), pixelCount, pixelSize, colorCount, palette))
+	{
+		palette = ColorQuantizer::medianCut(_pixelData.data(), pixelCount, pixelSize, colorCount);
+	}
+	const ColorQuantizer quantizer(palette);
+
+	PixelBuffer indices(pixelCount, _pixelData.get_allocator());
+	quantizer.mapRows(_pixelData.data(), indices.data(), _activeHeader.width, _activeHeader.height, pixelSize, dithering);
+
+	_pixelData = std::move(indices);
+	_activeHeader.bitCount = GRAY_SCALE_BIT_SIZE;
+	_palette = quantizer.getPalette();
+	_updateHeaders();
+}
+
+/// <summary>
+/// Get the pixel at the specified row and column
+/// </summary>
+/// <param name="x">row</param>
+/// <param name="y">column</param>
+/// <returns></returns>
+Pixel BMPImage::getPixel(const uint16_t x, const uint16_t y) const
+{
+	if (x >= _activeHeader.width || y >= _activeHeader.height)
+	{
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	}
+	if (isIndexed())
+	{
+		const uint8_t index = _getIndex(x, y);
+		if (index >= _palette.size())
+		{
+			return Pixel(0, 0, 0);
+		}
+		const std::array<uint8_t, 4>& color = _palette[index];
+		return Pixel(color[0], color[1], color[2]);
+	}
+	Pixel pixel(_getByteCount(), _pixelData.data() + (static_cast<size_t>(y) * _activeHeader.width + x) * _getByteCount());
+	return pixel;
+}
+
+/// <summary>
+/// Set the pixel at the specified row and column
+/// </summary>
+/// <param name="x"></param>
+/// <param name="y"></param>
+/// <param name="r"></param>
+/// <param name="g"></param>
+/// <param name="b"></param>
+void BMPImage::setPixel(const uint16_t x,const uint16_t y, const uint8_t r, const uint8_t g, const  uint8_t b, const uint8_t a)
+{
+	_invalidateContentHash();
+	if (x >= _activeHeader.width || y >= _activeHeader.height)
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	if (isIndexed())
+	{
+		if (a != 0) droppedAlpha.add();
+		_setIndex(x, y, _findPaletteIndex(r, g, b));
+		return;
+	}
+	uint8_t* pixel = _pixelData.data() + (static_cast<size_t>(y) * _activeHeader.width + x) * _getByteCount();
+	if (_activeHeader.bitCount == DEEP_COLOR_BIT_SIZE)
+	{
+		pixel[0] = r;
+		pixel[1] = g;
+		pixel[2] = b;
+		pixel[3] = a;
+	}
+
+	else if (_activeHeader.bitCount == TRUE_COLOR_BIT_SIZE)
+	{
+		if (a != 0) droppedAlpha.add();
+		pixel[0] = r;
+		pixel[1] = g;
+		pixel[2] = b;
+	}
+}
+
+/// <summary>
+/// Set the pixel at the specified row and column
+/// </summary>
+/// <param name="x">row</param>
+/// <param name="y">column</param>
+/// <param name="pixel"></param>
+void BMPImage::setPixel(uint16_t x, uint16_t y, const Pixel& pixel)
+{
+	_invalidateContentHash();
+	if (x >= _activeHeader.width || y >= _activeHeader.height)
+	{
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	}
+	if (isIndexed())
+	{
+		_setIndex(x, y, _findPaletteIndex(pixel.getRed(), pixel.getGreen(), pixel.getBlue()));
+		return;
+	}
+	uint8_t* data = _pixelData.data() + (static_cast<size_t>(y) * _activeHeader.width + x) * _getByteCount();
+	data[0] = pixel.getRed();
+	data[1] = pixel.getGreen();
+	data[2] = pixel.getBlue();
+	if (_isDeepColor())
+	{
+		data[3] = pixel.getSize() == Pixel::DEEP_COLOR_BYTE_SIZE ? pixel.getAlpha() : 0;
+	}
+}
+
+/// <summary>
+/// Resize the image to the specified height and width
+/// </summary>
+/// <param name="newHeight"></param>
+/// <param name="newWidth"></param>
+void BMPImage::resize(const int32_t newWidth, const int32_t newHeight)
+{
+	_invalidateContentHash();
+	if (newHeight > 0 && newWidth > 0)
+	{
+		if (_activeHeader.height != newHeight || _activeHeader.width != newWidth)
+		{
+			IMAGE_TIME_PHASE(RESAMPLE);
+			IMAGE_COUNT(PIXELS, static_cast<uint64_t>(newWidth) * newHeight);
+			_resizePixelsData(newWidth, newHeight);
+			Log::info("Image resized successfully");
+		}
+		else
+		{
+			Log::info("The image already has the specified dimensions");
+		}
+	}
+	else
+	{
+		throw std::invalid_argument("Height and width must be greater than 0");
+	}
+}
+
+/// <summary>
+/// Set a new height for the image
+/// </summary>
+/// <param name="height"></param>
+void BMPImage::setHeight(const int32_t height)
+{
+	resize(height, _activeHeader.width);
+}
+
+
+/// <summary>
+/// Set a new width for the image
+/// </summary>
+/// <param name="width"></param>
+void BMPImage::setWidth(int32_t width)
+{
+	resize(_activeHeader.height, width);
+}
+
+/// <summary>
+/// Get the resolution of the image
+/// </summary>
+/// <param name="xPixelsPerMeter"></param>
+/// <param name="yPixelsPerMeter"></param>
+void BMPImage::getResolution(int32_t& xPixelsPerMeter, int32_t& yPixelsPerMeter) const
+{
+	xPixelsPerMeter = _activeHeader.xPixelsPerMeter;
+	yPixelsPerMeter = _activeHeader.yPixelsPerMeter;
+}
+
+/// <summary>
+/// Set a new resolution for the image
+/// </summary>
+/// <param name="xPixelsPerMeter"></param>
+/// <param name="yPixelsPerMeter"></param>
+void BMPImage::setResolution(const int32_t xPixelsPerMeter,const int32_t yPixelsPerMeter)
+{
+	_activeHeader.xPixelsPerMeter = xPixelsPerMeter;
+	_activeHeader.yPixelsPerMeter = yPixelsPerMeter;
+}
+
+/// <summary>
+/// Set a new resolution for the image
+/// </summary>
+/// <param name="resolution"></param>
+void BMPImage::setResolution(const int32_t resolution)
+{
+	setResolution(resolution, resolution);
+}
+
+/// <summary>
+/// <summary>
+/// Multiply the size of the image by a given factor
+/// </summary>
+/// <param name="factor">Factor to multiply the size by</param>
+void BMPImage::multiplySize(float factor)
+{
+	_invalidateContentHash();
+
+    if (factor == 0)
+    {
+        throw std::invalid_argument("Factor can not be 0");
+    }
+	uint8_t reverse = 0;
+	if(factor < 0)
+	{
+		reverse = 1;
+		factor = -factor;
+		Log::info("Image reverse...");
+	}
+
+
+    const int32_t newWidth = static_cast<int32_t>(_activeHeader.width * factor);
+    const int32_t newHeight = static_cast<int32_t>(_activeHeader.height * factor);
+	IMAGE_TIME_PHASE(RESAMPLE);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(newWidth) * newHeight);
+
+    const uint16_t pixelSize = _getByteCount();
+    const size_t newRowSize = (static_cast<size_t>(newWidth) * _activeHeader.bitCount + 7) / 8;
+    PixelBuffer newPixelData(newRowSize * newHeight, _pixelData.get_allocator());
+    const bool monochrome = _isMonochrome();
+
+    int32_t previousOldY = -1;
+    for (int32_t y = 0; y < newHeight; ++y)
+    {
+		const int32_t oldY = reverse == 1 ? static_cast<int32_t>(_activeHeader.height - (y / factor)) : static_cast<int32_t>(y / factor);
+		// Rows sampling the same source row are copies of the previous one
+		if (oldY == previousOldY)
+		{
+			std::memcpy(newPixelData.data() + y * newRowSize, newPixelData.data() + (y - 1) * newRowSize, newRowSize);
+			continue;
+		}
+		previousOldY = oldY;
+        for (int32_t x = 0; x < newWidth; ++x)
+        {
+			int32_t oldX;
+			if (reverse == 1)
+			{
+				oldX = static_cast<int32_t>( _activeHeader.width - (x / factor));
+			}
+			else
+			{
+				oldX = static_cast<int32_t>(x / factor);
+			}
+            if (monochrome && oldX < _activeHeader.width && oldY < _activeHeader.height)
+            {
+                if (_getIndex(oldX, oldY))
+                {
+                    newPixelData[y * newRowSize + x / 8] |= static_cast<uint8_t>(0x80 >> (x % 8));
+                }
+            }
+            else if (oldX < _activeHeader.width && oldY < _activeHeader.height)
+            {
+                const uint8_t* source = _pixelData.data() + (static_cast<size_t>(oldY) * _activeHeader.width + oldX) * pixelSize;
+                std::copy(source, source + pixelSize, newPixelData.data() + (static_cast<size_t>(y) * newWidth + x) * pixelSize);
+            }
+        }
+    }
+
+    _activeHeader.width = newWidth;
+    _activeHeader.height = newHeight;
+    _pixelData = std::move(newPixelData);
+
+    _updateHeaders();
+	if (factor > 1)
+		Log::info("Image widen successfully");
+	if(factor <=1)
+	{
+		Log::info("Image shrinked successfully");
+	}
+}
+
+/// <summary>
+/// Halve the image again and again, each level from the previous one
+/// </summary>
+/// <param name="levelCount">Levels including the image, 0 for every level down to 1x1</param>
+/// <returns></returns>
+ImagePyramid BMPImage::buildPyramid(const uint32_t levelCount) const
+{
+	return ImagePyramid(*this, levelCount);
+}
+
+/// <summary>
+/// Apply a chain of point operations in a single pass over the pixels
+/// </summary>
+/// <param name="lut">Composed lookup tables</param>
+void BMPImage::applyLUT(const ColorLUT& lut)
+{
+	_invalidateContentHash();
+	if (lut.isIdentity())
+	{
+		return;
+	}
+	if (isIndexed())
+	{
+		// Only the color table changes
+		lut.apply(_palette.data()->data(), _palette.size(), 4);
+		return;
+	}
+	const uint16_t pixelSize = _getByteCount();
+	const int64_t width = _activeHeader.width;
+	uint8_t* data = _pixelData.data();
+	ThreadPool::instance().parallelFor(0, _activeHeader.height, [&](const int64_t begin, const int64_t end)
+	{
+		lut.apply(data + begin * width * pixelSize, static_cast<size_t>((end - begin) * width), pixelSize);
+	});
+}
+
+/// <summary>
+/// Add an offset to the color channels
+/// </summary>
+/// <param name="offset">-255 to 255</param>
+void BMPImage::adjustBrightness(const int16_t offset)
+{
+	applyLUT(ColorLUT().brightness(offset));
+}
 
-uint32_t BMPImage::getHeight() const
+/// <summary>
+/// Scale the contrast around the middle gray
+/// </summary>
+/// <param name="factor">1 keeps the image unchanged</param>
+void BMPImage::adjustContrast(const float factor)
 {
-	return _activeHeader.height;
+	applyLUT(ColorLUT().contrast(factor));
 }
 
 /// <summary>
-/// Get the pixel at the specified row and column
+/// Gamma correction of the color channels
 /// </summary>
-/// <param name="x">row</param>
-/// <param name="y">column</param>
-/// <returns></returns>
-Pixel BMPImage::getPixel(const uint16_t x, const uint16_t y) const
+/// <param name="gamma">Values above 1 brighten the image</param>
+void BMPImage::adjustGamma(const float gamma)
 {
-	if (x >= _activeHeader.width || y >= _activeHeader.height)
-	{
-		throw std::out_of_range("Pixel coordinates are out of bounds");
-	}
-	Pixel pixel = _pixelData[y * _activeHeader.width + x];
-	return pixel;
+	applyLUT(ColorLUT().gamma(gamma));
 }
 
 /// <summary>
-/// Set the pixel at the specified row and column
+/// Remap the input range of the color channels to the output range
 /// </summary>
-/// <param name="x"></param>
-/// <param name="y"></param>
-/// <param name="r"></param>
-/// <param name="g"></param>
-/// <param name="b"></param>
-void BMPImage::setPixel(const uint16_t x,const uint16_t y, const uint8_t r, const uint8_t g, const  uint8_t b, const uint8_t a)
+/// <param name="inputBlack"></param>
+/// <param name="inputWhite"></param>
+/// <param name="gamma"></param>
+/// <param name="outputBlack"></param>
+/// <param name="outputWhite"></param>
+void BMPImage::adjustLevels(const uint8_t inputBlack, const uint8_t inputWhite, const float gamma, const uint8_t outputBlack, const uint8_t outputWhite)
 {
-	if (x >= _activeHeader.width || y >= _activeHeader.height)
-		throw std::out_of_range("Pixel coordinates are out of bounds");
-	if (_activeHeader.bitCount == DEEP_COLOR_BIT_SIZE)
-	{
-		_pixelData[y * _activeHeader.width + x] = Pixel(r, g, b, a);
-	}
+	applyLUT(ColorLUT().levels(inputBlack, inputWhite, gamma, outputBlack, outputWhite));
+}
 
-	else if (_activeHeader.bitCount == TRUE_COLOR_BIT_SIZE)
-	{
-		if (a != 0) std::cout << "Pixel " << x << ", " << y << " : The image do not have alpha channel component.\n";
-		_pixelData[y * _activeHeader.width + x] = Pixel(r, g, b);
-	}
+/// <summary>
+/// Negative of the image (alpha is kept)
+/// </summary>
+void BMPImage::invertColors()
+{
+	applyLUT(ColorLUT().invert());
 }
 
 /// <summary>
-/// Set the pixel at the specified row and column
+/// Convert the colors to gray, the image keeps its bit count
 /// </summary>
-/// <param name="x">row</param>
-/// <param name="y">column</param>
-/// <param name="pixel"></param>
-void BMPImage::setPixel(uint16_t x, uint16_t y, const Pixel& pixel)
+void BMPImage::toGrayscale()
 {
-	_pixelData[y * _activeHeader.width + x] = pixel;
+	applyLUT(ColorLUT().grayscale());
 }
 
 /// <summary>
-/// Resize the image to the specified height and width
+/// Exchange two color channels
 /// </summary>
-/// <param name="newHeight"></param>
-/// <param name="newWidth"></param>
-void BMPImage::resize(const int32_t newWidth, const int32_t newHeight)
+/// <param name="first">ColorLUT channel mask</param>
+/// <param name="second">ColorLUT channel mask</param>
+void BMPImage::swapChannels(const uint8_t first, const uint8_t second)
 {
-	if (newHeight > 0 && newWidth > 0)
+	applyLUT(ColorLUT().swapChannels(first, second));
+}
+
+/// <summary>
+/// Count the values of each channel.
+/// Every thread fills its own histogram over a band of rows, they are merged at the end.
+/// </summary>
+/// <returns>Histogram with one entry per byte of the pixel</returns>
+BMPImage::Histogram BMPImage::histogram() const
+{
+	Histogram result{};
+	result.channelCount = isIndexed() ? 3 : _getByteCount();
+	result.pixelCount = static_cast<uint64_t>(_activeHeader.width) * _activeHeader.height;
+	if (isIndexed())
 	{
-		if (_activeHeader.height != newHeight || _activeHeader.width != newWidth)
+		// Count the indices, then spread the counts to the channels of their colors
+		std::array<uint64_t, 256> indexCounts{};
+		const size_t rowSize = _getRowSize();
+		const uint8_t* data = _pixelData.data();
+		const bool monochrome = _isMonochrome();
+		const int32_t width = _activeHeader.width;
+		std::mutex mergeMutex;
+		ThreadPool::instance().parallelFor(0, _activeHeader.height, [&](const int64_t begin, const int64_t end)
 		{
-			_resizePixelsData(newWidth, newHeight);
-			std::cout << "Image resized successfully" << std::endl;
+			std::array<uint64_t, 256> local{};
+			for (int64_t i = begin; i < end; i++)
+			{
+				const uint8_t* row = data + i * rowSize;
+				if (monochrome)
+				{
+					// Unused bits of the rows are always cleared
+					uint64_t ones = 0;
+					for (size_t j = 0; j < rowSize; j++)
+					{
+						ones += std::bitset<8>(row[j]).count();
+					}
+					local[1] += ones;
+					local[0] += width - ones;
+				}
+				else
+				{
+					for (size_t j = 0; j < rowSize; j++)
+					{
+						local[row[j]]++;
+					}
+				}
+			}
+			std::lock_guard<std::mutex> lock(mergeMutex);
+			for (int v = 0; v < 256; v++)
+			{
+				indexCounts[v] += local[v];
+			}
+		});
+		for (size_t i = 0; i < _palette.size(); i++)
+		{
+			for (uint8_t c = 0; c < 3; c++)
+			{
+				result.channels[c][_palette[i][c]] += indexCounts[i];
+			}
 		}
-		else
+		return result;
+	}
+
+	const uint16_t pixelSize = _getByteCount();
+	const size_t rowSize = _getRowSize();
+	const uint8_t* data = _pixelData.data();
+	std::mutex mergeMutex;
+	ThreadPool::instance().parallelFor(0, _activeHeader.height, [&](const int64_t begin, const int64_t end)
+	{
+		std::array<std::array<uint64_t, 256>, 4> local{};
+		for (int64_t i = begin; i < end; i++)
+		{
+			const uint8_t* row = data + i * rowSize;
+			const uint8_t* rowEnd = row + rowSize;
+			if (pixelSize == 4)
+			{
+				for (const uint8_t* pixel = row; pixel != rowEnd; pixel += 4)
+				{
+					local[0][pixel[0]]++;
+					local[1][pixel[1]]++;
+					local[2][pixel[2]]++;
+					local[3][pixel[3]]++;
+				}
+			}
+			else
+			{
+				for (const uint8_t* pixel = row; pixel != rowEnd; pixel += pixelSize)
+				{
+					local[0][pixel[0]]++;
+					local[1][pixel[1]]++;
+					local[2][pixel[2]]++;
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(mergeMutex);
+		for (uint16_t c = 0; c < pixelSize; c++)
 		{
-			std::cout << "The image already has the specified dimensions" << std::endl;
+			for (int v = 0; v < 256; v++)
+			{
+				result.channels[c][v] += local[c][v];
+			}
 		}
+	}, std::max<int64_t>(1, (1 << 16) / std::max<int64_t>(1, _activeHeader.width)));
+	return result;
+}
+
+/// <summary>
+/// Minimum, maximum, mean and standard deviation of each channel.
+/// The moments are computed from the histogram, so it costs a single pass over the pixels.
+/// </summary>
+/// <returns>One entry per byte of the pixel (red, green, blue and alpha if any)</returns>
+std::vector<BMPImage::ChannelStatistics> BMPImage::statistics() const
+{
+	const Histogram hist = histogram();
+	std::vector<ChannelStatistics> result(hist.channelCount, ChannelStatistics{0, 0, 0.0, 0.0});
+	if (hist.pixelCount == 0)
+	{
+		return result;
 	}
-	else
+	for (uint16_t c = 0; c < hist.channelCount; c++)
 	{
-		throw std::invalid_argument("Height and width must be greater than 0");
+		const std::array<uint64_t, 256>& counts = hist.channels[c];
+		int min = 0;
+		while (counts[min] == 0) min++;
+		int max = 255;
+		while (counts[max] == 0) max--;
+		uint64_t sum = 0;
+		uint64_t squaredSum = 0;
+		for (int v = min; v <= max; v++)
+		{
+			sum += counts[v] * v;
+			squaredSum += counts[v] * v * v;
+		}
+		const double mean = static_cast<double>(sum) / hist.pixelCount;
+		const double variance = static_cast<double>(squaredSum) / hist.pixelCount - mean * mean;
+		result[c] = ChannelStatistics{static_cast<uint8_t>(min), static_cast<uint8_t>(max), mean, std::sqrt(std::max(variance, 0.0))};
 	}
+	return result;
 }
 
 /// <summary>
-/// Set a new height for the image
+/// Spread the values of each color channel so their cumulative distribution becomes linear
 /// </summary>
-/// <param name="height"></param>
-void BMPImage::setHeight(const int32_t height)
+void BMPImage::equalizeHistogram()
 {
-	resize(height, _activeHeader.width);
+	const Histogram hist = histogram();
+	if (hist.pixelCount == 0)
+	{
+		return;
+	}
+	ColorLUT lut;
+	for (uint8_t c = 0; c < 3; c++)
+	{
+		const std::array<uint64_t, 256>& counts = hist.channels[c];
+		uint64_t firstCount = 0;
+		for (const uint64_t count : counts)
+		{
+			if (count != 0)
+			{
+				firstCount = count;
+				break;
+			}
+		}
+		if (firstCount == hist.pixelCount)
+		{
+			continue; // single value, nothing to spread
+		}
+		ColorLUT::Table table;
+		uint64_t cumulative = 0;
+		for (int v = 0; v < 256; v++)
+		{
+			cumulative += counts[v];
+			const uint64_t above = cumulative > firstCount ? cumulative - firstCount : 0;
+			table[v] = static_cast<uint8_t>((above * 255 + (hist.pixelCount - firstCount) / 2) / (hist.pixelCount - firstCount));
+		}
+		lut.map(table, static_cast<uint8_t>(1 << c));
+	}
+	applyLUT(lut);
 }
 
+/// <summary>
+/// Stretch each color channel to the full range, ignoring a fraction of the darkest and brightest values
+/// </summary>
+/// <param name="clipFraction">Fraction of pixels clipped at each end, from 0 to 0.5</param>
+void BMPImage::autoLevels(const float clipFraction)
+{
+	if (clipFraction < 0 || clipFraction >= 0.5f)
+	{
+		throw std::invalid_argument("Clip fraction must be between 0 and 0.5");
+	}
+	const Histogram hist = histogram();
+	const uint64_t clipped = static_cast<uint64_t>(hist.pixelCount * clipFraction);
+	ColorLUT lut;
+	for (uint8_t c = 0; c < 3; c++)
+	{
+		const std::array<uint64_t, 256>& counts = hist.channels[c];
+		int low = 0;
+		for (uint64_t cumulative = counts[0]; low < 255 && cumulative <= clipped; cumulative += counts[++low]) {}
+		int high = 255;
+		for (uint64_t cumulative = counts[255]; high > 0 && cumulative <= clipped; cumulative += counts[--high]) {}
+		if (low < high && (low > 0 || high < 255))
+		{
+			lut.levels(static_cast<uint8_t>(low), static_cast<uint8_t>(high), 1.0f, 0, 255, static_cast<uint8_t>(1 << c));
+		}
+	}
+	applyLUT(lut);
+}
 
 /// <summary>
-/// Set a new width for the image
+/// Copy a rectangle of the image to a new image, the rectangle is clipped to the image
 /// </summary>
+/// <param name="x">Column of the first pixel</param>
+/// <param name="y">Row of the first pixel</param>
 /// <param name="width"></param>
-void BMPImage::setWidth(int32_t width)
+/// <param name="height"></param>
+/// <returns>Image of the same color depth and palette</returns>
+BMPImage BMPImage::copyRegion(const int32_t x, const int32_t y, const int32_t width, const int32_t height) const
 {
-	resize(_activeHeader.height, width);
+	const int64_t left = std::max<int64_t>(0, x);
+	const int64_t right = std::min<int64_t>(_activeHeader.width, static_cast<int64_t>(x) + width);
+	const int64_t bottom = std::max<int64_t>(0, y);
+	const int64_t top = std::min<int64_t>(_activeHeader.height, static_cast<int64_t>(y) + height);
+	if (width <= 0 || height <= 0 || left >= right || bottom >= top)
+	{
+		throw std::invalid_argument("The region does not overlap the image");
+	}
+	BMPImage region(static_cast<int32_t>(right - left), static_cast<int32_t>(top - bottom), _activeHeader.bitCount);
+	region._palette = _palette;
+	region._activeHeader.xPixelsPerMeter = _activeHeader.xPixelsPerMeter;
+	region._activeHeader.yPixelsPerMeter = _activeHeader.yPixelsPerMeter;
+	region._updateHeaders();
+	_copyRows(_pixelData.data() + bottom * _getRowSize(), _getRowSize(), static_cast<size_t>(left),
+		region._pixelData.data(), region._getRowSize(), 0, static_cast<size_t>(right - left), static_cast<size_t>(top - bottom), _activeHeader.bitCount);
+	return region;
 }
 
 /// <summary>
-/// Get the resolution of the image
+/// Keep only a rectangle of the image, the rectangle is clipped to the image
 /// </summary>
-/// <param name="xPixelsPerMeter"></param>
-/// <param name="yPixelsPerMeter"></param>
-void BMPImage::getResolution(int32_t& xPixelsPerMeter, int32_t& yPixelsPerMeter) const
+/// <param name="x">Column of the first kept pixel</param>
+/// <param name="y">Row of the first kept pixel</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+void BMPImage::crop(const int32_t x, const int32_t y, const int32_t width, const int32_t height)
 {
-	xPixelsPerMeter = _activeHeader.xPixelsPerMeter;
-	yPixelsPerMeter = _activeHeader.yPixelsPerMeter;
+	_invalidateContentHash();
+	BMPImage region = copyRegion(x, y, width, height);
+	_pixelData.swap(region._pixelData);
+	_activeHeader.width = region._activeHeader.width;
+	_activeHeader.height = region._activeHeader.height;
+	_updateHeaders();
 }
 
 /// <summary>
-/// Set a new resolution for the image
+/// Copy the pixels of another image without blending, the parts of the source outside of this image are ignored.
+/// The source is converted to the color depth of this image, and mapped to its palette for indexed images.
 /// </summary>
-/// <param name="xPixelsPerMeter"></param>
-/// <param name="yPixelsPerMeter"></param>
-void BMPImage::setResolution(const int32_t xPixelsPerMeter,const int32_t yPixelsPerMeter)
+/// <param name="source"></param>
+/// <param name="x">Column of the first source pixel in this image, can be negative</param>
+/// <param name="y">Row of the first source pixel in this image, can be negative</param>
+void BMPImage::paste(const BMPImage& source, const int32_t x, const int32_t y)
 {
-	_activeHeader.xPixelsPerMeter = xPixelsPerMeter;
-	_activeHeader.yPixelsPerMeter = yPixelsPerMeter;
+	_invalidateContentHash();
+	const int64_t left = std::max<int64_t>(0, x);
+	const int64_t right = std::min<int64_t>(_activeHeader.width, static_cast<int64_t>(x) + source._activeHeader.width);
+	const int64_t bottom = std::max<int64_t>(0, y);
+	const int64_t top = std::min<int64_t>(_activeHeader.height, static_cast<int64_t>(y) + source._activeHeader.height);
+	if (left >= right || bottom >= top)
+	{
+		return;
+	}
+	const size_t width = static_cast<size_t>(right - left);
+	const size_t height = static_cast<size_t>(top - bottom);
+	const size_t sourceX = static_cast<size_t>(left - x);
+	const size_t sourceY = static_cast<size_t>(bottom - y);
+
+	const bool sameFormat = source._activeHeader.bitCount == _activeHeader.bitCount && source._palette == _palette;
+	if (sameFormat && &source != this)
+	{
+		_copyRows(source._pixelData.data() + sourceY * source._getRowSize(), source._getRowSize(), sourceX,
+			_pixelData.data() + bottom * _getRowSize(), _getRowSize(), static_cast<size_t>(left), width, height, _activeHeader.bitCount);
+		return;
+	}
+	if (!isIndexed() || sameFormat)
+	{
+		// Overlapping or converted pixels go through a copy of the pasted part
+		BMPImage converted = source.copyRegion(static_cast<int32_t>(sourceX), static_cast<int32_t>(sourceY), static_cast<int32_t>(width), static_cast<int32_t>(height));
+		if (converted._activeHeader.bitCount != _activeHeader.bitCount)
+		{
+			converted.convertTo(_activeHeader.bitCount);
+		}
+		paste(converted, static_cast<int32_t>(left), static_cast<int32_t>(bottom));
+		return;
+	}
+
+	// Different colors on an indexed image, map them to the closest entries of the palette
+	std::array<uint8_t, 256> indexMap{};
+	for (size_t i = 0; i < source._palette.size(); i++)
+	{
+		indexMap[i] = _findPaletteIndex(source._palette[i][0], source._palette[i][1], source._palette[i][2]);
+	}
+	std::unique_ptr<ColorQuantizer> quantizer;
+	if (!source.isIndexed())
+	{
+		quantizer = std::make_unique<ColorQuantizer>(_palette);
+	}
+	const BMPImage* input = &source;
+	std::unique_ptr<BMPImage> copy;
+	if (&source == this)
+	{
+		copy = std::make_unique<BMPImage>(source);
+		input = copy.get();
+	}
+	const uint16_t sourceSize = input->_getByteCount();
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(height), [&](const int64_t begin, const int64_t end)
+	{
+		for (int64_t row = begin; row < end; row++)
+		{
+			const uint32_t inputY = static_cast<uint32_t>(sourceY + row);
+			const uint32_t outputY = static_cast<uint32_t>(bottom + row);
+			for (size_t column = 0; column < width; column++)
+			{
+				const uint32_t inputX = static_cast<uint32_t>(sourceX + column);
+				uint8_t index;
+				if (quantizer)
+				{
+					const uint8_t* pixel = input->_pixelData.data() + (static_cast<size_t>(inputY) * input->_activeHeader.width + inputX) * sourceSize;
+					index = quantizer->nearest(pixel[0], pixel[1], pixel[2]);
+				}
+				else
+				{
+					index = indexMap[input->_getIndex(inputX, inputY)];
+				}
+				_setIndex(static_cast<uint32_t>(left + column), outputY, index);
+			}
+		}
+	});
 }
 
 /// <summary>
-/// Set a new resolution for the image
+/// Set every pixel of a rectangle to the same color, the rectangle is clipped to the image
 /// </summary>
-/// <param name="resolution"></param>
-void BMPImage::setResolution(const int32_t resolution)
+/// <param name="x">Column of the first pixel</param>
+/// <param name="y">Row of the first pixel</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="r"></param>
+/// <param name="g"></param>
+/// <param name="b"></param>
+/// <param name="a">Only kept by 32 bits images</param>
+void BMPImage::fillRect(const int32_t x, const int32_t y, const int32_t width, const int32_t height, const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a)
 {
-	setResolution(resolution, resolution);
+	_invalidateContentHash();
+	const int64_t left = std::max<int64_t>(0, x);
+	const int64_t right = std::min<int64_t>(_activeHeader.width, static_cast<int64_t>(x) + width);
+	const int64_t bottom = std::max<int64_t>(0, y);
+	const int64_t top = std::min<int64_t>(_activeHeader.height, static_cast<int64_t>(y) + height);
+	if (width <= 0 || height <= 0 || left >= right || bottom >= top)
+	{
+		return;
+	}
+	const uint16_t pixelSize = _getByteCount();
+	const uint8_t color[4] = {isIndexed() ? _findPaletteIndex(r, g, b) : r, g, b, a};
+	const size_t count = static_cast<size_t>(right - left);
+	const size_t rowSize = _getRowSize();
+	uint8_t* data = _pixelData.data();
+	const bool monochrome = _isMonochrome();
+	// The first row is filled once, the others are copies of it
+	uint8_t* first = data + bottom * rowSize;
+	if (monochrome)
+	{
+		_fillBits(first, static_cast<size_t>(left), count, color[0] != 0);
+	}
+	else
+	{
+		PixelConverter::fill(first + left * pixelSize, count, pixelSize, color);
+	}
+	_copyRows(first, 0, static_cast<size_t>(left), first + rowSize, rowSize, static_cast<size_t>(left),
+		count, static_cast<size_t>(top - bottom - 1), _activeHeader.bitCount);
 }
 
 /// <summary>
-/// <summary>
-/// Multiply the size of the image by a given factor
+/// Blend another image onto this one, the parts of the source outside of this image are ignored.
+/// Pixels without alpha channel are opaque, indexed sources are blended through their palette.
 /// </summary>
-/// <param name="factor">Factor to multiply the size by</param>
-void BMPImage::multiplySize(float factor)
+/// <param name="source"></param>
+/// <param name="x">Column of the first source pixel in this image, can be negative</param>
+/// <param name="y">Row of the first source pixel in this image, can be negative</param>
+/// <param name="mode"></param>
+void BMPImage::composite(const BMPImage& source, const int32_t x, const int32_t y, const Blender::Mode mode)
 {
-
-    if (factor == 0)
-    {
-        throw std::invalid_argument("Factor can not be 0");
-    }
-	uint8_t reverse = 0;
-	if(factor < 0)
+	_invalidateContentHash();
+	if (isIndexed())
 	{
-		reverse = 1;
-		factor = -factor;
-		std::cout << "Image reverse...\n";
+		throw std::invalid_argument("Compositing is only handled on 24 and 32 bits images");
+	}
+	// Indexed sources and the image itself are blended from a 32 bits copy
+	std::unique_ptr<BMPImage> copy;
+	const BMPImage* blended = &source;
+	if (source.isIndexed() || &source == this)
+	{
+		copy = std::make_unique<BMPImage>(source);
+		copy->convertTo(DEEP_COLOR_BIT_SIZE);
+		blended = copy.get();
 	}
 
+	// Opaque pixels over the image replace it
+	if (mode == Blender::Mode::OVER && !blended->_isDeepColor())
+	{
+		paste(*blended, x, y);
+		return;
+	}
 
-    const int32_t newWidth = static_cast<int32_t>(_activeHeader.width * factor);
-    const int32_t newHeight = static_cast<int32_t>(_activeHeader.height * factor);
-
-    std::vector<Pixel> newPixelData(newHeight * newWidth);
+	const int64_t left = std::max<int64_t>(0, x);
+	const int64_t right = std::min<int64_t>(_activeHeader.width, static_cast<int64_t>(x) + blended->_activeHeader.width);
+	const int64_t bottom = std::max<int64_t>(0, y);
+	const int64_t top = std::min<int64_t>(_activeHeader.height, static_cast<int64_t>(y) + blended->_activeHeader.height);
+	if (left >= right || bottom >= top)
+	{
+		return;
+	}
 
-    for (int32_t y = 0; y < newHeight; ++y)
-    {
-        for (int32_t x = 0; x < newWidth; ++x)
-        {
-			int32_t oldX;
-			int32_t oldY;
-			if (reverse == 1)
+	const size_t count = static_cast<size_t>(right - left);
+	const uint16_t sourceSize = blended->_getByteCount();
+	const uint16_t destinationSize = _getByteCount();
+	const int64_t sourceWidth = blended->_activeHeader.width;
+	const int64_t destinationWidth = _activeHeader.width;
+	const uint8_t* sourceData = blended->_pixelData.data();
+	uint8_t* destinationData = _pixelData.data();
+	ThreadPool::instance().parallelFor(bottom, top, [&](const int64_t begin, const int64_t end)
+	{
+		// 24 bits rows are blended through 32 bits row buffers
+		std::vector<uint8_t> sourceRow(sourceSize == 4 ? 0 : count * 4);
+		std::vector<uint8_t> destinationRow(destinationSize == 4 ? 0 : count * 4);
+		for (int64_t row = begin; row < end; row++)
+		{
+			const uint8_t* sourcePixels = sourceData + ((row - y) * sourceWidth + (left - x)) * sourceSize;
+			uint8_t* destinationPixels = destinationData + (row * destinationWidth + left) * destinationSize;
+			if (sourceSize != 4)
 			{
-				oldX = static_cast<int32_t>( _activeHeader.width - (x / factor));
-				oldY = static_cast<int32_t>( _activeHeader.height - (y / factor));
-
+				PixelConverter::rgbToRgba(sourcePixels, sourceRow.data(), count, 255);
+				sourcePixels = sourceRow.data();
+			}
+			if (destinationSize != 4)
+			{
+				PixelConverter::rgbToRgba(destinationPixels, destinationRow.data(), count, 255);
+				Blender::blend(sourcePixels, destinationRow.data(), count, mode);
+				PixelConverter::rgbaToRgb(destinationRow.data(), destinationPixels, count);
 			}
 			else
 			{
-				oldX = static_cast<int32_t>(x / factor);
-				oldY = static_cast<int32_t>(y / factor);
+				Blender::blend(sourcePixels, destinationPixels, count, mode);
 			}
-            if (oldX < _activeHeader.width && oldY < _activeHeader.height)
-            {
-                newPixelData[y * newWidth + x] = _pixelData[oldY * _activeHeader.width + oldX];
-            }
-        }
-    }
+		}
+	}, 16);
+}
 
-    _activeHeader.width = newWidth;
-    _activeHeader.height = newHeight;
-    _pixelData = std::move(newPixelData);
+/// <summary>
+/// Turn the image a quarter turn. The destination rows are split between the threads, each one reads a column of the source.
+/// </summary>
+/// <param name="clockwise"></param>
+void BMPImage::rotate90(const bool clockwise)
+{
+	_invalidateContentHash();
+	const uint32_t width = _activeHeader.width;
+	const uint32_t height = _activeHeader.height;
+	const size_t sourceRowSize = _getRowSize();
+	const size_t rotatedRowSize = (static_cast<size_t>(height) * _activeHeader.bitCount + 7) / 8;
+	const uint16_t byteCount = _getByteCount();
+	PixelBuffer rotated(rotatedRowSize * width, 0, _pixelData.get_allocator());
+	ThreadPool::instance().parallelFor(0, width, [&](const int64_t first, const int64_t last)
+	{
+		for (uint32_t y = static_cast<uint32_t>(first); y < static_cast<uint32_t>(last); y++)
+		{
+			// Clockwise, the pixel (x, y) goes to (y, width - 1 - x), and to (height - 1 - y, x) the other way
+			const uint32_t sourceX = clockwise ? width - 1 - y : y;
+			uint8_t* destination = rotated.data() + y * rotatedRowSize;
+			for (uint32_t x = 0; x < height; x++)
+			{
+				const uint32_t sourceY = clockwise ? x : height - 1 - x;
+				if (_isMonochrome())
+				{
+					destination[x / 8] |= static_cast<uint8_t>(_getIndex(sourceX, sourceY) << (7 - x % 8));
+				}
+				else
+				{
+					std::memcpy(destination + static_cast<size_t>(x) * byteCount,
+						_pixelData.data() + sourceY * sourceRowSize + static_cast<size_t>(sourceX) * byteCount, byteCount);
+				}
+			}
+		}
+	}, 16);
+	_pixelData.swap(rotated);
+	_activeHeader.width = static_cast<int32_t>(height);
+	_activeHeader.height = static_cast<int32_t>(width);
+	std::swap(_activeHeader.xPixelsPerMeter, _activeHeader.yPixelsPerMeter);
+	_updateHeaders();
+}
 
-    _updateHeaders();
-	if (factor > 1)
-		std::cout << "Image widen successfully" << std::endl;
-	if(factor <=1)
+/// <summary>
+/// Replace each pixel by the mean of the pixels above and below it within a radius, the edge pixels are repeated.
+/// The columns are split between the threads, each one walks down its columns.
+/// </summary>
+/// <param name="radius">In pixels</param>
+void BMPImage::blurVertical(const uint32_t radius)
+{
+	if (isIndexed() && !_hasGrayRamp())
+	{
+		throw std::logic_error("Blurring needs a true color or gray image");
+	}
+	_invalidateContentHash();
+	const int64_t height = _activeHeader.height;
+	if (radius == 0 || height == 0)
 	{
-		std::cout << "Image shrinked successfully" << std::endl;
+		return;
 	}
+	const size_t rowSize = _getRowSize();
+	const uint32_t windowSize = 2 * radius + 1;
+	PixelBuffer blurred(_pixelData.size(), _pixelData.get_allocator());
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(rowSize), [&](const int64_t first, const int64_t last)
+	{
+		const auto sample = [&](const size_t column, const int64_t y)
+		{
+			return _pixelData[static_cast<size_t>(std::clamp<int64_t>(y, 0, height - 1)) * rowSize + column];
+		};
+		for (size_t column = static_cast<size_t>(first); column < static_cast<size_t>(last); column++)
+		{
+			uint32_t sum = 0;
+			for (int64_t y = -static_cast<int64_t>(radius); y <= static_cast<int64_t>(radius); y++)
+			{
+				sum += sample(column, y);
+			}
+			for (int64_t y = 0; y < height; y++)
+			{
+				blurred[static_cast<size_t>(y) * rowSize + column] = static_cast<uint8_t>((sum + windowSize / 2) / windowSize);
+				sum += sample(column, y + radius + 1);
+				sum -= sample(column, y - radius);
+			}
+		}
+	}, 64);
+	_pixelData.swap(blurred);
 }
 
 /// <summary>
@@ -578,32 +2380,30 @@ BMPImage BMPImage::Fractal::mandelbrot(const int32_t width, const int32_t height
     const float offsetX = -2.5f * aspectRatio;
     constexpr float offsetY = -1.75f;
 	BMPImage image(width, height, TRUE_COLOR_BIT_SIZE);
-	for (int32_t y = 0; y < height; ++y)
+	IMAGE_TIME_PHASE(RENDER);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(width) * height);
+	// Every pixel is independent, the rows are split between the threads
+	image.transform<RgbPixel>([=](const RgbPixel&, const uint32_t x, const uint32_t y)
 	{
-		for (int32_t x = 0; x < width; ++x)
+		float zx = 0;
+		float zy = 0;
+		const float cx = (x * scale / aspectRatio) + offsetX;
+		const float cy = y * scale + offsetY;
+		int16_t i = 0;
+		for (; i < iterations; ++i)
 		{
-			float zx = 0;
-			float zy = 0;
-			const float cx = (x * scale / aspectRatio) + offsetX;
-			const float cy = y * scale + offsetY;
-			int16_t i = 0;
-			for (; i < iterations; ++i)
+			const float temp = zx * zx - zy * zy + cx;
+			zy = 2 * zx * zy + cy;
+			zx = temp;
+			if (zx * zx + zy * zy > 4)
 			{
-				const float temp = zx * zx - zy * zy + cx;
-				zy = 2 * zx * zy + cy;
-				zx = temp;
-				if (zx * zx + zy * zy > 4)
-				{
-					break;
-				}
+				break;
 			}
-			const uint8_t r = static_cast<uint8_t>(255 * i / iterations);
-			const uint8_t g = static_cast<uint8_t>(255 * i / iterations);
-			const uint8_t b = static_cast<uint8_t>(255 * i / iterations);
-			image.setPixel(x, y, r, g, b);
 		}
-	}
-	std::cout << "Mandelbrot fractal generated successfully" << std::endl;
+		const uint8_t value = static_cast<uint8_t>(255 * i / iterations);
+		return RgbPixel{value, value, value};
+	}, true);
+	Log::info("Mandelbrot fractal generated successfully");
 	return image;
 }
 
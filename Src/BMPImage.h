@@ -1,6 +1,20 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
 #include <vector>
+#include "Blender.h"
+#include "BufferPool.h"
+#include "ColorLUT.h"
+#include "ColorQuantizer.h"
+#include "PerceptualHash.h"
 #include "Pixel.h"
+#include "PixelSpan.h"
+#include "ThreadPool.h"
+
+class ImagePyramid;
 
 
 
@@ -32,7 +46,7 @@ class BMPImage
 		int32_t yPixelsPerMeter;	// Vertical resolution
 		uint32_t colorsUsed;		// No. of colors in the color palette
 		uint32_t colorsImportant;	// No. of important colors
-	}_infoHeader;
+	};
 
 	// BMP V4 info header(108 bytes)
 	// See https://learn.microsoft.com/en-us/windows/win32/api/wingdi/ns-wingdi-bitmapv4header
@@ -42,7 +56,7 @@ class BMPImage
         uint32_t greenMask;           // Mask identifying bits of green component
         uint32_t blueMask;            // Mask identifying bits of blue component
         uint32_t alphaMask;           // Mask identifying bits of alpha component
-        std::string csType;           // Color space type
+        uint32_t csType;              // Color space type
         int32_t redX;                 // X coordinate of red endpoint
         int32_t redY;                 // Y coordinate of red endpoint
         int32_t redZ;                 // Z coordinate of red endpoint
@@ -57,19 +71,53 @@ class BMPImage
         uint32_t gammaBlue;           // Gamma blue coordinate scale value
     }_v4InfoHeader;
 #pragma pack(pop)
-	BMPInfoHeader& _activeHeader = _infoHeader;
+	static_assert(sizeof(BMPFileHeader) == 14, "BMP file header must be 14 bytes");
+	static_assert(sizeof(BMPInfoHeader) == 40, "BMP info header must be 40 bytes");
+	static_assert(sizeof(BMPV4InfoHeader) == 108, "BMP V4 info header must be 108 bytes");
+	// Saves and restores the headers and pixels of its states
+	friend class ImageHistory;
+	// Reads the pixels of its source and writes the pixels of its levels
+	friend class ImagePyramid;
+	// Reads the headers and streams the pixels of the files it cuts into tiles
+	friend class DeepZoomExporter;
+	// Reads the rows of the images it compares
+	friend class ImageComparison;
+	// Converts the pixels from and to its tiles
+	friend class TiledImage;
+
+	// Fields shared by every header version, the V4 part is only written for 32 bits images
+	BMPInfoHeader& _activeHeader = _v4InfoHeader;
 
-	std::vector<Pixel> _pixelData;	// 2D vector to store pixels
+	// Contiguous rows of pixels, red first, without padding (bit packed for 1 bit images), charged to the account of the image
+	PixelBuffer _pixelData{PixelAllocator<uint8_t>(BufferPool::createAccount())};
+	std::vector<std::array<uint8_t, 4>> _palette;	// Color table of the 1 and 8 bits images (red, green, blue, reserved)
+	mutable std::atomic<uint64_t> _contentHash{0};	// 0 until computed, reset by every change of the pixels
 
 	bool _isTrueColor() const;
 	bool _isDeepColor() const;
+	bool _isMonochrome() const;
 	uint16_t _getByteCount() const;				
+	size_t _getRowSize() const;
+	uint8_t _getIndex(uint32_t x, uint32_t y) const;
+	void _setIndex(uint32_t x, uint32_t y, uint8_t index);
+	uint8_t _findPaletteIndex(uint8_t r, uint8_t g, uint8_t b) const;
+	bool _hasGrayRamp() const;
+	void _checkPixelType(size_t pixelSize) const;
+	void _invalidateContentHash();
+	template <typename T, typename Function>
+	static void _applyToRow(T* row, uint32_t width, uint32_t y, Function& function);
+	void _setDefaultPalette();
 	void _readHeaders(std::ifstream& file);
+	void _readPalette(std::ifstream& file);
 	void _readPixels(std::ifstream& file);
-	void _writeHeaders(std::ofstream& file) const;
-	void _writePixels(std::ofstream& file) const;
+	void _writeHeaders(std::ostream& file, uint32_t imageSize, uint32_t compression) const;
+	void _writePixels(std::ostream& file) const;
 	void _updateHeaders();
 	void _resizePixelsData(int32_t newWidth, int32_t newHeight);
+	static void _copyBits(const uint8_t* source, size_t sourceBit, uint8_t* destination, size_t destinationBit, size_t count);
+	static void _fillBits(uint8_t* destination, size_t firstBit, size_t count, bool value);
+	static void _copyRows(const uint8_t* source, size_t sourceRowSize, size_t sourceX, uint8_t* destination,
+		size_t destinationRowSize, size_t destinationX, size_t width, size_t height, uint16_t bitCount);
 
 	
 public:
@@ -84,6 +132,8 @@ public:
 
 	static constexpr uint16_t COLOR_PLANES_NUMBER = 1;
 	static constexpr uint32_t BI_RGB = 0;
+	static constexpr uint32_t BI_RLE8 = 1;
+	static constexpr uint32_t BI_RLE4 = 2;
 	static constexpr uint32_t BI_BITFIELDS = 3;
 
 	static constexpr int32_t BM_DEFAULT_RESOLUTION = 1;
@@ -92,29 +142,95 @@ public:
 	static constexpr uint32_t GREEN_CHANNEL_BIT_MASK = 0x0000FF00;
 	static constexpr uint32_t BLUE_CHANNEL_BIT_MASK = 0x000000FF;
 	static constexpr uint32_t ALPHA_CHANNEL_BIT_MASK = 0xFF000000;
-    static constexpr const char* LCS_WINDOWS_COLOR_SPACE = "Win ";
+	static constexpr uint32_t LCS_WINDOWS_COLOR_SPACE = 0x57696E20; // 'Win '
+
 
 	static constexpr uint16_t DEEP_COLOR_BIT_SIZE = 32;
 	static constexpr uint16_t TRUE_COLOR_BIT_SIZE = 24;
 	static constexpr uint16_t GRAY_SCALE_BIT_SIZE = 8;
+	static constexpr uint16_t SIXTEEN_COLORS_BIT_SIZE = 4;	// Only read, widened to 8 bits in memory
 	static constexpr uint16_t MONOCHROME_BIT_SIZE = 1;
 
+	// Count of each value per channel (red, green, blue, alpha)
+	struct Histogram {
+		std::array<std::array<uint64_t, 256>, 4> channels;
+		uint16_t channelCount;
+		uint64_t pixelCount;
+	};
+
+	// Formats handled by load, save, read and write
+	enum class FileFormat {
+		BMP,
+		QOI,	// Lossless, see https://qoiformat.org
+		PAM,	// Netpbm P7, raw samples
+		PNM,	// Netpbm P6 (PPM) or P5 (PGM) for gray images
+	};
+
+	// Header fields of an image file, read without the pixels
+	struct Info {
+		FileFormat format;
+		int32_t width;
+		int32_t height;
+		uint16_t bitCount;		// As stored in the file
+		uint32_t compression;	// BMP only
+		uint32_t offsetData;	// Start of the pixel data in the file
+	};
+
+	struct ChannelStatistics {
+		uint8_t min;
+		uint8_t max;
+		double mean;
+		double stddev;
+	};
+
 	BMPImage(uint16_t bitCount = TRUE_COLOR_BIT_SIZE);
 	BMPImage(int32_t width, int32_t height, uint16_t bitCount = TRUE_COLOR_BIT_SIZE);
 	BMPImage(const char* filename);
 	BMPImage(const BMPImage& other);
+	BMPImage(BMPImage&& other) noexcept;
 	~BMPImage();
 	BMPImage& operator=(const BMPImage& other);
+	BMPImage& operator=(BMPImage&& other) noexcept;
 
 	static void openImage(const std::string& filename);
 
 	void load(const char* filename);
-	void save(const char* filename) const;
+	void save(const char* filename, bool showImage = false) const;
+	static FileFormat formatOf(const std::string& filename);
+	static Info probe(const char* filename);
+	void read(std::istream& stream);
+	void write(std::ostream& stream, FileFormat format) const;
 	uint32_t getWidth() const;
 	uint32_t getHeight() const;
+	uint16_t getBitCount() const;
+	BufferPool::Usage getMemoryUsage() const;
+	bool isIndexed() const;
+	uint64_t contentHash() const;
+	uint64_t perceptualHash(PerceptualHash::Kind kind = PerceptualHash::Kind::DCT) const;
+	static uint64_t perceptualHashOf(const char* filename, PerceptualHash::Kind kind = PerceptualHash::Kind::DCT);
+	bool isCompressed() const;
+	void setCompressed(bool compressed);
+	const std::vector<std::array<uint8_t, 4>>& getPalette() const;
+	void setPalette(const std::vector<std::array<uint8_t, 4>>& palette);
+	uint8_t getPaletteIndex(uint32_t x, uint32_t y) const;
+	void setPaletteIndex(uint32_t x, uint32_t y, uint8_t index);
+	void convertTo(uint16_t bitCount);
+	void quantize(uint16_t colorCount = 256, ColorQuantizer::Dithering dithering = ColorQuantizer::Dithering::NONE);
 	Pixel getPixel(uint16_t x, uint16_t y) const;
 	void setPixel(uint16_t x, uint16_t y, uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0);
 	void setPixel(uint16_t x, uint16_t y, const Pixel& pixel);
+	template <typename T>
+	PixelSpan<T> row(uint32_t y);
+	template <typename T>
+	PixelSpan<const T> row(uint32_t y) const;
+	template <typename T>
+	PixelSpan<T> pixels();
+	template <typename T>
+	PixelSpan<const T> pixels() const;
+	template <typename T, typename Function>
+	void forEachPixel(Function&& function, bool parallel = false) const;
+	template <typename T, typename Function>
+	void transform(Function&& function, bool parallel = false);
 	void resize(int32_t newWidth, int32_t newHeight);
 	void setWidth(int32_t width);
 	void setHeight(int32_t height);
@@ -122,6 +238,26 @@ public:
 	void setResolution(int32_t xPixelsPerMeter, int32_t yPixelsPerMeter);
 	void setResolution(int32_t resolution);
 	void multiplySize(float factor);
+	ImagePyramid buildPyramid(uint32_t levelCount = 0) const;
+	void applyLUT(const ColorLUT& lut);
+	void adjustBrightness(int16_t offset);
+	void adjustContrast(float factor);
+	void adjustGamma(float gamma);
+	void adjustLevels(uint8_t inputBlack, uint8_t inputWhite, float gamma = 1.0f, uint8_t outputBlack = 0, uint8_t outputWhite = 255);
+	void invertColors();
+	void toGrayscale();
+	void swapChannels(uint8_t first, uint8_t second);
+	Histogram histogram() const;
+	std::vector<ChannelStatistics> statistics() const;
+	void equalizeHistogram();
+	void autoLevels(float clipFraction = 0.005f);
+	BMPImage copyRegion(int32_t x, int32_t y, int32_t width, int32_t height) const;
+	void crop(int32_t x, int32_t y, int32_t width, int32_t height);
+	void paste(const BMPImage& source, int32_t x, int32_t y);
+	void fillRect(int32_t x, int32_t y, int32_t width, int32_t height, uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255);
+	void composite(const BMPImage& source, int32_t x, int32_t y, Blender::Mode mode = Blender::Mode::OVER);
+	void rotate90(bool clockwise = true);
+	void blurVertical(uint32_t radius);
 	class Fractal
 	{
 	public:
@@ -132,4 +268,135 @@ public:
 
 	friend std::ostream& operator<<(std::ostream& os, const BMPImage& image);
 
-};
\ No newline at end of file
+};
+
+// Typed access to the pixels: T is RgbPixel for 24 bits images, RgbaPixel for 32 bits images and uint8_t (palette indices)
+// for 8 bits images, 1 bit images have no typed access. Rows are numbered like getPixel, from the bottom of the image.
+
+/// <summary>
+/// Pixels of a row, the content hash is computed again after a write access
+/// </summary>
+/// <param name="y">Row from the bottom</param>
+template <typename T>
+PixelSpan<T> BMPImage::row(const uint32_t y)
+{
+	const PixelSpan<const T> span = static_cast<const BMPImage*>(this)->row<T>(y);
+	_invalidateContentHash();
+	return PixelSpan<T>(const_cast<T*>(span.data()), span.size());
+}
+
+template <typename T>
+PixelSpan<const T> BMPImage::row(const uint32_t y) const
+{
+	_checkPixelType(sizeof(T));
+	if (y >= static_cast<uint32_t>(_activeHeader.height))
+	{
+		throw std::out_of_range("Row is out of bounds");
+	}
+	return PixelSpan<const T>(reinterpret_cast<const T*>(_pixelData.data()) + static_cast<size_t>(y) * _activeHeader.width, _activeHeader.width);
+}
+
+/// <summary>
+/// Every pixel, row after row from the bottom, the rows have no padding in memory
+/// </summary>
+template <typename T>
+PixelSpan<T> BMPImage::pixels()
+{
+	const PixelSpan<const T> span = static_cast<const BMPImage*>(this)->pixels<T>();
+	_invalidateContentHash();
+	return PixelSpan<T>(const_cast<T*>(span.data()), span.size());
+}
+
+template <typename T>
+PixelSpan<const T> BMPImage::pixels() const
+{
+	_checkPixelType(sizeof(T));
+	return PixelSpan<const T>(reinterpret_cast<const T*>(_pixelData.data()), static_cast<size_t>(_activeHeader.width) * _activeHeader.height);
+}
+
+/// <summary>
+/// Call a function on every pixel of a row, with the coordinates when it takes them
+/// </summary>
+template <typename T, typename Function>
+void BMPImage::_applyToRow(T* row, const uint32_t width, const uint32_t y, Function& function)
+{
+	for (uint32_t x = 0; x < width; x++)
+	{
+		if constexpr (std::is_invocable<Function&, T&, uint32_t, uint32_t>::value)
+		{
+			function(row[x], x, y);
+		}
+		else
+		{
+			function(row[x]);
+		}
+	}
+}
+
+/// <summary>
+/// Read every pixel
+/// </summary>
+/// <param name="function">Called with (const T& pixel) or (const T& pixel, x, y), from several threads when parallel</param>
+/// <param name="parallel">Split the rows between the threads of the pool</param>
+template <typename T, typename Function>
+void BMPImage::forEachPixel(Function&& function, const bool parallel) const
+{
+	_checkPixelType(sizeof(T));
+	const uint32_t width = _activeHeader.width;
+	const T* data = reinterpret_cast<const T*>(_pixelData.data());
+	const auto rows = [&](const int64_t begin, const int64_t end)
+	{
+		for (int64_t y = begin; y < end; y++)
+		{
+			_applyToRow(data + y * width, width, static_cast<uint32_t>(y), function);
+		}
+	};
+	if (parallel)
+	{
+		ThreadPool::instance().parallelFor(0, _activeHeader.height, rows);
+	}
+	else
+	{
+		rows(0, _activeHeader.height);
+	}
+}
+
+/// <summary>
+/// Replace every pixel by the result of a function
+/// </summary>
+/// <param name="function">Returns the new pixel from (const T& pixel) or (const T& pixel, x, y), from several threads when parallel</param>
+/// <param name="parallel">Split the rows between the threads of the pool</param>
+template <typename T, typename Function>
+void BMPImage::transform(Function&& function, const bool parallel)
+{
+	_checkPixelType(sizeof(T));
+	_invalidateContentHash();
+	const uint32_t width = _activeHeader.width;
+	T* data = reinterpret_cast<T*>(_pixelData.data());
+	const auto replace = [&function](T& pixel, const uint32_t x, const uint32_t y)
+	{
+		if constexpr (std::is_invocable<Function&, const T&, uint32_t, uint32_t>::value)
+		{
+			pixel = function(static_cast<const T&>(pixel), x, y);
+		}
+		else
+		{
+			pixel = function(static_cast<const T&>(pixel));
+		}
+	};
+	const auto rows = [&](const int64_t begin, const int64_t end)
+	{
+		for (int64_t y = begin; y < end; y++)
+		{
+			_applyToRow(data + y * width, width, static_cast<uint32_t>(y), replace);
+		}
+	};
+	if (parallel)
+	{
+		ThreadPool::instance().parallelFor(0, _activeHeader.height, rows);
+	}
+	else
+	{
+		rows(0, _activeHeader.height);
+	}
+}
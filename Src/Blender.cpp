@@ -0,0 +1,249 @@
+#include <algorithm>
+
+#include "Blender.h"
+#include "PixelConverter.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BLENDER_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	// a * b / 255 rounded to the nearest, exact for 8 bits operands
+	inline uint32_t multiply255(const uint32_t a, const uint32_t b)
+	{
+		const uint32_t product = a * b + 128;
+		return (product + (product >> 8)) >> 8;
+	}
+
+	// Blend of premultiplied values, the alpha channel goes through the same formula with its alpha as value
+	template <Blender::Mode mode>
+	inline uint32_t blendChannel(const uint32_t source, const uint32_t destination, const uint32_t sourceAlpha, const uint32_t destinationAlpha)
+	{
+		if constexpr (mode == Blender::Mode::OVER)
+		{
+			return source + multiply255(destination, 255 - sourceAlpha);
+		}
+		else if constexpr (mode == Blender::Mode::MULTIPLY)
+		{
+			return multiply255(source, 255 - destinationAlpha) + multiply255(destination, 255 - sourceAlpha) + multiply255(source, destination);
+		}
+		else if constexpr (mode == Blender::Mode::SCREEN)
+		{
+			return source + destination - multiply255(source, destination);
+		}
+		else
+		{
+			return source + destination;
+		}
+	}
+
+	// Back to straight alpha
+	inline void unpremultiply(uint8_t* pixel)
+	{
+		const uint32_t alpha = pixel[3];
+		if (alpha == 255)
+		{
+			return;
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			pixel[c] = alpha == 0 ? 0 : static_cast<uint8_t>(std::min<uint32_t>(255, (pixel[c] * 255 + alpha / 2) / alpha));
+		}
+	}
+
+	template <Blender::Mode mode>
+	void blendScalar(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		for (size_t i = 0; i < pixelCount; i++, source += 4, destination += 4)
+		{
+			const uint32_t sourceAlpha = source[3];
+			const uint32_t destinationAlpha = destination[3];
+			for (int c = 0; c < 3; c++)
+			{
+				const uint32_t blended = blendChannel<mode>(multiply255(source[c], sourceAlpha), multiply255(destination[c], destinationAlpha), sourceAlpha, destinationAlpha);
+				destination[c] = static_cast<uint8_t>(std::min<uint32_t>(255, blended));
+			}
+			destination[3] = static_cast<uint8_t>(std::min<uint32_t>(255, blendChannel<mode>(sourceAlpha, destinationAlpha, sourceAlpha, destinationAlpha)));
+			unpremultiply(destination);
+		}
+	}
+
+#ifdef BLENDER_X86
+	// The SIMD kernels work on pixels widened to 4 lanes of 16 bits, the lanes of one pixel mirror blendScalar
+
+	TARGET_SSSE3 inline __m128i multiply255(const __m128i a, const __m128i b)
+	{
+		const __m128i product = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+		return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+	}
+
+	template <Blender::Mode mode>
+	TARGET_SSSE3 inline __m128i blendLanes(const __m128i source, const __m128i destination)
+	{
+		// Alpha of each pixel in its 4 lanes, and the same with 255 in the alpha lane to premultiply
+		const __m128i colorLanes = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+		const __m128i alphaLanes = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+		const __m128i full = _mm_set1_epi16(255);
+		const __m128i sourceAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		const __m128i destinationAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(destination, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		const __m128i s = multiply255(source, _mm_or_si128(_mm_and_si128(sourceAlpha, colorLanes), alphaLanes));
+		const __m128i d = multiply255(destination, _mm_or_si128(_mm_and_si128(destinationAlpha, colorLanes), alphaLanes));
+		if constexpr (mode == Blender::Mode::OVER)
+		{
+			return _mm_add_epi16(s, multiply255(d, _mm_sub_epi16(full, sourceAlpha)));
+		}
+		else if constexpr (mode == Blender::Mode::MULTIPLY)
+		{
+			return _mm_add_epi16(_mm_add_epi16(multiply255(s, _mm_sub_epi16(full, destinationAlpha)), multiply255(d, _mm_sub_epi16(full, sourceAlpha))), multiply255(s, d));
+		}
+		else if constexpr (mode == Blender::Mode::SCREEN)
+		{
+			return _mm_sub_epi16(_mm_add_epi16(s, d), multiply255(s, d));
+		}
+		else
+		{
+			return _mm_add_epi16(s, d);
+		}
+	}
+
+	template <Blender::Mode mode>
+	TARGET_SSSE3 void blendSsse3(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alphaBytes = _mm_set1_epi32(static_cast<int>(0xFF000000));
+		size_t i = 0;
+		for (; i + 4 <= pixelCount; i += 4)
+		{
+			const __m128i sourcePixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+			const __m128i destinationPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(destination + i * 4));
+			const __m128i low = blendLanes<mode>(_mm_unpacklo_epi8(sourcePixels, zero), _mm_unpacklo_epi8(destinationPixels, zero));
+			const __m128i high = blendLanes<mode>(_mm_unpackhi_epi8(sourcePixels, zero), _mm_unpackhi_epi8(destinationPixels, zero));
+			const __m128i blended = _mm_packus_epi16(low, high);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), blended);
+			// Opaque results are already straight, the usual case when drawing on an opaque image
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(blended, alphaBytes), alphaBytes)) != 0xFFFF)
+			{
+				for (size_t j = 0; j < 4; j++)
+				{
+					unpremultiply(destination + (i + j) * 4);
+				}
+			}
+		}
+		blendScalar<mode>(source + i * 4, destination + i * 4, pixelCount - i);
+	}
+
+	TARGET_AVX2 inline __m256i multiply255(const __m256i a, const __m256i b)
+	{
+		const __m256i product = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+		return _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+	}
+
+	template <Blender::Mode mode>
+	TARGET_AVX2 inline __m256i blendLanes(const __m256i source, const __m256i destination)
+	{
+		const __m256i colorLanes = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0);
+		const __m256i alphaLanes = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+		const __m256i full = _mm256_set1_epi16(255);
+		const __m256i sourceAlpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(source, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		const __m256i destinationAlpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(destination, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		const __m256i s = multiply255(source, _mm256_or_si256(_mm256_and_si256(sourceAlpha, colorLanes), alphaLanes));
+		const __m256i d = multiply255(destination, _mm256_or_si256(_mm256_and_si256(destinationAlpha, colorLanes), alphaLanes));
+		if constexpr (mode == Blender::Mode::OVER)
+		{
+			return _mm256_add_epi16(s, multiply255(d, _mm256_sub_epi16(full, sourceAlpha)));
+		}
+		else if constexpr (mode == Blender::Mode::MULTIPLY)
+		{
+			return _mm256_add_epi16(_mm256_add_epi16(multiply255(s, _mm256_sub_epi16(full, destinationAlpha)), multiply255(d, _mm256_sub_epi16(full, sourceAlpha))), multiply255(s, d));
+		}
+		else if constexpr (mode == Blender::Mode::SCREEN)
+		{
+			return _mm256_sub_epi16(_mm256_add_epi16(s, d), multiply255(s, d));
+		}
+		else
+		{
+			return _mm256_add_epi16(s, d);
+		}
+	}
+
+	template <Blender::Mode mode>
+	TARGET_AVX2 void blendAvx2(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i alphaBytes = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+		size_t i = 0;
+		for (; i + 8 <= pixelCount; i += 8)
+		{
+			// Unpacking and packing stay within 128 bits lanes, so the pixel order is kept
+			const __m256i sourcePixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4));
+			const __m256i destinationPixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(destination + i * 4));
+			const __m256i low = blendLanes<mode>(_mm256_unpacklo_epi8(sourcePixels, zero), _mm256_unpacklo_epi8(destinationPixels, zero));
+			const __m256i high = blendLanes<mode>(_mm256_unpackhi_epi8(sourcePixels, zero), _mm256_unpackhi_epi8(destinationPixels, zero));
+			const __m256i blended = _mm256_packus_epi16(low, high);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), blended);
+			if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(blended, alphaBytes), alphaBytes))) != 0xFFFFFFFF)
+			{
+				for (size_t j = 0; j < 8; j++)
+				{
+					unpremultiply(destination + (i + j) * 4);
+				}
+			}
+		}
+		blendScalar<mode>(source + i * 4, destination + i * 4, pixelCount - i);
+	}
+#endif
+
+	template <Blender::Mode mode>
+	void blendRow(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+#ifdef BLENDER_X86
+		if (PixelConverter::hasAvx2())
+		{
+			blendAvx2<mode>(source, destination, pixelCount);
+			return;
+		}
+		if (PixelConverter::hasSsse3())
+		{
+			blendSsse3<mode>(source, destination, pixelCount);
+			return;
+		}
+#endif
+		blendScalar<mode>(source, destination, pixelCount);
+	}
+}
+
+/// <summary>
+/// Blend source pixels onto destination pixels. Source and destination must not overlap.
+/// </summary>
+/// <param name="source">4 bytes pixels</param>
+/// <param name="destination">4 bytes pixels, receive the result</param>
+/// <param name="pixelCount"></param>
+/// <param name="mode"></param>
+void Blender::blend(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const Mode mode)
+{
+	switch (mode)
+	{
+	case Mode::OVER:
+		blendRow<Mode::OVER>(source, destination, pixelCount);
+		break;
+	case Mode::MULTIPLY:
+		blendRow<Mode::MULTIPLY>(source, destination, pixelCount);
+		break;
+	case Mode::SCREEN:
+		blendRow<Mode::SCREEN>(source, destination, pixelCount);
+		break;
+	case Mode::ADDITIVE:
+		blendRow<Mode::ADDITIVE>(source, destination, pixelCount);
+		break;
+	}
+}
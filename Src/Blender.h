@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Blend rows of 4 bytes pixels (red first, straight alpha) onto each other.
+// Colors are premultiplied by their alpha and blended in 8 bits fixed point, with a SIMD implementation picked
+// at runtime when the CPU supports it. Scalar and SIMD code give the same result.
+class Blender
+{
+public:
+	enum class Mode
+	{
+		OVER,		// Porter-Duff source over destination
+		MULTIPLY,
+		SCREEN,
+		ADDITIVE,	// Porter-Duff plus, saturated
+	};
+
+	static void blend(const uint8_t* source, uint8_t* destination, size_t pixelCount, Mode mode);
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Queue between two threads with a maximum size: push waits while it is full and pop waits while it is empty,
+// so a fast producer cannot get ahead of its consumer by more than the capacity. Closing it wakes both sides,
+// the items already pushed can still be popped.
+template <typename T>
+class BoundedQueue
+{
+	std::deque<T> _items;
+	size_t _capacity;
+	bool _closed = false;
+	std::mutex _mutex;
+	std::condition_variable _notFull;
+	std::condition_variable _notEmpty;
+
+public:
+	explicit BoundedQueue(const size_t capacity) : _capacity(capacity > 0 ? capacity : 1)
+	{
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	/// <summary>
+	/// Add an item, waiting for room
+	/// </summary>
+	/// <returns>False when the queue was closed, the item is dropped</returns>
+	bool push(T item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notFull.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+		if (_closed)
+		{
+			return false;
+		}
+		_items.push_back(std::move(item));
+		lock.unlock();
+		_notEmpty.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// Take the oldest item, waiting for one
+	/// </summary>
+	/// <returns>False when the queue is closed and empty</returns>
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_notEmpty.wait(lock, [this] { return _closed || !_items.empty(); });
+		if (_items.empty())
+		{
+			return false;
+		}
+		item = std::move(_items.front());
+		_items.pop_front();
+		lock.unlock();
+		_notFull.notify_one();
+		return true;
+	}
+
+	/// <summary>
+	/// No more items will be pushed
+	/// </summary>
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_closed = true;
+		}
+		_notFull.notify_all();
+		_notEmpty.notify_all();
+	}
+};
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include "BufferPool.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	// Account of the scope of each thread, the parent of the images it creates
+	thread_local std::shared_ptr<BufferPool::Account> scopeAccount;
+
+	void raisePeak(std::atomic<size_t>& peak, const size_t value)
+	{
+		size_t current = peak.load(std::memory_order_relaxed);
+		while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+}
+
+/// <summary>
+/// Account charged to a parent
+/// </summary>
+/// <param name="parent">Charged too, may be null</param>
+/// <param name="limit">Bytes allocated at most at a time, 0 for no limit</param>
+BufferPool::Account::Account(std::shared_ptr<Account> parent, const size_t limit) : _limit(limit), _parent(std::move(parent))
+{
+}
+
+/// <summary>
+/// Count the bytes of a new buffer, here and in the parents
+/// </summary>
+/// <param name="bytes"></param>
+void BufferPool::Account::charge(const size_t bytes)
+{
+	const size_t current = _currentBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	const size_t limit = _limit.load(std::memory_order_relaxed);
+	if (limit != 0 && current > limit)
+	{
+		_currentBytes.fetch_sub(bytes, std::memory_order_relaxed);
+		throw std::runtime_error("Memory limit exceeded");
+	}
+	if (_parent)
+	{
+		try
+		{
+			_parent->charge(bytes);
+		}
+		catch (...)
+		{
+			_currentBytes.fetch_sub(bytes, std::memory_order_relaxed);
+			throw;
+		}
+	}
+	_totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+	raisePeak(_peakBytes, current);
+}
+
+void BufferPool::Account::release(const size_t bytes)
+{
+	_currentBytes.fetch_sub(bytes, std::memory_order_relaxed);
+	if (_parent)
+	{
+		_parent->release(bytes);
+	}
+}
+
+BufferPool::Usage BufferPool::Account::getUsage() const
+{
+	return Usage{_currentBytes.load(std::memory_order_relaxed), _peakBytes.load(std::memory_order_relaxed),
+		_totalBytes.load(std::memory_order_relaxed)};
+}
+
+/// <summary>
+/// Bytes allocated at most at a time, checked by the next allocations
+/// </summary>
+/// <param name="limit">0 for no limit</param>
+void BufferPool::Account::setLimit(const size_t limit)
+{
+	_limit.store(limit, std::memory_order_relaxed);
+}
+
+size_t BufferPool::Account::getLimit() const
+{
+	return _limit.load(std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Charge the images created by this thread to an account until the scope ends
+/// </summary>
+/// <param name="account"></param>
+BufferPool::Scope::Scope(std::shared_ptr<Account> account) : _previous(std::move(scopeAccount))
+{
+	scopeAccount = std::move(account);
+}
+
+BufferPool::Scope::~Scope()
+{
+	scopeAccount = std::move(_previous);
+}
+
+/// <summary>
+/// Give the pooled buffers back to the system
+/// </summary>
+BufferPool::~BufferPool()
+{
+	trim();
+}
+
+/// <summary>
+/// Pool shared by every image of the process
+/// </summary>
+BufferPool& BufferPool::instance()
+{
+	// Never destroyed, images may be freed by the destructors of other static objects
+	static BufferPool* pool = new BufferPool;
+	return *pool;
+}
+
+/// <summary>
+/// Account of a new image, charged to the account of the scope of the thread
+/// </summary>
+std::shared_ptr<BufferPool::Account> BufferPool::createAccount()
+{
+	return std::make_shared<Account>(scopeAccount);
+}
+
+/// <summary>
+/// Bytes really allocated for a size, four classes per power of two from MIN_POOLED_SIZE so that at most a
+/// quarter of a buffer is unused
+/// </summary>
+size_t BufferPool::_sizeClass(const size_t bytes)
+{
+	if (bytes < MIN_POOLED_SIZE)
+	{
+		return (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	}
+	size_t power = MIN_POOLED_SIZE;
+	while (power * 2 < bytes)
+	{
+		power *= 2;
+	}
+	const size_t step = power / 4;
+	return (bytes + step - 1) / step * step;
+}
+
+void* BufferPool::_allocateAligned(const size_t bytes)
+{
+	const size_t alignment = bytes >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : ALIGNMENT;
+#ifdef _WIN32
+	void* buffer = _aligned_malloc(bytes, alignment);
+#else
+	void* buffer = nullptr;
+	if (posix_memalign(&buffer, alignment, bytes) != 0)
+	{
+		buffer = nullptr;
+	}
+#endif
+	if (buffer == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (bytes >= HUGE_PAGE_SIZE)
+	{
+		madvise(buffer, bytes, MADV_HUGEPAGE);
+	}
+#endif
+	return buffer;
+}
+
+void BufferPool::_freeAligned(void* buffer)
+{
+#ifdef _WIN32
+	_aligned_free(buffer);
+#else
+	std::free(buffer);
+#endif
+}
+
+/// <summary>
+/// Buffer of at least the size asked, from the pool when one of its class is free
+/// </summary>
+/// <param name="bytes"></param>
+/// <param name="account">Charged with the size asked, may be null</param>
+/// <returns></returns>
+void* BufferPool::allocate(const size_t bytes, Account* account)
+{
+	const size_t size = _sizeClass(std::max<size_t>(bytes, 1));
+	// The accounts of the images and workers have the tighter limits
+	if (account != nullptr)
+	{
+		account->charge(bytes);
+	}
+	try
+	{
+		_process.charge(bytes);
+	}
+	catch (...)
+	{
+		if (account != nullptr)
+		{
+			account->release(bytes);
+		}
+		throw;
+	}
+	if (size >= MIN_POOLED_SIZE)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto found = _freeBuffers.find(size);
+		if (found != _freeBuffers.end() && !found->second.empty())
+		{
+			void* buffer = found->second.back();
+			found->second.pop_back();
+			_pooledBytes -= size;
+			_reuses.fetch_add(1, std::memory_order_relaxed);
+			return buffer;
+		}
+	}
+	try
+	{
+		void* buffer = _allocateAligned(size);
+		_allocations.fetch_add(1, std::memory_order_relaxed);
+		return buffer;
+	}
+	catch (...)
+	{
+		if (account != nullptr)
+		{
+			account->release(bytes);
+		}
+		_process.release(bytes);
+		throw;
+	}
+}
+
+/// <summary>
+/// Give a buffer back, it is kept for reuse while the pool is under its capacity
+/// </summary>
+/// <param name="buffer"></param>
+/// <param name="bytes">Size asked to allocate</param>
+/// <param name="account">Account given to allocate</param>
+void BufferPool::deallocate(void* buffer, const size_t bytes, Account* account)
+{
+	if (account != nullptr)
+	{
+		account->release(bytes);
+	}
+	_process.release(bytes);
+	const size_t size = _sizeClass(std::max<size_t>(bytes, 1));
+	if (size >= MIN_POOLED_SIZE)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_pooledBytes + size <= _capacity)
+		{
+			_freeBuffers[size].push_back(buffer);
+			_pooledBytes += size;
+			return;
+		}
+	}
+	_freeAligned(buffer);
+}
+
+/// <summary>
+/// Bytes of free buffers kept for reuse, the ones over it are freed
+/// </summary>
+/// <param name="capacity">0 to disable the pooling</param>
+void BufferPool::setCapacity(const size_t capacity)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_capacity = capacity;
+		if (_pooledBytes <= _capacity)
+		{
+			return;
+		}
+	}
+	trim();
+}
+
+/// <summary>
+/// Bytes of image buffers the process may allocate at a time, allocations over it throw
+/// </summary>
+/// <param name="limit">0 for no limit</param>
+void BufferPool::setLimit(const size_t limit)
+{
+	_process.setLimit(limit);
+}
+
+/// <summary>
+/// Free every pooled buffer
+/// </summary>
+void BufferPool::trim()
+{
+	std::unordered_map<size_t, std::vector<void*>> freeBuffers;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		freeBuffers.swap(_freeBuffers);
+		_pooledBytes = 0;
+	}
+	for (const auto& sizeClass : freeBuffers)
+	{
+		for (void* buffer : sizeClass.second)
+		{
+			_freeAligned(buffer);
+		}
+	}
+}
+
+BufferPool::Statistics BufferPool::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return Statistics{_process.getUsage(), _allocations.load(std::memory_order_relaxed), _reuses.load(std::memory_order_relaxed),
+		_pooledBytes, _process.getLimit()};
+}
+
+std::ostream& operator<<(std::ostream& os, const BufferPool::Statistics& statistics)
+{
+	os << "Image memory: " << statistics.usage.currentBytes / 1024 << " KiB used, " << statistics.usage.peakBytes / 1024 << " KiB peak, "
+		<< statistics.usage.totalBytes / 1024 << " KiB allocated in total, " << statistics.allocations << " allocations, "
+		<< statistics.reuses << " reuses, " << statistics.pooledBytes / 1024 << " KiB pooled";
+	if (statistics.limit != 0)
+	{
+		os << ", " << statistics.limit / 1024 << " KiB limit";
+	}
+	return os;
+}
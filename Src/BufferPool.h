@@ -0,0 +1,162 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Aligned buffers of the images, recycled between operations and images by size class.
+// Buffers are 64 bytes aligned, and 2 MiB aligned from 2 MiB so they can be backed by huge pages.
+// Every buffer is charged to the process and to the account of its image, itself charged to the account
+// of its scope (a worker for example), each with an optional limit.
+class BufferPool
+{
+public:
+	static constexpr size_t ALIGNMENT = 64;
+	static constexpr size_t HUGE_PAGE_SIZE = static_cast<size_t>(2) << 20;
+	static constexpr size_t MIN_POOLED_SIZE = static_cast<size_t>(64) << 10;	// Smaller buffers are not kept
+	static constexpr size_t DEFAULT_CAPACITY = static_cast<size_t>(256) << 20;
+
+	struct Usage {
+		size_t currentBytes;
+		size_t peakBytes;
+		uint64_t totalBytes;	// Allocated since the start, freed buffers included
+	};
+
+	struct Statistics {
+		Usage usage;
+		uint64_t allocations;	// Buffers taken from the system
+		uint64_t reuses;		// Buffers taken from the pool
+		size_t pooledBytes;
+		size_t limit;
+	};
+
+	// Bytes of the buffers of an image or of a worker, charged to the parent account too
+	class Account
+	{
+		std::atomic<size_t> _currentBytes{0};
+		std::atomic<size_t> _peakBytes{0};
+		std::atomic<uint64_t> _totalBytes{0};
+		std::atomic<size_t> _limit;
+		std::shared_ptr<Account> _parent;
+
+	public:
+		explicit Account(std::shared_ptr<Account> parent = nullptr, size_t limit = 0);
+		Account(const Account&) = delete;
+		Account& operator=(const Account&) = delete;
+
+		void charge(size_t bytes);
+		void release(size_t bytes);
+		Usage getUsage() const;
+		void setLimit(size_t limit);
+		size_t getLimit() const;
+	};
+
+	// Makes an account the parent of the images created by the thread while the scope lives
+	class Scope
+	{
+		std::shared_ptr<Account> _previous;
+
+	public:
+		explicit Scope(std::shared_ptr<Account> account);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope();
+	};
+
+private:
+	Account _process;
+	std::atomic<uint64_t> _allocations{0};
+	std::atomic<uint64_t> _reuses{0};
+	size_t _capacity = DEFAULT_CAPACITY;
+	size_t _pooledBytes = 0;
+	std::unordered_map<size_t, std::vector<void*>> _freeBuffers;	// By size class
+	mutable std::mutex _mutex;
+
+	static size_t _sizeClass(size_t bytes);
+	static void* _allocateAligned(size_t bytes);
+	static void _freeAligned(void* buffer);
+
+public:
+	BufferPool() = default;
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+	~BufferPool();
+
+	static BufferPool& instance();
+	static std::shared_ptr<Account> createAccount();
+
+	void* allocate(size_t bytes, Account* account);
+	void deallocate(void* buffer, size_t bytes, Account* account);
+	void setCapacity(size_t capacity);
+	void setLimit(size_t limit);
+	void trim();
+	Statistics getStatistics() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const BufferPool::Statistics& statistics);
+
+// Allocator of the containers of pixels, taking its buffers from the pool and charging them to an account.
+// The account follows the buffer when the container is moved or swapped, a copied container gets a new one.
+template <typename T>
+class PixelAllocator
+{
+	std::shared_ptr<BufferPool::Account> _account;
+
+	template <typename U>
+	friend class PixelAllocator;
+
+public:
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+	using is_always_equal = std::false_type;
+
+	PixelAllocator() = default;
+
+	explicit PixelAllocator(std::shared_ptr<BufferPool::Account> account) : _account(std::move(account))
+	{
+	}
+
+	template <typename U>
+	PixelAllocator(const PixelAllocator<U>& other) : _account(other._account)
+	{
+	}
+
+	T* allocate(const size_t count)
+	{
+		return static_cast<T*>(BufferPool::instance().allocate(count * sizeof(T), _account.get()));
+	}
+
+	void deallocate(T* buffer, const size_t count)
+	{
+		BufferPool::instance().deallocate(buffer, count * sizeof(T), _account.get());
+	}
+
+	PixelAllocator select_on_container_copy_construction() const
+	{
+		return PixelAllocator(BufferPool::createAccount());
+	}
+
+	const std::shared_ptr<BufferPool::Account>& getAccount() const
+	{
+		return _account;
+	}
+
+	template <typename U>
+	bool operator==(const PixelAllocator<U>& other) const
+	{
+		return _account == other._account;
+	}
+
+	template <typename U>
+	bool operator!=(const PixelAllocator<U>& other) const
+	{
+		return _account != other._account;
+	}
+};
+
+using PixelBuffer = std::vector<uint8_t, PixelAllocator<uint8_t>>;
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "ColorLUT.h"
+#include "PixelConverter.h"
+
+namespace
+{
+	uint8_t clampToByte(const float value)
+	{
+		return static_cast<uint8_t>(std::min(std::max(std::lround(value), 0L), 255L));
+	}
+
+	// Convert a single channel mask to its index in the pixel
+	uint8_t channelIndex(const uint8_t channel)
+	{
+		if (channel == ColorLUT::RED_CHANNEL) return 0;
+		if (channel == ColorLUT::GREEN_CHANNEL) return 1;
+		if (channel == ColorLUT::BLUE_CHANNEL) return 2;
+		throw std::invalid_argument("Channel must be a single channel mask");
+	}
+}
+
+/// <summary>
+/// Identity lookup table
+/// </summary>
+ColorLUT::ColorLUT() : _source{0, 1, 2}, _grayscale(false), _lumaWeights(), _identity(true)
+{
+	for (Table& table : _preTables)
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			table[i] = static_cast<uint8_t>(i);
+		}
+	}
+	_postTables = _preTables;
+}
+
+/// <summary>
+/// Compose an arbitrary table with the current chain
+/// </summary>
+/// <param name="table">New value for each input value</param>
+/// <param name="channels">Channel mask the table is applied to</param>
+ColorLUT& ColorLUT::map(const Table& table, const uint8_t channels)
+{
+	std::array<Table, 3>& tables = _grayscale ? _postTables : _preTables;
+	for (uint8_t c = 0; c < 3; c++)
+	{
+		if (channels & (1 << c))
+		{
+			for (uint8_t& value : tables[c])
+			{
+				value = table[value];
+			}
+		}
+	}
+	_identity = false;
+	return *this;
+}
+
+/// <summary>
+/// Add an offset to the channels
+/// </summary>
+/// <param name="offset">Value added, from -255 to 255</param>
+/// <param name="channels"></param>
+ColorLUT& ColorLUT::brightness(const int16_t offset, const uint8_t channels)
+{
+	Table table;
+	for (int i = 0; i < 256; i++)
+	{
+		table[i] = clampToByte(static_cast<float>(i + offset));
+	}
+	return map(table, channels);
+}
+
+/// <summary>
+/// Scale the distance of the channels to the middle gray
+/// </summary>
+/// <param name="factor">1 keeps the image unchanged, 0 gives a flat gray</param>
+/// <param name="channels"></param>
+ColorLUT& ColorLUT::contrast(const float factor, const uint8_t channels)
+{
+	if (factor < 0)
+	{
+		throw std::invalid_argument("Contrast factor can not be negative");
+	}
+	Table table;
+	for (int i = 0; i < 256; i++)
+	{
+		table[i] = clampToByte((i - 127.5f) * factor + 127.5f);
+	}
+	return map(table, channels);
+}
+
+/// <summary>
+/// Gamma correction : out = 255 * (in / 255) ^ (1 / gamma)
+/// </summary>
+/// <param name="gamma">Values above 1 brighten the image</param>
+/// <param name="channels"></param>
+ColorLUT& ColorLUT::gamma(const float gamma, const uint8_t channels)
+{
+	if (gamma <= 0)
+	{
+		throw std::invalid_argument("Gamma must be greater than 0");
+	}
+	Table table;
+	for (int i = 0; i < 256; i++)
+	{
+		table[i] = clampToByte(255.0f * std::pow(i / 255.0f, 1.0f / gamma));
+	}
+	return map(table, channels);
+}
+
+/// <summary>
+/// Remap [inputBlack, inputWhite] to [outputBlack, outputWhite] with a midtones gamma
+/// </summary>
+/// <param name="inputBlack">Values below are clipped to outputBlack</param>
+/// <param name="inputWhite">Values above are clipped to outputWhite</param>
+/// <param name="gamma">Midtones correction, 1 for linear</param>
+/// <param name="outputBlack"></param>
+/// <param name="outputWhite"></param>
+/// <param name="channels"></param>
+ColorLUT& ColorLUT::levels(const uint8_t inputBlack, const uint8_t inputWhite, const float gamma,
+	const uint8_t outputBlack, const uint8_t outputWhite, const uint8_t channels)
+{
+	if (inputWhite <= inputBlack)
+	{
+		throw std::invalid_argument("Input white must be greater than input black");
+	}
+	if (gamma <= 0)
+	{
+		throw std::invalid_argument("Gamma must be greater than 0");
+	}
+	Table table;
+	const float inputRange = static_cast<float>(inputWhite - inputBlack);
+	const float outputRange = static_cast<float>(outputWhite - outputBlack);
+	for (int i = 0; i < 256; i++)
+	{
+		const float normalized = std::min(std::max((i - inputBlack) / inputRange, 0.0f), 1.0f);
+		table[i] = clampToByte(outputBlack + outputRange * std::pow(normalized, 1.0f / gamma));
+	}
+	return map(table, channels);
+}
+
+/// <summary>
+/// Negative of the channels
+/// </summary>
+/// <param name="channels"></param>
+ColorLUT& ColorLUT::invert(const uint8_t channels)
+{
+	Table table;
+	for (int i = 0; i < 256; i++)
+	{
+		table[i] = static_cast<uint8_t>(255 - i);
+	}
+	return map(table, channels);
+}
+
+/// <summary>
+/// Replace the color channels by the luma of the pixel
+/// </summary>
+ColorLUT& ColorLUT::grayscale()
+{
+	if (!_grayscale)
+	{
+		// Fold the previous tables in the weights : luma = (W0[in[s0]] + W1[in[s1]] + W2[in[s2]]) >> LUMA_SHIFT
+		const uint32_t weights[3] = {PixelConverter::LUMA_RED_WEIGHT, PixelConverter::LUMA_GREEN_WEIGHT, PixelConverter::LUMA_BLUE_WEIGHT};
+		for (uint8_t c = 0; c < 3; c++)
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				_lumaWeights[c][i] = weights[c] * _preTables[c][i] + (c == 0 ? 1u << (PixelConverter::LUMA_SHIFT - 1) : 0);
+			}
+		}
+		_grayscale = true;
+	}
+	else
+	{
+		// Already gray before the post tables : fold the new conversion in them
+		std::array<Table, 3> tables = _postTables;
+		for (int i = 0; i < 256; i++)
+		{
+			const uint8_t value = PixelConverter::luma(tables[0][i], tables[1][i], tables[2][i]);
+			_postTables[0][i] = value;
+			_postTables[1][i] = value;
+			_postTables[2][i] = value;
+		}
+	}
+	_identity = false;
+	return *this;
+}
+
+/// <summary>
+/// Exchange two color channels
+/// </summary>
+/// <param name="first">Single channel mask</param>
+/// <param name="second">Single channel mask</param>
+ColorLUT& ColorLUT::swapChannels(const uint8_t first, const uint8_t second)
+{
+	const uint8_t a = channelIndex(first);
+	const uint8_t b = channelIndex(second);
+	if (a == b)
+	{
+		return *this;
+	}
+	if (_grayscale)
+	{
+		std::swap(_postTables[a], _postTables[b]);
+	}
+	else
+	{
+		std::swap(_preTables[a], _preTables[b]);
+		std::swap(_source[a], _source[b]);
+	}
+	_identity = false;
+	return *this;
+}
+
+bool ColorLUT::isIdentity() const
+{
+	return _identity;
+}
+
+/// <summary>
+/// Chain that gives back the values this one was applied to, when no two values of a channel are mapped to the same one
+/// </summary>
+/// <param name="result">Set when it returns true</param>
+/// <returns>False for the chains that lose values, like a clipped brightness or a grayscale conversion</returns>
+bool ColorLUT::inverse(ColorLUT& result) const
+{
+	if (_grayscale)
+	{
+		return false;
+	}
+	// out[c] = table[c][in[source[c]]], so in[source[c]] = inverse of table[c] applied to out[c]
+	ColorLUT inverted;
+	for (uint8_t c = 0; c < 3; c++)
+	{
+		Table& table = inverted._preTables[_source[c]];
+		std::array<bool, 256> mapped{};
+		for (int i = 0; i < 256; i++)
+		{
+			const uint8_t value = _preTables[c][i];
+			if (mapped[value])
+			{
+				return false;
+			}
+			mapped[value] = true;
+			table[value] = static_cast<uint8_t>(i);
+		}
+		inverted._source[_source[c]] = c;
+	}
+	inverted._identity = _identity;
+	result = inverted;
+	return true;
+}
+
+/// <summary>
+/// Apply the chain on contiguous pixels in place. The alpha channel is left untouched.
+/// </summary>
+/// <param name="data">First pixel, red first</param>
+/// <param name="pixelCount"></param>
+/// <param name="byteCount">Size of a pixel (3 or 4)</param>
+void ColorLUT::apply(uint8_t* data, const size_t pixelCount, const uint16_t byteCount) const
+{
+	if (byteCount < 3)
+	{
+		throw std::invalid_argument("Lookup tables need at least 3 bytes per pixel");
+	}
+	if (_identity)
+	{
+		return;
+	}
+	if (_grayscale)
+	{
+		_applyGrayscale(data, pixelCount, byteCount);
+	}
+	else
+	{
+		_applyColor(data, pixelCount, byteCount);
+	}
+}
+
+void ColorLUT::_applyColor(uint8_t* data, const size_t pixelCount, const uint16_t byteCount) const
+{
+	const uint8_t* red = _preTables[0].data();
+	const uint8_t* green = _preTables[1].data();
+	const uint8_t* blue = _preTables[2].data();
+	const uint8_t s0 = _source[0];
+	const uint8_t s1 = _source[1];
+	const uint8_t s2 = _source[2];
+	uint8_t* const end = data + pixelCount * byteCount;
+	if (s0 == 0 && s1 == 1 && s2 == 2)
+	{
+		for (uint8_t* pixel = data; pixel != end; pixel += byteCount)
+		{
+			pixel[0] = red[pixel[0]];
+			pixel[1] = green[pixel[1]];
+			pixel[2] = blue[pixel[2]];
+		}
+		return;
+	}
+	for (uint8_t* pixel = data; pixel != end; pixel += byteCount)
+	{
+		const uint8_t in[3] = {pixel[0], pixel[1], pixel[2]};
+		pixel[0] = red[in[s0]];
+		pixel[1] = green[in[s1]];
+		pixel[2] = blue[in[s2]];
+	}
+}
+
+void ColorLUT::_applyGrayscale(uint8_t* data, const size_t pixelCount, const uint16_t byteCount) const
+{
+	const uint32_t* redWeights = _lumaWeights[0].data();
+	const uint32_t* greenWeights = _lumaWeights[1].data();
+	const uint32_t* blueWeights = _lumaWeights[2].data();
+	const uint8_t* red = _postTables[0].data();
+	const uint8_t* green = _postTables[1].data();
+	const uint8_t* blue = _postTables[2].data();
+	const uint8_t s0 = _source[0];
+	const uint8_t s1 = _source[1];
+	const uint8_t s2 = _source[2];
+	uint8_t* const end = data + pixelCount * byteCount;
+	for (uint8_t* pixel = data; pixel != end; pixel += byteCount)
+	{
+		const uint8_t value = static_cast<uint8_t>(
+			(redWeights[pixel[s0]] + greenWeights[pixel[s1]] + blueWeights[pixel[s2]]) >> PixelConverter::LUMA_SHIFT);
+		pixel[0] = red[value];
+		pixel[1] = green[value];
+		pixel[2] = blue[value];
+	}
+}
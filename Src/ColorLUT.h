@@ -0,0 +1,50 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Chain of point operations (brightness, contrast, levels, ...) folded into 256 entries lookup tables.
+// Every call composes the new operation with the previous ones, so applying the whole chain
+// costs a single pass over the pixels whatever the number of operations.
+class ColorLUT
+{
+public:
+	using Table = std::array<uint8_t, 256>;
+
+	// Channel masks (pixels are stored red, green, blue, alpha)
+	static constexpr uint8_t RED_CHANNEL = 1;
+	static constexpr uint8_t GREEN_CHANNEL = 2;
+	static constexpr uint8_t BLUE_CHANNEL = 4;
+	static constexpr uint8_t RGB_CHANNELS = RED_CHANNEL | GREEN_CHANNEL | BLUE_CHANNEL;
+
+private:
+	// Before the grayscale conversion : out[c] = _preTables[c][in[_source[c]]]
+	std::array<Table, 3> _preTables;
+	std::array<uint8_t, 3> _source;
+	// After the grayscale conversion : out[c] = _postTables[c][luma]
+	bool _grayscale;
+	std::array<Table, 3> _postTables;
+	std::array<std::array<uint32_t, 256>, 3> _lumaWeights;
+
+	bool _identity;
+
+	void _applyColor(uint8_t* data, size_t pixelCount, uint16_t byteCount) const;
+	void _applyGrayscale(uint8_t* data, size_t pixelCount, uint16_t byteCount) const;
+
+public:
+	ColorLUT();
+
+	ColorLUT& map(const Table& table, uint8_t channels = RGB_CHANNELS);
+	ColorLUT& brightness(int16_t offset, uint8_t channels = RGB_CHANNELS);
+	ColorLUT& contrast(float factor, uint8_t channels = RGB_CHANNELS);
+	ColorLUT& gamma(float gamma, uint8_t channels = RGB_CHANNELS);
+	ColorLUT& levels(uint8_t inputBlack, uint8_t inputWhite, float gamma = 1.0f, uint8_t outputBlack = 0,
+		uint8_t outputWhite = 255, uint8_t channels = RGB_CHANNELS);
+	ColorLUT& invert(uint8_t channels = RGB_CHANNELS);
+	ColorLUT& grayscale();
+	ColorLUT& swapChannels(uint8_t first, uint8_t second);
+
+	bool isIdentity() const;
+	bool inverse(ColorLUT& result) const;
+	void apply(uint8_t* data, size_t pixelCount, uint16_t byteCount) const;
+};
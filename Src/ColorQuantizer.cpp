@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "ColorQuantizer.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	constexpr int BIN_COUNT = ColorQuantizer::GRID_SIZE * ColorQuantizer::GRID_SIZE * ColorQuantizer::GRID_SIZE;
+
+	// Local counters are flushed before a bin sum can overflow 32 bits
+	constexpr size_t FLUSH_PIXEL_COUNT = 1 << 24;
+
+	struct ColorHistogram
+	{
+		std::vector<uint64_t> counts = std::vector<uint64_t>(BIN_COUNT, 0);
+		std::vector<uint64_t> sums = std::vector<uint64_t>(BIN_COUNT * 3, 0);
+	};
+
+	// Box of bins, bounds included
+	struct Box
+	{
+		int low[3];
+		int high[3];
+		uint64_t count;
+	};
+
+	int binIndex(const int r, const int g, const int b)
+	{
+		return (r << (2 * ColorQuantizer::GRID_BITS)) | (g << ColorQuantizer::GRID_BITS) | b;
+	}
+
+	uint64_t countBox(const ColorHistogram& hist, const Box& box)
+	{
+		uint64_t count = 0;
+		for (int r = box.low[0]; r <= box.high[0]; r++)
+			for (int g = box.low[1]; g <= box.high[1]; g++)
+				for (int b = box.low[2]; b <= box.high[2]; b++)
+					count += hist.counts[binIndex(r, g, b)];
+		return count;
+	}
+
+	// Reduce a box to the bounds of its non empty bins
+	void shrinkBox(const ColorHistogram& hist, Box& box)
+	{
+		int low[3] = {ColorQuantizer::GRID_SIZE, ColorQuantizer::GRID_SIZE, ColorQuantizer::GRID_SIZE};
+		int high[3] = {-1, -1, -1};
+		for (int r = box.low[0]; r <= box.high[0]; r++)
+			for (int g = box.low[1]; g <= box.high[1]; g++)
+				for (int b = box.low[2]; b <= box.high[2]; b++)
+				{
+					if (hist.counts[binIndex(r, g, b)] == 0) continue;
+					const int bin[3] = {r, g, b};
+					for (int c = 0; c < 3; c++)
+					{
+						low[c] = std::min(low[c], bin[c]);
+						high[c] = std::max(high[c], bin[c]);
+					}
+				}
+		std::copy(low, low + 3, box.low);
+		std::copy(high, high + 3, box.high);
+	}
+
+	int longestAxis(const Box& box)
+	{
+		int axis = 0;
+		for (int c = 1; c < 3; c++)
+		{
+			if (box.high[c] - box.low[c] > box.high[axis] - box.low[axis]) axis = c;
+		}
+		return axis;
+	}
+
+	// 8x8 Bayer matrix
+	constexpr uint8_t BAYER_MATRIX[8][8] = {
+		{0, 32, 8, 40, 2, 34, 10, 42},
+		{48, 16, 56, 24, 50, 18, 58, 26},
+		{12, 44, 4, 36, 14, 46, 6, 38},
+		{60, 28, 52, 20, 62, 30, 54, 22},
+		{3, 35, 11, 43, 1, 33, 9, 41},
+		{51, 19, 59, 27, 49, 17, 57, 25},
+		{15, 47, 7, 39, 13, 45, 5, 37},
+		{63, 31, 55, 23, 61, 29, 53, 21},
+	};
+
+	uint8_t clampToByte(const int value)
+	{
+		return static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+	}
+
+	uint32_t colorKey(const uint8_t r, const uint8_t g, const uint8_t b)
+	{
+		return (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | b;
+	}
+}
+
+/// <summary>
+/// Prepare the mapping to a palette
+/// </summary>
+/// <param name="palette">1 to 256 colors</param>
+ColorQuantizer::ColorQuantizer(const std::vector<Color>& palette) : _palette(palette)
+{
+	if (_palette.empty() || _palette.size() > 256)
+	{
+		throw std::invalid_argument("Palette must have between 1 and 256 colors");
+	}
+	_buildGrid();
+}
+
+size_t ColorQuantizer::_gridIndex(const uint8_t r, const uint8_t g, const uint8_t b) const
+{
+	constexpr int shift = 8 - GRID_BITS;
+	return binIndex(r >> shift, g >> shift, b >> shift);
+}
+
+/// <summary>
+/// Closest palette entry of the center of every grid cell
+/// </summary>
+void ColorQuantizer::_buildGrid()
+{
+	_grid.assign(BIN_COUNT, 0);
+	constexpr int cellSize = 256 / GRID_SIZE;
+	ThreadPool::instance().parallelFor(0, GRID_SIZE, [this](const int64_t begin, const int64_t end)
+	{
+		for (int64_t r = begin; r < end; r++)
+		{
+			for (int g = 0; g < GRID_SIZE; g++)
+			{
+				for (int b = 0; b < GRID_SIZE; b++)
+				{
+					const int center[3] = {static_cast<int>(r) * cellSize + cellSize / 2, g * cellSize + cellSize / 2, b * cellSize + cellSize / 2};
+					int bestDistance = INT32_MAX;
+					uint8_t best = 0;
+					for (size_t i = 0; i < _palette.size(); i++)
+					{
+						const int dr = _palette[i][0] - center[0];
+						const int dg = _palette[i][1] - center[1];
+						const int db = _palette[i][2] - center[2];
+						const int distance = dr * dr + dg * dg + db * db;
+						if (distance < bestDistance)
+						{
+							bestDistance = distance;
+							best = static_cast<uint8_t>(i);
+						}
+					}
+					_grid[binIndex(static_cast<int>(r), g, b)] = best;
+				}
+			}
+		}
+	});
+
+	_exactColors.clear();
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		_exactColors.emplace_back(colorKey(_palette[i][0], _palette[i][1], _palette[i][2]), static_cast<uint8_t>(i));
+	}
+	// Stable, so a color listed twice maps to its first entry
+	std::stable_sort(_exactColors.begin(), _exactColors.end(),
+		[](const std::pair<uint32_t, uint8_t>& a, const std::pair<uint32_t, uint8_t>& b) { return a.first < b.first; });
+	_exactCells.assign(BIN_COUNT, 0);
+	for (size_t i = 0; i < _palette.size(); i++)
+	{
+		const size_t cell = _gridIndex(_palette[i][0], _palette[i][1], _palette[i][2]);
+		if (_grid[cell] != i)
+		{
+			_exactCells[cell] = 1;
+		}
+	}
+}
+
+/// <summary>
+/// Palette index for a color, its own entry for a palette color and the one of its grid cell otherwise
+/// </summary>
+uint8_t ColorQuantizer::_mapColor(const uint8_t r, const uint8_t g, const uint8_t b) const
+{
+	const size_t cell = _gridIndex(r, g, b);
+	if (_exactCells[cell] == 0)
+	{
+		return _grid[cell];
+	}
+	const uint32_t key = colorKey(r, g, b);
+	const auto found = std::lower_bound(_exactColors.begin(), _exactColors.end(), key,
+		[](const std::pair<uint32_t, uint8_t>& color, const uint32_t value) { return color.first < value; });
+	return found != _exactColors.end() && found->first == key ? found->second : _grid[cell];
+}
+
+/// <summary>
+/// Build a palette with the median cut algorithm
+/// </summary>
+/// <param name="pixels">Contiguous pixels, red first</param>
+/// <param name="pixelCount"></param>
+/// <param name="byteCount">3 or 4</param>
+/// <param name="colorCount">Maximum number of colors, 1 to 256</param>
+/// <returns>Mean color of each box</returns>
+std::vector<ColorQuantizer::Color> ColorQuantizer::medianCut(const uint8_t* pixels, const size_t pixelCount, const uint16_t byteCount, const uint16_t colorCount)
+{
+	if (colorCount == 0 || colorCount > 256)
+	{
+		throw std::invalid_argument("Color count must be between 1 and 256");
+	}
+	if (pixelCount == 0)
+	{
+		return {Color{0, 0, 0, 0}};
+	}
+
+	// Histogram of 5 bits per channel, privatized per thread
+	ColorHistogram hist;
+	std::mutex mergeMutex;
+	constexpr int shift = 8 - GRID_BITS;
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(pixelCount), [&](const int64_t begin, const int64_t end)
+	{
+		std::vector<uint32_t> counts(BIN_COUNT);
+		std::vector<uint32_t> sums(BIN_COUNT * 3);
+		for (int64_t blockBegin = begin; blockBegin < end; blockBegin += FLUSH_PIXEL_COUNT)
+		{
+			std::fill(counts.begin(), counts.end(), 0);
+			std::fill(sums.begin(), sums.end(), 0);
+			const int64_t blockEnd = std::min<int64_t>(end, blockBegin + FLUSH_PIXEL_COUNT);
+			for (const uint8_t* pixel = pixels + blockBegin * byteCount; pixel != pixels + blockEnd * byteCount; pixel += byteCount)
+			{
+				const int bin = binIndex(pixel[0] >> shift, pixel[1] >> shift, pixel[2] >> shift);
+				counts[bin]++;
+				sums[bin * 3] += pixel[0];
+				sums[bin * 3 + 1] += pixel[1];
+				sums[bin * 3 + 2] += pixel[2];
+			}
+			std::lock_guard<std::mutex> lock(mergeMutex);
+			for (int bin = 0; bin < BIN_COUNT; bin++)
+			{
+				if (counts[bin] == 0) continue;
+				hist.counts[bin] += counts[bin];
+				hist.sums[bin * 3] += sums[bin * 3];
+				hist.sums[bin * 3 + 1] += sums[bin * 3 + 1];
+				hist.sums[bin * 3 + 2] += sums[bin * 3 + 2];
+			}
+		}
+	}, 1 << 16);
+
+	Box first{{0, 0, 0}, {GRID_SIZE - 1, GRID_SIZE - 1, GRID_SIZE - 1}, pixelCount};
+	shrinkBox(hist, first);
+	std::vector<Box> boxes = {first};
+
+	while (boxes.size() < colorCount)
+	{
+		// Split the most populated box weighted by its extent
+		int selected = -1;
+		uint64_t bestScore = 0;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			const Box& box = boxes[i];
+			const int axis = longestAxis(box);
+			const uint64_t score = box.count * static_cast<uint64_t>(box.high[axis] - box.low[axis]);
+			if (score > bestScore)
+			{
+				bestScore = score;
+				selected = static_cast<int>(i);
+			}
+		}
+		if (selected < 0)
+		{
+			break; // every box is a single bin
+		}
+
+		Box& box = boxes[selected];
+		const int axis = longestAxis(box);
+		// Count along the axis and cut at the median
+		std::vector<uint64_t> slices(GRID_SIZE, 0);
+		for (int r = box.low[0]; r <= box.high[0]; r++)
+			for (int g = box.low[1]; g <= box.high[1]; g++)
+				for (int b = box.low[2]; b <= box.high[2]; b++)
+				{
+					const int bin[3] = {r, g, b};
+					slices[bin[axis]] += hist.counts[binIndex(r, g, b)];
+				}
+		int cut = box.low[axis];
+		uint64_t below = slices[cut];
+		while (cut + 1 < box.high[axis] && below * 2 < box.count)
+		{
+			below += slices[++cut];
+		}
+
+		Box upper = box;
+		box.high[axis] = cut;
+		upper.low[axis] = cut + 1;
+		box.count = countBox(hist, box);
+		upper.count = box.count <= upper.count ? upper.count - box.count : countBox(hist, upper);
+		shrinkBox(hist, box);
+		shrinkBox(hist, upper);
+		boxes.push_back(upper);
+	}
+
+	std::vector<Color> palette;
+	palette.reserve(boxes.size());
+	for (const Box& box : boxes)
+	{
+		uint64_t sums[3] = {0, 0, 0};
+		for (int r = box.low[0]; r <= box.high[0]; r++)
+			for (int g = box.low[1]; g <= box.high[1]; g++)
+				for (int b = box.low[2]; b <= box.high[2]; b++)
+				{
+					const int bin = binIndex(r, g, b);
+					sums[0] += hist.sums[bin * 3];
+					sums[1] += hist.sums[bin * 3 + 1];
+					sums[2] += hist.sums[bin * 3 + 2];
+				}
+		const uint64_t count = std::max<uint64_t>(box.count, 1);
+		palette.push_back({static_cast<uint8_t>((sums[0] + count / 2) / count), static_cast<uint8_t>((sums[1] + count / 2) / count),
+			static_cast<uint8_t>((sums[2] + count / 2) / count), 0});
+	}
+	return palette;
+}
+
+/// <summary>
+/// Collect the colors of an image that already has few of them
+/// </summary>
+/// <param name="pixels">Contiguous pixels, red first</param>
+/// <param name="pixelCount"></param>
+/// <param name="byteCount">3 or 4</param>
+/// <param name="colorCount">Maximum number of colors</param>
+/// <param name="palette">Every color of the image when it returns true</param>
+/// <returns>False as soon as there are more colors than colorCount</returns>
+bool ColorQuantizer::exactPalette(const uint8_t* pixels, const size_t pixelCount, const uint16_t byteCount, const uint16_t colorCount, std::vector<Color>& palette)
+{
+	std::unordered_map<uint32_t, uint8_t> colors;
+	palette.clear();
+	uint32_t lastKey = UINT32_MAX;
+	for (const uint8_t* pixel = pixels; pixel != pixels + pixelCount * byteCount; pixel += byteCount)
+	{
+		const uint32_t key = colorKey(pixel[0], pixel[1], pixel[2]);
+		if (key == lastKey || colors.count(key) != 0)
+		{
+			lastKey = key;
+			continue;
+		}
+		if (colors.size() == colorCount)
+		{
+			palette.clear();
+			return false;
+		}
+		colors.emplace(key, static_cast<uint8_t>(palette.size()));
+		palette.push_back({pixel[0], pixel[1], pixel[2], 0});
+		lastKey = key;
+	}
+	return !palette.empty();
+}
+
+const std::vector<ColorQuantizer::Color>& ColorQuantizer::getPalette() const
+{
+	return _palette;
+}
+
+/// <summary>
+/// Palette index for a color, read from the grid
+/// </summary>
+uint8_t ColorQuantizer::nearest(const uint8_t r, const uint8_t g, const uint8_t b) const
+{
+	return _grid[_gridIndex(r, g, b)];
+}
+
+/// <summary>
+/// Map rows of pixels to palette indices.
+/// Floyd-Steinberg rows run in parallel as a wavefront : a row only needs the previous one
+/// to be two pixels ahead, so each thread follows the one working on the row before.
+/// </summary>
+/// <param name="source">Contiguous rows, red first</param>
+/// <param name="destination">One index per pixel</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="byteCount">3 or 4</param>
+/// <param name="dithering"></param>
+void ColorQuantizer::mapRows(const uint8_t* source, uint8_t* destination, const int64_t width, const int64_t height,
+	const uint16_t byteCount, const Dithering dithering) const
+{
+	const size_t rowSize = static_cast<size_t>(width) * byteCount;
+
+	if (dithering == Dithering::NONE)
+	{
+		ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+		{
+			for (int64_t y = begin; y < end; y++)
+			{
+				const uint8_t* pixel = source + y * rowSize;
+				uint8_t* indices = destination + y * width;
+				uint32_t lastKey = UINT32_MAX;
+				uint8_t lastIndex = 0;
+				for (int64_t x = 0; x < width; x++, pixel += byteCount)
+				{
+					// Flat areas repeat the same color
+					const uint32_t key = colorKey(pixel[0], pixel[1], pixel[2]);
+					if (key != lastKey)
+					{
+						lastKey = key;
+						lastIndex = _mapColor(pixel[0], pixel[1], pixel[2]);
+					}
+					indices[x] = lastIndex;
+				}
+			}
+		});
+		return;
+	}
+
+	if (dithering == Dithering::ORDERED)
+	{
+		// Threshold amplitude close to the distance between palette levels
+		const int spread = static_cast<int>(256 / std::cbrt(static_cast<double>(_palette.size())));
+		int offsets[8][8];
+		for (int i = 0; i < 8; i++)
+			for (int j = 0; j < 8; j++)
+				offsets[i][j] = (BAYER_MATRIX[i][j] * 2 + 1) * spread / 128 - spread / 2;
+		ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+		{
+			for (int64_t y = begin; y < end; y++)
+			{
+				const uint8_t* pixel = source + y * rowSize;
+				uint8_t* indices = destination + y * width;
+				const int* rowOffsets = offsets[y % 8];
+				for (int64_t x = 0; x < width; x++, pixel += byteCount)
+				{
+					const int offset = rowOffsets[x % 8];
+					indices[x] = nearest(clampToByte(pixel[0] + offset), clampToByte(pixel[1] + offset), clampToByte(pixel[2] + offset));
+				}
+			}
+		});
+		return;
+	}
+
+	// Floyd-Steinberg, errors are kept in 1/16 units.
+	// Row y reads the errors of row y - 1 from a ring of buffers, index x + 1 holds the error for column x.
+	const unsigned threadCount = ThreadPool::instance().getThreadCount();
+	const size_t ringSize = threadCount + 2;
+	std::vector<std::vector<int32_t>> errorRing(ringSize, std::vector<int32_t>((width + 2) * 3, 0));
+	std::vector<int32_t> noError((width + 2) * 3, 0);
+	std::unique_ptr<std::atomic<int64_t>[]> progress(new std::atomic<int64_t>[static_cast<size_t>(height)]);
+	for (int64_t y = 0; y < height; y++)
+	{
+		progress[y].store(0, std::memory_order_relaxed);
+	}
+	std::atomic<int64_t> nextRow(0);
+
+	ThreadPool::instance().parallelFor(0, threadCount, [&](int64_t, int64_t)
+	{
+		// Rows are claimed in order, so the row before is always being worked on
+		for (int64_t y = nextRow.fetch_add(1); y < height; y = nextRow.fetch_add(1))
+		{
+			const uint8_t* pixel = source + y * rowSize;
+			uint8_t* indices = destination + y * width;
+			const int32_t* above = y == 0 ? noError.data() : errorRing[(y - 1) % ringSize].data();
+			int32_t* below = errorRing[y % ringSize].data();
+			below[0] = below[1] = below[2] = 0;
+			below[3] = below[4] = below[5] = 0;
+			int32_t right[3] = {0, 0, 0};
+			int64_t aboveDone = y == 0 ? width : 0;
+			for (int64_t x = 0; x < width; x++, pixel += byteCount)
+			{
+				// Wait for the row before to be done with the errors of x - 1 to x + 1
+				const int64_t needed = std::min(x + 2, width);
+				while (aboveDone < needed)
+				{
+					aboveDone = progress[y - 1].load(std::memory_order_acquire);
+					if (aboveDone < needed) std::this_thread::yield();
+				}
+				int32_t error[3];
+				uint8_t value[3];
+				for (int c = 0; c < 3; c++)
+				{
+					const int32_t wanted = pixel[c] * 16 + above[(x + 1) * 3 + c] + right[c];
+					// Saturated areas do not accumulate error
+					error[c] = std::min(std::max(wanted, 0), 255 * 16);
+					value[c] = static_cast<uint8_t>((error[c] + 8) >> 4 > 255 ? 255 : (error[c] + 8) >> 4);
+				}
+				const uint8_t index = _mapColor(value[0], value[1], value[2]);
+				indices[x] = index;
+				for (int c = 0; c < 3; c++)
+				{
+					const int32_t e = error[c] - _palette[index][c] * 16;
+					right[c] = e * 7 / 16;
+					below[x * 3 + c] += e * 3 / 16;
+					below[(x + 1) * 3 + c] += e * 5 / 16;
+					below[(x + 2) * 3 + c] = e / 16;
+				}
+				progress[y].store(x + 1, std::memory_order_release);
+			}
+		}
+	});
+}
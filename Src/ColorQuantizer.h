@@ -0,0 +1,48 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Reduce 24/32 bits pixels to a palette of at most 256 colors.
+// The palette comes from a median cut over a 5 bits per channel histogram, and colors are mapped
+// through a precomputed 32x32x32 grid holding the closest palette entry of each cell. Palette colors keep their own
+// entry: the few cells holding a palette color of another entry are flagged, and only their pixels search the
+// sorted palette colors.
+class ColorQuantizer
+{
+public:
+	using Color = std::array<uint8_t, 4>;	// red, green, blue, reserved
+
+	enum class Dithering
+	{
+		NONE,
+		ORDERED,
+		FLOYD_STEINBERG,
+	};
+
+	static constexpr int GRID_BITS = 5;
+	static constexpr int GRID_SIZE = 1 << GRID_BITS;
+
+private:
+	std::vector<Color> _palette;
+	std::vector<uint8_t> _grid;	// GRID_SIZE^3 palette indices
+	std::vector<uint8_t> _exactCells;	// GRID_SIZE^3 flags, set for the cells holding a palette color of another entry
+	std::vector<std::pair<uint32_t, uint8_t>> _exactColors;	// Palette colors and their first entry, sorted by color
+
+	void _buildGrid();
+	size_t _gridIndex(uint8_t r, uint8_t g, uint8_t b) const;
+	uint8_t _mapColor(uint8_t r, uint8_t g, uint8_t b) const;
+
+public:
+	explicit ColorQuantizer(const std::vector<Color>& palette);
+
+	static std::vector<Color> medianCut(const uint8_t* pixels, size_t pixelCount, uint16_t byteCount, uint16_t colorCount);
+	static bool exactPalette(const uint8_t* pixels, size_t pixelCount, uint16_t byteCount, uint16_t colorCount, std::vector<Color>& palette);
+
+	const std::vector<Color>& getPalette() const;
+	uint8_t nearest(uint8_t r, uint8_t g, uint8_t b) const;
+
+	void mapRows(const uint8_t* source, uint8_t* destination, int64_t width, int64_t height, uint16_t byteCount, Dithering dithering) const;
+};
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "ContentHash.h"
+#include "PixelConverter.h"
+#include "ThreadPool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CONTENT_HASH_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	constexpr uint64_t PRIME32_1 = 0x9E3779B1;
+	constexpr uint64_t PRIME32_2 = 0x85EBCA77;
+	constexpr uint64_t PRIME32_3 = 0xC2B2AE3D;
+	constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87;
+	constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4F;
+	constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9;
+	constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63;
+	constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5;
+
+	constexpr size_t LANE_COUNT = 8;
+	constexpr size_t STRIPE_SIZE = 64;
+	constexpr size_t SECRET_SIZE = 192;
+	// Each stripe of a block uses the secret 8 bytes further, the scrambling uses its last 64 bytes
+	constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_SIZE) / 8;
+	constexpr size_t BLOCK_SIZE = STRIPES_PER_BLOCK * STRIPE_SIZE;
+
+	// Fixed pseudo random bytes, they must never change or the hashes kept in files would not match anymore
+	constexpr std::array<uint8_t, SECRET_SIZE> makeSecret()
+	{
+		std::array<uint8_t, SECRET_SIZE> secret{};
+		uint64_t state = PRIME64_1;
+		for (size_t i = 0; i < SECRET_SIZE; i += 8)
+		{
+			// SplitMix64
+			state += 0x9E3779B97F4A7C15;
+			uint64_t value = state;
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+			value ^= value >> 31;
+			for (size_t j = 0; j < 8; j++)
+			{
+				secret[i + j] = static_cast<uint8_t>(value >> (8 * j));
+			}
+		}
+		return secret;
+	}
+
+	alignas(64) constexpr std::array<uint8_t, SECRET_SIZE> SECRET = makeSecret();
+
+	// Little endian reads, the hash is the same on every platform
+	inline uint64_t read64(const uint8_t* bytes)
+	{
+		uint64_t value;
+		std::memcpy(&value, bytes, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap64(value);
+#endif
+		return value;
+	}
+
+	// Low and high halves of a 128 bits product, xored
+	inline uint64_t multiplyFold(const uint64_t first, const uint64_t second)
+	{
+#if defined(__SIZEOF_INT128__)
+		const unsigned __int128 product = static_cast<unsigned __int128>(first) * second;
+		return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#else
+		const uint64_t lowLow = (first & 0xFFFFFFFF) * (second & 0xFFFFFFFF);
+		const uint64_t highLow = (first >> 32) * (second & 0xFFFFFFFF);
+		const uint64_t lowHigh = (first & 0xFFFFFFFF) * (second >> 32);
+		const uint64_t highHigh = (first >> 32) * (second >> 32);
+		const uint64_t cross = (lowLow >> 32) + (highLow & 0xFFFFFFFF) + lowHigh;
+		const uint64_t high = highHigh + (highLow >> 32) + (cross >> 32);
+		const uint64_t low = (cross << 32) | (lowLow & 0xFFFFFFFF);
+		return low ^ high;
+#endif
+	}
+
+	inline uint64_t avalanche(uint64_t hash)
+	{
+		hash ^= hash >> 37;
+		hash *= 0x165667919E3779F9;
+		return hash ^ (hash >> 32);
+	}
+
+	void accumulateScalar(uint64_t* accumulators, const uint8_t* stripes, const size_t stripeCount, const uint8_t* secret)
+	{
+		for (size_t s = 0; s < stripeCount; s++)
+		{
+			const uint8_t* stripe = stripes + s * STRIPE_SIZE;
+			const uint8_t* key = secret + s * 8;
+			for (size_t i = 0; i < LANE_COUNT; i++)
+			{
+				const uint64_t value = read64(stripe + i * 8);
+				const uint64_t keyed = value ^ read64(key + i * 8);
+				accumulators[i ^ 1] += value;
+				accumulators[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+			}
+		}
+	}
+
+	void scrambleScalar(uint64_t* accumulators, const uint8_t* secret)
+	{
+		for (size_t i = 0; i < LANE_COUNT; i++)
+		{
+			uint64_t accumulator = accumulators[i];
+			accumulator ^= accumulator >> 47;
+			accumulator ^= read64(secret + i * 8);
+			accumulators[i] = accumulator * PRIME32_1;
+		}
+	}
+
+	// Whole blocks, the accumulators are scrambled after each one
+	void blocksScalar(uint64_t* accumulators, const uint8_t* data, const size_t blockCount)
+	{
+		for (size_t b = 0; b < blockCount; b++)
+		{
+			accumulateScalar(accumulators, data + b * BLOCK_SIZE, STRIPES_PER_BLOCK, SECRET.data());
+			scrambleScalar(accumulators, SECRET.data() + SECRET_SIZE - STRIPE_SIZE);
+		}
+	}
+
+#ifdef CONTENT_HASH_X86
+	TARGET_AVX2 inline __m256i accumulateAvx2(const __m256i accumulator, const uint8_t* stripe, const uint8_t* key)
+	{
+		const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe));
+		const __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(key)));
+		// Low 32 bits of each lane times its high 32 bits
+		const __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+		// Each value goes to the other lane of its pair
+		const __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+		return _mm256_add_epi64(accumulator, _mm256_add_epi64(product, swapped));
+	}
+
+	TARGET_AVX2 inline __m256i scrambleAvx2(__m256i accumulator, const __m256i key, const __m256i prime)
+	{
+		accumulator = _mm256_xor_si256(accumulator, _mm256_srli_epi64(accumulator, 47));
+		accumulator = _mm256_xor_si256(accumulator, key);
+		// 64 bits product by a 32 bits prime from two 32 x 32 bits products
+		const __m256i productLow = _mm256_mul_epu32(accumulator, prime);
+		const __m256i productHigh = _mm256_mul_epu32(_mm256_srli_epi64(accumulator, 32), prime);
+		return _mm256_add_epi64(productLow, _mm256_slli_epi64(productHigh, 32));
+	}
+
+	TARGET_AVX2 void blocksAvx2(uint64_t* accumulators, const uint8_t* data, const size_t blockCount)
+	{
+		__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accumulators));
+		__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accumulators + 4));
+		const __m256i prime = _mm256_set1_epi64x(static_cast<int64_t>(PRIME32_1));
+		const uint8_t* scrambleKey = SECRET.data() + SECRET_SIZE - STRIPE_SIZE;
+		const __m256i lowScrambleKey = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scrambleKey));
+		const __m256i highScrambleKey = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scrambleKey + 32));
+
+		for (size_t b = 0; b < blockCount; b++)
+		{
+			const uint8_t* block = data + b * BLOCK_SIZE;
+			for (size_t s = 0; s < STRIPES_PER_BLOCK; s++)
+			{
+				const uint8_t* stripe = block + s * STRIPE_SIZE;
+				const uint8_t* key = SECRET.data() + s * 8;
+				low = accumulateAvx2(low, stripe, key);
+				high = accumulateAvx2(high, stripe + 32, key + 32);
+			}
+			low = scrambleAvx2(low, lowScrambleKey, prime);
+			high = scrambleAvx2(high, highScrambleKey, prime);
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(accumulators), low);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(accumulators + 4), high);
+	}
+#endif
+}
+
+/// <summary>
+/// Hash of a buffer, computed by the calling thread
+/// </summary>
+/// <param name="data"></param>
+/// <param name="size">In bytes</param>
+/// <param name="seed">Gives another hash of the same bytes</param>
+/// <returns></returns>
+uint64_t ContentHash::hash(const void* data, const size_t size, const uint64_t seed)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t accumulators[LANE_COUNT] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+	for (size_t i = 0; i < LANE_COUNT; i++)
+	{
+		accumulators[i] += i % 2 == 0 ? seed : 0 - seed;
+	}
+
+	const size_t blockCount = size / BLOCK_SIZE;
+#ifdef CONTENT_HASH_X86
+	if (PixelConverter::hasAvx2())
+	{
+		blocksAvx2(accumulators, bytes, blockCount);
+	}
+	else
+	{
+		blocksScalar(accumulators, bytes, blockCount);
+	}
+#else
+	blocksScalar(accumulators, bytes, blockCount);
+#endif
+
+	// Stripes of the last block, the last one padded with zeros, the size below tells the padding from data
+	const size_t offset = blockCount * BLOCK_SIZE;
+	const size_t rest = size - offset;
+	const size_t stripeCount = rest / STRIPE_SIZE;
+	accumulateScalar(accumulators, bytes + offset, stripeCount, SECRET.data());
+	if (rest % STRIPE_SIZE != 0)
+	{
+		uint8_t last[STRIPE_SIZE] = {};
+		std::memcpy(last, bytes + offset + stripeCount * STRIPE_SIZE, rest % STRIPE_SIZE);
+		accumulateScalar(accumulators, last, 1, SECRET.data() + stripeCount * 8);
+	}
+
+	uint64_t result = static_cast<uint64_t>(size) * PRIME64_1;
+	for (size_t i = 0; i < LANE_COUNT; i += 2)
+	{
+		result += multiplyFold(accumulators[i] ^ read64(SECRET.data() + 11 + i * 8), accumulators[i + 1] ^ read64(SECRET.data() + 19 + i * 8));
+	}
+	return avalanche(result);
+}
+
+/// <summary>
+/// Hash of a buffer, its chunks hashed by the threads of the pool.
+/// It does not depend on the thread count, but differs from hash() of the same bytes.
+/// </summary>
+/// <param name="data"></param>
+/// <param name="size">In bytes</param>
+/// <param name="seed"></param>
+/// <returns></returns>
+uint64_t ContentHash::hashParallel(const void* data, const size_t size, const uint64_t seed)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	const size_t chunkCount = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	std::vector<uint8_t> chunkHashes(chunkCount * 8);
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(chunkCount), [&](const int64_t first, const int64_t last)
+	{
+		for (int64_t chunk = first; chunk < last; chunk++)
+		{
+			const size_t offset = static_cast<size_t>(chunk) * CHUNK_SIZE;
+			const uint64_t chunkHash = hash(bytes + offset, std::min(CHUNK_SIZE, size - offset), seed);
+			for (size_t i = 0; i < 8; i++)
+			{
+				chunkHashes[static_cast<size_t>(chunk) * 8 + i] = static_cast<uint8_t>(chunkHash >> (8 * i));
+			}
+		}
+	});
+	return hash(chunkHashes.data(), chunkHashes.size(), seed ^ static_cast<uint64_t>(size));
+}
+
+/// <summary>
+/// 16 lowercase hexadecimal digits, for file names
+/// </summary>
+std::string ContentHash::toHex(const uint64_t hash)
+{
+	static constexpr char DIGITS[] = "0123456789abcdef";
+	std::string text(16, '0');
+	for (int i = 0; i < 16; i++)
+	{
+		text[15 - i] = DIGITS[(hash >> (4 * i)) & 0xF];
+	}
+	return text;
+}
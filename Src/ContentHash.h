@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Fast non cryptographic 64 bits hash of a buffer, made like XXH3: eight 64 bits lanes accumulate 64 bytes stripes
+// mixed with a fixed secret, and are scrambled every block. The lanes are computed with AVX2 when the CPU supports it,
+// with the same result as the scalar code, so a hash can be kept in a file and compared on another machine.
+// Large buffers are hashed by the threads of the pool in fixed size chunks, whose hashes are hashed again.
+class ContentHash
+{
+public:
+	static constexpr size_t CHUNK_SIZE = static_cast<size_t>(1) << 20;
+
+	static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+	static uint64_t hashParallel(const void* data, size_t size, uint64_t seed = 0);
+	static std::string toHex(uint64_t hash);
+};
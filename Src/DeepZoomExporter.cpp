@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#include "DeepZoomExporter.h"
+#include "PixelConverter.h"
+
+namespace
+{
+	// Tiles waiting for a writer, per writer, before the rows stop coming
+	constexpr size_t QUEUED_TILES_PER_WORKER = 4;
+}
+
+/// <summary>
+/// Exporter of tiles of a size, overlapping their neighbours by some pixels
+/// </summary>
+/// <param name="tileSize">Pixels of a tile side, without the overlap</param>
+/// <param name="overlap">Pixels shared with each neighbour tile</param>
+/// <param name="threadCount">Tile writers</param>
+DeepZoomExporter::DeepZoomExporter(const uint32_t tileSize, const uint32_t overlap, const unsigned threadCount)
+	: _tileSize(tileSize), _overlap(overlap), _threadCount(std::max(1u, threadCount))
+{
+	if (tileSize == 0 || overlap >= tileSize)
+	{
+		throw std::invalid_argument("Tile size must be positive and larger than the overlap");
+	}
+}
+
+/// <summary>
+/// Create the levels, the descriptor and the directories, and start the tile writers
+/// </summary>
+void DeepZoomExporter::_start(const int32_t width, const int32_t height, const uint16_t bitCount,
+	const std::vector<std::array<uint8_t, 4>>& palette, const std::string& destination)
+{
+	if (width <= 0 || height <= 0)
+	{
+		throw std::invalid_argument("The image is empty");
+	}
+	_bitCount = bitCount;
+	_palette = palette;
+	_tileCount = 0;
+	_stopping = false;
+	_error = nullptr;
+
+	// The last level is the image, each level before it is half of the next one, down to 1x1
+	size_t levelCount = 1;
+	while ((static_cast<int64_t>(1) << (levelCount - 1)) < std::max(width, height))
+	{
+		levelCount++;
+	}
+	_levels.assign(levelCount, Level{});
+	int32_t levelWidth = width;
+	int32_t levelHeight = height;
+	for (size_t i = levelCount; i-- > 0;)
+	{
+		Level& level = _levels[i];
+		level.width = levelWidth;
+		level.height = levelHeight;
+		level.directory = destination + "_files/" + std::to_string(i);
+		std::filesystem::create_directories(level.directory);
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+
+	std::ofstream descriptor(destination + ".dzi");
+	descriptor << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		<< "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" Format=\"bmp\" Overlap=\"" << _overlap
+		<< "\" TileSize=\"" << _tileSize << "\">\n"
+		<< "  <Size Width=\"" << width << "\" Height=\"" << height << "\"/>\n"
+		<< "</Image>\n";
+	if (!descriptor)
+	{
+		throw std::runtime_error("Could not write the deep zoom descriptor");
+	}
+
+	for (unsigned i = 0; i < _threadCount; i++)
+	{
+		_workers.emplace_back(&DeepZoomExporter::_workerLoop, this);
+	}
+}
+
+/// <summary>
+/// Give the next row from the top to a level: it is kept until its tiles are cut, and halved with the row before it
+/// for the level below
+/// </summary>
+void DeepZoomExporter::_pushRow(const size_t levelIndex, std::vector<uint8_t> row)
+{
+	Level& level = _levels[levelIndex];
+	if (levelIndex > 0)
+	{
+		if (level.pendingRow.empty())
+		{
+			level.pendingRow = row;
+		}
+		else
+		{
+			std::vector<uint8_t> halved(static_cast<size_t>(_levels[levelIndex - 1].width) * (_bitCount / 8));
+			PixelConverter::reduceRows(level.pendingRow.data(), row.data(), halved.data(), static_cast<size_t>(level.width), _bitCount / 8);
+			level.pendingRow.clear();
+			_pushRow(levelIndex - 1, std::move(halved));
+		}
+	}
+	level.rows.push_back(std::move(row));
+	level.receivedRowCount++;
+
+	// A row of tiles is cut once the rows of its bottom overlap came
+	const int32_t tileSize = static_cast<int32_t>(_tileSize);
+	const int32_t overlap = static_cast<int32_t>(_overlap);
+	while (level.nextTileRow * tileSize < level.height &&
+		level.receivedRowCount >= std::min(level.height, (level.nextTileRow + 1) * tileSize + overlap))
+	{
+		_cutTiles(level, level.nextTileRow);
+		level.nextTileRow++;
+		while (!level.rows.empty() && level.firstRow < level.nextTileRow * tileSize - overlap)
+		{
+			level.rows.pop_front();
+			level.firstRow++;
+		}
+	}
+}
+
+/// <summary>
+/// Queue the tiles of a row of tiles, waiting while the queue is full
+/// </summary>
+void DeepZoomExporter::_cutTiles(const Level& level, const int32_t tileRow)
+{
+	const int32_t tileSize = static_cast<int32_t>(_tileSize);
+	const int32_t overlap = static_cast<int32_t>(_overlap);
+	const size_t byteCount = _bitCount / 8;
+	const int32_t top = tileRow * tileSize - (tileRow > 0 ? overlap : 0);
+	const int32_t bottom = std::min(level.height, (tileRow + 1) * tileSize + overlap);
+	for (int32_t column = 0; column * tileSize < level.width; column++)
+	{
+		const int32_t left = column * tileSize - (column > 0 ? overlap : 0);
+		const int32_t right = std::min(level.width, (column + 1) * tileSize + overlap);
+		Tile tile{level.directory + "/" + std::to_string(column) + "_" + std::to_string(tileRow) + ".bmp",
+			right - left, bottom - top, {}};
+		const size_t rowSize = static_cast<size_t>(tile.width) * byteCount;
+		tile.pixels.resize(rowSize * tile.height);
+		for (int32_t y = top; y < bottom; y++)
+		{
+			std::memcpy(tile.pixels.data() + (y - top) * rowSize, level.rows[y - level.firstRow].data() + left * byteCount, rowSize);
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_spaceCondition.wait(lock, [this] { return _queue.size() < _threadCount * QUEUED_TILES_PER_WORKER || _error; });
+		if (_error)
+		{
+			std::rethrow_exception(_error);
+		}
+		_queue.push_back(std::move(tile));
+		_tileCount++;
+		_queueCondition.notify_one();
+	}
+}
+
+/// <summary>
+/// Halve the last row of the levels of odd height with itself, and wait for the tiles to be written
+/// </summary>
+void DeepZoomExporter::_finish()
+{
+	for (size_t i = _levels.size(); i-- > 1;)
+	{
+		if (!_levels[i].pendingRow.empty())
+		{
+			const std::vector<uint8_t> last = _levels[i].pendingRow;
+			_levels[i].pendingRow.clear();
+			std::vector<uint8_t> halved(static_cast<size_t>(_levels[i - 1].width) * (_bitCount / 8));
+			PixelConverter::reduceRows(last.data(), last.data(), halved.data(), static_cast<size_t>(_levels[i].width), _bitCount / 8);
+			_pushRow(i - 1, std::move(halved));
+		}
+	}
+	_stopWorkers();
+	_levels.clear();
+	if (_error)
+	{
+		std::rethrow_exception(_error);
+	}
+}
+
+/// <summary>
+/// Let the writers empty the queue and join them
+/// </summary>
+void DeepZoomExporter::_stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_queueCondition.notify_all();
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+}
+
+void DeepZoomExporter::_workerLoop()
+{
+	while (true)
+	{
+		Tile tile;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_queueCondition.wait(lock, [this] { return _stopping || !_queue.empty(); });
+			if (_queue.empty())
+			{
+				return;
+			}
+			tile = std::move(_queue.front());
+			_queue.pop_front();
+		}
+		_spaceCondition.notify_one();
+		try
+		{
+			_writeTile(tile);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_error)
+			{
+				_error = std::current_exception();
+			}
+			_queue.clear();
+			_spaceCondition.notify_all();
+		}
+	}
+}
+
+void DeepZoomExporter::_writeTile(const Tile& tile) const
+{
+	BMPImage image(tile.width, tile.height, _bitCount);
+	if (!_palette.empty())
+	{
+		image.setPalette(_palette);
+	}
+	// Image rows are from the bottom
+	const size_t rowSize = static_cast<size_t>(tile.width) * (_bitCount / 8);
+	for (int32_t y = 0; y < tile.height; y++)
+	{
+		std::memcpy(image._pixelData.data() + (tile.height - 1 - y) * rowSize, tile.pixels.data() + y * rowSize, rowSize);
+	}
+	std::ofstream file(tile.path, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Could not create file " + tile.path);
+	}
+	image.write(file, BMPImage::FileFormat::BMP);
+}
+
+/// <summary>
+/// Export the tiles of a file. Uncompressed BMP files are streamed, other files are loaded first.
+/// </summary>
+/// <param name="filename"></param>
+/// <param name="destination">Path of the descriptor without its .dzi extension</param>
+/// <returns>Number of tiles written</returns>
+size_t DeepZoomExporter::exportFile(const std::string& filename, const std::string& destination)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("Could not open file");
+	}
+	if (file.peek() != 'B')
+	{
+		return exportImage(BMPImage(filename.c_str()), destination);
+	}
+	// Headers and palette only, the pixels are read by strips
+	BMPImage source;
+	source._readHeaders(file);
+	const uint32_t compression = source._activeHeader.compression;
+	if (compression == BMPImage::BI_RLE8 || compression == BMPImage::BI_RLE4)
+	{
+		return exportImage(BMPImage(filename.c_str()), destination);
+	}
+	source._readPalette(file);
+
+	const int32_t width = source._activeHeader.width;
+	const int32_t height = source._activeHeader.height;
+	const uint16_t fileBitCount = source._activeHeader.bitCount;
+	const bool grayRamp = source._hasGrayRamp();
+	// Palette images other than gray ramps become true colors
+	uint16_t bitCount = fileBitCount;
+	if (fileBitCount <= BMPImage::GRAY_SCALE_BIT_SIZE && !grayRamp)
+	{
+		bitCount = BMPImage::TRUE_COLOR_BIT_SIZE;
+	}
+	std::vector<uint8_t> expandedPalette(256 * 4, 0);
+	for (size_t i = 0; i < source._palette.size(); i++)
+	{
+		std::copy(source._palette[i].begin(), source._palette[i].begin() + 3, expandedPalette.begin() + i * 4);
+	}
+
+	_start(width, height, bitCount, grayRamp ? source._palette : std::vector<std::array<uint8_t, 4>>(), destination);
+	try
+	{
+		const size_t fileRowSize = (static_cast<size_t>(width) * fileBitCount + 7) / 8;
+		const size_t paddedRowSize = (fileRowSize + 3) & ~static_cast<size_t>(3);
+		const size_t rowSize = static_cast<size_t>(width) * (bitCount / 8);
+		std::vector<uint8_t> strip;
+		std::vector<uint8_t> indices(width);
+		for (int32_t top = 0; top < height; top += static_cast<int32_t>(_tileSize))
+		{
+			// Rows from the top are stored from the bottom, so a strip is read at once and walked backwards
+			const int32_t rowCount = std::min(static_cast<int32_t>(_tileSize), height - top);
+			const int32_t firstFileRow = height - top - rowCount;
+			strip.resize(paddedRowSize * rowCount);
+			file.seekg(source._fileHeader.offsetData + firstFileRow * paddedRowSize);
+			file.read(reinterpret_cast<char*>(strip.data()), static_cast<std::streamsize>(strip.size()));
+			if (!file)
+			{
+				throw std::runtime_error("Pixel data is truncated");
+			}
+			for (int32_t i = rowCount - 1; i >= 0; i--)
+			{
+				const uint8_t* fileRow = strip.data() + i * paddedRowSize;
+				std::vector<uint8_t> row(rowSize);
+				if (fileBitCount > BMPImage::GRAY_SCALE_BIT_SIZE)
+				{
+					PixelConverter::swapRedBlue(fileRow, row.data(), static_cast<size_t>(width), bitCount / 8);
+				}
+				else if (grayRamp)
+				{
+					std::memcpy(row.data(), fileRow, rowSize);
+				}
+				else
+				{
+					if (fileBitCount == BMPImage::MONOCHROME_BIT_SIZE)
+					{
+						PixelConverter::unpackBits(fileRow, indices.data(), static_cast<size_t>(width));
+					}
+					else if (fileBitCount == BMPImage::SIXTEEN_COLORS_BIT_SIZE)
+					{
+						for (int32_t x = 0; x < width; x++)
+						{
+							indices[x] = (fileRow[x / 2] >> (x % 2 == 0 ? 4 : 0)) & 0x0F;
+						}
+					}
+					else
+					{
+						std::memcpy(indices.data(), fileRow, indices.size());
+					}
+					PixelConverter::expandPalette(indices.data(), row.data(), static_cast<size_t>(width), expandedPalette.data(), 3);
+				}
+				_pushRow(_levels.size() - 1, std::move(row));
+			}
+		}
+		_finish();
+	}
+	catch (...)
+	{
+		_stopWorkers();
+		_levels.clear();
+		throw;
+	}
+	return _tileCount;
+}
+
+/// <summary>
+/// Export the tiles of an image in memory
+/// </summary>
+/// <param name="image"></param>
+/// <param name="destination">Path of the descriptor without its .dzi extension</param>
+/// <returns>Number of tiles written</returns>
+size_t DeepZoomExporter::exportImage(const BMPImage& image, const std::string& destination)
+{
+	// Palette images other than gray ramps become true colors
+	const BMPImage* source = &image;
+	BMPImage converted;
+	if (image.isIndexed() && !image._hasGrayRamp())
+	{
+		converted = image;
+		converted.convertTo(BMPImage::TRUE_COLOR_BIT_SIZE);
+		source = &converted;
+	}
+	const int32_t width = static_cast<int32_t>(source->getWidth());
+	const int32_t height = static_cast<int32_t>(source->getHeight());
+	_start(width, height, source->getBitCount(), source->_palette, destination);
+	try
+	{
+		const size_t rowSize = source->_getRowSize();
+		for (int32_t y = height - 1; y >= 0; y--)
+		{
+			const uint8_t* row = source->_pixelData.data() + y * rowSize;
+			_pushRow(_levels.size() - 1, std::vector<uint8_t>(row, row + rowSize));
+		}
+		_finish();
+	}
+	catch (...)
+	{
+		_stopWorkers();
+		_levels.clear();
+		throw;
+	}
+	return _tileCount;
+}
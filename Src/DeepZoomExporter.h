@@ -0,0 +1,78 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Deep zoom tiles in the DZI layout: destination.dzi describes the image, and destination_files/<level>/<column>_<row>.bmp
+// are the tiles, level 0 being 1x1 and the last level the image itself. Uncompressed BMP files are read by strips from
+// the top and every level is halved as the rows go through, so only the rows of one row of tiles per level are in memory.
+// Tiles are encoded and written by worker threads fed through a bounded queue.
+class DeepZoomExporter
+{
+public:
+	static constexpr uint32_t DEFAULT_TILE_SIZE = 254;
+	static constexpr uint32_t DEFAULT_OVERLAP = 1;
+
+private:
+	struct Tile {
+		std::string path;
+		int32_t width;
+		int32_t height;
+		std::vector<uint8_t> pixels;	// Rows from the top
+	};
+
+	struct Level {
+		int32_t width;
+		int32_t height;
+		std::string directory;
+		std::deque<std::vector<uint8_t>> rows;	// From firstRow, top down
+		int32_t firstRow;
+		int32_t receivedRowCount;
+		int32_t nextTileRow;
+		std::vector<uint8_t> pendingRow;		// Waiting for the row it is halved with
+	};
+
+	uint32_t _tileSize;
+	uint32_t _overlap;
+	unsigned _threadCount;
+
+	// State of the running export
+	std::vector<Level> _levels;
+	uint16_t _bitCount = 0;
+	std::vector<std::array<uint8_t, 4>> _palette;
+	size_t _tileCount = 0;
+
+	// Tile writers
+	std::deque<Tile> _queue;
+	std::mutex _mutex;
+	std::condition_variable _queueCondition;
+	std::condition_variable _spaceCondition;
+	bool _stopping = false;
+	std::exception_ptr _error;
+	std::vector<std::thread> _workers;
+
+	void _start(int32_t width, int32_t height, uint16_t bitCount, const std::vector<std::array<uint8_t, 4>>& palette, const std::string& destination);
+	void _pushRow(size_t levelIndex, std::vector<uint8_t> row);
+	void _cutTiles(const Level& level, int32_t tileRow);
+	void _finish();
+	void _stopWorkers();
+	void _workerLoop();
+	void _writeTile(const Tile& tile) const;
+
+public:
+	explicit DeepZoomExporter(uint32_t tileSize = DEFAULT_TILE_SIZE, uint32_t overlap = DEFAULT_OVERLAP,
+		unsigned threadCount = std::thread::hardware_concurrency());
+	DeepZoomExporter(const DeepZoomExporter&) = delete;
+	DeepZoomExporter& operator=(const DeepZoomExporter&) = delete;
+
+	size_t exportFile(const std::string& filename, const std::string& destination);
+	size_t exportImage(const BMPImage& image, const std::string& destination);
+};
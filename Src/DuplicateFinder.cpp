@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+
+#include "BMPImage.h"
+#include "DuplicateFinder.h"
+#include "ImageIndex.h"
+#include "Log.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	// Files hashed by each task, small as hashing is mostly waiting for the disk
+	constexpr int64_t HASH_CHUNK_SIZE = 16;
+	// Entries searched by each task
+	constexpr int64_t SEARCH_CHUNK_SIZE = 1024;
+
+	// Entry not visited yet by a search
+	constexpr size_t UNVISITED = static_cast<size_t>(-1);
+
+	double secondsSince(const Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// Call a function with every value within a distance of a value, each once
+	/// </summary>
+	/// <param name="bitCount">Of the values</param>
+	/// <param name="firstBit">Lowest bit that may still be flipped</param>
+	template <typename Function>
+	void forEachWithin(const uint32_t value, const uint32_t distance, const uint32_t bitCount, const uint32_t firstBit, Function& function)
+	{
+		function(value);
+		if (distance == 0)
+		{
+			return;
+		}
+		for (uint32_t bit = firstBit; bit < bitCount; bit++)
+		{
+			forEachWithin(value ^ (1u << bit), distance - 1, bitCount, bit + 1, function);
+		}
+	}
+}
+
+/// <summary>
+/// Empty index of hashes
+/// </summary>
+/// <param name="kind">Of the hashes of the files added from directories</param>
+DuplicateFinder::DuplicateFinder(const PerceptualHash::Kind kind) : _kind(kind)
+{
+}
+
+/// <summary>
+/// Sort the entries by the value of each part of their hash, when entries were added since the last time
+/// </summary>
+void DuplicateFinder::_buildTables()
+{
+	if (_indexedCount == _entries.size())
+	{
+		return;
+	}
+	constexpr uint32_t valueCount = 1u << PART_BITS;
+	for (uint32_t part = 0; part < PART_COUNT; part++)
+	{
+		const auto valueOf = [part](const uint64_t hash) { return static_cast<uint32_t>(hash >> (part * PART_BITS)) & (valueCount - 1); };
+		std::vector<uint32_t>& offsets = _bucketOffsets[part];
+		offsets.assign(valueCount + 1, 0);
+		for (const Entry& entry : _entries)
+		{
+			offsets[valueOf(entry.hash) + 1]++;
+		}
+		for (uint32_t value = 0; value < valueCount; value++)
+		{
+			offsets[value + 1] += offsets[value];
+		}
+		std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+		_bucketEntries[part].resize(_entries.size());
+		for (size_t i = 0; i < _entries.size(); i++)
+		{
+			_bucketEntries[part][next[valueOf(_entries[i].hash)]++] = static_cast<uint32_t>(i);
+		}
+	}
+	_indexedCount = _entries.size();
+}
+
+/// <summary>
+/// Visit the entries within a distance of a hash, each once
+/// </summary>
+/// <param name="visited">Of the size of _entries, the stamp of the search that visited each entry</param>
+/// <param name="stamp">Not used by an earlier search with the same visited entries</param>
+template <typename Visit>
+void DuplicateFinder::_search(const uint64_t hash, const uint32_t maxDistance, std::vector<size_t>& visited, const size_t stamp,
+	Visit&& visit) const
+{
+	if (_entries.empty())
+	{
+		return;
+	}
+	// Within maxDistance, at least one of the parts is within maxDistance / PART_COUNT
+	const uint32_t partDistance = std::min(maxDistance / PART_COUNT, PART_BITS);
+	for (uint32_t part = 0; part < PART_COUNT; part++)
+	{
+		const std::vector<uint32_t>& offsets = _bucketOffsets[part];
+		const std::vector<uint32_t>& entries = _bucketEntries[part];
+		const auto lookUp = [&](const uint32_t value)
+		{
+			for (uint32_t i = offsets[value]; i < offsets[value + 1]; i++)
+			{
+				const uint32_t entry = entries[i];
+				if (visited[entry] == stamp)
+				{
+					continue;
+				}
+				visited[entry] = stamp;
+				const uint32_t distance = PerceptualHash::distance(_entries[entry].hash, hash);
+				if (distance <= maxDistance)
+				{
+					visit(entry, distance);
+				}
+			}
+		};
+		const uint32_t value = static_cast<uint32_t>(hash >> (part * PART_BITS)) & ((1u << PART_BITS) - 1);
+		forEachWithin(value, partDistance, PART_BITS, 0, lookUp);
+	}
+}
+
+/// <summary>
+/// Hash the images of a directory and add them, the files that can not be read are reported and left out
+/// </summary>
+/// <param name="directory"></param>
+/// <param name="recursive">With the images of the subdirectories</param>
+/// <returns>Number of files added</returns>
+size_t DuplicateFinder::addDirectory(const std::string& directory, const bool recursive)
+{
+	if (!std::filesystem::is_directory(directory))
+	{
+		throw std::runtime_error("Directory " + directory + " does not exist");
+	}
+	const Clock::time_point start = Clock::now();
+	std::vector<std::string> directories{directory};
+	if (recursive)
+	{
+		std::error_code error;
+		for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+		{
+			if (it->is_directory(error))
+			{
+				directories.push_back(it->path().string());
+			}
+		}
+	}
+	std::vector<std::string> paths;
+	for (const std::string& path : directories)
+	{
+		ImageIndex index(path);
+		index.refresh();
+		for (const ImageIndex::Entry& entry : index.getEntries())
+		{
+			if (entry.info.bitCount != 0)
+			{
+				paths.push_back((std::filesystem::path(path) / entry.name).string());
+			}
+		}
+	}
+
+	std::vector<uint64_t> hashes(paths.size());
+	std::vector<std::string> errors(paths.size());
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(paths.size()), [&](const int64_t first, const int64_t last)
+	{
+		for (int64_t i = first; i < last; i++)
+		{
+			try
+			{
+				hashes[i] = BMPImage::perceptualHashOf(paths[i].c_str(), _kind);
+			}
+			catch (const std::exception& e)
+			{
+				errors[i] = e.what();
+			}
+		}
+	}, HASH_CHUNK_SIZE);
+
+	size_t addedCount = 0;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (!errors[i].empty())
+		{
+			Log::write(Log::Level::WARNING, paths[i] + " could not be hashed: " + errors[i]);
+			_statistics.failureCount++;
+			continue;
+		}
+		add(paths[i], hashes[i]);
+		addedCount++;
+	}
+	_statistics.hashSeconds += secondsSince(start);
+	return addedCount;
+}
+
+/// <summary>
+/// Add a file with its hash, computed by the caller
+/// </summary>
+/// <param name="file"></param>
+/// <param name="hash">Of the kind of the finder</param>
+void DuplicateFinder::add(const std::string& file, const uint64_t hash)
+{
+	const size_t fileIndex = _files.size();
+	_files.push_back(file);
+	_statistics.fileCount++;
+	const auto found = _entryOf.find(hash);
+	if (found != _entryOf.end())
+	{
+		_entries[found->second].files.push_back(fileIndex);
+		return;
+	}
+	_entryOf.emplace(hash, _entries.size());
+	_entries.push_back(Entry{hash, {fileIndex}});
+	_statistics.distinctHashCount++;
+}
+
+/// <summary>
+/// Files whose hash is within a distance of a hash
+/// </summary>
+/// <param name="hash"></param>
+/// <param name="maxDistance">In bits</param>
+/// <returns>Closest first</returns>
+std::vector<DuplicateFinder::Neighbor> DuplicateFinder::findNear(const uint64_t hash, const uint32_t maxDistance)
+{
+	_buildTables();
+	std::vector<Neighbor> neighbors;
+	std::vector<size_t> visited(_entries.size(), UNVISITED);
+	_search(hash, maxDistance, visited, 0, [&](const size_t entry, const uint32_t distance)
+	{
+		for (const size_t file : _entries[entry].files)
+		{
+			neighbors.push_back(Neighbor{_files[file], distance});
+		}
+	});
+	std::sort(neighbors.begin(), neighbors.end(), [](const Neighbor& a, const Neighbor& b)
+	{
+		return a.distance != b.distance ? a.distance < b.distance : a.file < b.file;
+	});
+	return neighbors;
+}
+
+/// <summary>
+/// Every pair of files whose hashes are within a distance, the entries are searched for by the threads of the pool
+/// </summary>
+/// <param name="maxDistance">In bits</param>
+/// <returns>Closest first</returns>
+std::vector<DuplicateFinder::Pair> DuplicateFinder::findPairs(const uint32_t maxDistance)
+{
+	const Clock::time_point start = Clock::now();
+	_buildTables();
+	std::vector<Pair> pairs;
+	std::mutex mutex;
+	const auto makePair = [this](const size_t first, const size_t second, const uint32_t distance)
+	{
+		const std::string& a = _files[first];
+		const std::string& b = _files[second];
+		return a < b ? Pair{a, b, distance} : Pair{b, a, distance};
+	};
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(_entries.size()), [&](const int64_t first, const int64_t last)
+	{
+		std::vector<Pair> found;
+		std::vector<size_t> visited(_entries.size(), UNVISITED);
+		for (size_t index = static_cast<size_t>(first); index < static_cast<size_t>(last); index++)
+		{
+			const std::vector<size_t>& files = _entries[index].files;
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				for (size_t j = i + 1; j < files.size(); j++)
+				{
+					found.push_back(makePair(files[i], files[j], 0));
+				}
+			}
+			// Each pair of entries once, from the entry of lower index
+			_search(_entries[index].hash, maxDistance, visited, index, [&](const size_t other, const uint32_t distance)
+			{
+				if (other <= index)
+				{
+					return;
+				}
+				for (const size_t file : files)
+				{
+					for (const size_t otherFile : _entries[other].files)
+					{
+						found.push_back(makePair(file, otherFile, distance));
+					}
+				}
+			});
+		}
+		const std::lock_guard<std::mutex> lock(mutex);
+		pairs.insert(pairs.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+	}, SEARCH_CHUNK_SIZE);
+	std::sort(pairs.begin(), pairs.end(), [](const Pair& a, const Pair& b)
+	{
+		if (a.distance != b.distance)
+		{
+			return a.distance < b.distance;
+		}
+		return a.first != b.first ? a.first < b.first : a.second < b.second;
+	});
+	_statistics.pairCount = pairs.size();
+	_statistics.searchSeconds = secondsSince(start);
+	return pairs;
+}
+
+PerceptualHash::Kind DuplicateFinder::getKind() const
+{
+	return _kind;
+}
+
+size_t DuplicateFinder::getFileCount() const
+{
+	return _files.size();
+}
+
+DuplicateFinder::Statistics DuplicateFinder::getStatistics() const
+{
+	return _statistics;
+}
+
+std::ostream& operator<<(std::ostream& os, const DuplicateFinder::Statistics& statistics)
+{
+	const std::streamsize precision = os.precision(3);
+	const std::ios::fmtflags flags = os.setf(std::ios::fixed, std::ios::floatfield);
+	os << "Duplicates: " << statistics.fileCount << " files hashed in " << statistics.hashSeconds << " s (" << statistics.failureCount
+		<< " failures), " << statistics.distinctHashCount << " distinct hashes, " << statistics.pairCount << " pairs found in "
+		<< statistics.searchSeconds << " s";
+	os.precision(precision);
+	os.flags(flags);
+	return os;
+}
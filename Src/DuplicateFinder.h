@@ -0,0 +1,79 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "PerceptualHash.h"
+
+// Near duplicate images of directories, found by the distance between their perceptual hashes. The hashes are indexed
+// by multi-index hashing: each of the four 16 bits parts of a hash keys a table, and two hashes within a distance d have
+// at least one part within d / 4 of each other, so a search only looks up the buckets of the few part values within d / 4
+// of each part of the hash instead of comparing the hash with every other. Images with the same hash share an entry.
+// Files are listed through the image index of each directory and hashed by the threads of the pool, only the headers
+// and the sampled rows of the uncompressed BMP files are read.
+class DuplicateFinder
+{
+public:
+	struct Neighbor {
+		std::string file;
+		uint32_t distance;
+	};
+
+	struct Pair {
+		std::string first;		// Before second in the order of the names
+		std::string second;
+		uint32_t distance;
+	};
+
+	struct Statistics {
+		size_t fileCount;			// Hashed
+		size_t failureCount;		// Files that could not be read
+		size_t distinctHashCount;
+		size_t pairCount;			// Of the last search
+		double hashSeconds;
+		double searchSeconds;
+	};
+
+	static constexpr uint32_t DEFAULT_MAX_DISTANCE = 8;
+
+private:
+	struct Entry {
+		uint64_t hash;
+		std::vector<size_t> files;	// Indices in _files
+	};
+
+	static constexpr uint32_t PART_COUNT = 4;
+	static constexpr uint32_t PART_BITS = 64 / PART_COUNT;
+
+	PerceptualHash::Kind _kind;
+	std::vector<std::string> _files;
+	std::vector<Entry> _entries;
+	std::unordered_map<uint64_t, size_t> _entryOf;		// Index in _entries of a hash
+	// Entries by the value of each part, the entries of a value start at its offset, built again before a search
+	// when entries were added
+	std::array<std::vector<uint32_t>, PART_COUNT> _bucketOffsets;
+	std::array<std::vector<uint32_t>, PART_COUNT> _bucketEntries;
+	size_t _indexedCount = 0;
+	Statistics _statistics{};
+
+	void _buildTables();
+	template <typename Visit>
+	void _search(uint64_t hash, uint32_t maxDistance, std::vector<size_t>& visited, size_t stamp, Visit&& visit) const;
+
+public:
+	explicit DuplicateFinder(PerceptualHash::Kind kind = PerceptualHash::Kind::DCT);
+
+	size_t addDirectory(const std::string& directory, bool recursive = true);
+	void add(const std::string& file, uint64_t hash);
+	std::vector<Neighbor> findNear(uint64_t hash, uint32_t maxDistance = DEFAULT_MAX_DISTANCE);
+	std::vector<Pair> findPairs(uint32_t maxDistance = DEFAULT_MAX_DISTANCE);
+	PerceptualHash::Kind getKind() const;
+	size_t getFileCount() const;
+	Statistics getStatistics() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const DuplicateFinder::Statistics& statistics);
@@ -0,0 +1,246 @@
+#include <filesystem>
+
+#include "ImageCache.h"
+
+namespace
+{
+	// Pending prefetches beyond this are dropped, oldest first
+	constexpr size_t MAX_PREFETCH_QUEUE = 8;
+
+	size_t imageBytes(const BMPImage& image)
+	{
+		const size_t rowSize = (static_cast<size_t>(image.getWidth()) * image.getBitCount() + 7) / 8;
+		return rowSize * image.getHeight() + image.getPalette().size() * 4;
+	}
+}
+
+/// <summary>
+/// Start the background loader
+/// </summary>
+/// <param name="capacity">Bytes of decoded pixels kept at most</param>
+ImageCache::ImageCache(const size_t capacity) : _capacity(capacity)
+{
+	_loader = std::thread(&ImageCache::_loaderLoop, this);
+}
+
+/// <summary>
+/// Stop the background loader, the prefetches not started are dropped
+/// </summary>
+ImageCache::~ImageCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+		_prefetchQueue.clear();
+	}
+	_condition.notify_all();
+	_loader.join();
+}
+
+bool ImageCache::_fileInfo(const std::string& path, int64_t& modificationTime, uintmax_t& fileSize)
+{
+	std::error_code error;
+	const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+	if (error)
+	{
+		return false;
+	}
+	fileSize = std::filesystem::file_size(path, error);
+	modificationTime = static_cast<int64_t>(time.time_since_epoch().count());
+	return !error;
+}
+
+/// <summary>
+/// Entry of an unchanged file, moved to the front. Must be called with the mutex locked.
+/// </summary>
+ImageCache::ImagePointer ImageCache::_find(const std::string& path, const int64_t modificationTime, const uintmax_t fileSize)
+{
+	const auto found = _index.find(path);
+	if (found == _index.end())
+	{
+		return nullptr;
+	}
+	const std::list<Entry>::iterator entry = found->second;
+	if (entry->modificationTime != modificationTime || entry->fileSize != fileSize)
+	{
+		// The file changed since it was decoded
+		_statistics.bytes -= entry->bytes;
+		_statistics.imageCount--;
+		_entries.erase(entry);
+		_index.erase(found);
+		return nullptr;
+	}
+	_entries.splice(_entries.begin(), _entries, entry);
+	return entry->image;
+}
+
+/// <summary>
+/// Add an image at the front and evict the least recently used ones over the capacity
+/// </summary>
+void ImageCache::_insert(const std::string& path, const int64_t modificationTime, const uintmax_t fileSize, const ImagePointer& image)
+{
+	const size_t bytes = imageBytes(*image);
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto found = _index.find(path);
+	if (found != _index.end())
+	{
+		_statistics.bytes -= found->second->bytes;
+		_statistics.imageCount--;
+		_entries.erase(found->second);
+		_index.erase(found);
+	}
+	if (bytes > _capacity)
+	{
+		return;
+	}
+	_entries.push_front(Entry{path, modificationTime, fileSize, bytes, image});
+	_index[path] = _entries.begin();
+	_statistics.bytes += bytes;
+	_statistics.imageCount++;
+	while (_statistics.bytes > _capacity)
+	{
+		const Entry& last = _entries.back();
+		_statistics.bytes -= last.bytes;
+		_statistics.imageCount--;
+		_statistics.evictions++;
+		_index.erase(last.path);
+		_entries.pop_back();
+	}
+}
+
+void ImageCache::_loaderLoop()
+{
+	while (true)
+	{
+		std::string path;
+		int64_t modificationTime;
+		uintmax_t fileSize;
+		std::promise<ImagePointer> promise;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this] { return _stopping || !_prefetchQueue.empty(); });
+			if (_stopping)
+			{
+				return;
+			}
+			path = std::move(_prefetchQueue.front());
+			_prefetchQueue.pop_front();
+			if (!_fileInfo(path, modificationTime, fileSize) || _find(path, modificationTime, fileSize) || _pending.count(path) != 0)
+			{
+				continue;
+			}
+			// Requests for this file now wait for the prefetch
+			_pending[path] = promise.get_future().share();
+		}
+		try
+		{
+			const ImagePointer image = std::make_shared<const BMPImage>(path.c_str());
+			_insert(path, modificationTime, fileSize, image);
+			promise.set_value(image);
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending.erase(path);
+		_statistics.prefetches++;
+	}
+}
+
+/// <summary>
+/// Decoded image of a file, loaded when it is not cached
+/// </summary>
+/// <param name="path"></param>
+/// <returns>Shared with the cache, copy it to modify it</returns>
+ImageCache::ImagePointer ImageCache::get(const std::string& path)
+{
+	int64_t modificationTime;
+	uintmax_t fileSize;
+	if (!_fileInfo(path, modificationTime, fileSize))
+	{
+		throw std::runtime_error("Could not open file");
+	}
+	std::shared_future<ImagePointer> pending;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (ImagePointer image = _find(path, modificationTime, fileSize))
+		{
+			_statistics.hits++;
+			return image;
+		}
+		const auto found = _pending.find(path);
+		if (found != _pending.end())
+		{
+			pending = found->second;
+		}
+	}
+	if (pending.valid())
+	{
+		// A failed prefetch is retried below, so the error comes from this call
+		try
+		{
+			ImagePointer image = pending.get();
+			std::lock_guard<std::mutex> lock(_mutex);
+			_statistics.hits++;
+			return image;
+		}
+		catch (...)
+		{
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_statistics.misses++;
+	}
+	const ImagePointer image = std::make_shared<const BMPImage>(path.c_str());
+	_insert(path, modificationTime, fileSize, image);
+	return image;
+}
+
+/// <summary>
+/// Decode a file in the background if it is not cached yet
+/// </summary>
+/// <param name="path"></param>
+void ImageCache::prefetch(const std::string& path)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_index.count(path) != 0 || _pending.count(path) != 0)
+		{
+			return;
+		}
+		_prefetchQueue.push_back(path);
+		if (_prefetchQueue.size() > MAX_PREFETCH_QUEUE)
+		{
+			_prefetchQueue.pop_front();
+		}
+	}
+	_condition.notify_one();
+}
+
+/// <summary>
+/// Drop every cached image, the counters are kept
+/// </summary>
+void ImageCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_entries.clear();
+	_index.clear();
+	_statistics.bytes = 0;
+	_statistics.imageCount = 0;
+}
+
+ImageCache::Statistics ImageCache::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
+
+std::ostream& operator<<(std::ostream& os, const ImageCache::Statistics& statistics)
+{
+	os << "Image cache: " << statistics.hits << " hits, " << statistics.misses << " misses, "
+		<< statistics.prefetches << " prefetches, " << statistics.evictions << " evictions, "
+		<< statistics.imageCount << " images (" << statistics.bytes / 1024 << " KiB)";
+	return os;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "BMPImage.h"
+
+// Decoded images by file, least recently used first out when the cache is over its size in bytes.
+// An entry is only reused while the file keeps the same modification time and size.
+// Files can be prefetched by a background thread, a request for a file being prefetched waits for it.
+class ImageCache
+{
+public:
+	struct Statistics {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t prefetches;
+		uint64_t evictions;
+		size_t bytes;
+		size_t imageCount;
+	};
+
+	static constexpr size_t DEFAULT_CAPACITY = static_cast<size_t>(512) << 20;
+
+private:
+	using ImagePointer = std::shared_ptr<const BMPImage>;
+
+	struct Entry {
+		std::string path;
+		int64_t modificationTime;
+		uintmax_t fileSize;
+		size_t bytes;
+		ImagePointer image;
+	};
+
+	size_t _capacity;
+	std::list<Entry> _entries;	// Most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+	std::unordered_map<std::string, std::shared_future<ImagePointer>> _pending;
+	Statistics _statistics{};
+	mutable std::mutex _mutex;
+
+	// Background loader
+	std::deque<std::string> _prefetchQueue;
+	std::condition_variable _condition;
+	bool _stopping = false;
+	std::thread _loader;
+
+	static bool _fileInfo(const std::string& path, int64_t& modificationTime, uintmax_t& fileSize);
+	ImagePointer _find(const std::string& path, int64_t modificationTime, uintmax_t fileSize);
+	void _insert(const std::string& path, int64_t modificationTime, uintmax_t fileSize, const ImagePointer& image);
+	void _loaderLoop();
+
+public:
+	explicit ImageCache(size_t capacity = DEFAULT_CAPACITY);
+	ImageCache(const ImageCache&) = delete;
+	ImageCache& operator=(const ImageCache&) = delete;
+	~ImageCache();
+
+	ImagePointer get(const std::string& path);
+	void prefetch(const std::string& path);
+	void clear();
+	Statistics getStatistics() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const ImageCache::Statistics& statistics);
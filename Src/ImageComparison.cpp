@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+#include "ImageComparison.h"
+#include "PixelConverter.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// Stabilizing constants of SSIM for 8 bits values
+	constexpr double SSIM_C1 = (0.01 * 255) * (0.01 * 255);
+	constexpr double SSIM_C2 = (0.03 * 255) * (0.03 * 255);
+
+	// Rows are compared a few at a time so that small images stay on one thread
+	constexpr int64_t MIN_ROWS_PER_CHUNK = 8;
+
+	struct Sums {
+		std::array<uint64_t, 4> absolute{};
+		std::array<uint64_t, 4> squared{};
+		std::array<uint8_t, 4> maxima{};
+	};
+}
+
+void ImageComparison::_checkSizes(const BMPImage& first, const BMPImage& second)
+{
+	if (first.getWidth() != second.getWidth() || first.getHeight() != second.getHeight())
+	{
+		throw std::invalid_argument("Images must have the same size to be compared");
+	}
+}
+
+/// <summary>
+/// Palette of 256 entries red, green, blue, alpha, opaque like the images without alpha
+/// </summary>
+std::vector<uint8_t> ImageComparison::_expandedPalette(const BMPImage& image)
+{
+	std::vector<uint8_t> palette(256 * 4, 0);
+	for (size_t i = 0; i < 256; i++)
+	{
+		if (i < image._palette.size())
+		{
+			std::copy(image._palette[i].begin(), image._palette[i].begin() + 3, palette.begin() + i * 4);
+		}
+		palette[i * 4 + 3] = 255;
+	}
+	return palette;
+}
+
+/// <summary>
+/// Row of an image as RGBA pixels
+/// </summary>
+/// <param name="image"></param>
+/// <param name="y">Row from the bottom</param>
+/// <param name="palette">Expanded palette of indexed images</param>
+/// <param name="indices">Scratch of width bytes for the 1 bit images</param>
+/// <param name="destination">4 bytes per pixel</param>
+void ImageComparison::_rgbaRow(const BMPImage& image, const uint32_t y, const uint8_t* palette, std::vector<uint8_t>& indices, uint8_t* destination)
+{
+	const size_t width = image.getWidth();
+	const uint8_t* source = image._pixelData.data() + y * image._getRowSize();
+	switch (image.getBitCount())
+	{
+	case BMPImage::DEEP_COLOR_BIT_SIZE:
+		std::memcpy(destination, source, width * 4);
+		break;
+	case BMPImage::TRUE_COLOR_BIT_SIZE:
+		PixelConverter::rgbToRgba(source, destination, width, 255);
+		break;
+	case BMPImage::MONOCHROME_BIT_SIZE:
+		PixelConverter::unpackBits(source, indices.data(), width);
+		PixelConverter::expandPalette(indices.data(), destination, width, palette, 4);
+		break;
+	default:
+		PixelConverter::expandPalette(source, destination, width, palette, 4);
+		break;
+	}
+}
+
+/// <summary>
+/// Differences of every channel, and of the image as a whole
+/// </summary>
+/// <param name="first"></param>
+/// <param name="second">Same size as the first image, any bit count</param>
+/// <returns></returns>
+ImageComparison::Result ImageComparison::compare(const BMPImage& first, const BMPImage& second)
+{
+	_checkSizes(first, second);
+	const uint32_t width = first.getWidth();
+	const uint32_t height = first.getHeight();
+	const std::vector<uint8_t> firstPalette = _expandedPalette(first);
+	const std::vector<uint8_t> secondPalette = _expandedPalette(second);
+
+	Sums total;
+	std::mutex mutex;
+	ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+	{
+		std::vector<uint8_t> firstRow(static_cast<size_t>(width) * 4);
+		std::vector<uint8_t> secondRow(firstRow.size());
+		std::vector<uint8_t> indices(width);
+		Sums sums;
+		for (int64_t y = begin; y < end; y++)
+		{
+			_rgbaRow(first, static_cast<uint32_t>(y), firstPalette.data(), indices, firstRow.data());
+			_rgbaRow(second, static_cast<uint32_t>(y), secondPalette.data(), indices, secondRow.data());
+			PixelConverter::differenceRgba(firstRow.data(), secondRow.data(), width, sums.absolute.data(), sums.squared.data(), sums.maxima.data());
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t c = 0; c < 4; c++)
+		{
+			total.absolute[c] += sums.absolute[c];
+			total.squared[c] += sums.squared[c];
+			total.maxima[c] = std::max(total.maxima[c], sums.maxima[c]);
+		}
+	}, MIN_ROWS_PER_CHUNK);
+
+	Result result{};
+	const bool alpha = first.getBitCount() == BMPImage::DEEP_COLOR_BIT_SIZE || second.getBitCount() == BMPImage::DEEP_COLOR_BIT_SIZE;
+	result.channelCount = alpha ? 4 : 3;
+	const double pixelCount = std::max(1.0, static_cast<double>(width) * height);
+	double squaredSum = 0;
+	for (uint16_t c = 0; c < result.channelCount; c++)
+	{
+		Channel& channel = result.channels[c];
+		channel.maxDifference = total.maxima[c];
+		channel.meanAbsoluteDifference = total.absolute[c] / pixelCount;
+		channel.mse = total.squared[c] / pixelCount;
+		channel.psnr = psnrOf(channel.mse);
+		result.maxDifference = std::max(result.maxDifference, channel.maxDifference);
+		squaredSum += static_cast<double>(total.squared[c]);
+	}
+	result.mse = squaredSum / (pixelCount * result.channelCount);
+	result.psnr = psnrOf(result.mse);
+	return result;
+}
+
+/// <summary>
+/// Mean structural similarity of the lumas, over square windows overlapping by half
+/// </summary>
+/// <param name="first"></param>
+/// <param name="second">Same size as the first image, any bit count</param>
+/// <param name="windowSize">Side of the windows, reduced for smaller images</param>
+/// <returns>1 for equal images, lower for less similar images</returns>
+double ImageComparison::ssim(const BMPImage& first, const BMPImage& second, const uint32_t windowSize)
+{
+	_checkSizes(first, second);
+	const uint32_t width = first.getWidth();
+	const uint32_t height = first.getHeight();
+	if (width == 0 || height == 0)
+	{
+		return 1;
+	}
+
+	// Luma planes, rows from the bottom
+	std::vector<uint8_t> firstLuma(static_cast<size_t>(width) * height);
+	std::vector<uint8_t> secondLuma(firstLuma.size());
+	const std::vector<uint8_t> firstPalette = _expandedPalette(first);
+	const std::vector<uint8_t> secondPalette = _expandedPalette(second);
+	ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+	{
+		std::vector<uint8_t> row(static_cast<size_t>(width) * 4);
+		std::vector<uint8_t> indices(width);
+		for (int64_t y = begin; y < end; y++)
+		{
+			_rgbaRow(first, static_cast<uint32_t>(y), firstPalette.data(), indices, row.data());
+			PixelConverter::rgbToGray(row.data(), firstLuma.data() + y * width, width, 4);
+			_rgbaRow(second, static_cast<uint32_t>(y), secondPalette.data(), indices, row.data());
+			PixelConverter::rgbToGray(row.data(), secondLuma.data() + y * width, width, 4);
+		}
+	}, MIN_ROWS_PER_CHUNK);
+
+	const uint32_t size = std::max(1u, std::min({windowSize, width, height}));
+	const uint32_t step = std::max(1u, size / 2);
+	const uint32_t columnCount = (width - size) / step + 1;
+	const uint32_t rowCount = (height - size) / step + 1;
+	const double sampleCount = static_cast<double>(size) * size;
+	double total = 0;
+	std::mutex mutex;
+	ThreadPool::instance().parallelFor(0, rowCount, [&](const int64_t begin, const int64_t end)
+	{
+		double sum = 0;
+		for (int64_t windowRow = begin; windowRow < end; windowRow++)
+		{
+			for (uint32_t windowColumn = 0; windowColumn < columnCount; windowColumn++)
+			{
+				uint32_t sumX = 0, sumY = 0;
+				uint64_t sumXX = 0, sumYY = 0, sumXY = 0;
+				for (uint32_t dy = 0; dy < size; dy++)
+				{
+					const size_t offset = (windowRow * step + dy) * static_cast<size_t>(width) + windowColumn * step;
+					const uint8_t* x = firstLuma.data() + offset;
+					const uint8_t* y = secondLuma.data() + offset;
+					for (uint32_t dx = 0; dx < size; dx++)
+					{
+						sumX += x[dx];
+						sumY += y[dx];
+						sumXX += static_cast<uint32_t>(x[dx]) * x[dx];
+						sumYY += static_cast<uint32_t>(y[dx]) * y[dx];
+						sumXY += static_cast<uint32_t>(x[dx]) * y[dx];
+					}
+				}
+				const double meanX = sumX / sampleCount;
+				const double meanY = sumY / sampleCount;
+				const double varianceX = sumXX / sampleCount - meanX * meanX;
+				const double varianceY = sumYY / sampleCount - meanY * meanY;
+				const double covariance = sumXY / sampleCount - meanX * meanY;
+				sum += (2 * meanX * meanY + SSIM_C1) * (2 * covariance + SSIM_C2) /
+					((meanX * meanX + meanY * meanY + SSIM_C1) * (varianceX + varianceY + SSIM_C2));
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		total += sum;
+	});
+	return total / (static_cast<double>(columnCount) * rowCount);
+}
+
+/// <summary>
+/// Gray image of the largest channel difference of each pixel
+/// </summary>
+/// <param name="first"></param>
+/// <param name="second">Same size as the first image, any bit count</param>
+/// <param name="threshold">Differences up to it are black</param>
+/// <returns>8 bits image with a gray palette</returns>
+BMPImage ImageComparison::diffMask(const BMPImage& first, const BMPImage& second, const uint8_t threshold)
+{
+	_checkSizes(first, second);
+	const uint32_t width = first.getWidth();
+	const uint32_t height = first.getHeight();
+	const std::vector<uint8_t> firstPalette = _expandedPalette(first);
+	const std::vector<uint8_t> secondPalette = _expandedPalette(second);
+	const size_t channelCount = first.getBitCount() == BMPImage::DEEP_COLOR_BIT_SIZE || second.getBitCount() == BMPImage::DEEP_COLOR_BIT_SIZE ? 4 : 3;
+	BMPImage mask(static_cast<int32_t>(width), static_cast<int32_t>(height), BMPImage::GRAY_SCALE_BIT_SIZE);
+	ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+	{
+		std::vector<uint8_t> firstRow(static_cast<size_t>(width) * 4);
+		std::vector<uint8_t> secondRow(firstRow.size());
+		std::vector<uint8_t> indices(width);
+		for (int64_t y = begin; y < end; y++)
+		{
+			_rgbaRow(first, static_cast<uint32_t>(y), firstPalette.data(), indices, firstRow.data());
+			_rgbaRow(second, static_cast<uint32_t>(y), secondPalette.data(), indices, secondRow.data());
+			const PixelSpan<uint8_t> row = mask.row<uint8_t>(static_cast<uint32_t>(y));
+			for (uint32_t x = 0; x < width; x++)
+			{
+				uint8_t difference = 0;
+				for (size_t c = 0; c < channelCount; c++)
+				{
+					const uint8_t a = firstRow[x * 4 + c];
+					const uint8_t b = secondRow[x * 4 + c];
+					difference = std::max(difference, static_cast<uint8_t>(a > b ? a - b : b - a));
+				}
+				row[x] = difference > threshold ? difference : 0;
+			}
+		}
+	}, MIN_ROWS_PER_CHUNK);
+	return mask;
+}
+
+/// <summary>
+/// Peak signal to noise ratio of 8 bits values
+/// </summary>
+/// <param name="mse">Mean squared error</param>
+/// <returns>In dB, infinite for a null error</returns>
+double ImageComparison::psnrOf(const double mse)
+{
+	if (mse <= 0)
+	{
+		return std::numeric_limits<double>::infinity();
+	}
+	return 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+std::ostream& operator<<(std::ostream& os, const ImageComparison::Result& result)
+{
+	static const char* const NAMES[] = {"red", "green", "blue", "alpha"};
+	const std::streamsize precision = os.precision();
+	os << std::fixed << std::setprecision(2) << "PSNR " << result.psnr << " dB, MSE " << result.mse
+		<< ", max difference " << static_cast<int>(result.maxDifference) << " (";
+	for (uint16_t c = 0; c < result.channelCount; c++)
+	{
+		os << (c != 0 ? ", " : "") << NAMES[c] << ' ' << static_cast<int>(result.channels[c].maxDifference);
+	}
+	os << ')' << std::defaultfloat;
+	os.precision(precision);
+	return os;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Differences between two images of the same size, to check the output of an operation against a reference.
+// Indexed images are compared through their palettes, and the alpha channel only when one of the images has one.
+// The rows are compared by the threads of the pool with SIMD kernels.
+class ImageComparison
+{
+public:
+	struct Channel {
+		uint8_t maxDifference;
+		double meanAbsoluteDifference;
+		double mse;						// Mean squared error
+		double psnr;					// Peak signal to noise ratio in dB, infinite for equal channels
+	};
+
+	struct Result {
+		std::array<Channel, 4> channels;	// Red, green, blue, alpha
+		uint16_t channelCount;			// 3, or 4 with alpha
+		uint8_t maxDifference;
+		double mse;
+		double psnr;
+	};
+
+	static constexpr uint32_t DEFAULT_SSIM_WINDOW = 8;
+
+private:
+	static void _checkSizes(const BMPImage& first, const BMPImage& second);
+	static std::vector<uint8_t> _expandedPalette(const BMPImage& image);
+	static void _rgbaRow(const BMPImage& image, uint32_t y, const uint8_t* palette, std::vector<uint8_t>& indices, uint8_t* destination);
+
+public:
+	static Result compare(const BMPImage& first, const BMPImage& second);
+	static double ssim(const BMPImage& first, const BMPImage& second, uint32_t windowSize = DEFAULT_SSIM_WINDOW);
+	static BMPImage diffMask(const BMPImage& first, const BMPImage& second, uint8_t threshold = 0);
+	static double psnrOf(double mse);
+};
+
+std::ostream& operator<<(std::ostream& os, const ImageComparison::Result& result);
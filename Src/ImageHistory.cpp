@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "ImageHistory.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	size_t tileCount(const size_t size, const size_t tileSize)
+	{
+		return (size + tileSize - 1) / tileSize;
+	}
+}
+
+/// <summary>
+/// Empty history, the image is its current state
+/// </summary>
+/// <param name="image">Must outlive the history</param>
+/// <param name="capacity">Bytes of tiles kept at most by the steps</param>
+ImageHistory::ImageHistory(BMPImage& image, const size_t capacity) : _image(image), _capacity(capacity)
+{
+}
+
+/// <summary>
+/// Copy the headers and every tile of the image
+/// </summary>
+ImageHistory::Snapshot ImageHistory::_capture() const
+{
+	Snapshot snapshot{_image._fileHeader, _image._v4InfoHeader, _image._palette, _image._getRowSize(),
+		static_cast<size_t>(std::max(_image._v4InfoHeader.height, 0)), {}, 0};
+	const size_t columnCount = tileCount(snapshot.rowSize, TILE_ROW_BYTES);
+	const size_t rowCount = tileCount(snapshot.height, TILE_ROWS);
+	snapshot.tiles.resize(rowCount * columnCount);
+	const uint8_t* pixels = _image._pixelData.data();
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(rowCount), [&](const int64_t first, const int64_t last)
+	{
+		for (size_t tileY = static_cast<size_t>(first); tileY < static_cast<size_t>(last); tileY++)
+		{
+			const size_t y = tileY * TILE_ROWS;
+			const size_t rows = std::min(TILE_ROWS, snapshot.height - y);
+			for (size_t tileX = 0; tileX < columnCount; tileX++)
+			{
+				const size_t x = tileX * TILE_ROW_BYTES;
+				const size_t width = std::min(TILE_ROW_BYTES, snapshot.rowSize - x);
+				std::vector<uint8_t>& tile = snapshot.tiles[tileY * columnCount + tileX];
+				tile.resize(rows * width);
+				for (size_t row = 0; row < rows; row++)
+				{
+					std::memcpy(tile.data() + row * width, pixels + (y + row) * snapshot.rowSize + x, width);
+				}
+			}
+		}
+	});
+	snapshot.bytes = snapshot.rowSize * snapshot.height;
+	return snapshot;
+}
+
+/// <summary>
+/// Exchange the state of the image with another one. With the same layout only the tiles of the snapshot are swapped,
+/// otherwise the snapshot holds every tile and gets every tile of the image.
+/// </summary>
+void ImageHistory::_swap(Snapshot& other)
+{
+	const bool sameLayout = _image._getRowSize() == other.rowSize &&
+		static_cast<size_t>(std::max(_image._v4InfoHeader.height, 0)) == other.height;
+	Snapshot current;
+	if (!sameLayout)
+	{
+		current = _capture();
+		_image._pixelData.assign(other.rowSize * other.height, 0);
+	}
+	std::swap(_image._fileHeader, other.fileHeader);
+	std::swap(_image._v4InfoHeader, other.infoHeader);
+	std::swap(_image._palette, other.palette);
+	_image._invalidateContentHash();
+
+	const size_t rowSize = other.rowSize;
+	const size_t columnCount = tileCount(rowSize, TILE_ROW_BYTES);
+	uint8_t* pixels = _image._pixelData.data();
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(tileCount(other.height, TILE_ROWS)), [&](const int64_t first, const int64_t last)
+	{
+		for (size_t tileY = static_cast<size_t>(first); tileY < static_cast<size_t>(last); tileY++)
+		{
+			const size_t y = tileY * TILE_ROWS;
+			for (size_t tileX = 0; tileX < columnCount; tileX++)
+			{
+				std::vector<uint8_t>& tile = other.tiles[tileY * columnCount + tileX];
+				if (tile.empty())
+				{
+					continue;
+				}
+				const size_t x = tileX * TILE_ROW_BYTES;
+				const size_t width = std::min(TILE_ROW_BYTES, rowSize - x);
+				for (size_t row = 0; row * width < tile.size(); row++)
+				{
+					uint8_t* line = pixels + (y + row) * rowSize + x;
+					std::swap_ranges(line, line + width, tile.data() + row * width);
+				}
+			}
+		}
+	});
+	if (!sameLayout)
+	{
+		other = std::move(current);
+	}
+}
+
+/// <summary>
+/// Add a step after the current one, the steps that could be redone are dropped
+/// </summary>
+ImageHistory::Result ImageHistory::_record(Step step)
+{
+	while (_steps.size() > _current)
+	{
+		_bytes -= _steps.back().other.bytes;
+		_steps.pop_back();
+	}
+	if (step.other.bytes > _capacity)
+	{
+		// The steps before lead to the image before this one, they can not be undone without it
+		_steps.clear();
+		_current = 0;
+		_bytes = 0;
+		return Result::TOO_LARGE;
+	}
+	_bytes += step.other.bytes;
+	_steps.push_back(std::move(step));
+	_current = _steps.size();
+	while (_bytes > _capacity)
+	{
+		_bytes -= _steps.front().other.bytes;
+		_steps.pop_front();
+		_current--;
+	}
+	return Result::RECORDED;
+}
+
+/// <summary>
+/// Run an operation that can not be undone exactly, the tiles it changes are kept as they were before it.
+/// The image is copied while the operation runs, and put back when it throws.
+/// </summary>
+/// <param name="operation">Any change of the image</param>
+ImageHistory::Result ImageHistory::apply(const Operation& operation)
+{
+	Step step{nullptr, nullptr, _capture()};
+	Snapshot& before = step.other;
+	try
+	{
+		operation(_image);
+	}
+	catch (...)
+	{
+		_swap(before);
+		throw;
+	}
+
+	const size_t rowSize = _image._getRowSize();
+	const size_t height = static_cast<size_t>(std::max(_image._v4InfoHeader.height, 0));
+	if (rowSize == before.rowSize && height == before.height)
+	{
+		// The tiles left unchanged are already in the image
+		const size_t columnCount = tileCount(rowSize, TILE_ROW_BYTES);
+		const uint8_t* pixels = _image._pixelData.data();
+		std::atomic<size_t> changedBytes{0};
+		ThreadPool::instance().parallelFor(0, static_cast<int64_t>(tileCount(height, TILE_ROWS)), [&](const int64_t first, const int64_t last)
+		{
+			size_t bytes = 0;
+			for (size_t tileY = static_cast<size_t>(first); tileY < static_cast<size_t>(last); tileY++)
+			{
+				const size_t y = tileY * TILE_ROWS;
+				for (size_t tileX = 0; tileX < columnCount; tileX++)
+				{
+					std::vector<uint8_t>& tile = before.tiles[tileY * columnCount + tileX];
+					const size_t x = tileX * TILE_ROW_BYTES;
+					const size_t width = std::min(TILE_ROW_BYTES, rowSize - x);
+					bool unchanged = true;
+					for (size_t row = 0; row * width < tile.size() && unchanged; row++)
+					{
+						unchanged = std::memcmp(tile.data() + row * width, pixels + (y + row) * rowSize + x, width) == 0;
+					}
+					if (unchanged)
+					{
+						std::vector<uint8_t>().swap(tile);
+					}
+					else
+					{
+						bytes += tile.size();
+					}
+				}
+			}
+			changedBytes += bytes;
+		});
+		before.bytes = changedBytes;
+		if (before.bytes == 0 && before.palette == _image._palette &&
+			std::memcmp(&before.fileHeader, &_image._fileHeader, sizeof(before.fileHeader)) == 0 &&
+			std::memcmp(&before.infoHeader, &_image._v4InfoHeader, sizeof(before.infoHeader)) == 0)
+		{
+			return Result::UNCHANGED;
+		}
+	}
+	return _record(std::move(step));
+}
+
+/// <summary>
+/// Run an operation that can be undone exactly, only the operation is kept
+/// </summary>
+/// <param name="operation"></param>
+/// <param name="inverse">Gives back the image the operation was applied to</param>
+ImageHistory::Result ImageHistory::apply(const Operation& operation, const Operation& inverse)
+{
+	operation(_image);
+	return _record(Step{operation, inverse, Snapshot{}});
+}
+
+/// <summary>
+/// Apply a lookup table, kept as an operation when it has an inverse and as tiles otherwise
+/// </summary>
+/// <param name="lut"></param>
+ImageHistory::Result ImageHistory::applyLUT(const ColorLUT& lut)
+{
+	if (lut.isIdentity())
+	{
+		return Result::UNCHANGED;
+	}
+	ColorLUT inverse;
+	if (lut.inverse(inverse))
+	{
+		return apply([lut](BMPImage& image) { image.applyLUT(lut); }, [inverse](BMPImage& image) { image.applyLUT(inverse); });
+	}
+	return apply([&lut](BMPImage& image) { image.applyLUT(lut); });
+}
+
+/// <summary>
+/// Go back to the state before the last step
+/// </summary>
+/// <returns>False when there is nothing to undo</returns>
+bool ImageHistory::undo()
+{
+	if (!canUndo())
+	{
+		return false;
+	}
+	Step& step = _steps[_current - 1];
+	if (step.backward)
+	{
+		step.backward(_image);
+	}
+	else
+	{
+		_bytes -= step.other.bytes;
+		_swap(step.other);
+		_bytes += step.other.bytes;
+	}
+	_current--;
+	return true;
+}
+
+/// <summary>
+/// Do again the step that was undone last
+/// </summary>
+/// <returns>False when there is nothing to redo</returns>
+bool ImageHistory::redo()
+{
+	if (!canRedo())
+	{
+		return false;
+	}
+	Step& step = _steps[_current];
+	if (step.forward)
+	{
+		step.forward(_image);
+	}
+	else
+	{
+		_bytes -= step.other.bytes;
+		_swap(step.other);
+		_bytes += step.other.bytes;
+	}
+	_current++;
+	return true;
+}
+
+bool ImageHistory::canUndo() const
+{
+	return _current > 0;
+}
+
+bool ImageHistory::canRedo() const
+{
+	return _current < _steps.size();
+}
+
+/// <summary>
+/// Bytes of the tiles kept by the steps, the image itself is not counted
+/// </summary>
+size_t ImageHistory::getBytes() const
+{
+	return _bytes;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Undo and redo of the operations applied to an image. The current state is the image itself, the history only keeps
+// what is needed to move between states. An operation that can be undone exactly, like invertColors, rotate90,
+// swapChannels or a lookup table without clipping, is kept as the operation and its inverse, without any pixel.
+// Another operation keeps the tiles it changed, of TILE_ROWS rows by TILE_ROW_BYTES bytes, as they were before it:
+// undo and redo swap these tiles with the ones of the image, so they cost the changed area. The oldest steps are
+// dropped when the tiles of every step use more than the capacity, and a step larger than the capacity clears the history.
+// Every change of the image must go through the history.
+class ImageHistory
+{
+public:
+	static constexpr size_t DEFAULT_CAPACITY = static_cast<size_t>(256) << 20;
+	static constexpr size_t TILE_ROWS = 64;
+	static constexpr size_t TILE_ROW_BYTES = 256;
+
+	using Operation = std::function<void(BMPImage&)>;
+
+	enum class Result
+	{
+		UNCHANGED,	// Nothing was recorded
+		RECORDED,
+		TOO_LARGE,	// The image changed but the step is over the capacity, nothing can be undone anymore
+	};
+
+private:
+	// Headers and tiles of the image in another state
+	struct Snapshot {
+		BMPImage::BMPFileHeader fileHeader;
+		BMPImage::BMPV4InfoHeader infoHeader;
+		std::vector<std::array<uint8_t, 4>> palette;
+		size_t rowSize;
+		size_t height;
+		std::vector<std::vector<uint8_t>> tiles;	// Row by row of tiles from the bottom, empty when the image holds the same
+		size_t bytes;
+	};
+
+	struct Step {
+		Operation forward;		// Set for the operations kept as such
+		Operation backward;
+		Snapshot other;			// Otherwise, the changed tiles before the step while it is done, after it once undone
+	};
+
+	BMPImage& _image;
+	size_t _capacity;
+	size_t _bytes = 0;
+	std::deque<Step> _steps;
+	size_t _current = 0;	// Steps done, the others can be redone
+
+	Snapshot _capture() const;
+	void _swap(Snapshot& other);
+	Result _record(Step step);
+
+public:
+	explicit ImageHistory(BMPImage& image, size_t capacity = DEFAULT_CAPACITY);
+	ImageHistory(const ImageHistory&) = delete;
+	ImageHistory& operator=(const ImageHistory&) = delete;
+
+	Result apply(const Operation& operation);
+	Result apply(const Operation& operation, const Operation& inverse);
+	Result applyLUT(const ColorLUT& lut);
+	bool undo();
+	bool redo();
+	bool canUndo() const;
+	bool canRedo() const;
+	size_t getBytes() const;
+};
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "ImageIndex.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// First line of the index file, an index of another version is rebuilt
+	constexpr const char* INDEX_VERSION = "imageindex 1";
+
+	// Files probed by each task, small as probing is mostly waiting for the disk
+	constexpr int64_t PROBE_CHUNK_SIZE = 16;
+
+	bool lessByName(const ImageIndex::Entry& a, const ImageIndex::Entry& b)
+	{
+		return a.name < b.name;
+	}
+}
+
+/// <summary>
+/// Index of a directory, as saved by the last refresh
+/// </summary>
+/// <param name="directory"></param>
+ImageIndex::ImageIndex(std::string directory) : _directory(std::move(directory))
+{
+	_load();
+}
+
+/// <summary>
+/// Read the saved entries, a missing or damaged index file gives an empty index
+/// </summary>
+void ImageIndex::_load()
+{
+	std::ifstream file(std::filesystem::path(_directory) / FILE_NAME);
+	std::string line;
+	if (!std::getline(file, line) || line != INDEX_VERSION)
+	{
+		return;
+	}
+	// name, modification time, size, format, width, height, bit count, compression, offset of the pixels
+	while (std::getline(file, line))
+	{
+		const size_t separator = line.find('\t');
+		if (separator == std::string::npos)
+		{
+			_entries.clear();
+			return;
+		}
+		Entry entry{line.substr(0, separator), 0, 0, {}};
+		std::istringstream fields(line.substr(separator + 1));
+		int format;
+		fields >> entry.modificationTime >> entry.fileSize >> format >> entry.info.width >> entry.info.height
+			>> entry.info.bitCount >> entry.info.compression >> entry.info.offsetData;
+		if (!fields || format < 0 || format > static_cast<int>(BMPImage::FileFormat::PNM))
+		{
+			_entries.clear();
+			return;
+		}
+		entry.info.format = static_cast<BMPImage::FileFormat>(format);
+		_entries.push_back(std::move(entry));
+	}
+	std::sort(_entries.begin(), _entries.end(), lessByName);
+}
+
+/// <summary>
+/// Write the entries to a temporary file renamed over the index, so a reader never sees half of it.
+/// The index is only kept in memory when the directory is not writable.
+/// </summary>
+void ImageIndex::_save() const
+{
+	const std::filesystem::path path = std::filesystem::path(_directory) / FILE_NAME;
+	std::filesystem::path temporaryPath = path;
+	temporaryPath += ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::trunc);
+		if (!file)
+		{
+			return;
+		}
+		file << INDEX_VERSION << '\n';
+		for (const Entry& entry : _entries)
+		{
+			file << entry.name << '\t' << entry.modificationTime << ' ' << entry.fileSize << ' '
+				<< static_cast<int>(entry.info.format) << ' ' << entry.info.width << ' ' << entry.info.height << ' '
+				<< entry.info.bitCount << ' ' << entry.info.compression << ' ' << entry.info.offsetData << '\n';
+		}
+		if (!file.flush())
+		{
+			file.close();
+			std::error_code error;
+			std::filesystem::remove(temporaryPath, error);
+			return;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error)
+	{
+		std::filesystem::remove(temporaryPath, error);
+	}
+}
+
+/// <summary>
+/// Bring the index up to date with the directory: new and changed files are probed in parallel,
+/// the entries of removed files are dropped, and the index file is saved when something changed.
+/// </summary>
+/// <returns>Number of files probed</returns>
+size_t ImageIndex::refresh()
+{
+	std::unordered_map<std::string, const Entry*> previous;
+	previous.reserve(_entries.size());
+	for (const Entry& entry : _entries)
+	{
+		previous.emplace(entry.name, &entry);
+	}
+
+	std::vector<Entry> entries;
+	std::vector<size_t> changed;
+	std::error_code error;
+	for (std::filesystem::directory_iterator it(_directory, error), end; !error && it != end; it.increment(error))
+	{
+		const std::filesystem::directory_entry& file = *it;
+		std::string name = file.path().filename().string();
+		std::error_code fileError;
+		if (!file.is_regular_file(fileError) || name.compare(0, std::char_traits<char>::length(FILE_NAME), FILE_NAME) == 0 ||
+			name.find_first_of("\t\n") != std::string::npos)
+		{
+			continue;
+		}
+		const std::filesystem::file_time_type time = file.last_write_time(fileError);
+		const uintmax_t fileSize = fileError ? 0 : file.file_size(fileError);
+		if (fileError)
+		{
+			continue;
+		}
+		const int64_t modificationTime = static_cast<int64_t>(time.time_since_epoch().count());
+		const auto found = previous.find(name);
+		if (found != previous.end() && found->second->modificationTime == modificationTime && found->second->fileSize == fileSize)
+		{
+			entries.push_back(*found->second);
+			continue;
+		}
+		changed.push_back(entries.size());
+		entries.push_back(Entry{std::move(name), modificationTime, fileSize, {}});
+	}
+
+	ThreadPool::instance().parallelFor(0, static_cast<int64_t>(changed.size()), [&](const int64_t first, const int64_t last)
+	{
+		for (int64_t i = first; i < last; i++)
+		{
+			Entry& entry = entries[changed[i]];
+			const std::string path = (std::filesystem::path(_directory) / entry.name).string();
+			try
+			{
+				entry.info = BMPImage::probe(path.c_str());
+			}
+			catch (const std::exception&)
+			{
+				entry.info = BMPImage::Info{BMPImage::FileFormat::BMP, 0, 0, 0, 0, 0};
+			}
+		}
+	}, PROBE_CHUNK_SIZE);
+
+	std::sort(entries.begin(), entries.end(), lessByName);
+	const bool modified = !changed.empty() || entries.size() != _entries.size();
+	_entries = std::move(entries);
+	if (modified)
+	{
+		_save();
+	}
+	return changed.size();
+}
+
+const std::vector<ImageIndex::Entry>& ImageIndex::getEntries() const
+{
+	return _entries;
+}
+
+/// <summary>
+/// Entries of the files with an extension, as of the last refresh
+/// </summary>
+/// <param name="extension">Like ".bmp"</param>
+std::vector<ImageIndex::Entry> ImageIndex::getEntries(const std::string& extension) const
+{
+	std::vector<Entry> entries;
+	for (const Entry& entry : _entries)
+	{
+		if (std::filesystem::path(entry.name).extension() == extension)
+		{
+			entries.push_back(entry);
+		}
+	}
+	return entries;
+}
+
+/// <summary>
+/// Entry of a file, as of the last refresh
+/// </summary>
+/// <param name="name">File name in the directory</param>
+/// <returns>nullptr when the file is not indexed</returns>
+const ImageIndex::Entry* ImageIndex::find(const std::string& name) const
+{
+	const auto found = std::lower_bound(_entries.begin(), _entries.end(), name,
+		[](const Entry& entry, const std::string& value) { return entry.name < value; });
+	return found != _entries.end() && found->name == name ? &*found : nullptr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Header fields of the image files of a directory, kept in a file of that directory so listing it again
+// does not open every image. A file is probed again only when its modification time or size changed.
+// A tree is indexed with one index per directory. Every file is indexed, so that listings of different extensions
+// share the index of a directory.
+class ImageIndex
+{
+public:
+	struct Entry {
+		std::string name;
+		int64_t modificationTime;
+		uintmax_t fileSize;
+		BMPImage::Info info;	// Bit count of 0 when the file could not be read as an image
+	};
+
+	static constexpr const char* FILE_NAME = ".imageindex";
+
+private:
+	std::string _directory;
+	std::vector<Entry> _entries;	// Sorted by name
+
+	void _load();
+	void _save() const;
+
+public:
+	explicit ImageIndex(std::string directory);
+
+	size_t refresh();
+	const std::vector<Entry>& getEntries() const;
+	std::vector<Entry> getEntries(const std::string& extension) const;
+	const Entry* find(const std::string& name) const;
+};
@@ -0,0 +1,150 @@
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <thread>
+
+#include "BoundedQueue.h"
+#include "ImagePipeline.h"
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	double secondsSince(const Clock::time_point start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+}
+
+/// <summary>
+/// Pipeline running an operation on every image
+/// </summary>
+/// <param name="operation">Called from the processing thread only, one image at a time</param>
+/// <param name="queueCapacity">Images waiting between two stages at most</param>
+ImagePipeline::ImagePipeline(Operation operation, const size_t queueCapacity)
+	: _operation(std::move(operation)), _queueCapacity(queueCapacity)
+{
+}
+
+/// <summary>
+/// Load, process and save every file. A failed file is reported and the others go on.
+/// </summary>
+/// <param name="jobs"></param>
+/// <param name="onResult">Called from the saving thread when a file is done, in the order of the jobs</param>
+/// <returns></returns>
+ImagePipeline::Statistics ImagePipeline::run(const std::vector<Job>& jobs, const std::function<void(const Result&)>& onResult) const
+{
+	const Clock::time_point start = Clock::now();
+	Statistics statistics{jobs.size(), 0, 0.0, 0.0, 0.0, 0.0};
+	BoundedQueue<Item> loaded(_queueCapacity);
+	BoundedQueue<Item> processed(_queueCapacity);
+
+	std::thread loader([&]
+	{
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			const Clock::time_point begin = Clock::now();
+			Item item{i, BMPImage(), ""};
+			try
+			{
+				item.image.load(jobs[i].input.c_str());
+			}
+			catch (const std::exception& e)
+			{
+				item.error = e.what();
+			}
+			statistics.loadSeconds += secondsSince(begin);
+			if (!loaded.push(std::move(item)))
+			{
+				break;
+			}
+		}
+		loaded.close();
+	});
+
+	std::thread processor([&]
+	{
+		Item item{0, BMPImage(), ""};
+		while (loaded.pop(item))
+		{
+			const Clock::time_point begin = Clock::now();
+			if (item.error.empty())
+			{
+				try
+				{
+					_operation(item.image);
+				}
+				catch (const std::exception& e)
+				{
+					item.error = e.what();
+				}
+			}
+			statistics.processSeconds += secondsSince(begin);
+			if (!processed.push(std::move(item)))
+			{
+				break;
+			}
+		}
+		processed.close();
+	});
+
+	// The calling thread saves, so the results are reported from it
+	try
+	{
+		Item item{0, BMPImage(), ""};
+		while (processed.pop(item))
+		{
+			const Clock::time_point begin = Clock::now();
+			const Job& job = jobs[item.index];
+			if (item.error.empty())
+			{
+				try
+				{
+					std::ofstream file(job.output, std::ios::binary);
+					if (!file)
+					{
+						throw std::runtime_error("Could not create file " + job.output);
+					}
+					item.image.write(file, BMPImage::formatOf(job.output));
+				}
+				catch (const std::exception& e)
+				{
+					item.error = e.what();
+				}
+			}
+			// The pixels go back to the pool before the next image is taken
+			item.image = BMPImage();
+			statistics.saveSeconds += secondsSince(begin);
+			statistics.failureCount += item.error.empty() ? 0 : 1;
+			if (onResult)
+			{
+				onResult(Result{item.index, job.input, job.output, item.error.empty(), item.error});
+			}
+		}
+	}
+	catch (...)
+	{
+		// A throwing callback stops the other stages before the error goes up
+		loaded.close();
+		processed.close();
+		loader.join();
+		processor.join();
+		throw;
+	}
+	loader.join();
+	processor.join();
+	statistics.totalSeconds = secondsSince(start);
+	return statistics;
+}
+
+std::ostream& operator<<(std::ostream& os, const ImagePipeline::Statistics& statistics)
+{
+	const std::streamsize precision = os.precision(3);
+	const std::ios::fmtflags flags = os.setf(std::ios::fixed, std::ios::floatfield);
+	os << "Pipeline: " << statistics.fileCount << " files, " << statistics.failureCount << " failures in " << statistics.totalSeconds
+		<< " s (loading " << statistics.loadSeconds << " s, processing " << statistics.processSeconds << " s, saving "
+		<< statistics.saveSeconds << " s)";
+	os.precision(precision);
+	os.flags(flags);
+	return os;
+}
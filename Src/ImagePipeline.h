@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Runs the same operations on many files in three stages: loading (reading and decoding) and the operations on threads
+// of their own, and saving (encoding and writing) on the calling thread. The stages are joined by bounded queues, so the
+// file after the one being processed is read while the one before it is written, and at most a few decoded images wait.
+// The operations still split their rows between the threads of the pool.
+class ImagePipeline
+{
+public:
+	using Operation = std::function<void(BMPImage&)>;
+
+	struct Job {
+		std::string input;
+		std::string output;		// Format from the extension
+	};
+
+	struct Result {
+		size_t index;			// Of the job
+		std::string input;
+		std::string output;
+		bool succeeded;
+		std::string error;
+	};
+
+	struct Statistics {
+		size_t fileCount;
+		size_t failureCount;
+		double loadSeconds;		// Busy time of each stage, they overlap
+		double processSeconds;
+		double saveSeconds;
+		double totalSeconds;
+	};
+
+	static constexpr size_t DEFAULT_QUEUE_CAPACITY = 2;
+
+private:
+	struct Item {
+		size_t index;
+		BMPImage image;
+		std::string error;		// Empty while the file is processed without error
+	};
+
+	Operation _operation;
+	size_t _queueCapacity;
+
+public:
+	explicit ImagePipeline(Operation operation, size_t queueCapacity = DEFAULT_QUEUE_CAPACITY);
+
+	Statistics run(const std::vector<Job>& jobs, const std::function<void(const Result&)>& onResult = nullptr) const;
+};
+
+std::ostream& operator<<(std::ostream& os, const ImagePipeline::Statistics& statistics);
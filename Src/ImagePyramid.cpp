@@ -0,0 +1,142 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "BMPImage.h"
+#include "ImagePyramid.h"
+#include "PixelConverter.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// Rows of a level reduced by each task
+	constexpr int64_t REDUCE_CHUNK_SIZE = 16;
+}
+
+/// <summary>
+/// Build the levels, each from the previous one
+/// </summary>
+/// <param name="image"></param>
+/// <param name="levelCount">Levels including the image, 0 for every level down to 1x1</param>
+ImagePyramid::ImagePyramid(const BMPImage& image, const uint32_t levelCount)
+{
+	if (image.getWidth() == 0 || image.getHeight() == 0)
+	{
+		throw std::invalid_argument("The image is empty");
+	}
+	// The mean of gray ramp indices is the index of the mean gray, other palette images are averaged as true colors
+	const BMPImage* source = &image;
+	BMPImage converted;
+	if (image._hasGrayRamp())
+	{
+		_palette = image._palette;
+	}
+	else if (image.getBitCount() != BMPImage::DEEP_COLOR_BIT_SIZE && image.getBitCount() != BMPImage::TRUE_COLOR_BIT_SIZE)
+	{
+		converted = image;
+		converted.convertTo(BMPImage::TRUE_COLOR_BIT_SIZE);
+		source = &converted;
+	}
+	_bitCount = source->getBitCount();
+	const uint16_t byteCount = _bitCount / 8;
+
+	// Sizes first, so the levels share one allocation
+	int32_t width = static_cast<int32_t>(image.getWidth());
+	int32_t height = static_cast<int32_t>(image.getHeight());
+	size_t size = 0;
+	while (true)
+	{
+		const size_t rowSize = static_cast<size_t>(width) * byteCount;
+		_levels.push_back(Level{width, height, size, rowSize});
+		size += rowSize * height;
+		if ((width == 1 && height == 1) || _levels.size() == levelCount)
+		{
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	_pixelData.resize(size);
+	std::memcpy(_pixelData.data(), source->_pixelData.data(), _levels[0].rowSize * _levels[0].height);
+
+	for (size_t i = 1; i < _levels.size(); i++)
+	{
+		const Level& previous = _levels[i - 1];
+		const Level& level = _levels[i];
+		const uint8_t* previousPixels = _pixelData.data() + previous.offset;
+		uint8_t* pixels = _pixelData.data() + level.offset;
+		ThreadPool::instance().parallelFor(0, level.height, [&](const int64_t first, const int64_t last)
+		{
+			for (int64_t y = first; y < last; y++)
+			{
+				// The last row of an odd height is averaged with itself
+				const int64_t secondY = std::min<int64_t>(2 * y + 1, previous.height - 1);
+				PixelConverter::reduceRows(previousPixels + 2 * y * previous.rowSize, previousPixels + secondY * previous.rowSize,
+					pixels + y * level.rowSize, previous.width, byteCount);
+			}
+		}, REDUCE_CHUNK_SIZE);
+	}
+}
+
+size_t ImagePyramid::getLevelCount() const
+{
+	return _levels.size();
+}
+
+const ImagePyramid::Level& ImagePyramid::getLevel(const size_t level) const
+{
+	if (level >= _levels.size())
+	{
+		throw std::out_of_range("Pyramid level out of range");
+	}
+	return _levels[level];
+}
+
+uint16_t ImagePyramid::getBitCount() const
+{
+	return _bitCount;
+}
+
+/// <summary>
+/// Pixels of a level, in the layout of the BMPImage pixels
+/// </summary>
+/// <param name="level"></param>
+/// <returns></returns>
+const uint8_t* ImagePyramid::getPixels(const size_t level) const
+{
+	return _pixelData.data() + getLevel(level).offset;
+}
+
+/// <summary>
+/// Copy of a level as an image
+/// </summary>
+/// <param name="level"></param>
+/// <returns></returns>
+BMPImage ImagePyramid::getImage(const size_t level) const
+{
+	const Level& description = getLevel(level);
+	BMPImage image(description.width, description.height, _bitCount);
+	if (!_palette.empty())
+	{
+		image.setPalette(_palette);
+	}
+	std::memcpy(image._pixelData.data(), getPixels(level), description.rowSize * description.height);
+	return image;
+}
+
+/// <summary>
+/// Write every level as a BMP file named prefix_<level>.bmp
+/// </summary>
+/// <param name="prefix">Path and start of the file names</param>
+void ImagePyramid::save(const std::string& prefix) const
+{
+	for (size_t level = 0; level < _levels.size(); level++)
+	{
+		std::ofstream file(prefix + "_" + std::to_string(level) + ".bmp", std::ios::binary);
+		if (!file)
+		{
+			throw std::runtime_error("Could not create file");
+		}
+		getImage(level).write(file, BMPImage::FileFormat::BMP);
+	}
+}
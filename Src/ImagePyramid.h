@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BufferPool.h"
+
+class BMPImage;
+
+// Successive halvings of an image, down to 1x1 or a number of levels, level 0 being the image itself.
+// Each level is the 2x2 mean of the previous one, and every level lives in the same buffer.
+// Levels are 32 bits for 32 bits images, 8 bits for gray images and 24 bits otherwise.
+class ImagePyramid
+{
+public:
+	struct Level {
+		int32_t width;
+		int32_t height;
+		size_t offset;	// Of the first row in the pixel buffer
+		size_t rowSize;
+	};
+
+private:
+	PixelBuffer _pixelData;	// Every level, largest first, rows from the bottom without padding
+	std::vector<Level> _levels;
+	uint16_t _bitCount;
+	std::vector<std::array<uint8_t, 4>> _palette;
+
+public:
+	ImagePyramid(const BMPImage& image, uint32_t levelCount = 0);
+
+	size_t getLevelCount() const;
+	const Level& getLevel(size_t level) const;
+	uint16_t getBitCount() const;
+	const uint8_t* getPixels(size_t level) const;
+	BMPImage getImage(size_t level) const;
+	void save(const std::string& prefix) const;
+};
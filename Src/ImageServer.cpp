@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "ImageServer.h"
+#include "Log.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Delay between two checks of a stop request while waiting for a client
+	constexpr int POLL_TIMEOUT_MS = 200;
+
+#ifndef _WIN32
+	void sendAll(const int socket, const std::string& data)
+	{
+		size_t sent = 0;
+		while (sent < data.size())
+		{
+			const ssize_t count = ::send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if (count <= 0)
+			{
+				return;
+			}
+			sent += static_cast<size_t>(count);
+		}
+	}
+#endif
+}
+
+/// <summary>
+/// Server on a socket path, nothing is opened before run
+/// </summary>
+/// <param name="socketPath"></param>
+/// <param name="workerCount">Requests answered at the same time</param>
+/// <param name="cacheCapacity">Bytes of decoded images kept between requests</param>
+/// <param name="requestMemoryLimit">Bytes of image buffers a worker may allocate for a request, 0 for no limit</param>
+/// <param name="resultCacheDirectory">Where the results of the operations are kept, none when empty</param>
+/// <param name="resultCacheCapacity">Bytes of result files kept at most</param>
+ImageServer::ImageServer(std::string socketPath, const unsigned workerCount, const size_t cacheCapacity, const size_t requestMemoryLimit,
+	const std::string& resultCacheDirectory, const uintmax_t resultCacheCapacity)
+	: _socketPath(std::move(socketPath)), _workerCount(std::max(1u, workerCount)), _requestMemoryLimit(requestMemoryLimit), _cache(cacheCapacity)
+{
+	if (!resultCacheDirectory.empty())
+	{
+		_results = std::make_unique<ResultCache>(resultCacheDirectory, resultCacheCapacity);
+	}
+}
+
+/// <summary>
+/// Run operations on an image, or take their result from the result cache when they were already run on the same image
+/// </summary>
+/// <param name="image"></param>
+/// <param name="operations"></param>
+void ImageServer::_runOperations(BMPImage& image, const OperationChain& operations)
+{
+	if (operations.empty())
+	{
+		return;
+	}
+	const std::string description = operations.getDescription();
+	const uint64_t inputHash = _results ? image.contentHash() : 0;
+	if (_results && _results->find(inputHash, description, image))
+	{
+		return;
+	}
+	operations.apply(image);
+	if (_results)
+	{
+		_results->store(inputHash, description, image);
+	}
+}
+
+/// <summary>
+/// Run the operations of a request on one image. The operations between a load and a save are run together,
+/// so that their result can be memoized.
+/// </summary>
+/// <param name="request"></param>
+/// <returns>Answer line</returns>
+std::string ImageServer::_handle(const std::string& request)
+{
+	BMPImage image;
+	bool loaded = false;
+	OperationChain pending;
+	for (const OperationChain::Operation& operation : OperationChain::parse(request))
+	{
+		const std::string& name = operation.name;
+		const std::string& arguments = operation.arguments;
+		if (name == "load")
+		{
+			// The cached image stays untouched, the request works on a copy
+			pending.clear();
+			image = *_cache.get(arguments);
+			loaded = true;
+			continue;
+		}
+		if (!loaded)
+		{
+			throw std::invalid_argument("No image loaded before " + name);
+		}
+		if (name == "save")
+		{
+			_runOperations(image, pending);
+			pending.clear();
+			std::ofstream file(arguments, std::ios::binary);
+			if (!file)
+			{
+				throw std::runtime_error("Could not create file " + arguments);
+			}
+			image.write(file, BMPImage::formatOf(arguments));
+		}
+		else
+		{
+			pending.add(name, arguments);
+		}
+	}
+	if (!loaded)
+	{
+		throw std::invalid_argument("Empty request");
+	}
+	_runOperations(image, pending);
+	return "OK " + std::to_string(image.getWidth()) + " " + std::to_string(image.getHeight()) + " " + std::to_string(image.getBitCount());
+}
+
+#ifndef _WIN32
+/// <summary>
+/// Answer a request, then give its connection back to the polling thread
+/// </summary>
+void ImageServer::_answer(const Request& request)
+{
+	std::string answer;
+	bool failed = false;
+	try
+	{
+		// The images of the request are charged to an account of the worker with the request limit
+		const BufferPool::Scope scope(std::make_shared<BufferPool::Account>(nullptr, _requestMemoryLimit));
+		answer = _handle(request.line);
+	}
+	catch (const std::exception& e)
+	{
+		answer = std::string("ERROR ") + e.what();
+		failed = true;
+	}
+	Log::flush();
+	sendAll(request.client, answer + "\n");
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_statistics.requests++;
+		_statistics.failures += failed ? 1 : 0;
+		_answered.push_back(request.client);
+	}
+	// A full pipe already wakes the polling thread
+	const char byte = 0;
+	const ssize_t written = ::write(_wakePipe[1], &byte, 1);
+	(void)written;
+}
+
+void ImageServer::_workerLoop()
+{
+	while (true)
+	{
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this] { return _stopRequested || !_requests.empty(); });
+			if (_stopRequested)
+			{
+				return;
+			}
+			request = std::move(_requests.front());
+			_requests.pop_front();
+		}
+		_answer(request);
+	}
+}
+
+/// <summary>
+/// Queue the next complete request of a connection that has none in flight. Requests refused because the queue
+/// is full are answered at once, and the next one is tried.
+/// </summary>
+/// <returns>False when the connection must be closed</returns>
+bool ImageServer::_dispatch(const int client, Connection& connection)
+{
+	while (!connection.busy)
+	{
+		const size_t end = connection.buffer.find('\n');
+		if (end == std::string::npos)
+		{
+			if (connection.buffer.size() > MAX_REQUEST_SIZE)
+			{
+				sendAll(client, "ERROR Request is too long\n");
+				return false;
+			}
+			return true;
+		}
+		Request request{client, connection.buffer.substr(0, end)};
+		connection.buffer.erase(0, end + 1);
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_requests.size() >= MAX_QUEUED_REQUESTS)
+		{
+			_statistics.rejections++;
+			lock.unlock();
+			sendAll(client, "ERROR Server is busy\n");
+			continue;
+		}
+		_requests.push_back(std::move(request));
+		connection.busy = true;
+		lock.unlock();
+		_condition.notify_one();
+	}
+	return true;
+}
+
+void ImageServer::_accept(const int server)
+{
+	const int client = ::accept(server, nullptr, nullptr);
+	if (client < 0)
+	{
+		return;
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	_statistics.connections++;
+	if (_connections.size() >= MAX_CONNECTIONS)
+	{
+		_statistics.rejections++;
+		lock.unlock();
+		sendAll(client, "ERROR Server is busy\n");
+		::close(client);
+		return;
+	}
+	lock.unlock();
+	_connections.emplace(client, Connection{"", false});
+}
+
+void ImageServer::_close(const int client)
+{
+	::close(client);
+	_connections.erase(client);
+}
+
+/// <summary>
+/// Bind the socket path. A socket file that no server listens on anymore is replaced, any other file is left alone.
+/// </summary>
+/// <returns>Listening socket</returns>
+int ImageServer::_listen()
+{
+	sockaddr_un address{};
+	if (_socketPath.size() >= sizeof(address.sun_path))
+	{
+		throw std::invalid_argument("Socket path is too long");
+	}
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, _socketPath.c_str(), _socketPath.size() + 1);
+
+	struct stat status;
+	if (::lstat(_socketPath.c_str(), &status) == 0)
+	{
+		if (!S_ISSOCK(status.st_mode))
+		{
+			throw std::runtime_error(_socketPath + " exists and is not a socket");
+		}
+		const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe < 0)
+		{
+			throw std::runtime_error("Could not create the socket");
+		}
+		const bool listening = ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+		::close(probe);
+		if (listening)
+		{
+			throw std::runtime_error("Another server is listening on " + _socketPath);
+		}
+		// Left by a server that did not stop cleanly
+		::unlink(_socketPath.c_str());
+	}
+
+	const int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+	{
+		throw std::runtime_error("Could not create the socket");
+	}
+	if (::bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+		::listen(server, static_cast<int>(MAX_QUEUED_REQUESTS)) != 0)
+	{
+		::close(server);
+		throw std::runtime_error("Could not listen on " + _socketPath);
+	}
+	return server;
+}
+
+/// <summary>
+/// Listen on the socket and serve the clients until stop is called. The connections are polled by the calling thread,
+/// their requests are answered by the workers.
+/// </summary>
+void ImageServer::run()
+{
+	const int server = _listen();
+	if (::pipe(_wakePipe) != 0)
+	{
+		::close(server);
+		::unlink(_socketPath.c_str());
+		throw std::runtime_error("Could not create the wake up pipe");
+	}
+	::fcntl(_wakePipe[0], F_SETFL, O_NONBLOCK);
+	::fcntl(_wakePipe[1], F_SETFL, O_NONBLOCK);
+
+	for (unsigned i = 0; i < _workerCount; i++)
+	{
+		_workers.emplace_back(&ImageServer::_workerLoop, this);
+	}
+	std::vector<pollfd> descriptors;
+	while (!_stopRequested)
+	{
+		// The connections with a request in flight are left out until it is answered
+		descriptors.clear();
+		descriptors.push_back(pollfd{server, POLLIN, 0});
+		descriptors.push_back(pollfd{_wakePipe[0], POLLIN, 0});
+		for (const auto& connection : _connections)
+		{
+			if (!connection.second.busy)
+			{
+				descriptors.push_back(pollfd{connection.first, POLLIN, 0});
+			}
+		}
+		if (::poll(descriptors.data(), descriptors.size(), POLL_TIMEOUT_MS) < 0)
+		{
+			continue;
+		}
+
+		if (descriptors[1].revents != 0)
+		{
+			char bytes[64];
+			while (::read(_wakePipe[0], bytes, sizeof(bytes)) > 0)
+			{
+			}
+		}
+		std::vector<int> answered;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			answered.swap(_answered);
+		}
+		for (const int client : answered)
+		{
+			Connection& connection = _connections[client];
+			connection.busy = false;
+			// The next request may already be received
+			if (!_dispatch(client, connection))
+			{
+				_close(client);
+			}
+		}
+
+		for (size_t i = 2; i < descriptors.size(); i++)
+		{
+			const int client = descriptors[i].fd;
+			const auto found = _connections.find(client);
+			if (descriptors[i].revents == 0 || found == _connections.end() || found->second.busy)
+			{
+				continue;
+			}
+			char chunk[4096];
+			const ssize_t count = ::recv(client, chunk, sizeof(chunk), 0);
+			if (count <= 0)
+			{
+				_close(client);
+				continue;
+			}
+			found->second.buffer.append(chunk, static_cast<size_t>(count));
+			if (!_dispatch(client, found->second))
+			{
+				_close(client);
+			}
+		}
+
+		if (descriptors[0].revents & POLLIN)
+		{
+			_accept(server);
+		}
+	}
+
+	::close(server);
+	::unlink(_socketPath.c_str());
+	{
+		// A worker between its check and its wait would miss the notification
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+	_condition.notify_all();
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+	for (const auto& connection : _connections)
+	{
+		::close(connection.first);
+	}
+	_connections.clear();
+	_requests.clear();
+	_answered.clear();
+	::close(_wakePipe[0]);
+	::close(_wakePipe[1]);
+	_wakePipe[0] = _wakePipe[1] = -1;
+}
+#else
+int ImageServer::_listen()
+{
+	return -1;
+}
+
+void ImageServer::_accept(int)
+{
+}
+
+bool ImageServer::_dispatch(int, Connection&)
+{
+	return false;
+}
+
+void ImageServer::_close(int)
+{
+}
+
+void ImageServer::_workerLoop()
+{
+}
+
+void ImageServer::_answer(const Request&)
+{
+}
+
+void ImageServer::run()
+{
+	throw std::runtime_error("Server mode needs Unix domain sockets");
+}
+#endif
+
+/// <summary>
+/// Ask run to return, the requests being answered are finished first. Can be called from a signal handler.
+/// </summary>
+void ImageServer::stop()
+{
+	_stopRequested = true;
+}
+
+ImageServer::Statistics ImageServer::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
+
+ImageCache::Statistics ImageServer::getCacheStatistics() const
+{
+	return _cache.getStatistics();
+}
+
+bool ImageServer::hasResultCache() const
+{
+	return _results != nullptr;
+}
+
+/// <summary>
+/// Counters of the result cache, all 0 without one
+/// </summary>
+ResultCache::Statistics ImageServer::getResultCacheStatistics() const
+{
+	return _results ? _results->getStatistics() : ResultCache::Statistics{};
+}
+
+std::ostream& operator<<(std::ostream& os, const ImageServer::Statistics& statistics)
+{
+	os << "Image server: " << statistics.connections << " connections, " << statistics.requests << " requests, "
+		<< statistics.failures << " failures, " << statistics.rejections << " rejections";
+	return os;
+}
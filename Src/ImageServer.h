@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ImageCache.h"
+#include "OperationChain.h"
+#include "ResultCache.h"
+
+// Long running server mode: requests come through a Unix domain socket, one per line, and decoded images stay
+// in an image cache between requests. A request is a chain of operations separated by ';', for example
+// "load Images/a.bmp; multiply 0.5; grayscale; save /tmp/a.qoi", answered by "OK <width> <height> <bit count>"
+// or "ERROR <message>". One thread polls every connection and puts each complete request in a bounded queue for the
+// workers, a request is refused when the queue is full. A connection has one request queued or answered at a time,
+// so its answers come in order and an idle connection holds no worker.
+// With a result cache directory, the result of the operations between a load and a save is kept in it, and taken from it
+// when a later request runs the same operations on the same image.
+class ImageServer
+{
+public:
+	static constexpr const char* DEFAULT_SOCKET_PATH = "/tmp/imageproject.sock";
+	static constexpr size_t MAX_CONNECTIONS = 1024;
+	static constexpr size_t MAX_QUEUED_REQUESTS = 64;
+	static constexpr size_t MAX_REQUEST_SIZE = 64 * 1024;
+	static constexpr size_t DEFAULT_REQUEST_MEMORY_LIMIT = static_cast<size_t>(1) << 30;
+
+	struct Statistics {
+		uint64_t connections;
+		uint64_t requests;
+		uint64_t failures;
+		uint64_t rejections;
+	};
+
+private:
+	struct Connection {
+		std::string buffer;	// Received after the last complete request
+		bool busy;			// A request of the connection is queued or being answered, it is not polled meanwhile
+	};
+
+	struct Request {
+		int client;
+		std::string line;
+	};
+
+	std::string _socketPath;
+	unsigned _workerCount;
+	size_t _requestMemoryLimit;
+	ImageCache _cache;
+	std::unique_ptr<ResultCache> _results;	// Null without a result cache directory
+
+	std::unordered_map<int, Connection> _connections;	// Open connections, only used by the polling thread
+	std::deque<Request> _requests;		// Waiting for a worker, guarded by _mutex
+	std::vector<int> _answered;			// Connections whose request was answered, guarded by _mutex
+	int _wakePipe[2] = {-1, -1};		// Written by the workers to wake the polling thread
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::vector<std::thread> _workers;
+	std::atomic<bool> _stopRequested{false};
+	Statistics _statistics{};
+
+	int _listen();
+	void _accept(int server);
+	bool _dispatch(int client, Connection& connection);
+	void _close(int client);
+	void _workerLoop();
+	void _answer(const Request& request);
+	void _runOperations(BMPImage& image, const OperationChain& operations);
+	std::string _handle(const std::string& request);
+
+public:
+	explicit ImageServer(std::string socketPath = DEFAULT_SOCKET_PATH, unsigned workerCount = std::thread::hardware_concurrency(),
+		size_t cacheCapacity = ImageCache::DEFAULT_CAPACITY, size_t requestMemoryLimit = DEFAULT_REQUEST_MEMORY_LIMIT,
+		const std::string& resultCacheDirectory = "", uintmax_t resultCacheCapacity = ResultCache::DEFAULT_CAPACITY);
+	ImageServer(const ImageServer&) = delete;
+	ImageServer& operator=(const ImageServer&) = delete;
+
+	void run();
+	void stop();
+	Statistics getStatistics();
+	ImageCache::Statistics getCacheStatistics() const;
+	bool hasResultCache() const;
+	ResultCache::Statistics getResultCacheStatistics() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const ImageServer::Statistics& statistics);
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+#include "Instrumentation.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// Counters of one thread, only written by it
+	struct Counters {
+		std::array<std::atomic<uint64_t>, Instrumentation::COUNTER_COUNT> counters{};
+		std::array<std::atomic<uint64_t>, Instrumentation::PHASE_COUNT> phaseCalls{};
+		std::array<std::atomic<uint64_t>, Instrumentation::PHASE_COUNT> phaseNanoseconds{};
+	};
+
+	// Counters of the running threads, the ones of the finished threads are summed in retired
+	struct Registry {
+		std::mutex mutex;
+		std::vector<Counters*> threads;
+		Counters retired;
+	};
+
+	// Never destroyed, threads may finish after the static objects are
+	Registry& registry()
+	{
+		static Registry* instance = new Registry;
+		return *instance;
+	}
+
+	void increment(std::atomic<uint64_t>& counter, const uint64_t value)
+	{
+		// A single writer, no locked instruction is needed
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	template <size_t N>
+	void accumulate(std::array<uint64_t, N>& sum, const std::array<std::atomic<uint64_t>, N>& counters)
+	{
+		for (size_t i = 0; i < N; i++)
+		{
+			sum[i] += counters[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	template <size_t N>
+	void clear(std::array<std::atomic<uint64_t>, N>& counters)
+	{
+		for (std::atomic<uint64_t>& counter : counters)
+		{
+			counter.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	class ThreadCounters
+	{
+	public:
+		Counters counters;
+
+		ThreadCounters()
+		{
+			Registry& instance = registry();
+			std::lock_guard<std::mutex> lock(instance.mutex);
+			instance.threads.push_back(&counters);
+		}
+
+		~ThreadCounters()
+		{
+			Registry& instance = registry();
+			std::lock_guard<std::mutex> lock(instance.mutex);
+			for (size_t i = 0; i < counters.counters.size(); i++)
+			{
+				increment(instance.retired.counters[i], counters.counters[i].load(std::memory_order_relaxed));
+			}
+			for (size_t i = 0; i < counters.phaseCalls.size(); i++)
+			{
+				increment(instance.retired.phaseCalls[i], counters.phaseCalls[i].load(std::memory_order_relaxed));
+				increment(instance.retired.phaseNanoseconds[i], counters.phaseNanoseconds[i].load(std::memory_order_relaxed));
+			}
+			instance.threads.erase(std::find(instance.threads.begin(), instance.threads.end(), &counters));
+		}
+	};
+
+	Counters& threadCounters()
+	{
+		thread_local ThreadCounters instance;
+		return instance.counters;
+	}
+
+	const char* const COUNTER_NAMES[] = {
+		"bytes_read", "bytes_written", "read_calls", "write_calls", "pixels",
+		"pool_loops", "pool_tasks", "pool_busy_nanoseconds", "pool_loop_nanoseconds"
+	};
+	const char* const PHASE_NAMES[] = {"read_headers", "read_pixels", "write_pixels", "resample", "render"};
+}
+
+uint64_t Instrumentation::Snapshot::operator[](const Counter counter) const
+{
+	return counters[static_cast<size_t>(counter)];
+}
+
+/// <summary>
+/// Share of the time the threads of the pool spent in chunks while parallel loops were running
+/// </summary>
+/// <returns>Between 0 and 1, 0 without any loop</returns>
+double Instrumentation::Snapshot::poolUtilization() const
+{
+	const uint64_t loopNanoseconds = (*this)[Counter::POOL_LOOP_NANOSECONDS];
+	if (loopNanoseconds == 0 || poolThreadCount == 0)
+	{
+		return 0;
+	}
+	const double utilization = static_cast<double>((*this)[Counter::POOL_BUSY_NANOSECONDS]) / (static_cast<double>(loopNanoseconds) * poolThreadCount);
+	return std::min(utilization, 1.0);
+}
+
+Instrumentation::ScopedTimer::ScopedTimer(const Phase phase) : _phase(phase), _start(std::chrono::steady_clock::now())
+{
+}
+
+Instrumentation::ScopedTimer::~ScopedTimer()
+{
+	const auto elapsed = std::chrono::steady_clock::now() - _start;
+	addPhase(_phase, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+}
+
+void Instrumentation::add(const Counter counter, const uint64_t value)
+{
+	increment(threadCounters().counters[static_cast<size_t>(counter)], value);
+}
+
+/// <summary>
+/// Count a call of a phase
+/// </summary>
+/// <param name="phase"></param>
+/// <param name="nanoseconds">Duration of the call</param>
+void Instrumentation::addPhase(const Phase phase, const uint64_t nanoseconds)
+{
+	Counters& counters = threadCounters();
+	increment(counters.phaseCalls[static_cast<size_t>(phase)], 1);
+	increment(counters.phaseNanoseconds[static_cast<size_t>(phase)], nanoseconds);
+}
+
+/// <summary>
+/// Sum of the counters of every thread, finished ones included
+/// </summary>
+Instrumentation::Snapshot Instrumentation::snapshot()
+{
+	Snapshot snapshot{};
+	Registry& instance = registry();
+	{
+		std::lock_guard<std::mutex> lock(instance.mutex);
+		accumulate(snapshot.counters, instance.retired.counters);
+		accumulate(snapshot.phaseCalls, instance.retired.phaseCalls);
+		accumulate(snapshot.phaseNanoseconds, instance.retired.phaseNanoseconds);
+		for (const Counters* counters : instance.threads)
+		{
+			accumulate(snapshot.counters, counters->counters);
+			accumulate(snapshot.phaseCalls, counters->phaseCalls);
+			accumulate(snapshot.phaseNanoseconds, counters->phaseNanoseconds);
+		}
+	}
+	snapshot.poolThreadCount = ThreadPool::instance().getThreadCount();
+	return snapshot;
+}
+
+/// <summary>
+/// Clear the counters of every thread. An addition running meanwhile on another thread may be kept.
+/// </summary>
+void Instrumentation::reset()
+{
+	Registry& instance = registry();
+	std::lock_guard<std::mutex> lock(instance.mutex);
+	clear(instance.retired.counters);
+	clear(instance.retired.phaseCalls);
+	clear(instance.retired.phaseNanoseconds);
+	for (Counters* counters : instance.threads)
+	{
+		clear(counters->counters);
+		clear(counters->phaseCalls);
+		clear(counters->phaseNanoseconds);
+	}
+}
+
+const char* Instrumentation::nameOf(const Counter counter)
+{
+	return COUNTER_NAMES[static_cast<size_t>(counter)];
+}
+
+const char* Instrumentation::nameOf(const Phase phase)
+{
+	return PHASE_NAMES[static_cast<size_t>(phase)];
+}
+
+/// <summary>
+/// Write the counters as a JSON object
+/// </summary>
+/// <param name="os"></param>
+/// <param name="snapshot"></param>
+void Instrumentation::writeJson(std::ostream& os, const Snapshot& snapshot)
+{
+	os << "{\"enabled\": " << (isEnabled() ? "true" : "false") << ", \"counters\": {";
+	for (size_t i = 0; i < COUNTER_COUNT; i++)
+	{
+		os << (i != 0 ? ", " : "") << '"' << COUNTER_NAMES[i] << "\": " << snapshot.counters[i];
+	}
+	os << "}, \"phases\": {";
+	for (size_t i = 0; i < PHASE_COUNT; i++)
+	{
+		os << (i != 0 ? ", " : "") << '"' << PHASE_NAMES[i] << "\": {\"calls\": " << snapshot.phaseCalls[i]
+			<< ", \"nanoseconds\": " << snapshot.phaseNanoseconds[i] << '}';
+	}
+	os << "}, \"pool_threads\": " << snapshot.poolThreadCount << ", \"pool_utilization\": " << snapshot.poolUtilization() << "}\n";
+}
+
+std::ostream& operator<<(std::ostream& os, const Instrumentation::Snapshot& snapshot)
+{
+	using Counter = Instrumentation::Counter;
+	if (!Instrumentation::isEnabled())
+	{
+		return os << "Instrumentation: not compiled in, build with IMAGE_INSTRUMENTATION\n";
+	}
+	const std::streamsize precision = os.precision();
+	os << "Instrumentation:\n"
+		<< "  Read: " << snapshot[Counter::BYTES_READ] << " bytes in " << snapshot[Counter::READ_CALLS] << " calls\n"
+		<< "  Written: " << snapshot[Counter::BYTES_WRITTEN] << " bytes in " << snapshot[Counter::WRITE_CALLS] << " calls\n"
+		<< "  Pixels processed: " << snapshot[Counter::PIXELS] << "\n";
+	for (size_t i = 0; i < Instrumentation::PHASE_COUNT; i++)
+	{
+		const auto phase = static_cast<Instrumentation::Phase>(i);
+		os << "  " << std::left << std::setw(14) << Instrumentation::nameOf(phase) << std::right << snapshot.phaseCalls[i] << " calls, "
+			<< std::fixed << std::setprecision(3) << snapshot.phaseNanoseconds[i] / 1e6 << " ms\n" << std::defaultfloat;
+	}
+	os << "  Thread pool: " << snapshot[Counter::POOL_LOOPS] << " loops, " << snapshot[Counter::POOL_TASKS] << " tasks, "
+		<< std::fixed << std::setprecision(1) << snapshot.poolUtilization() * 100 << std::defaultfloat << "% busy over "
+		<< snapshot.poolThreadCount << " threads\n";
+	os.precision(precision);
+	return os;
+}
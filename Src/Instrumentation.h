@@ -0,0 +1,89 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Counters and phase timings of the image operations, compiled in when IMAGE_INSTRUMENTATION is defined.
+// Each thread adds to its own counters, a snapshot sums the counters of every thread.
+// The IMAGE_COUNT and IMAGE_TIME_PHASE macros compile to nothing when the instrumentation is off.
+class Instrumentation
+{
+public:
+	enum class Counter {
+		BYTES_READ,
+		BYTES_WRITTEN,
+		READ_CALLS,				// Reads and writes of the file streams, each one at most a system call
+		WRITE_CALLS,
+		PIXELS,					// Pixels decoded, encoded, resampled or rendered
+		POOL_LOOPS,				// Parallel loops split between threads
+		POOL_TASKS,				// Chunks of these loops
+		POOL_BUSY_NANOSECONDS,	// Time spent in the chunks, by every thread
+		POOL_LOOP_NANOSECONDS,	// Time spent in the loops, by the calling threads
+		COUNT
+	};
+
+	enum class Phase {
+		READ_HEADERS,
+		READ_PIXELS,
+		WRITE_PIXELS,
+		RESAMPLE,
+		RENDER,
+		COUNT
+	};
+
+	static constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::COUNT);
+	static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::COUNT);
+
+	struct Snapshot {
+		std::array<uint64_t, COUNTER_COUNT> counters;
+		std::array<uint64_t, PHASE_COUNT> phaseCalls;
+		std::array<uint64_t, PHASE_COUNT> phaseNanoseconds;
+		unsigned poolThreadCount;
+
+		uint64_t operator[](Counter counter) const;
+		double poolUtilization() const;
+	};
+
+	// Time of a phase, from the construction to the destruction
+	class ScopedTimer
+	{
+		Phase _phase;
+		std::chrono::steady_clock::time_point _start;
+
+	public:
+		explicit ScopedTimer(Phase phase);
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+		~ScopedTimer();
+	};
+
+	static constexpr bool isEnabled()
+	{
+#ifdef IMAGE_INSTRUMENTATION
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	static void add(Counter counter, uint64_t value);
+	static void addPhase(Phase phase, uint64_t nanoseconds);
+	static Snapshot snapshot();
+	static void reset();
+	static const char* nameOf(Counter counter);
+	static const char* nameOf(Phase phase);
+	static void writeJson(std::ostream& os, const Snapshot& snapshot);
+};
+
+std::ostream& operator<<(std::ostream& os, const Instrumentation::Snapshot& snapshot);
+
+#ifdef IMAGE_INSTRUMENTATION
+#define IMAGE_COUNT(counter, value) Instrumentation::add(Instrumentation::Counter::counter, static_cast<uint64_t>(value))
+#define IMAGE_PHASE_TIMER_NAME(line) imagePhaseTimer##line
+#define IMAGE_PHASE_TIMER(phase, line) Instrumentation::ScopedTimer IMAGE_PHASE_TIMER_NAME(line)(Instrumentation::Phase::phase)
+#define IMAGE_TIME_PHASE(phase) IMAGE_PHASE_TIMER(phase, __LINE__)
+#else
+#define IMAGE_COUNT(counter, value) ((void)0)
+#define IMAGE_TIME_PHASE(phase) ((void)0)
+#endif
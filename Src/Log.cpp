@@ -0,0 +1,141 @@
+#include <iostream>
+#include <mutex>
+
+#include "Log.h"
+
+std::atomic<int> Log::_level{static_cast<int>(Log::Level::WARNING)};
+
+namespace
+{
+	// Written to the standard error, so the standard output is left to the results
+	void defaultSink(const Log::Level level, const std::string& message)
+	{
+		std::clog << Log::nameOf(level) << ": " << message << '\n';
+	}
+
+	struct State {
+		std::mutex mutex;
+		Log::Sink sink = defaultSink;
+	};
+
+	// Never destroyed, messages may be written while the static objects are
+	State& state()
+	{
+		static State* instance = new State;
+		return *instance;
+	}
+
+	// Every RepeatedMessage, they are static objects so the list is only pushed to
+	std::atomic<Log::RepeatedMessage*> repeatedMessages{nullptr};
+}
+
+/// <summary>
+/// Register the message, it must live as long as the program
+/// </summary>
+/// <param name="level"></param>
+/// <param name="message">Written after the count, like "pixels had alpha dropped"</param>
+Log::RepeatedMessage::RepeatedMessage(const Level level, const char* message) : _level(level), _message(message)
+{
+	_next = repeatedMessages.load();
+	while (!repeatedMessages.compare_exchange_weak(_next, this))
+	{
+	}
+}
+
+/// <summary>
+/// Messages below this level are dropped, WARNING by default
+/// </summary>
+/// <param name="level"></param>
+void Log::setLevel(const Level level)
+{
+	_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+Log::Level Log::getLevel()
+{
+	return static_cast<Level>(_level.load(std::memory_order_relaxed));
+}
+
+/// <summary>
+/// Replace where the messages go, the standard error by default. Calls to the sink are serialized.
+/// </summary>
+/// <param name="sink">Empty to drop the messages</param>
+void Log::setSink(Sink sink)
+{
+	std::lock_guard<std::mutex> lock(state().mutex);
+	state().sink = std::move(sink);
+}
+
+void Log::write(const Level level, const char* message)
+{
+	if (isEnabled(level))
+	{
+		write(level, std::string(message));
+	}
+}
+
+void Log::write(const Level level, const std::string& message)
+{
+	if (!isEnabled(level) || level == Level::NONE)
+	{
+		return;
+	}
+	State& instance = state();
+	std::lock_guard<std::mutex> lock(instance.mutex);
+	if (instance.sink)
+	{
+		instance.sink(level, message);
+	}
+}
+
+void Log::verbose(const char* message)
+{
+	write(Level::VERBOSE, message);
+}
+
+void Log::info(const char* message)
+{
+	write(Level::INFO, message);
+}
+
+void Log::warning(const char* message)
+{
+	write(Level::WARNING, message);
+}
+
+void Log::error(const char* message)
+{
+	write(Level::FAILURE, message);
+}
+
+/// <summary>
+/// Write the repeated messages counted since the last flush, with their count
+/// </summary>
+void Log::flush()
+{
+	for (RepeatedMessage* repeated = repeatedMessages.load(); repeated != nullptr; repeated = repeated->_next)
+	{
+		const uint64_t count = repeated->_count.exchange(0, std::memory_order_relaxed);
+		if (count != 0)
+		{
+			write(repeated->_level, std::to_string(count) + " " + repeated->_message);
+		}
+	}
+}
+
+const char* Log::nameOf(const Level level)
+{
+	switch (level)
+	{
+	case Level::VERBOSE:
+		return "verbose";
+	case Level::INFO:
+		return "info";
+	case Level::WARNING:
+		return "warning";
+	case Level::FAILURE:
+		return "error";
+	default:
+		return "none";
+	}
+}
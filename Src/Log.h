@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Messages of the image operations, sent to a sink when their level is enabled.
+// The level check is a single relaxed load, so disabled messages cost nothing on the hot paths.
+// Warnings repeated for many pixels are counted by a RepeatedMessage and written once by flush.
+class Log
+{
+public:
+	enum class Level {
+		VERBOSE,
+		INFO,
+		WARNING,
+		FAILURE,	// Not ERROR, a macro of the Windows headers
+		NONE		// Disables every message
+	};
+
+	using Sink = std::function<void(Level, const std::string&)>;
+
+	// Message counted at each occurrence, declared once at the call site, written with the count by flush
+	class RepeatedMessage
+	{
+		Level _level;
+		const char* _message;
+		std::atomic<uint64_t> _count{0};
+		RepeatedMessage* _next;
+
+		friend class Log;
+
+	public:
+		RepeatedMessage(Level level, const char* message);
+		RepeatedMessage(const RepeatedMessage&) = delete;
+		RepeatedMessage& operator=(const RepeatedMessage&) = delete;
+
+		void add()
+		{
+			if (isEnabled(_level))
+			{
+				_count.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	};
+
+private:
+	static std::atomic<int> _level;
+
+public:
+	static bool isEnabled(const Level level)
+	{
+		return static_cast<int>(level) >= _level.load(std::memory_order_relaxed);
+	}
+
+	static void setLevel(Level level);
+	static Level getLevel();
+	static void setSink(Sink sink);
+	static void write(Level level, const char* message);
+	static void write(Level level, const std::string& message);
+	static void verbose(const char* message);
+	static void info(const char* message);
+	static void warning(const char* message);
+	static void error(const char* message);
+	static void flush();
+	static const char* nameOf(Level level);
+};
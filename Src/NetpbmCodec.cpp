@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <stdexcept>
+
+#include "NetpbmCodec.h"
+
+namespace
+{
+	// Next whitespace separated token of a PGM/PPM header, comments run to the end of the line
+	std::string readToken(std::istream& stream)
+	{
+		std::string token;
+		int c = stream.get();
+		while (c != std::char_traits<char>::eof() && (std::isspace(c) || c == '#'))
+		{
+			if (c == '#')
+			{
+				while (c != std::char_traits<char>::eof() && c != '\n')
+				{
+					c = stream.get();
+				}
+			}
+			c = stream.get();
+		}
+		while (c != std::char_traits<char>::eof() && !std::isspace(c))
+		{
+			token += static_cast<char>(c);
+			c = stream.get();
+		}
+		// The single whitespace after the token is consumed, the raw samples start right after the last one
+		return token;
+	}
+
+	uint32_t toNumber(const std::string& token)
+	{
+		if (token.empty() || token.find_first_not_of("0123456789") != std::string::npos || token.size() > 9)
+		{
+			throw std::runtime_error("Netpbm header is not valid.");
+		}
+		return static_cast<uint32_t>(std::stoul(token));
+	}
+}
+
+/// <summary>
+/// Read the header up to the first sample
+/// </summary>
+/// <param name="stream"></param>
+/// <returns></returns>
+NetpbmCodec::Header NetpbmCodec::readHeader(std::istream& stream)
+{
+	char magic[2];
+	stream.read(magic, 2);
+	if (!stream || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6' && magic[1] != '7'))
+	{
+		throw std::runtime_error("File is not a raw PGM, PPM or PAM file.");
+	}
+	Header header{magic[1], 0, 0, 0, 0, ""};
+	if (header.type != '7')
+	{
+		header.width = toNumber(readToken(stream));
+		header.height = toNumber(readToken(stream));
+		header.maxValue = toNumber(readToken(stream));
+		header.depth = header.type == '5' ? 1 : 3;
+		header.tupleType = header.type == '5' ? "GRAYSCALE" : "RGB";
+	}
+	else
+	{
+		// One "KEY value" per line up to ENDHDR
+		std::string line;
+		while (std::getline(stream, line) && line != "ENDHDR")
+		{
+			const size_t separator = line.find(' ');
+			if (line.empty() || line[0] == '#' || separator == std::string::npos)
+			{
+				continue;
+			}
+			const std::string key = line.substr(0, separator);
+			const std::string value = line.substr(line.find_first_not_of(' ', separator));
+			if (key == "WIDTH") header.width = toNumber(value);
+			else if (key == "HEIGHT") header.height = toNumber(value);
+			else if (key == "DEPTH") header.depth = toNumber(value);
+			else if (key == "MAXVAL") header.maxValue = toNumber(value);
+			else if (key == "TUPLTYPE") header.tupleType = value;
+		}
+		if (line != "ENDHDR")
+		{
+			throw std::runtime_error("PAM header is truncated.");
+		}
+	}
+	if (!stream || header.width == 0 || header.height == 0 || header.depth == 0 || header.depth > 4 || header.maxValue == 0)
+	{
+		throw std::runtime_error("Netpbm header is not valid.");
+	}
+	if (header.maxValue > 255)
+	{
+		throw std::runtime_error("16 bits samples are not handled by the program");
+	}
+	return header;
+}
+
+/// <summary>
+/// Read the samples, scaled to 0-255 when the maximum value is lower
+/// </summary>
+/// <param name="stream"></param>
+/// <param name="header"></param>
+/// <param name="row">Memory of a row from the top, header.depth bytes per pixel</param>
+void NetpbmCodec::readRows(std::istream& stream, const Header& header, const std::function<uint8_t*(uint32_t)>& row)
+{
+	const size_t rowSize = static_cast<size_t>(header.width) * header.depth;
+	std::array<uint8_t, 256> scale{};
+	for (uint32_t i = 0; i < scale.size(); i++)
+	{
+		scale[i] = static_cast<uint8_t>(std::min<uint32_t>(255, (i * 255 + header.maxValue / 2) / header.maxValue));
+	}
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		uint8_t* samples = row(y);
+		stream.read(reinterpret_cast<char*>(samples), static_cast<std::streamsize>(rowSize));
+		if (header.maxValue != 255)
+		{
+			for (size_t i = 0; i < rowSize; i++)
+			{
+				samples[i] = scale[samples[i]];
+			}
+		}
+	}
+	if (!stream)
+	{
+		throw std::runtime_error("Pixel data is truncated");
+	}
+}
+
+/// <summary>
+/// Write the header, in the format of header.type
+/// </summary>
+/// <param name="stream"></param>
+/// <param name="header"></param>
+void NetpbmCodec::writeHeader(std::ostream& stream, const Header& header)
+{
+	if (header.type == '7')
+	{
+		stream << "P7\nWIDTH " << header.width << "\nHEIGHT " << header.height << "\nDEPTH " << header.depth
+			<< "\nMAXVAL " << header.maxValue << "\nTUPLTYPE " << header.tupleType << "\nENDHDR\n";
+	}
+	else
+	{
+		stream << 'P' << header.type << '\n' << header.width << ' ' << header.height << '\n' << header.maxValue << '\n';
+	}
+}
+
+/// <summary>
+/// Write the samples of every row
+/// </summary>
+/// <param name="stream"></param>
+/// <param name="header"></param>
+/// <param name="row">Samples of a row from the top, header.depth bytes per pixel</param>
+void NetpbmCodec::writeRows(std::ostream& stream, const Header& header, const std::function<const uint8_t*(uint32_t)>& row)
+{
+	const std::streamsize rowSize = static_cast<std::streamsize>(header.width) * header.depth;
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		stream.write(reinterpret_cast<const char*>(row(y)), rowSize);
+	}
+	if (!stream)
+	{
+		throw std::runtime_error("Could not write the pixel data");
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Raw Netpbm images: PGM (P5), PPM (P6) and PAM (P7), see https://netpbm.sourceforge.net/doc/pam.html
+// They have no compression, rows are copied as is between the stream and the memory given by a callback,
+// top to bottom, which makes them suited to pipes between processes.
+class NetpbmCodec
+{
+public:
+	struct Header {
+		char type;				// '5', '6' or '7'
+		uint32_t width;
+		uint32_t height;
+		uint32_t depth;			// Bytes per pixel
+		uint32_t maxValue;
+		std::string tupleType;	// GRAYSCALE, RGB, RGB_ALPHA or BLACKANDWHITE for PAM
+	};
+
+	static Header readHeader(std::istream& stream);
+	static void readRows(std::istream& stream, const Header& header, const std::function<uint8_t*(uint32_t)>& row);
+	static void writeHeader(std::ostream& stream, const Header& header);
+	static void writeRows(std::ostream& stream, const Header& header, const std::function<const uint8_t*(uint32_t)>& row);
+};
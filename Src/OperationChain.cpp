@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <stdexcept>
+
+#include "OperationChain.h"
+
+namespace
+{
+	const std::array<std::string, 13> NAMES = {"resize", "multiply", "crop", "convert", "quantize", "compress", "brightness",
+		"contrast", "gamma", "invert", "grayscale", "equalize", "autolevels"};
+
+	std::string trim(const std::string& text)
+	{
+		const size_t first = text.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+		{
+			return "";
+		}
+		return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+	}
+
+	// Numbers of an operation, all of them or an error
+	template <typename... Values>
+	void parseArguments(const std::string& operation, const std::string& arguments, Values&... values)
+	{
+		std::istringstream stream(arguments);
+		(void)(stream >> ... >> values);
+		std::string rest;
+		if (!stream || (stream >> rest))
+		{
+			throw std::invalid_argument("Bad arguments for " + operation);
+		}
+	}
+}
+
+/// <summary>
+/// Operations separated by ';'
+/// </summary>
+/// <param name="text"></param>
+OperationChain::OperationChain(const std::string& text)
+{
+	for (const Operation& operation : parse(text))
+	{
+		add(operation.name, operation.arguments);
+	}
+}
+
+/// <summary>
+/// Split operations separated by ';' in names and arguments, without checking the names, so the server can take
+/// steps of its own (load, save) in the same text
+/// </summary>
+/// <param name="text"></param>
+/// <returns>In the order of the text, the empty ones left out</returns>
+std::vector<OperationChain::Operation> OperationChain::parse(const std::string& text)
+{
+	std::vector<Operation> operations;
+	std::istringstream stream(text);
+	std::string operation;
+	while (std::getline(stream, operation, ';'))
+	{
+		operation = trim(operation);
+		if (operation.empty())
+		{
+			continue;
+		}
+		const size_t separator = operation.find(' ');
+		operations.push_back(Operation{operation.substr(0, separator), separator == std::string::npos ? "" : trim(operation.substr(separator))});
+	}
+	return operations;
+}
+
+bool OperationChain::isOperation(const std::string& name)
+{
+	return std::find(NAMES.begin(), NAMES.end(), name) != NAMES.end();
+}
+
+/// <summary>
+/// Add an operation at the end
+/// </summary>
+/// <param name="name"></param>
+/// <param name="arguments">Separated by spaces</param>
+void OperationChain::add(const std::string& name, const std::string& arguments)
+{
+	if (!isOperation(name))
+	{
+		throw std::invalid_argument("Unknown operation " + name);
+	}
+	_operations.push_back(Operation{name, arguments});
+}
+
+bool OperationChain::empty() const
+{
+	return _operations.empty();
+}
+
+void OperationChain::clear()
+{
+	_operations.clear();
+}
+
+/// <summary>
+/// The operations as text, the same for the same operations and arguments
+/// </summary>
+std::string OperationChain::getDescription() const
+{
+	std::string description;
+	for (const Operation& operation : _operations)
+	{
+		description += (description.empty() ? "" : "; ") + operation.name + (operation.arguments.empty() ? "" : " " + operation.arguments);
+	}
+	return description;
+}
+
+/// <summary>
+/// Run the operations in order
+/// </summary>
+/// <param name="image"></param>
+void OperationChain::apply(BMPImage& image) const
+{
+	for (const Operation& operation : _operations)
+	{
+		_apply(image, operation);
+	}
+}
+
+void OperationChain::_apply(BMPImage& image, const Operation& operation)
+{
+	const std::string& name = operation.name;
+	const std::string& arguments = operation.arguments;
+	if (name == "resize")
+	{
+		int32_t width, height;
+		parseArguments(name, arguments, width, height);
+		image.resize(width, height);
+	}
+	else if (name == "multiply")
+	{
+		float factor;
+		parseArguments(name, arguments, factor);
+		image.multiplySize(factor);
+	}
+	else if (name == "crop")
+	{
+		int32_t x, y, width, height;
+		parseArguments(name, arguments, x, y, width, height);
+		image.crop(x, y, width, height);
+	}
+	else if (name == "convert")
+	{
+		uint16_t bitCount;
+		parseArguments(name, arguments, bitCount);
+		image.convertTo(bitCount);
+	}
+	else if (name == "quantize")
+	{
+		uint16_t colorCount;
+		parseArguments(name, arguments, colorCount);
+		image.quantize(colorCount, ColorQuantizer::Dithering::FLOYD_STEINBERG);
+	}
+	else if (name == "compress")
+	{
+		parseArguments(name, arguments);
+		image.setCompressed(true);
+	}
+	else if (name == "brightness")
+	{
+		int16_t offset;
+		parseArguments(name, arguments, offset);
+		image.adjustBrightness(offset);
+	}
+	else if (name == "contrast")
+	{
+		float factor;
+		parseArguments(name, arguments, factor);
+		image.adjustContrast(factor);
+	}
+	else if (name == "gamma")
+	{
+		float gamma;
+		parseArguments(name, arguments, gamma);
+		image.adjustGamma(gamma);
+	}
+	else if (name == "invert")
+	{
+		parseArguments(name, arguments);
+		image.invertColors();
+	}
+	else if (name == "grayscale")
+	{
+		parseArguments(name, arguments);
+		image.toGrayscale();
+	}
+	else if (name == "equalize")
+	{
+		parseArguments(name, arguments);
+		image.equalizeHistogram();
+	}
+	else if (name == "autolevels")
+	{
+		parseArguments(name, arguments);
+		image.autoLevels();
+	}
+	else
+	{
+		throw std::invalid_argument("Unknown operation " + name);
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "BMPImage.h"
+
+// Image operations written as text, like "multiply 0.5; grayscale; brightness 20", as the server and the batch mode take them.
+// The operations are resize W H, multiply F, crop X Y W H, convert BITS, quantize N, compress, brightness N, contrast F,
+// gamma F, invert, grayscale, equalize and autolevels. Names are checked when added, arguments when applied.
+class OperationChain
+{
+public:
+	struct Operation {
+		std::string name;
+		std::string arguments;	// Separated by spaces
+	};
+
+private:
+	std::vector<Operation> _operations;
+
+	static void _apply(BMPImage& image, const Operation& operation);
+
+public:
+	OperationChain() = default;
+	explicit OperationChain(const std::string& text);
+
+	static std::vector<Operation> parse(const std::string& text);
+	static bool isOperation(const std::string& name);
+
+	void add(const std::string& name, const std::string& arguments);
+	bool empty() const;
+	void clear();
+	std::string getDescription() const;
+	void apply(BMPImage& image) const;
+};
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cmath>
+#include <stdexcept>
+
+#include "PerceptualHash.h"
+
+namespace
+{
+	constexpr uint32_t DIFFERENCE_WIDTH = 9;
+	constexpr uint32_t DIFFERENCE_HEIGHT = 8;
+	constexpr uint32_t DCT_SIZE = 32;
+	constexpr uint32_t DCT_KEPT = 8;	// Lowest frequencies per axis
+
+	/// <summary>
+	/// Means of the samples over a grid of cells, cells of uneven sizes when the grid does not divide SAMPLE_COUNT
+	/// </summary>
+	/// <returns>Rows from the top</returns>
+	std::vector<double> cellMeans(const std::vector<float>& samples, const uint32_t width, const uint32_t height)
+	{
+		constexpr uint32_t sampleCount = PerceptualHash::SAMPLE_COUNT;
+		std::vector<double> sums(static_cast<size_t>(width) * height, 0.0);
+		std::vector<uint32_t> counts(sums.size(), 0);
+		for (uint32_t y = 0; y < sampleCount; y++)
+		{
+			const size_t cellRow = static_cast<size_t>(y * height / sampleCount) * width;
+			for (uint32_t x = 0; x < sampleCount; x++)
+			{
+				const size_t cell = cellRow + x * width / sampleCount;
+				sums[cell] += samples[static_cast<size_t>(y) * sampleCount + x];
+				counts[cell]++;
+			}
+		}
+		for (size_t i = 0; i < sums.size(); i++)
+		{
+			sums[i] /= counts[i];
+		}
+		return sums;
+	}
+}
+
+/// <summary>
+/// Coordinate of a sample, at the center of its cell. Small images have cells sharing a pixel.
+/// </summary>
+/// <param name="index">Below SAMPLE_COUNT</param>
+/// <param name="size">Width or height of the image, not 0</param>
+uint32_t PerceptualHash::samplePosition(const uint32_t index, const uint32_t size)
+{
+	return static_cast<uint32_t>((2 * static_cast<uint64_t>(index) + 1) * size / (2 * SAMPLE_COUNT));
+}
+
+/// <summary>
+/// Hash of the luma samples of an image
+/// </summary>
+/// <param name="samples">SAMPLE_COUNT rows of SAMPLE_COUNT lumas from 0 to 255, from the top left</param>
+/// <param name="kind"></param>
+/// <returns>The bit of the first cell is the highest</returns>
+uint64_t PerceptualHash::compute(const std::vector<float>& samples, const Kind kind)
+{
+	if (samples.size() != static_cast<size_t>(SAMPLE_COUNT) * SAMPLE_COUNT)
+	{
+		throw std::invalid_argument("Perceptual hashes need SAMPLE_COUNT x SAMPLE_COUNT samples");
+	}
+	return kind == Kind::DIFFERENCE ? _differenceHash(samples) : _dctHash(samples);
+}
+
+/// <summary>
+/// Number of bits that differ, 0 for the same image and about 32 for unrelated ones
+/// </summary>
+uint32_t PerceptualHash::distance(const uint64_t first, const uint64_t second)
+{
+	return static_cast<uint32_t>(std::bitset<64>(first ^ second).count());
+}
+
+const char* PerceptualHash::nameOf(const Kind kind)
+{
+	return kind == Kind::DIFFERENCE ? "difference" : "dct";
+}
+
+PerceptualHash::Kind PerceptualHash::kindOf(const std::string& name)
+{
+	if (name == "difference")
+	{
+		return Kind::DIFFERENCE;
+	}
+	if (name == "dct")
+	{
+		return Kind::DCT;
+	}
+	throw std::invalid_argument("Unknown perceptual hash " + name);
+}
+
+uint64_t PerceptualHash::_differenceHash(const std::vector<float>& samples)
+{
+	const std::vector<double> means = cellMeans(samples, DIFFERENCE_WIDTH, DIFFERENCE_HEIGHT);
+	uint64_t hash = 0;
+	for (uint32_t y = 0; y < DIFFERENCE_HEIGHT; y++)
+	{
+		const double* row = means.data() + static_cast<size_t>(y) * DIFFERENCE_WIDTH;
+		for (uint32_t x = 0; x + 1 < DIFFERENCE_WIDTH; x++)
+		{
+			hash = (hash << 1) | (row[x + 1] > row[x] ? 1 : 0);
+		}
+	}
+	return hash;
+}
+
+uint64_t PerceptualHash::_dctHash(const std::vector<float>& samples)
+{
+	const std::vector<double> means = cellMeans(samples, DCT_SIZE, DCT_SIZE);
+	// DCT-II basis of the kept frequencies, the scale factors do not change the comparisons with the median
+	static const std::vector<double> basis = []
+	{
+		const double pi = std::acos(-1.0);
+		std::vector<double> values(DCT_KEPT * DCT_SIZE);
+		for (uint32_t u = 0; u < DCT_KEPT; u++)
+		{
+			for (uint32_t x = 0; x < DCT_SIZE; x++)
+			{
+				values[u * DCT_SIZE + x] = std::cos((2 * x + 1) * u * pi / (2 * DCT_SIZE));
+			}
+		}
+		return values;
+	}();
+	// Rows first, then the columns of the kept frequencies
+	std::array<double, DCT_SIZE * DCT_KEPT> rows{};
+	for (uint32_t y = 0; y < DCT_SIZE; y++)
+	{
+		for (uint32_t u = 0; u < DCT_KEPT; u++)
+		{
+			double sum = 0.0;
+			for (uint32_t x = 0; x < DCT_SIZE; x++)
+			{
+				sum += basis[u * DCT_SIZE + x] * means[y * DCT_SIZE + x];
+			}
+			rows[y * DCT_KEPT + u] = sum;
+		}
+	}
+	std::array<double, DCT_KEPT * DCT_KEPT> coefficients{};
+	for (uint32_t v = 0; v < DCT_KEPT; v++)
+	{
+		for (uint32_t u = 0; u < DCT_KEPT; u++)
+		{
+			double sum = 0.0;
+			for (uint32_t y = 0; y < DCT_SIZE; y++)
+			{
+				sum += basis[v * DCT_SIZE + y] * rows[y * DCT_KEPT + u];
+			}
+			coefficients[v * DCT_KEPT + u] = sum;
+		}
+	}
+	std::array<double, DCT_KEPT * DCT_KEPT> sorted = coefficients;
+	std::sort(sorted.begin(), sorted.end());
+	const double median = (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+	uint64_t hash = 0;
+	for (const double coefficient : coefficients)
+	{
+		hash = (hash << 1) | (coefficient > median ? 1 : 0);
+	}
+	return hash;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// 64 bits hashes of what an image looks like: resized, recompressed or slightly retouched copies of an image have hashes
+// a few bits apart, where their content hashes have nothing in common. Both hashes are computed from a grid of luma samples
+// taken at the centers of SAMPLE_COUNT x SAMPLE_COUNT cells of the image, so only the sampled rows of a file need reading.
+// DIFFERENCE (dHash) averages the samples down to 9 x 8 and sets a bit where a cell is brighter than its left neighbor.
+// DCT (pHash) averages them down to 32 x 32 and sets a bit for each of the 8 x 8 lowest frequencies of the cosine transform
+// above their median, which holds better against gamma and contrast changes.
+class PerceptualHash
+{
+public:
+	enum class Kind {
+		DIFFERENCE,
+		DCT,
+	};
+
+	static constexpr uint32_t SAMPLE_COUNT = 128;	// Luma samples per side
+
+	static uint32_t samplePosition(uint32_t index, uint32_t size);
+	static uint64_t compute(const std::vector<float>& samples, Kind kind);
+	static uint32_t distance(uint64_t first, uint64_t second);
+	static const char* nameOf(Kind kind);
+	static Kind kindOf(const std::string& name);
+
+private:
+	static uint64_t _differenceHash(const std::vector<float>& samples);
+	static uint64_t _dctHash(const std::vector<float>& samples);
+};
@@ -1,14 +1,19 @@
 #include <cstdint>
 #include <memory>
 #include <iostream>
+#include <stdexcept>
 #include "Pixel.h"
 
 /// <summary>
 /// Default constructor
 /// </summary>
 /// <param name="size"></param>
-Pixel::Pixel(uint16_t size) : size(size), pixel_data(std::make_unique<uint8_t[]>(size))
+Pixel::Pixel(uint16_t size) : size(size)
 {
+	if (size > DEEP_COLOR_BYTE_SIZE)
+	{
+		throw std::invalid_argument("Pixel size is not valid");
+	}
 }
 
 /// <summary>
@@ -16,7 +21,7 @@ Pixel::Pixel(uint16_t size) : size(size), pixel_data(std::make_unique<uint8_t[]>
 /// </summary>
 /// <param name="size"></param>
 /// <param name="data"></param>
-Pixel::Pixel(uint16_t size, std::unique_ptr<uint8_t[]> data) : size(size), pixel_data(std::move(data))
+Pixel::Pixel(uint16_t size, std::unique_ptr<uint8_t[]> data) : Pixel(size, data.get())
 {
 }
 
@@ -25,9 +30,9 @@ Pixel::Pixel(uint16_t size, std::unique_ptr<uint8_t[]> data) : size(size), pixel
 /// </summary>
 /// <param name="size"></param>
 /// <param name="data"></param>
-Pixel::Pixel(uint16_t size, uint8_t* data) : size(size), pixel_data(std::make_unique<uint8_t[]>(size))
+Pixel::Pixel(uint16_t size, const uint8_t* data) : Pixel(size)
 {
-	std::copy(data, data + size, pixel_data.get());
+	std::copy(data, data + size, pixel_data.begin());
 }
 
 /// <summary>
@@ -38,11 +43,8 @@ Pixel::Pixel(uint16_t size, uint8_t* data) : size(size), pixel_data(std::make_un
 /// <param name="blue"></param>
 Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue) :
 	size(TRUE_COLOR_BYTE_SIZE),
-	pixel_data(std::make_unique<uint8_t[]>(TRUE_COLOR_BYTE_SIZE))
+	pixel_data{red, green, blue, 0}
 {
-	pixel_data[0] = red;
-	pixel_data[1] = green;
-	pixel_data[2] = blue;
 }
 
 /// <summary>
@@ -54,48 +56,8 @@ Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue) :
 /// <param name="alpha"></param>
 Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) :
 	size(DEEP_COLOR_BYTE_SIZE),
-	pixel_data(std::make_unique<uint8_t[]>(DEEP_COLOR_BYTE_SIZE))
-{
-	pixel_data[0] = red;
-	pixel_data[1] = green;
-	pixel_data[2] = blue;
-	pixel_data[3] = alpha;
-}
-
-// Copy constructor
-Pixel::Pixel(const Pixel& pixel) : size(pixel.size), pixel_data(std::make_unique<uint8_t[]>(pixel.size))
+	pixel_data{red, green, blue, alpha}
 {
-	if (pixel.size == 0) return;
-	if(pixel.size != size)
-	{
-		size = pixel.size;
-	}
-	std::copy(pixel.pixel_data.get(), pixel.pixel_data.get() + pixel.size, pixel_data.get());
-}
-
-// Destructor 
-Pixel::~Pixel() = default;
-
-Pixel& Pixel::operator=(const Pixel& other)
-{
-	if (this == &other)
-	{
-		return *this;
-	}
-	if (other.size == 0)
-	{
-		size = 0;
-		pixel_data = nullptr;
-		return *this;
-	}
-	if (other.size != size)
-	{
-		size = other.size;
-		pixel_data = std::make_unique<uint8_t[]>(size);
-	}
-	pixel_data = std::make_unique<uint8_t[]>(other.size);
-	std::copy(other.pixel_data.get(), other.pixel_data.get() + other.size, pixel_data.get());
-	return *this;
 }
 
 uint16_t Pixel::getSize() const
@@ -1,11 +1,12 @@
 #pragma once
+#include <array>
 #include <memory>
 #include <iostream>
 
 class Pixel
 {
 	uint16_t size;
-	std::unique_ptr<uint8_t[]> pixel_data;
+	std::array<uint8_t, 4> pixel_data{};	// Stored in the object, a pixel is never allocated
 public:
 
 	// Constants
@@ -16,13 +17,13 @@ public:
 
 	Pixel(uint16_t size = TRUE_COLOR_BYTE_SIZE);
 	Pixel(uint16_t size, std::unique_ptr<uint8_t[]> data);
-	Pixel(uint16_t size,uint8_t* data);
+	Pixel(uint16_t size, const uint8_t* data);
 	Pixel(uint8_t red, uint8_t green, uint8_t blue);
 	Pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
 
-	Pixel(const Pixel& pixel);
-	~Pixel();
-	Pixel& operator=(const Pixel& other);
+	Pixel(const Pixel& pixel) = default;
+	~Pixel() = default;
+	Pixel& operator=(const Pixel& other) = default;
 
 	uint16_t getSize() const;
 	uint8_t getRed() const;
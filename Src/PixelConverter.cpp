@@ -0,0 +1,687 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "PixelConverter.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXEL_CONVERTER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+	// Bit order of a byte reversed, BMP stores the leftmost pixel in the most significant bit
+	constexpr std::array<uint8_t, 256> makeReversedBits()
+	{
+		std::array<uint8_t, 256> table{};
+		for (int i = 0; i < 256; i++)
+		{
+			uint8_t reversed = 0;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				if (i & (1 << bit)) reversed |= static_cast<uint8_t>(0x80 >> bit);
+			}
+			table[i] = reversed;
+		}
+		return table;
+	}
+	constexpr std::array<uint8_t, 256> REVERSED_BITS = makeReversedBits();
+
+	// 8 indices (0 or 1) for each packed byte
+	std::array<uint64_t, 256> makeUnpackedBits()
+	{
+		std::array<uint64_t, 256> table{};
+		for (int i = 0; i < 256; i++)
+		{
+			uint8_t bytes[8];
+			for (int bit = 0; bit < 8; bit++)
+			{
+				bytes[bit] = (i >> (7 - bit)) & 1;
+			}
+			std::memcpy(&table[i], bytes, 8);
+		}
+		return table;
+	}
+
+	void swapRedBlueScalar(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t byteCount)
+	{
+		for (size_t i = 0; i < pixelCount; i++, source += byteCount, destination += byteCount)
+		{
+			const uint8_t first = source[0];
+			const uint8_t second = source[1];
+			const uint8_t third = source[2];
+			destination[0] = third;
+			destination[1] = second;
+			destination[2] = first;
+			if (byteCount == 4)
+			{
+				destination[3] = source[3];
+			}
+		}
+	}
+
+	void rgbToRgbaScalar(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint8_t alpha)
+	{
+		for (size_t i = 0; i < pixelCount; i++, source += 3, destination += 4)
+		{
+			destination[0] = source[0];
+			destination[1] = source[1];
+			destination[2] = source[2];
+			destination[3] = alpha;
+		}
+	}
+
+	void rgbaToRgbScalar(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		for (size_t i = 0; i < pixelCount; i++, source += 4, destination += 3)
+		{
+			const uint8_t red = source[0];
+			const uint8_t green = source[1];
+			const uint8_t blue = source[2];
+			destination[0] = red;
+			destination[1] = green;
+			destination[2] = blue;
+		}
+	}
+
+	void fillScalar(uint8_t* destination, const size_t pixelCount, const uint16_t byteCount, const uint8_t* color)
+	{
+		for (size_t i = 0; i < pixelCount; i++, destination += byteCount)
+		{
+			std::memcpy(destination, color, byteCount);
+		}
+	}
+
+	// Pixel x of the destination averages pixels 2x and 2x + 1 of both rows, the last one is repeated for odd widths
+	void reduceRowsScalar(const uint8_t* first, const uint8_t* second, uint8_t* destination, const size_t start,
+		const size_t destinationWidth, const size_t sourceWidth, const uint16_t byteCount)
+	{
+		for (size_t x = start; x < destinationWidth; x++)
+		{
+			const size_t left = 2 * x * byteCount;
+			const size_t right = std::min(2 * x + 1, sourceWidth - 1) * byteCount;
+			for (uint16_t c = 0; c < byteCount; c++)
+			{
+				destination[x * byteCount + c] = static_cast<uint8_t>(
+					(first[left + c] + first[right + c] + second[left + c] + second[right + c] + 2) >> 2);
+			}
+		}
+	}
+
+	void differenceRgbaScalar(const uint8_t* first, const uint8_t* second, const size_t start, const size_t pixelCount,
+		uint64_t* absoluteSums, uint64_t* squaredSums, uint8_t* maxima)
+	{
+		for (size_t i = start * 4; i < pixelCount * 4; i++)
+		{
+			const uint8_t difference = static_cast<uint8_t>(first[i] > second[i] ? first[i] - second[i] : second[i] - first[i]);
+			absoluteSums[i % 4] += difference;
+			squaredSums[i % 4] += static_cast<uint32_t>(difference) * difference;
+			maxima[i % 4] = std::max(maxima[i % 4], difference);
+		}
+	}
+
+	void rgbToGrayScalar(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t sourceByteCount)
+	{
+		for (size_t i = 0; i < pixelCount; i++, source += sourceByteCount)
+		{
+			destination[i] = PixelConverter::luma(source[0], source[1], source[2]);
+		}
+	}
+
+#ifdef PIXEL_CONVERTER_X86
+	// Luma of 4 pixels laid out red, green, blue, x in 32 bits lanes
+	TARGET_SSSE3 __m128i luma4(const __m128i pixels)
+	{
+		const __m128i weights = _mm_setr_epi16(
+			PixelConverter::LUMA_RED_WEIGHT, PixelConverter::LUMA_GREEN_WEIGHT, PixelConverter::LUMA_BLUE_WEIGHT, 0,
+			PixelConverter::LUMA_RED_WEIGHT, PixelConverter::LUMA_GREEN_WEIGHT, PixelConverter::LUMA_BLUE_WEIGHT, 0);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+		const __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+		const __m128i sums = _mm_hadd_epi32(low, high);
+		return _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(1 << (PixelConverter::LUMA_SHIFT - 1))), PixelConverter::LUMA_SHIFT);
+	}
+
+	TARGET_SSSE3 void rgbToGraySsse3(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t sourceByteCount)
+	{
+		// Spread 4 pixels of 3 bytes to 4 lanes of 4 bytes
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		size_t i = 0;
+		if (sourceByteCount == 4)
+		{
+			for (; i + 16 <= pixelCount; i += 16)
+			{
+				const __m128i* block = reinterpret_cast<const __m128i*>(source + i * 4);
+				const __m128i a = luma4(_mm_loadu_si128(block));
+				const __m128i b = luma4(_mm_loadu_si128(block + 1));
+				const __m128i c = luma4(_mm_loadu_si128(block + 2));
+				const __m128i d = luma4(_mm_loadu_si128(block + 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+			}
+		}
+		else
+		{
+			// The last load of a block reads 4 bytes past it, keep a pixel and a bit of margin
+			for (; i + 18 <= pixelCount; i += 16)
+			{
+				const uint8_t* block = source + i * 3;
+				const __m128i a = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)), spread));
+				const __m128i b = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 12)), spread));
+				const __m128i c = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 24)), spread));
+				const __m128i d = luma4(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 36)), spread));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+			}
+		}
+		rgbToGrayScalar(source + i * sourceByteCount, destination + i, pixelCount - i, sourceByteCount);
+	}
+
+	TARGET_SSSE3 void swapRedBlueSsse3(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t byteCount)
+	{
+		size_t i = 0;
+		if (byteCount == 4)
+		{
+			const __m128i swap = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+			for (; i + 4 <= pixelCount; i += 4)
+			{
+				const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_shuffle_epi8(block, swap));
+			}
+		}
+		else
+		{
+			// 5 pixels per block, the 16th byte is copied as is and fixed by the next block
+			const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+			for (; i * 3 + 16 <= pixelCount * 3; i += 5)
+			{
+				const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 3), _mm_shuffle_epi8(block, swap));
+			}
+		}
+		swapRedBlueScalar(source + i * byteCount, destination + i * byteCount, pixelCount - i, byteCount);
+	}
+
+	TARGET_AVX2 void swapRedBlueAvx2(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		const __m256i swap = _mm256_setr_epi8(
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+		size_t i = 0;
+		for (; i + 8 <= pixelCount; i += 8)
+		{
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_shuffle_epi8(block, swap));
+		}
+		swapRedBlueScalar(source + i * 4, destination + i * 4, pixelCount - i, 4);
+	}
+
+	TARGET_SSSE3 void rgbToRgbaSsse3(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint8_t alpha)
+	{
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alphaBytes = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+		size_t i = 0;
+		// A block reads 4 bytes past its 4 pixels
+		for (; i * 3 + 16 <= pixelCount * 3; i += 4)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_or_si128(_mm_shuffle_epi8(block, spread), alphaBytes));
+		}
+		rgbToRgbaScalar(source + i * 3, destination + i * 4, pixelCount - i, alpha);
+	}
+
+	TARGET_AVX2 void rgbToRgbaAvx2(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint8_t alpha)
+	{
+		const __m256i spread = _mm256_setr_epi8(
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i alphaBytes = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(alpha) << 24));
+		size_t i = 0;
+		// The upper lane reads 4 bytes past the 8 pixels
+		for (; i * 3 + 28 <= pixelCount * 3; i += 8)
+		{
+			const uint8_t* block = source + i * 3;
+			const __m256i pixels = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block))),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 12)), 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(pixels, spread), alphaBytes));
+		}
+		rgbToRgbaScalar(source + i * 3, destination + i * 4, pixelCount - i, alpha);
+	}
+
+	TARGET_SSSE3 void rgbaToRgbSsse3(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		size_t i = 0;
+		// A block writes 4 bytes past its 4 pixels, they are overwritten by the next block
+		for (; i * 3 + 16 <= pixelCount * 3; i += 4)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 3), _mm_shuffle_epi8(block, pack));
+		}
+		rgbaToRgbScalar(source + i * 4, destination + i * 3, pixelCount - i);
+	}
+
+	TARGET_AVX2 void rgbaToRgbAvx2(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+	{
+		const __m256i pack = _mm256_setr_epi8(
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+			0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		// Gather the 12 useful bytes of each lane in the low 24 bytes
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+		size_t i = 0;
+		for (; i * 3 + 32 <= pixelCount * 3; i += 8)
+		{
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4));
+			const __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(block, pack), lanes);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 3), packed);
+		}
+		rgbaToRgbScalar(source + i * 4, destination + i * 3, pixelCount - i);
+	}
+
+	// Sums of the even and odd pixels of 16 bytes, as 16 bits lanes
+	TARGET_SSSE3 inline __m128i pairSums(const uint8_t* bytes, const __m128i split)
+	{
+		const __m128i block = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes)), split);
+		const __m128i zero = _mm_setzero_si128();
+		return _mm_add_epi16(_mm_unpacklo_epi8(block, zero), _mm_unpackhi_epi8(block, zero));
+	}
+
+	TARGET_SSSE3 void reduceRowsSsse3(const uint8_t* first, const uint8_t* second, uint8_t* destination,
+		const size_t destinationWidth, const size_t sourceWidth, const uint16_t byteCount)
+	{
+		// Even pixels of a block go to the low half and odd pixels to the high half, 3 bytes pixels leave 2 bytes empty
+		__m128i split;
+		__m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		size_t outputCount;
+		if (byteCount == 1)
+		{
+			split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+			outputCount = 16;
+		}
+		else if (byteCount == 3)
+		{
+			split = _mm_setr_epi8(0, 1, 2, 6, 7, 8, -1, -1, 3, 4, 5, 9, 10, 11, -1, -1);
+			compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+			outputCount = 4;
+		}
+		else
+		{
+			split = _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15);
+			outputCount = 4;
+		}
+		// Each block is two loads of half the source bytes, and one 16 bytes store kept inside the row
+		const size_t half = outputCount * byteCount;
+		const size_t sourceSize = sourceWidth * byteCount;
+		const size_t destinationSize = destinationWidth * byteCount;
+		const __m128i rounding = _mm_set1_epi16(2);
+		size_t x = 0;
+		for (; 2 * (x + outputCount) <= sourceWidth && 2 * x * byteCount + half + 16 <= sourceSize && x * byteCount + 16 <= destinationSize; x += outputCount)
+		{
+			const size_t offset = 2 * x * byteCount;
+			const __m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairSums(first + offset, split), pairSums(second + offset, split)), rounding), 2);
+			const __m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairSums(first + offset + half, split), pairSums(second + offset + half, split)), rounding), 2);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x * byteCount), _mm_shuffle_epi8(_mm_packus_epi16(low, high), compact));
+		}
+		reduceRowsScalar(first, second, destination, x, destinationWidth, sourceWidth, byteCount);
+	}
+
+	TARGET_SSSE3 void differenceRgbaSsse3(const uint8_t* first, const uint8_t* second, const size_t pixelCount,
+		uint64_t* absoluteSums, uint64_t* squaredSums, uint8_t* maxima)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i maximum = zero;
+		const size_t blockCount = pixelCount / 4 * 4;
+		size_t i = 0;
+		while (i < blockCount)
+		{
+			// One 32 bits lane per channel, moved to the 64 bits sums before a lane of squares can overflow
+			__m128i absolute = zero;
+			__m128i squared = zero;
+			const size_t end = std::min(blockCount, i + 4 * 4096);
+			for (; i < end; i += 4)
+			{
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i * 4));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i * 4));
+				const __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+				maximum = _mm_max_epu8(maximum, difference);
+				// 16 bits lanes of two pixels each, a square still fits
+				const __m128i low = _mm_unpacklo_epi8(difference, zero);
+				const __m128i high = _mm_unpackhi_epi8(difference, zero);
+				const __m128i sums = _mm_add_epi16(low, high);
+				absolute = _mm_add_epi32(absolute, _mm_add_epi32(_mm_unpacklo_epi16(sums, zero), _mm_unpackhi_epi16(sums, zero)));
+				const __m128i lowSquares = _mm_mullo_epi16(low, low);
+				const __m128i highSquares = _mm_mullo_epi16(high, high);
+				squared = _mm_add_epi32(squared, _mm_add_epi32(
+					_mm_add_epi32(_mm_unpacklo_epi16(lowSquares, zero), _mm_unpackhi_epi16(lowSquares, zero)),
+					_mm_add_epi32(_mm_unpacklo_epi16(highSquares, zero), _mm_unpackhi_epi16(highSquares, zero))));
+			}
+			alignas(16) uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), absolute);
+			for (int c = 0; c < 4; c++) absoluteSums[c] += lanes[c];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), squared);
+			for (int c = 0; c < 4; c++) squaredSums[c] += lanes[c];
+		}
+		alignas(16) uint8_t bytes[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(bytes), maximum);
+		for (int j = 0; j < 16; j++)
+		{
+			maxima[j % 4] = std::max(maxima[j % 4], bytes[j]);
+		}
+		differenceRgbaScalar(first, second, blockCount, pixelCount, absoluteSums, squaredSums, maxima);
+	}
+
+	TARGET_SSSE3 void fillSsse3(uint8_t* destination, const size_t pixelCount, const uint16_t byteCount, const uint8_t* color)
+	{
+		// 48 bytes hold a whole number of 1 to 4 bytes pixels
+		alignas(16) uint8_t pattern[48];
+		for (size_t i = 0; i < sizeof(pattern); i++)
+		{
+			pattern[i] = color[i % byteCount];
+		}
+		const __m128i first = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+		const __m128i second = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern + 16));
+		const __m128i third = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern + 32));
+		const size_t size = pixelCount * byteCount;
+		size_t offset = 0;
+		for (; offset + sizeof(pattern) <= size; offset += sizeof(pattern))
+		{
+			__m128i* block = reinterpret_cast<__m128i*>(destination + offset);
+			_mm_storeu_si128(block, first);
+			_mm_storeu_si128(block + 1, second);
+			_mm_storeu_si128(block + 2, third);
+		}
+		std::memcpy(destination + offset, pattern, size - offset);
+	}
+#endif
+}
+
+/// <summary>
+/// Halve two rows into one, each destination pixel being the rounded mean of a 2x2 block
+/// </summary>
+/// <param name="first"></param>
+/// <param name="second">Can be the first row, for the last row of an odd height</param>
+/// <param name="destination">(sourceWidth + 1) / 2 pixels</param>
+/// <param name="sourceWidth"></param>
+/// <param name="byteCount">1, 3 or 4</param>
+void PixelConverter::reduceRows(const uint8_t* first, const uint8_t* second, uint8_t* destination, const size_t sourceWidth, const uint16_t byteCount)
+{
+	const size_t destinationWidth = (sourceWidth + 1) / 2;
+#ifdef PIXEL_CONVERTER_X86
+	if (hasSsse3())
+	{
+		reduceRowsSsse3(first, second, destination, destinationWidth, sourceWidth, byteCount);
+		return;
+	}
+#endif
+	reduceRowsScalar(first, second, destination, 0, destinationWidth, sourceWidth, byteCount);
+}
+
+/// <summary>
+/// Add the differences between two rows of RGBA pixels to per channel sums
+/// </summary>
+/// <param name="first"></param>
+/// <param name="second"></param>
+/// <param name="pixelCount"></param>
+/// <param name="absoluteSums">4 sums of the absolute differences, added to</param>
+/// <param name="squaredSums">4 sums of the squared differences, added to</param>
+/// <param name="maxima">4 largest absolute differences, raised</param>
+void PixelConverter::differenceRgba(const uint8_t* first, const uint8_t* second, const size_t pixelCount,
+	uint64_t* absoluteSums, uint64_t* squaredSums, uint8_t* maxima)
+{
+#ifdef PIXEL_CONVERTER_X86
+	if (hasSsse3())
+	{
+		differenceRgbaSsse3(first, second, pixelCount, absoluteSums, squaredSums, maxima);
+		return;
+	}
+#endif
+	differenceRgbaScalar(first, second, 0, pixelCount, absoluteSums, squaredSums, maxima);
+}
+
+bool PixelConverter::hasSsse3()
+{
+#if defined(PIXEL_CONVERTER_X86) && (defined(__GNUC__) || defined(__clang__))
+	static const bool supported = __builtin_cpu_supports("ssse3");
+	return supported;
+#elif defined(PIXEL_CONVERTER_X86) && defined(_MSC_VER)
+	static const bool supported = []
+	{
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+bool PixelConverter::hasAvx2()
+{
+#if defined(PIXEL_CONVERTER_X86) && (defined(__GNUC__) || defined(__clang__))
+	static const bool supported = __builtin_cpu_supports("avx2");
+	return supported;
+#elif defined(PIXEL_CONVERTER_X86) && defined(_MSC_VER)
+	static const bool supported = []
+	{
+		int info[4];
+		__cpuid(info, 1);
+		// The OS must save the AVX registers
+		const bool osSupport = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return osSupport && (info[1] & (1 << 5)) != 0;
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+/// <summary>
+/// Luma of a color, rounded to the nearest
+/// </summary>
+uint8_t PixelConverter::luma(const uint8_t red, const uint8_t green, const uint8_t blue)
+{
+	return static_cast<uint8_t>((LUMA_RED_WEIGHT * red + LUMA_GREEN_WEIGHT * green + LUMA_BLUE_WEIGHT * blue
+		+ (1 << (LUMA_SHIFT - 1))) >> LUMA_SHIFT);
+}
+
+/// <summary>
+/// Convert red first pixels to one luma byte per pixel
+/// </summary>
+/// <param name="source"></param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+/// <param name="sourceByteCount">3 or 4</param>
+void PixelConverter::rgbToGray(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t sourceByteCount)
+{
+#ifdef PIXEL_CONVERTER_X86
+	if (hasSsse3())
+	{
+		rgbToGraySsse3(source, destination, pixelCount, sourceByteCount);
+		return;
+	}
+#endif
+	rgbToGrayScalar(source, destination, pixelCount, sourceByteCount);
+}
+
+/// <summary>
+/// Replace palette indices by their color
+/// </summary>
+/// <param name="indices">One byte per pixel</param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+/// <param name="palette">256 entries of 4 bytes, red first</param>
+/// <param name="destinationByteCount">3 or 4</param>
+void PixelConverter::expandPalette(const uint8_t* indices, uint8_t* destination, const size_t pixelCount, const uint8_t* palette, const uint16_t destinationByteCount)
+{
+	if (pixelCount == 0)
+	{
+		return;
+	}
+	// Whole entries are copied, the next pixel overwrites the extra byte of a 3 bytes destination
+	for (size_t i = 0; i + 1 < pixelCount; i++, destination += destinationByteCount)
+	{
+		std::memcpy(destination, palette + indices[i] * 4, 4);
+	}
+	std::memcpy(destination, palette + indices[pixelCount - 1] * 4, destinationByteCount);
+}
+
+/// <summary>
+/// Pack one bit per pixel, most significant bit first
+/// </summary>
+/// <param name="values">One byte per pixel</param>
+/// <param name="destination">(pixelCount + 7) / 8 bytes, unused bits of the last byte are cleared</param>
+/// <param name="pixelCount"></param>
+/// <param name="threshold">Values greater or equal give a 1 bit</param>
+void PixelConverter::packBits(const uint8_t* values, uint8_t* destination, const size_t pixelCount, const uint8_t threshold)
+{
+	size_t i = 0;
+#ifdef PIXEL_CONVERTER_X86
+	// SSE2 is part of every x86-64 CPU
+	const __m128i thresholds = _mm_set1_epi8(static_cast<char>(threshold));
+	for (; i + 16 <= pixelCount; i += 16)
+	{
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, thresholds), block));
+		destination[i / 8] = REVERSED_BITS[mask & 0xFF];
+		destination[i / 8 + 1] = REVERSED_BITS[(mask >> 8) & 0xFF];
+	}
+#endif
+	for (; i < pixelCount; i += 8)
+	{
+		uint8_t byte = 0;
+		for (size_t bit = 0; bit < 8 && i + bit < pixelCount; bit++)
+		{
+			if (values[i + bit] >= threshold) byte |= static_cast<uint8_t>(0x80 >> bit);
+		}
+		destination[i / 8] = byte;
+	}
+}
+
+/// <summary>
+/// Expand packed bits to one index (0 or 1) per pixel
+/// </summary>
+/// <param name="source">Most significant bit first</param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+void PixelConverter::unpackBits(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+{
+	static const std::array<uint64_t, 256> unpacked = makeUnpackedBits();
+	size_t i = 0;
+	for (; i + 8 <= pixelCount; i += 8)
+	{
+		std::memcpy(destination + i, &unpacked[source[i / 8]], 8);
+	}
+	for (; i < pixelCount; i++)
+	{
+		destination[i] = (source[i / 8] >> (7 - i % 8)) & 1;
+	}
+}
+
+/// <summary>
+/// Exchange the first and third bytes of each pixel (red first to blue first and back).
+/// Source and destination can be the same buffer.
+/// </summary>
+/// <param name="source"></param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+/// <param name="byteCount">3 or 4</param>
+void PixelConverter::swapRedBlue(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint16_t byteCount)
+{
+#ifdef PIXEL_CONVERTER_X86
+	if (byteCount == 4 && hasAvx2())
+	{
+		swapRedBlueAvx2(source, destination, pixelCount);
+		return;
+	}
+	if (hasSsse3())
+	{
+		swapRedBlueSsse3(source, destination, pixelCount, byteCount);
+		return;
+	}
+#endif
+	swapRedBlueScalar(source, destination, pixelCount, byteCount);
+}
+
+/// <summary>
+/// Add an alpha channel to 3 bytes pixels. Source and destination must not overlap.
+/// </summary>
+/// <param name="source"></param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+/// <param name="alpha">Alpha of every pixel</param>
+void PixelConverter::rgbToRgba(const uint8_t* source, uint8_t* destination, const size_t pixelCount, const uint8_t alpha)
+{
+#ifdef PIXEL_CONVERTER_X86
+	if (hasAvx2())
+	{
+		rgbToRgbaAvx2(source, destination, pixelCount, alpha);
+		return;
+	}
+	if (hasSsse3())
+	{
+		rgbToRgbaSsse3(source, destination, pixelCount, alpha);
+		return;
+	}
+#endif
+	rgbToRgbaScalar(source, destination, pixelCount, alpha);
+}
+
+/// <summary>
+/// Drop the alpha channel of 4 bytes pixels. Source and destination can be the same buffer.
+/// </summary>
+/// <param name="source"></param>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+void PixelConverter::rgbaToRgb(const uint8_t* source, uint8_t* destination, const size_t pixelCount)
+{
+#ifdef PIXEL_CONVERTER_X86
+	if (hasAvx2())
+	{
+		rgbaToRgbAvx2(source, destination, pixelCount);
+		return;
+	}
+	if (hasSsse3())
+	{
+		rgbaToRgbSsse3(source, destination, pixelCount);
+		return;
+	}
+#endif
+	rgbaToRgbScalar(source, destination, pixelCount);
+}
+
+/// <summary>
+/// Set every pixel to the same color
+/// </summary>
+/// <param name="destination"></param>
+/// <param name="pixelCount"></param>
+/// <param name="byteCount">1 to 4</param>
+/// <param name="color">byteCount bytes</param>
+void PixelConverter::fill(uint8_t* destination, const size_t pixelCount, const uint16_t byteCount, const uint8_t* color)
+{
+	if (byteCount == 1)
+	{
+		std::memset(destination, color[0], pixelCount);
+		return;
+	}
+#ifdef PIXEL_CONVERTER_X86
+	if (hasSsse3())
+	{
+		fillSsse3(destination, pixelCount, byteCount, color);
+		return;
+	}
+#endif
+	fillScalar(destination, pixelCount, byteCount, color);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Row conversion kernels between the in memory pixel formats.
+// Each kernel picks a SIMD implementation at runtime when the CPU supports it, and falls back to scalar code.
+class PixelConverter
+{
+public:
+	// Runtime CPU support of the instruction sets the kernels use
+	static bool hasSsse3();
+	static bool hasAvx2();
+
+	// ITU-R BT.601 luma weights in 15 bits fixed point (they fit 16 bits signed SIMD lanes)
+	static constexpr uint32_t LUMA_RED_WEIGHT = 9798;
+	static constexpr uint32_t LUMA_GREEN_WEIGHT = 19235;
+	static constexpr uint32_t LUMA_BLUE_WEIGHT = 3735;
+	static constexpr uint32_t LUMA_SHIFT = 15;
+
+	static uint8_t luma(uint8_t red, uint8_t green, uint8_t blue);
+
+	static void rgbToGray(const uint8_t* source, uint8_t* destination, size_t pixelCount, uint16_t sourceByteCount);
+	static void expandPalette(const uint8_t* indices, uint8_t* destination, size_t pixelCount, const uint8_t* palette, uint16_t destinationByteCount);
+	static void packBits(const uint8_t* values, uint8_t* destination, size_t pixelCount, uint8_t threshold);
+	static void unpackBits(const uint8_t* source, uint8_t* destination, size_t pixelCount);
+	static void swapRedBlue(const uint8_t* source, uint8_t* destination, size_t pixelCount, uint16_t byteCount);
+	static void rgbToRgba(const uint8_t* source, uint8_t* destination, size_t pixelCount, uint8_t alpha);
+	static void rgbaToRgb(const uint8_t* source, uint8_t* destination, size_t pixelCount);
+	static void fill(uint8_t* destination, size_t pixelCount, uint16_t byteCount, const uint8_t* color);
+	static void differenceRgba(const uint8_t* first, const uint8_t* second, size_t pixelCount,
+		uint64_t* absoluteSums, uint64_t* squaredSums, uint8_t* maxima);
+	static void reduceRows(const uint8_t* first, const uint8_t* second, uint8_t* destination, size_t sourceWidth, uint16_t byteCount);
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Pixels of the 24 and 32 bits images as they are stored in memory, red first
+struct RgbPixel {
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+};
+
+struct RgbaPixel {
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+	uint8_t alpha;
+};
+
+static_assert(sizeof(RgbPixel) == 3 && alignof(RgbPixel) == 1, "RGB pixels must be packed");
+static_assert(sizeof(RgbaPixel) == 4 && alignof(RgbaPixel) == 1, "RGBA pixels must be packed");
+
+// Contiguous pixels of an image, a row or every row, without ownership.
+// The iterators are plain pointers, so loops over a span compile like loops over an array.
+template <typename T>
+class PixelSpan
+{
+	T* _data = nullptr;
+	size_t _size = 0;
+
+public:
+	using value_type = std::remove_const_t<T>;
+	using iterator = T*;
+
+	constexpr PixelSpan() = default;
+
+	constexpr PixelSpan(T* data, const size_t size) : _data(data), _size(size)
+	{
+	}
+
+	// A span of pixels can be read as a span of constant pixels
+	template <typename U, typename = std::enable_if_t<std::is_same<const U, T>::value>>
+	constexpr PixelSpan(const PixelSpan<U>& other) : _data(other.data()), _size(other.size())
+	{
+	}
+
+	constexpr T* data() const
+	{
+		return _data;
+	}
+
+	constexpr size_t size() const
+	{
+		return _size;
+	}
+
+	constexpr bool empty() const
+	{
+		return _size == 0;
+	}
+
+	constexpr T& operator[](const size_t index) const
+	{
+		return _data[index];
+	}
+
+	constexpr iterator begin() const
+	{
+		return _data;
+	}
+
+	constexpr iterator end() const
+	{
+		return _data + _size;
+	}
+};
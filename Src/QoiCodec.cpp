@@ -0,0 +1,272 @@
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+#include "QoiCodec.h"
+
+namespace
+{
+	constexpr uint8_t OP_INDEX = 0x00;
+	constexpr uint8_t OP_DIFF = 0x40;
+	constexpr uint8_t OP_LUMA = 0x80;
+	constexpr uint8_t OP_RUN = 0xC0;
+	constexpr uint8_t OP_RGB = 0xFE;
+	constexpr uint8_t OP_RGBA = 0xFF;
+	constexpr uint8_t TAG_MASK = 0xC0;
+	constexpr int MAX_RUN = 62;
+	constexpr uint8_t END_MARKER[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+	// Encoded bytes are written by blocks of this size
+	constexpr size_t BUFFER_SIZE = 1 << 16;
+
+	// Pixels packed red in the low byte
+	inline uint32_t pack(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a)
+	{
+		return r | (g << 8) | (b << 16) | (static_cast<uint32_t>(a) << 24);
+	}
+
+	inline size_t hash(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a)
+	{
+		return (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+	}
+
+	void writeBigEndian(std::vector<uint8_t>& buffer, const uint32_t value)
+	{
+		buffer.push_back(static_cast<uint8_t>(value >> 24));
+		buffer.push_back(static_cast<uint8_t>(value >> 16));
+		buffer.push_back(static_cast<uint8_t>(value >> 8));
+		buffer.push_back(static_cast<uint8_t>(value));
+	}
+
+	uint32_t readBigEndian(const uint8_t* bytes)
+	{
+		return (static_cast<uint32_t>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+	}
+}
+
+/// <summary>
+/// Read and check the 14 bytes header
+/// </summary>
+/// <param name="stream"></param>
+/// <returns></returns>
+QoiCodec::Header QoiCodec::readHeader(std::istream& stream)
+{
+	uint8_t bytes[HEADER_SIZE];
+	stream.read(reinterpret_cast<char*>(bytes), HEADER_SIZE);
+	if (!stream || readBigEndian(bytes) != MAGIC)
+	{
+		throw std::runtime_error("File is not a QOI file.");
+	}
+	const Header header{readBigEndian(bytes + 4), readBigEndian(bytes + 8), bytes[12], bytes[13]};
+	if (header.width == 0 || header.height == 0 || (header.channels != 3 && header.channels != 4) || header.colorSpace > 1)
+	{
+		throw std::runtime_error("QOI header is not valid.");
+	}
+	return header;
+}
+
+/// <summary>
+/// Decode the pixels following the header, and the end marker
+/// </summary>
+/// <param name="stream">Read up to the end of the image only</param>
+/// <param name="header"></param>
+/// <param name="row">Memory of a row from the top, header.channels bytes per pixel</param>
+void QoiCodec::decode(std::istream& stream, const Header& header, const std::function<uint8_t*(uint32_t)>& row)
+{
+	// Bytes come from the stream buffer one by one, so nothing past the image is consumed
+	std::streambuf* input = stream.rdbuf();
+	const auto next = [input]()
+	{
+		const int value = input->sbumpc();
+		if (value == std::char_traits<char>::eof())
+		{
+			throw std::runtime_error("QOI data is truncated");
+		}
+		return static_cast<uint8_t>(value);
+	};
+
+	std::array<uint32_t, 64> index{};
+	uint8_t r = 0;
+	uint8_t g = 0;
+	uint8_t b = 0;
+	uint8_t a = 255;
+	int run = 0;
+	const uint8_t channels = header.channels;
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		uint8_t* pixel = row(y);
+		for (uint32_t x = 0; x < header.width; x++, pixel += channels)
+		{
+			if (run > 0)
+			{
+				run--;
+			}
+			else
+			{
+				const uint8_t op = next();
+				if (op == OP_RGB)
+				{
+					r = next();
+					g = next();
+					b = next();
+				}
+				else if (op == OP_RGBA)
+				{
+					r = next();
+					g = next();
+					b = next();
+					a = next();
+				}
+				else if ((op & TAG_MASK) == OP_INDEX)
+				{
+					const uint32_t color = index[op];
+					r = static_cast<uint8_t>(color);
+					g = static_cast<uint8_t>(color >> 8);
+					b = static_cast<uint8_t>(color >> 16);
+					a = static_cast<uint8_t>(color >> 24);
+				}
+				else if ((op & TAG_MASK) == OP_DIFF)
+				{
+					r = static_cast<uint8_t>(r + ((op >> 4) & 3) - 2);
+					g = static_cast<uint8_t>(g + ((op >> 2) & 3) - 2);
+					b = static_cast<uint8_t>(b + (op & 3) - 2);
+				}
+				else if ((op & TAG_MASK) == OP_LUMA)
+				{
+					const uint8_t second = next();
+					const int greenDifference = (op & 0x3F) - 32;
+					r = static_cast<uint8_t>(r + greenDifference - 8 + ((second >> 4) & 0x0F));
+					g = static_cast<uint8_t>(g + greenDifference);
+					b = static_cast<uint8_t>(b + greenDifference - 8 + (second & 0x0F));
+				}
+				else
+				{
+					run = op & 0x3F;
+				}
+				index[hash(r, g, b, a)] = pack(r, g, b, a);
+			}
+			pixel[0] = r;
+			pixel[1] = g;
+			pixel[2] = b;
+			if (channels == 4)
+			{
+				pixel[3] = a;
+			}
+		}
+	}
+	for (const uint8_t expected : END_MARKER)
+	{
+		if (next() != expected)
+		{
+			throw std::runtime_error("QOI end marker is missing");
+		}
+	}
+}
+
+/// <summary>
+/// Write the header, the pixels and the end marker
+/// </summary>
+/// <param name="stream"></param>
+/// <param name="header"></param>
+/// <param name="row">Pixels of a row from the top, header.channels bytes per pixel</param>
+void QoiCodec::encode(std::ostream& stream, const Header& header, const std::function<const uint8_t*(uint32_t)>& row)
+{
+	std::vector<uint8_t> buffer;
+	buffer.reserve(BUFFER_SIZE + 64);
+	writeBigEndian(buffer, MAGIC);
+	writeBigEndian(buffer, header.width);
+	writeBigEndian(buffer, header.height);
+	buffer.push_back(header.channels);
+	buffer.push_back(header.colorSpace);
+
+	std::array<uint32_t, 64> index{};
+	uint8_t previousR = 0;
+	uint8_t previousG = 0;
+	uint8_t previousB = 0;
+	uint8_t previousA = 255;
+	uint32_t previous = pack(0, 0, 0, 255);
+	int run = 0;
+	const uint8_t channels = header.channels;
+	for (uint32_t y = 0; y < header.height; y++)
+	{
+		const uint8_t* pixel = row(y);
+		for (uint32_t x = 0; x < header.width; x++, pixel += channels)
+		{
+			const uint8_t r = pixel[0];
+			const uint8_t g = pixel[1];
+			const uint8_t b = pixel[2];
+			const uint8_t a = channels == 4 ? pixel[3] : 255;
+			const uint32_t color = pack(r, g, b, a);
+			if (color == previous)
+			{
+				if (++run == MAX_RUN)
+				{
+					buffer.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0)
+			{
+				buffer.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+				run = 0;
+			}
+			const size_t position = hash(r, g, b, a);
+			if (index[position] == color)
+			{
+				buffer.push_back(static_cast<uint8_t>(OP_INDEX | position));
+			}
+			else
+			{
+				index[position] = color;
+				if (a == previousA)
+				{
+					const int8_t redDifference = static_cast<int8_t>(r - previousR);
+					const int8_t greenDifference = static_cast<int8_t>(g - previousG);
+					const int8_t blueDifference = static_cast<int8_t>(b - previousB);
+					const int redGreen = redDifference - greenDifference;
+					const int blueGreen = blueDifference - greenDifference;
+					if (redDifference > -3 && redDifference < 2 && greenDifference > -3 && greenDifference < 2 &&
+						blueDifference > -3 && blueDifference < 2)
+					{
+						buffer.push_back(static_cast<uint8_t>(OP_DIFF | (redDifference + 2) << 4 | (greenDifference + 2) << 2 | (blueDifference + 2)));
+					}
+					else if (redGreen > -9 && redGreen < 8 && greenDifference > -33 && greenDifference < 32 &&
+						blueGreen > -9 && blueGreen < 8)
+					{
+						buffer.push_back(static_cast<uint8_t>(OP_LUMA | (greenDifference + 32)));
+						buffer.push_back(static_cast<uint8_t>((redGreen + 8) << 4 | (blueGreen + 8)));
+					}
+					else
+					{
+						buffer.insert(buffer.end(), {OP_RGB, r, g, b});
+					}
+				}
+				else
+				{
+					buffer.insert(buffer.end(), {OP_RGBA, r, g, b, a});
+				}
+			}
+			previous = color;
+			previousR = r;
+			previousG = g;
+			previousB = b;
+			previousA = a;
+		}
+		if (buffer.size() >= BUFFER_SIZE)
+		{
+			stream.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+			buffer.clear();
+		}
+	}
+	if (run > 0)
+	{
+		buffer.push_back(static_cast<uint8_t>(OP_RUN | (run - 1)));
+	}
+	buffer.insert(buffer.end(), std::begin(END_MARKER), std::end(END_MARKER));
+	stream.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+	if (!stream)
+	{
+		throw std::runtime_error("Could not write the QOI data");
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+
+// "Quite OK Image" lossless format, see https://qoiformat.org/qoi-specification.pdf
+// Pixels are red first with 3 or 4 channels, rows are streamed top to bottom through a callback giving
+// the memory of each row, so the caller decides where the rows live.
+class QoiCodec
+{
+public:
+	struct Header {
+		uint32_t width;
+		uint32_t height;
+		uint8_t channels;	// 3 (RGB) or 4 (RGBA)
+		uint8_t colorSpace;	// 0 sRGB with linear alpha, 1 all channels linear
+	};
+
+	static constexpr uint32_t MAGIC = 0x716F6966; // 'qoif'
+	static constexpr size_t HEADER_SIZE = 14;
+
+	static Header readHeader(std::istream& stream);
+	static void decode(std::istream& stream, const Header& header, const std::function<uint8_t*(uint32_t)>& row);
+	static void encode(std::ostream& stream, const Header& header, const std::function<const uint8_t*(uint32_t)>& row);
+};
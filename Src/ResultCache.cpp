@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "ContentHash.h"
+#include "Log.h"
+#include "ResultCache.h"
+
+/// <summary>
+/// Cache of a directory, the results already in it are indexed
+/// </summary>
+/// <param name="directory">Created when missing</param>
+/// <param name="capacity">Bytes of result files kept at most</param>
+ResultCache::ResultCache(std::string directory, const uintmax_t capacity) : _directory(std::move(directory)), _capacity(capacity)
+{
+	std::filesystem::create_directories(_directory);
+	struct File {
+		std::string key;
+		uintmax_t bytes;
+		std::filesystem::file_time_type time;
+	};
+	std::vector<File> files;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(_directory))
+	{
+		if (entry.is_regular_file() && entry.path().extension() == EXTENSION)
+		{
+			files.push_back(File{entry.path().stem().string(), entry.file_size(), entry.last_write_time()});
+		}
+	}
+	std::sort(files.begin(), files.end(), [](const File& first, const File& second) { return first.time > second.time; });
+	for (const File& file : files)
+	{
+		_entries.push_back(Entry{file.key, file.bytes});
+		_index[file.key] = std::prev(_entries.end());
+		_statistics.bytes += file.bytes;
+		_statistics.resultCount++;
+	}
+	_evict();
+}
+
+std::string ResultCache::_pathOf(const std::string& key) const
+{
+	return (std::filesystem::path(_directory) / (key + EXTENSION)).string();
+}
+
+/// <summary>
+/// Forget an entry and delete its file. Must be called with the mutex locked.
+/// </summary>
+void ResultCache::_remove(const std::list<Entry>::iterator entry)
+{
+	std::error_code error;
+	std::filesystem::remove(_pathOf(entry->key), error);
+	_statistics.bytes -= entry->bytes;
+	_statistics.resultCount--;
+	_index.erase(entry->key);
+	_entries.erase(entry);
+}
+
+/// <summary>
+/// Remove the least recently used results over the capacity. Must be called with the mutex locked.
+/// </summary>
+void ResultCache::_evict()
+{
+	while (_statistics.bytes > _capacity && !_entries.empty())
+	{
+		_remove(std::prev(_entries.end()));
+		_statistics.evictions++;
+	}
+}
+
+/// <summary>
+/// Name of the file of a result, from the hashes of the input and of the operations
+/// </summary>
+std::string ResultCache::keyOf(const uint64_t inputHash, const std::string& operations)
+{
+	return ContentHash::toHex(inputHash) + "-" + ContentHash::toHex(ContentHash::hash(operations.data(), operations.size()));
+}
+
+/// <summary>
+/// Load the result of operations on an image, when it was stored
+/// </summary>
+/// <param name="inputHash">Content hash of the image before the operations</param>
+/// <param name="operations">Description of the operations</param>
+/// <param name="result">Replaced by the stored result when there is one</param>
+/// <returns>True when the result was found</returns>
+bool ResultCache::find(const uint64_t inputHash, const std::string& operations, BMPImage& result)
+{
+	const std::string key = keyOf(inputHash, operations);
+	const std::string path = _pathOf(key);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto found = _index.find(key);
+		if (found == _index.end())
+		{
+			_statistics.misses++;
+			return false;
+		}
+		_entries.splice(_entries.begin(), _entries, found->second);
+	}
+	try
+	{
+		BMPImage loaded(path.c_str());
+		std::error_code error;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+		result = std::move(loaded);
+	}
+	catch (const std::exception& e)
+	{
+		// Removed or damaged outside of the cache
+		Log::write(Log::Level::WARNING, "Result " + key + " could not be read: " + e.what());
+		std::lock_guard<std::mutex> lock(_mutex);
+		const auto found = _index.find(key);
+		if (found != _index.end())
+		{
+			_remove(found->second);
+		}
+		_statistics.misses++;
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_statistics.hits++;
+	return true;
+}
+
+/// <summary>
+/// Keep the result of operations on an image. A result that can not be written is reported and left out of the cache.
+/// </summary>
+/// <param name="inputHash">Content hash of the image before the operations</param>
+/// <param name="operations">Description of the operations</param>
+/// <param name="result"></param>
+void ResultCache::store(const uint64_t inputHash, const std::string& operations, const BMPImage& result)
+{
+	const std::string key = keyOf(inputHash, operations);
+	const std::string path = _pathOf(key);
+	// Written aside and renamed, so that a reader never sees a partial file
+	const std::string temporaryPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	uintmax_t bytes = 0;
+	try
+	{
+		{
+			std::ofstream file(temporaryPath, std::ios::binary);
+			if (!file)
+			{
+				throw std::runtime_error("Could not create file " + temporaryPath);
+			}
+			result.write(file, BMPImage::FileFormat::BMP);
+		}
+		std::filesystem::rename(temporaryPath, path);
+		bytes = std::filesystem::file_size(path);
+	}
+	catch (const std::exception& e)
+	{
+		// The result is still good for the caller, it is only not kept
+		Log::write(Log::Level::WARNING, "Result " + key + " could not be stored: " + e.what());
+		std::error_code error;
+		std::filesystem::remove(temporaryPath, error);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto found = _index.find(key);
+	if (found != _index.end())
+	{
+		_statistics.bytes -= found->second->bytes;
+		_statistics.resultCount--;
+		_entries.erase(found->second);
+		_index.erase(found);
+	}
+	_entries.push_front(Entry{key, bytes});
+	_index[key] = _entries.begin();
+	_statistics.bytes += bytes;
+	_statistics.resultCount++;
+	_statistics.stores++;
+	_evict();
+}
+
+/// <summary>
+/// Delete every result, the counters are kept
+/// </summary>
+void ResultCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	while (!_entries.empty())
+	{
+		_remove(_entries.begin());
+	}
+}
+
+ResultCache::Statistics ResultCache::getStatistics() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
+
+/// <summary>
+/// Hits out of the lookups, 0 before the first one
+/// </summary>
+double ResultCache::Statistics::hitRate() const
+{
+	const uint64_t lookups = hits + misses;
+	return lookups == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(lookups);
+}
+
+std::ostream& operator<<(std::ostream& os, const ResultCache::Statistics& statistics)
+{
+	const std::streamsize precision = os.precision(1);
+	const std::ios::fmtflags flags = os.setf(std::ios::fixed, std::ios::floatfield);
+	os << "Result cache: " << statistics.hits << " hits, " << statistics.misses << " misses (" << statistics.hitRate() * 100
+		<< "% hit rate), " << statistics.stores << " stores, " << statistics.evictions << " evictions, "
+		<< statistics.resultCount << " results (" << statistics.bytes / 1024 << " KiB)";
+	os.precision(precision);
+	os.flags(flags);
+	return os;
+}
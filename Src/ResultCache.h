@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#include "BMPImage.h"
+
+// Results of operation chains kept as BMP files in a directory, so a chain applied again to the same image is not run.
+// A result is found by the content hash of the input image and the description of the chain, like "multiply 0.5; grayscale".
+// The least recently used results are removed when the files are over the capacity in bytes, the order is kept
+// between runs through the modification times of the files.
+class ResultCache
+{
+public:
+	struct Statistics {
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t stores;
+		uint64_t evictions;
+		uintmax_t bytes;
+		size_t resultCount;
+
+		double hitRate() const;
+	};
+
+	static constexpr uintmax_t DEFAULT_CAPACITY = static_cast<uintmax_t>(1) << 30;
+	static constexpr const char* EXTENSION = ".bmp";
+
+private:
+	struct Entry {
+		std::string key;
+		uintmax_t bytes;
+	};
+
+	std::string _directory;
+	uintmax_t _capacity;
+	std::list<Entry> _entries;	// Most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+	Statistics _statistics{};
+	mutable std::mutex _mutex;
+
+	std::string _pathOf(const std::string& key) const;
+	void _remove(std::list<Entry>::iterator entry);
+	void _evict();
+
+public:
+	explicit ResultCache(std::string directory, uintmax_t capacity = DEFAULT_CAPACITY);
+	ResultCache(const ResultCache&) = delete;
+	ResultCache& operator=(const ResultCache&) = delete;
+
+	static std::string keyOf(uint64_t inputHash, const std::string& operations);
+
+	bool find(uint64_t inputHash, const std::string& operations, BMPImage& result);
+	void store(uint64_t inputHash, const std::string& operations, const BMPImage& result);
+	void clear();
+	Statistics getStatistics() const;
+};
+
+std::ostream& operator<<(std::ostream& os, const ResultCache::Statistics& statistics);
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "RunLengthCodec.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// Escape codes following a zero count
+	constexpr uint8_t END_OF_LINE = 0;
+	constexpr uint8_t END_OF_BITMAP = 1;
+	constexpr uint8_t DELTA = 2;
+
+	// Shorter runs are cheaper inside absolute blocks, which also need 3 pixels at least
+	constexpr int32_t MIN_RUN = 3;
+	constexpr int32_t MAX_COUNT = 255;
+
+	// Count of pixels equal to the one at x, up to the limit and the largest count of a code
+	int32_t runLength(const uint8_t* row, const int32_t x, const int32_t limit)
+	{
+		const int32_t end = std::min(limit, x + MAX_COUNT);
+		int32_t next = x + 1;
+		while (next < end && row[next] == row[x])
+		{
+			next++;
+		}
+		return next - x;
+	}
+
+	void encodeRun(std::vector<uint8_t>& output, const int32_t count, const uint8_t value, const bool nibbles)
+	{
+		output.push_back(static_cast<uint8_t>(count));
+		output.push_back(nibbles ? static_cast<uint8_t>((value & 0x0F) * 0x11) : value);
+	}
+
+	void encodeRow(const uint8_t* row, const int32_t width, const bool nibbles, std::vector<uint8_t>& output)
+	{
+		int32_t x = 0;
+		while (x < width)
+		{
+			const int32_t run = runLength(row, x, width);
+			if (run >= MIN_RUN)
+			{
+				encodeRun(output, run, row[x], nibbles);
+				x += run;
+				continue;
+			}
+			// Literal pixels up to the next run worth encoding
+			int32_t end = x + run;
+			while (end < width && end - x < MAX_COUNT)
+			{
+				const int32_t next = runLength(row, end, width);
+				if (next >= MIN_RUN)
+				{
+					break;
+				}
+				end += next;
+			}
+			end = std::min(end, x + MAX_COUNT);
+			const int32_t count = end - x;
+			if (count < MIN_RUN)
+			{
+				while (x < end)
+				{
+					const int32_t shortRun = runLength(row, x, end);
+					encodeRun(output, shortRun, row[x], nibbles);
+					x += shortRun;
+				}
+				continue;
+			}
+			output.push_back(0);
+			output.push_back(static_cast<uint8_t>(count));
+			size_t written;
+			if (nibbles)
+			{
+				written = static_cast<size_t>(count + 1) / 2;
+				for (int32_t i = 0; i < count; i += 2)
+				{
+					const uint8_t second = i + 1 < count ? row[x + i + 1] & 0x0F : 0;
+					output.push_back(static_cast<uint8_t>(((row[x + i] & 0x0F) << 4) | second));
+				}
+			}
+			else
+			{
+				written = static_cast<size_t>(count);
+				output.insert(output.end(), row + x, row + end);
+			}
+			// Absolute blocks are padded to 16 bits
+			if (written % 2 != 0)
+			{
+				output.push_back(0);
+			}
+			x = end;
+		}
+	}
+}
+
+/// <summary>
+/// Expand run length encoded pixel data. Pixels skipped by the data keep their value.
+/// </summary>
+/// <param name="data">Encoded pixel data</param>
+/// <param name="size">Size of the encoded data</param>
+/// <param name="pixels">width * height indices, one byte each</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="nibbles">BI_RLE4 data</param>
+void RunLengthCodec::decode(const uint8_t* data, const size_t size, uint8_t* pixels, const int32_t width, const int32_t height, const bool nibbles)
+{
+	int64_t x = 0;
+	int64_t y = 0;
+	size_t position = 0;
+	while (position + 2 <= size && y < height)
+	{
+		const uint8_t count = data[position++];
+		const uint8_t value = data[position++];
+		uint8_t* row = pixels + y * width;
+		if (count > 0)
+		{
+			// Encoded run, clipped to the row
+			const int64_t end = std::min<int64_t>(width, x + count);
+			if (x < end)
+			{
+				if (!nibbles || value >> 4 == (value & 0x0F))
+				{
+					std::memset(row + x, nibbles ? value & 0x0F : value, static_cast<size_t>(end - x));
+				}
+				else
+				{
+					const uint8_t pair[2] = {static_cast<uint8_t>(value >> 4), static_cast<uint8_t>(value & 0x0F)};
+					for (int64_t i = x; i < end; i++)
+					{
+						row[i] = pair[(i - x) & 1];
+					}
+				}
+			}
+			x += count;
+			continue;
+		}
+		if (value == END_OF_LINE)
+		{
+			x = 0;
+			y++;
+		}
+		else if (value == END_OF_BITMAP)
+		{
+			return;
+		}
+		else if (value == DELTA)
+		{
+			if (position + 2 > size)
+			{
+				break;
+			}
+			x += data[position];
+			y += data[position + 1];
+			position += 2;
+		}
+		else
+		{
+			// Absolute block of value pixels, padded to 16 bits
+			const size_t byteCount = nibbles ? (value + 1u) / 2 : value;
+			if (position + byteCount > size)
+			{
+				throw std::runtime_error("Pixel data is truncated");
+			}
+			const int64_t end = std::min<int64_t>(width, x + value);
+			for (int64_t i = x; i < end; i++)
+			{
+				const size_t index = static_cast<size_t>(i - x);
+				row[i] = nibbles ? (data[position + index / 2] >> (index % 2 == 0 ? 4 : 0)) & 0x0F : data[position + index];
+			}
+			x += value;
+			position += byteCount + byteCount % 2;
+		}
+	}
+}
+
+/// <summary>
+/// Run length encode pixels, the rows are encoded in parallel
+/// </summary>
+/// <param name="pixels">width * height indices, one byte each (below 16 for BI_RLE4)</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="nibbles">BI_RLE4 data</param>
+/// <returns>Encoded pixel data, ending with an end of bitmap code</returns>
+std::vector<uint8_t> RunLengthCodec::encode(const uint8_t* pixels, const int32_t width, const int32_t height, const bool nibbles)
+{
+	std::vector<std::vector<uint8_t>> rows(static_cast<size_t>(std::max(height, 0)));
+	ThreadPool::instance().parallelFor(0, height, [&](const int64_t begin, const int64_t end)
+	{
+		for (int64_t y = begin; y < end; y++)
+		{
+			std::vector<uint8_t>& output = rows[static_cast<size_t>(y)];
+			encodeRow(pixels + y * width, width, nibbles, output);
+			output.push_back(0);
+			output.push_back(y + 1 == height ? END_OF_BITMAP : END_OF_LINE);
+		}
+	});
+
+	size_t size = 0;
+	for (const std::vector<uint8_t>& row : rows)
+	{
+		size += row.size();
+	}
+	std::vector<uint8_t> data;
+	data.reserve(size);
+	for (const std::vector<uint8_t>& row : rows)
+	{
+		data.insert(data.end(), row.begin(), row.end());
+	}
+	return data;
+}
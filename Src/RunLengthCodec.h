@@ -0,0 +1,14 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// BI_RLE8 and BI_RLE4 pixel data of BMP files, see https://learn.microsoft.com/en-us/windows/win32/gdi/bitmap-compression
+// Pixels are one palette index per byte in memory, rows bottom-up like the file, and 4 bits indices are packed
+// in pairs on disk.
+class RunLengthCodec
+{
+public:
+	static void decode(const uint8_t* data, size_t size, uint8_t* pixels, int32_t width, int32_t height, bool nibbles);
+	static std::vector<uint8_t> encode(const uint8_t* pixels, int32_t width, int32_t height, bool nibbles);
+};
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+
+#include "Instrumentation.h"
+#include "ThreadPool.h"
+
+namespace
+{
+	// State of one parallelFor call, shared with the helpers that may outlive the caller's wait
+	struct ParallelJob
+	{
+		std::atomic<int64_t> next;
+		std::atomic<int64_t> remaining;
+		int64_t end;
+		int64_t chunkSize;
+		std::function<void(int64_t, int64_t)> body;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::atomic<bool> failed{false};
+		std::exception_ptr error;		// First exception thrown by the body, guarded by mutex
+
+		// Process chunks until the range is exhausted. After a throw the other chunks are skipped but still
+		// counted down, so the caller waits for every thread to leave the body before the exception goes up.
+		void run()
+		{
+			while (true)
+			{
+				const int64_t chunkBegin = next.fetch_add(chunkSize);
+				if (chunkBegin >= end)
+				{
+					return;
+				}
+				const int64_t chunkEnd = std::min(chunkBegin + chunkSize, end);
+				if (!failed.load())
+				{
+					try
+					{
+#ifdef IMAGE_INSTRUMENTATION
+						const auto start = std::chrono::steady_clock::now();
+						body(chunkBegin, chunkEnd);
+						IMAGE_COUNT(POOL_TASKS, 1);
+						IMAGE_COUNT(POOL_BUSY_NANOSECONDS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#else
+						body(chunkBegin, chunkEnd);
+#endif
+					}
+					catch (...)
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						if (!error)
+						{
+							error = std::current_exception();
+						}
+						failed = true;
+					}
+				}
+				if (remaining.fetch_sub(chunkEnd - chunkBegin) == chunkEnd - chunkBegin)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					done.notify_all();
+				}
+			}
+		}
+	};
+}
+
+/// <summary>
+/// Start the worker threads
+/// </summary>
+/// <param name="threadCount">Number of threads working on a parallel loop, the calling thread included</param>
+ThreadPool::ThreadPool(const unsigned threadCount)
+{
+	const unsigned workerCount = std::max(threadCount, 1u) - 1;
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		_workers.emplace_back(&ThreadPool::_workerLoop, this);
+	}
+}
+
+/// <summary>
+/// Stop and join the worker threads
+/// </summary>
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_condition.notify_all();
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
+}
+
+/// <summary>
+/// Pool shared by every image of the process
+/// </summary>
+ThreadPool& ThreadPool::instance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::_workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_condition.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+			if (_stopping && _tasks.empty())
+			{
+				return;
+			}
+			task = std::move(_tasks.front());
+			_tasks.pop();
+		}
+		task();
+	}
+}
+
+unsigned ThreadPool::getThreadCount() const
+{
+	return static_cast<unsigned>(_workers.size()) + 1;
+}
+
+/// <summary>
+/// Restart the pool with another number of threads. No parallel loop may be running.
+/// </summary>
+/// <param name="threadCount">Number of threads working on a parallel loop, the calling thread included</param>
+void ThreadPool::setThreadCount(const unsigned threadCount)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_condition.notify_all();
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+	_stopping = false;
+	const unsigned workerCount = std::max(threadCount, 1u) - 1;
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		_workers.emplace_back(&ThreadPool::_workerLoop, this);
+	}
+}
+
+/// <summary>
+/// Run body over [begin, end) split in contiguous chunks.
+/// The calling thread takes part in the work, so nested calls can not deadlock.
+/// </summary>
+/// <param name="begin"></param>
+/// <param name="end"></param>
+/// <param name="body">Called with a [chunkBegin, chunkEnd) sub range, its first exception is rethrown once no thread runs it anymore</param>
+/// <param name="minChunkSize">Smallest range worth handing to another thread</param>
+void ThreadPool::parallelFor(const int64_t begin, const int64_t end, const std::function<void(int64_t, int64_t)>& body, const int64_t minChunkSize)
+{
+	const int64_t count = end - begin;
+	if (count <= 0)
+	{
+		return;
+	}
+#ifdef IMAGE_INSTRUMENTATION
+	// The whole loop keeps the pool busy, only the threads working on it count as busy
+	const auto loopStart = std::chrono::steady_clock::now();
+	struct LoopTimer {
+		std::chrono::steady_clock::time_point start;
+		~LoopTimer()
+		{
+			IMAGE_COUNT(POOL_LOOPS, 1);
+			IMAGE_COUNT(POOL_LOOP_NANOSECONDS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+	} loopTimer{loopStart};
+#endif
+	const int64_t threadCount = getThreadCount();
+	if (threadCount == 1 || count <= minChunkSize)
+	{
+		body(begin, end);
+		IMAGE_COUNT(POOL_TASKS, 1);
+		IMAGE_COUNT(POOL_BUSY_NANOSECONDS, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - loopStart).count());
+		return;
+	}
+
+	// A few chunks per thread to balance uneven rows
+	const int64_t chunkSize = std::max(minChunkSize, (count + threadCount * 4 - 1) / (threadCount * 4));
+	auto job = std::make_shared<ParallelJob>();
+	job->next = begin;
+	job->remaining = count;
+	job->end = end;
+	job->chunkSize = chunkSize;
+	job->body = body;
+
+	const int64_t helperCount = std::min(threadCount - 1, (count + chunkSize - 1) / chunkSize - 1);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (int64_t i = 0; i < helperCount; i++)
+		{
+			_tasks.emplace([job] { job->run(); });
+		}
+	}
+	_condition.notify_all();
+
+	job->run();
+
+	std::unique_lock<std::mutex> lock(job->mutex);
+	job->done.wait(lock, [&job] { return job->remaining.load() == 0; });
+	// Taken out of the job, a helper may release the job after the caller is gone
+	const std::exception_ptr error = std::move(job->error);
+	job->error = nullptr;
+	lock.unlock();
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads shared by the image operations.
+// Work is split in contiguous chunks (usually rows) so each thread touches its own part of the pixel buffer.
+class ThreadPool
+{
+	std::vector<std::thread> _workers;
+	std::queue<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _stopping = false;
+
+	void _workerLoop();
+
+public:
+	explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	static ThreadPool& instance();
+
+	unsigned getThreadCount() const;
+	void setThreadCount(unsigned threadCount);
+	void parallelFor(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)>& body, int64_t minChunkSize = 1);
+};
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#include "Instrumentation.h"
+#include "ThreadPool.h"
+#include "TiledImage.h"
+
+namespace
+{
+	/// <summary>
+	/// Pixels of a column of a tile into a row, the pixel size is known to the compiler
+	/// </summary>
+	template <size_t ByteCount>
+	void copyColumn(uint8_t* destination, const uint8_t* source, const uint32_t count, const ptrdiff_t stride)
+	{
+		for (uint32_t i = 0; i < count; i++, destination += ByteCount, source += stride)
+		{
+			std::memcpy(destination, source, ByteCount);
+		}
+	}
+}
+
+/// <summary>
+/// Black image
+/// </summary>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="bitCount">8 (gray), 24 or 32</param>
+TiledImage::TiledImage(const uint32_t width, const uint32_t height, const uint16_t bitCount)
+	: _width(width), _height(height), _bitCount(bitCount), _tileColumns((width + TILE_SIZE - 1) / TILE_SIZE),
+	_tileRows((height + TILE_SIZE - 1) / TILE_SIZE), _grayRamp(bitCount == BMPImage::GRAY_SCALE_BIT_SIZE),
+	_xPixelsPerMeter(BMPImage::BM_DEFAULT_RESOLUTION), _yPixelsPerMeter(BMPImage::BM_DEFAULT_RESOLUTION)
+{
+	if (bitCount != BMPImage::GRAY_SCALE_BIT_SIZE && bitCount != BMPImage::TRUE_COLOR_BIT_SIZE && bitCount != BMPImage::DEEP_COLOR_BIT_SIZE)
+	{
+		throw std::invalid_argument("Only 8, 24 and 32 bits images can be tiled");
+	}
+	if (_grayRamp)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			const uint8_t value = static_cast<uint8_t>(i);
+			_palette.push_back({value, value, value, 0});
+		}
+	}
+	// Edge tiles are whole, the pixels past the image are never read
+	_pixelData.assign(_getTileSize() * _tileColumns * _tileRows, 0);
+}
+
+/// <summary>
+/// Tiles of the pixels of an image, the tile rows are copied by the threads of the pool
+/// </summary>
+/// <param name="image">8, 24 or 32 bits</param>
+TiledImage::TiledImage(const BMPImage& image) : TiledImage(image.getWidth(), image.getHeight(), image.getBitCount())
+{
+	_palette = image._palette;
+	_grayRamp = image._hasGrayRamp();
+	_xPixelsPerMeter = image._activeHeader.xPixelsPerMeter;
+	_yPixelsPerMeter = image._activeHeader.yPixelsPerMeter;
+	const size_t rowSize = image._getRowSize();
+	const size_t tileRowSize = static_cast<size_t>(TILE_SIZE) * _getByteCount();
+	ThreadPool::instance().parallelFor(0, _tileRows, [&](const int64_t first, const int64_t last)
+	{
+		for (uint32_t tileY = static_cast<uint32_t>(first); tileY < static_cast<uint32_t>(last); tileY++)
+		{
+			const uint32_t rowCount = std::min(TILE_SIZE, _height - tileY * TILE_SIZE);
+			for (uint32_t tileX = 0; tileX < _tileColumns; tileX++)
+			{
+				const size_t bytes = static_cast<size_t>(std::min(TILE_SIZE, _width - tileX * TILE_SIZE)) * _getByteCount();
+				uint8_t* tile = _getTile(tileX, tileY);
+				const uint8_t* source = image._pixelData.data() + static_cast<size_t>(tileY) * TILE_SIZE * rowSize + tileX * tileRowSize;
+				for (uint32_t y = 0; y < rowCount; y++)
+				{
+					std::memcpy(tile + y * tileRowSize, source + y * rowSize, bytes);
+				}
+			}
+		}
+	});
+}
+
+/// <summary>
+/// Load an image file and tile it
+/// </summary>
+/// <param name="filename"></param>
+TiledImage::TiledImage(const char* filename) : TiledImage(BMPImage(filename))
+{
+}
+
+uint16_t TiledImage::_getByteCount() const
+{
+	return _bitCount / 8;
+}
+
+size_t TiledImage::_getTileSize() const
+{
+	return static_cast<size_t>(TILE_SIZE) * TILE_SIZE * _getByteCount();
+}
+
+uint8_t* TiledImage::_getTile(const uint32_t tileX, const uint32_t tileY)
+{
+	return _pixelData.data() + (static_cast<size_t>(tileY) * _tileColumns + tileX) * _getTileSize();
+}
+
+const uint8_t* TiledImage::_getTile(const uint32_t tileX, const uint32_t tileY) const
+{
+	return const_cast<TiledImage*>(this)->_getTile(tileX, tileY);
+}
+
+/// <summary>
+/// Pixels back in rows, the tile rows are copied by the threads of the pool
+/// </summary>
+/// <returns></returns>
+BMPImage TiledImage::toImage() const
+{
+	BMPImage image(static_cast<int32_t>(_width), static_cast<int32_t>(_height), _bitCount);
+	if (_bitCount == BMPImage::GRAY_SCALE_BIT_SIZE)
+	{
+		image.setPalette(_palette);
+	}
+	image.setResolution(_xPixelsPerMeter, _yPixelsPerMeter);
+	const size_t rowSize = image._getRowSize();
+	const size_t tileRowSize = static_cast<size_t>(TILE_SIZE) * _getByteCount();
+	ThreadPool::instance().parallelFor(0, _tileRows, [&](const int64_t first, const int64_t last)
+	{
+		for (uint32_t tileY = static_cast<uint32_t>(first); tileY < static_cast<uint32_t>(last); tileY++)
+		{
+			const uint32_t rowCount = std::min(TILE_SIZE, _height - tileY * TILE_SIZE);
+			for (uint32_t tileX = 0; tileX < _tileColumns; tileX++)
+			{
+				const size_t bytes = static_cast<size_t>(std::min(TILE_SIZE, _width - tileX * TILE_SIZE)) * _getByteCount();
+				const uint8_t* tile = _getTile(tileX, tileY);
+				uint8_t* destination = image._pixelData.data() + static_cast<size_t>(tileY) * TILE_SIZE * rowSize + tileX * tileRowSize;
+				for (uint32_t y = 0; y < rowCount; y++)
+				{
+					std::memcpy(destination + y * rowSize, tile + y * tileRowSize, bytes);
+				}
+			}
+		}
+	});
+	return image;
+}
+
+/// <summary>
+/// Save in rows, in the format of the extension
+/// </summary>
+/// <param name="filename"></param>
+void TiledImage::save(const char* filename) const
+{
+	toImage().save(filename);
+}
+
+uint32_t TiledImage::getWidth() const
+{
+	return _width;
+}
+
+uint32_t TiledImage::getHeight() const
+{
+	return _height;
+}
+
+uint16_t TiledImage::getBitCount() const
+{
+	return _bitCount;
+}
+
+/// <summary>
+/// Bytes of a pixel, red first
+/// </summary>
+/// <param name="x"></param>
+/// <param name="y">From the bottom, like BMPImage</param>
+uint8_t* TiledImage::pixel(const uint32_t x, const uint32_t y)
+{
+	if (x >= _width || y >= _height)
+	{
+		throw std::out_of_range("Pixel coordinates are out of bounds");
+	}
+	return _getTile(x / TILE_SIZE, y / TILE_SIZE) + (static_cast<size_t>(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * _getByteCount();
+}
+
+const uint8_t* TiledImage::pixel(const uint32_t x, const uint32_t y) const
+{
+	return const_cast<TiledImage*>(this)->pixel(x, y);
+}
+
+/// <summary>
+/// Turn the image a quarter turn, like BMPImage::rotate90. The destination tiles are split between the threads,
+/// the pixels of a destination tile come from one or two source tiles.
+/// </summary>
+/// <param name="clockwise"></param>
+void TiledImage::rotate90(const bool clockwise)
+{
+	TiledImage rotated(_height, _width, _bitCount);
+	const uint16_t byteCount = _getByteCount();
+	const ptrdiff_t tileRowSize = static_cast<ptrdiff_t>(TILE_SIZE) * byteCount;
+	const int64_t tileCount = static_cast<int64_t>(rotated._tileColumns) * rotated._tileRows;
+	ThreadPool::instance().parallelFor(0, tileCount, [&](const int64_t first, const int64_t last)
+	{
+		for (int64_t index = first; index < last; index++)
+		{
+			const uint32_t tileX = static_cast<uint32_t>(index % rotated._tileColumns);
+			const uint32_t tileY = static_cast<uint32_t>(index / rotated._tileColumns);
+			uint8_t* tile = rotated._getTile(tileX, tileY);
+			const uint32_t rowCount = std::min(TILE_SIZE, rotated._height - tileY * TILE_SIZE);
+			const uint32_t columnCount = std::min(TILE_SIZE, rotated._width - tileX * TILE_SIZE);
+			for (uint32_t row = 0; row < rowCount; row++)
+			{
+				// Clockwise, the pixel (x, y) goes to (y, width - 1 - x), and to (height - 1 - y, x) the other way
+				const uint32_t y = tileY * TILE_SIZE + row;
+				const uint32_t sourceX = clockwise ? _width - 1 - y : y;
+				uint8_t* destination = tile + static_cast<size_t>(row) * TILE_SIZE * byteCount;
+				// A destination row is a source column, copied a source tile at a time
+				for (uint32_t column = 0; column < columnCount;)
+				{
+					const uint32_t x = tileX * TILE_SIZE + column;
+					const uint32_t sourceY = clockwise ? x : _height - 1 - x;
+					const uint32_t tileRow = sourceY % TILE_SIZE;
+					const uint32_t count = std::min(columnCount - column, clockwise ? TILE_SIZE - tileRow : tileRow + 1);
+					const uint8_t* source = _getTile(sourceX / TILE_SIZE, sourceY / TILE_SIZE)
+						+ (static_cast<size_t>(tileRow) * TILE_SIZE + sourceX % TILE_SIZE) * byteCount;
+					const ptrdiff_t stride = clockwise ? tileRowSize : -tileRowSize;
+					uint8_t* target = destination + static_cast<size_t>(column) * byteCount;
+					switch (byteCount)
+					{
+					case 1:
+						copyColumn<1>(target, source, count, stride);
+						break;
+					case 3:
+						copyColumn<3>(target, source, count, stride);
+						break;
+					default:
+						copyColumn<4>(target, source, count, stride);
+						break;
+					}
+					column += count;
+				}
+			}
+		}
+	});
+	rotated._palette = std::move(_palette);
+	rotated._grayRamp = _grayRamp;
+	rotated._xPixelsPerMeter = _yPixelsPerMeter;
+	rotated._yPixelsPerMeter = _xPixelsPerMeter;
+	*this = std::move(rotated);
+}
+
+/// <summary>
+/// Replace each pixel by the mean of the pixels above and below it within a radius, like BMPImage::blurVertical.
+/// The tile columns are split between the threads, the running sums of a tile column are updated a tile row at a time.
+/// </summary>
+/// <param name="radius">In pixels</param>
+void TiledImage::blurVertical(const uint32_t radius)
+{
+	if (_bitCount == BMPImage::GRAY_SCALE_BIT_SIZE && !_grayRamp)
+	{
+		throw std::logic_error("Blurring needs a true color or gray image");
+	}
+	if (radius == 0 || _height == 0)
+	{
+		return;
+	}
+	const int64_t height = _height;
+	const uint32_t windowSize = 2 * radius + 1;
+	const size_t tileRowSize = static_cast<size_t>(TILE_SIZE) * _getByteCount();
+	PixelBuffer blurred(_pixelData.size(), _pixelData.get_allocator());
+	ThreadPool::instance().parallelFor(0, _tileColumns, [&](const int64_t first, const int64_t last)
+	{
+		std::vector<uint32_t> sums(tileRowSize);
+		for (uint32_t tileX = static_cast<uint32_t>(first); tileX < static_cast<uint32_t>(last); tileX++)
+		{
+			// Row y of the tile column, the edge rows are repeated
+			const auto row = [&](const int64_t y)
+			{
+				const uint32_t clamped = static_cast<uint32_t>(std::clamp<int64_t>(y, 0, height - 1));
+				return _getTile(tileX, clamped / TILE_SIZE) + (clamped % TILE_SIZE) * tileRowSize;
+			};
+			std::fill(sums.begin(), sums.end(), 0);
+			for (int64_t y = -static_cast<int64_t>(radius); y <= static_cast<int64_t>(radius); y++)
+			{
+				const uint8_t* samples = row(y);
+				for (size_t i = 0; i < tileRowSize; i++)
+				{
+					sums[i] += samples[i];
+				}
+			}
+			for (int64_t y = 0; y < height; y++)
+			{
+				uint8_t* destination = blurred.data() + (static_cast<size_t>(y / TILE_SIZE) * _tileColumns + tileX) * _getTileSize()
+					+ (y % TILE_SIZE) * tileRowSize;
+				const uint8_t* entering = row(y + radius + 1);
+				const uint8_t* leaving = row(y - radius);
+				for (size_t i = 0; i < tileRowSize; i++)
+				{
+					destination[i] = static_cast<uint8_t>((sums[i] + windowSize / 2) / windowSize);
+					sums[i] += entering[i];
+					sums[i] -= leaving[i];
+				}
+			}
+		}
+	});
+	_pixelData.swap(blurred);
+}
+
+/// <summary>
+/// Mandelbrot fractal rendered tile by tile, the same pixels as BMPImage::Fractal::mandelbrot
+/// </summary>
+TiledImage TiledImage::mandelbrot(const int32_t width, const int32_t height, const int16_t iterations)
+{
+	const float aspectRatio = static_cast<float>(width) / height;
+	const float scale = 3.5f / std::min(width, height);
+	const float offsetX = -2.5f * aspectRatio;
+	constexpr float offsetY = -1.75f;
+	TiledImage image(static_cast<uint32_t>(width), static_cast<uint32_t>(height), BMPImage::TRUE_COLOR_BIT_SIZE);
+	IMAGE_TIME_PHASE(RENDER);
+	IMAGE_COUNT(PIXELS, static_cast<uint64_t>(width) * height);
+	// Tiles are smaller units of work than rows, the slow areas of the fractal are spread over more tasks
+	const int64_t tileCount = static_cast<int64_t>(image._tileColumns) * image._tileRows;
+	ThreadPool::instance().parallelFor(0, tileCount, [&](const int64_t first, const int64_t last)
+	{
+		for (int64_t index = first; index < last; index++)
+		{
+			const uint32_t tileX = static_cast<uint32_t>(index % image._tileColumns);
+			const uint32_t tileY = static_cast<uint32_t>(index / image._tileColumns);
+			uint8_t* tile = image._getTile(tileX, tileY);
+			const uint32_t rowCount = std::min(TILE_SIZE, image._height - tileY * TILE_SIZE);
+			const uint32_t columnCount = std::min(TILE_SIZE, image._width - tileX * TILE_SIZE);
+			for (uint32_t row = 0; row < rowCount; row++)
+			{
+				const uint32_t y = tileY * TILE_SIZE + row;
+				for (uint32_t column = 0; column < columnCount; column++)
+				{
+					const uint32_t x = tileX * TILE_SIZE + column;
+					float zx = 0;
+					float zy = 0;
+					const float cx = (x * scale / aspectRatio) + offsetX;
+					const float cy = y * scale + offsetY;
+					int16_t i = 0;
+					for (; i < iterations; ++i)
+					{
+						const float temp = zx * zx - zy * zy + cx;
+						zy = 2 * zx * zy + cy;
+						zx = temp;
+						if (zx * zx + zy * zy > 4)
+						{
+							break;
+						}
+					}
+					const uint8_t value = static_cast<uint8_t>(255 * i / iterations);
+					std::memset(tile + (static_cast<size_t>(row) * TILE_SIZE + column) * 3, value, 3);
+				}
+			}
+		}
+	});
+	return image;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "BMPImage.h"
+#include "BufferPool.h"
+
+// Pixels stored in square tiles instead of rows, for the passes that walk the columns of an image: a tile of
+// 64 x 64 pixels is at most 16 KiB, so going down a column stays in the cache and in a few pages, where a row layout
+// jumps a whole row for every pixel. Images are converted from and to the row layout of BMPImage when loaded and saved.
+// Only the 8, 24 and 32 bits images can be tiled.
+class TiledImage
+{
+public:
+	static constexpr uint32_t TILE_SIZE = 64;
+
+private:
+	PixelBuffer _pixelData{PixelAllocator<uint8_t>(BufferPool::createAccount())};	// Tiles row after row from the bottom left one, each tile with its rows from the bottom
+	uint32_t _width;
+	uint32_t _height;
+	uint16_t _bitCount;
+	uint32_t _tileColumns;
+	uint32_t _tileRows;
+	std::vector<std::array<uint8_t, 4>> _palette;
+	bool _grayRamp;
+	int32_t _xPixelsPerMeter;
+	int32_t _yPixelsPerMeter;
+
+	uint16_t _getByteCount() const;
+	size_t _getTileSize() const;
+	uint8_t* _getTile(uint32_t tileX, uint32_t tileY);
+	const uint8_t* _getTile(uint32_t tileX, uint32_t tileY) const;
+
+public:
+	TiledImage(uint32_t width, uint32_t height, uint16_t bitCount = BMPImage::TRUE_COLOR_BIT_SIZE);
+	explicit TiledImage(const BMPImage& image);
+	explicit TiledImage(const char* filename);
+
+	BMPImage toImage() const;
+	void save(const char* filename) const;
+	uint32_t getWidth() const;
+	uint32_t getHeight() const;
+	uint16_t getBitCount() const;
+	uint8_t* pixel(uint32_t x, uint32_t y);
+	const uint8_t* pixel(uint32_t x, uint32_t y) const;
+
+	void rotate90(bool clockwise = true);
+	void blurVertical(uint32_t radius);
+	static TiledImage mandelbrot(int32_t width, int32_t height, int16_t iterations);
+};
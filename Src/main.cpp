@@ -1,6 +1,20 @@
 #include "BMPImage.h"
+#include "DeepZoomExporter.h"
+#include "DuplicateFinder.h"
+#include "ImageCache.h"
+#include "ImageHistory.h"
+#include "ImageIndex.h"
+#include "ImagePipeline.h"
+#include "ImageServer.h"
+#include "Instrumentation.h"
+#include "Log.h"
+#include "OperationChain.h"
 #include "Pixel.h"
+#include <algorithm>
+#include <csignal>
+#include <filesystem>
 #include <iostream>
+#include <limits>
 #include <vector>
 
 // Cross-platform terminal handling
@@ -35,6 +49,22 @@ namespace
     )" << "\n";
 	}
 
+    // Instrumentation counters printed when the program ends, set by --stats or --stats=json
+    enum class StatsOutput { NONE, SUMMARY, JSON };
+    StatsOutput statsOutput = StatsOutput::NONE;
+
+    void printStats()
+    {
+        if (statsOutput == StatsOutput::SUMMARY)
+        {
+            std::cout << Instrumentation::snapshot();
+        }
+        else if (statsOutput == StatsOutput::JSON)
+        {
+            Instrumentation::writeJson(std::cout, Instrumentation::snapshot());
+        }
+    }
+
     void waitForKey()
 	{
 		std::cout << "Press enter to continue...";
@@ -132,59 +162,54 @@ namespace
         return current;
     }
 
-    std::vector<std::string> getFilesInDirectory(const std::string& directoryPath, std::string extension = "") {
-        std::vector<std::string> fileNames;
-		if (extension[0] == '.' && extension.size() > 1)
-		{
-			extension = extension.substr(1);
-		}
-
-    #ifdef _WIN32
-        // Windows-specific implementation
-        WIN32_FIND_DATA findFileData;
-        HANDLE hFind = FindFirstFile((directoryPath + "\\*" + extension).c_str(), &findFileData);
+    // Decoded images, so reopening a file or browsing its neighbours does not decode it again
+    ImageCache& imageCache()
+    {
+        static ImageCache cache;
+        return cache;
+    }
 
-        if (hFind == INVALID_HANDLE_VALUE) {
-            std::cerr << "Error opening directory: " << directoryPath << std::endl;
-            return fileNames;
+    // Decode the files around the chosen one in the background
+    void prefetchNeighbours(const std::string& path, const std::vector<std::string>& files, const size_t chosen)
+    {
+        if (chosen > 0)
+        {
+            imageCache().prefetch(path + "/" + files[chosen - 1]);
         }
+        if (chosen + 1 < files.size())
+        {
+            imageCache().prefetch(path + "/" + files[chosen + 1]);
+        }
+    }
 
-        do {
-            const std::string fileName = findFileData.cFileName;
-            if (fileName != "." && fileName != "..") {
-                fileNames.push_back(fileName);
-            }
-        } while (FindNextFile(hFind, &findFileData) != 0);
-
-        FindClose(hFind);
-
-    #else
-        // Linux/macOS implementation using C++17 filesystem
-        try {
-            for (const auto& entry : fs::directory_iterator(directoryPath)) {
-                if (entry.is_regular_file() && entry.path().extension() == "." + extension) {  // Only add regular files with the specified extension
-                    fileNames.push_back(entry.path().filename().string());
-                }
+    // BMP files of a directory, with their size and depth read from the directory index
+    std::vector<std::string> listImages(const std::string& path, std::vector<std::string>& labels)
+    {
+        ImageIndex index(path);
+        index.refresh();
+        std::vector<std::string> files;
+        for (const ImageIndex::Entry& entry : index.getEntries(".bmp"))
+        {
+            if (entry.info.bitCount == 0)
+            {
+                continue;
             }
+            files.push_back(entry.name);
+            labels.push_back(entry.name + "  (" + std::to_string(entry.info.width) + "x" + std::to_string(entry.info.height) +
+                ", " + std::to_string(entry.info.bitCount) + " bits)");
         }
-        catch (const fs::filesystem_error& e) {
-            std::cerr << "Error accessing directory: " << e.what() << std::endl;
-        }
-    #endif
-
-        return fileNames;
+        return files;
     }
 
-
-    BMPImage openImage()
+    // Path of a file picked in the image directories, the files around it are decoded in the background when prefetch is set
+    std::string chooseFile(const bool prefetch)
 	{
 		// File selection menu
         std::string filename;
         std::string path = "Images";
 
         std::vector<std::string> fileOptions = {"File to open"};
-		std::vector<std::string> files = getFilesInDirectory(path, ".bmp");
-		fileOptions.insert(fileOptions.end(), files.begin(), files.end());
+		std::vector<std::string> files = listImages(path, fileOptions);
         fileOptions.push_back("Demo Images");
 		int choice = selectOption(fileOptions);
 		if (choice == fileOptions.size() - 1)
@@ -193,57 +218,235 @@ namespace
 			std::vector<std::string> demoImages = {
 				"File to open"
 			};
-			std::vector<std::string> demoFiles = getFilesInDirectory(path,".bmp");
-			demoImages.insert(demoImages.end(), demoFiles.begin(), demoFiles.end());
+			std::vector<std::string> demoFiles = listImages(path, demoImages);
 			int demoChoice = selectOption(demoImages);
-			filename = path + "/" +demoImages[demoChoice];
+			filename = path + "/" + (demoChoice > 0 ? demoFiles[demoChoice - 1] : "");
+			if (prefetch && demoChoice > 0)
+			{
+				prefetchNeighbours(path, demoFiles, demoChoice - 1);
+			}
 		}
 		else
 		{
-			filename = path + "/" + fileOptions[choice];
+			filename = path + "/" + (choice > 0 ? files[choice - 1] : "");
+			if (prefetch && choice > 0)
+			{
+				prefetchNeighbours(path, files, choice - 1);
+			}
 		}
+		return filename;
+	}
+
+    BMPImage openImage()
+	{
+		const std::string filename = chooseFile(true);
 		std::cout << "Opening " << filename << "...\n";
-        BMPImage image(filename.c_str());
+        // The cached image stays untouched, the caller edits a copy
+        BMPImage image(*imageCache().get(filename));
         return image;
 	}
 
+    // Deep zoom tiles of a file, streamed from the file
+    void exportTiles()
+	{
+		const std::string filename = chooseFile(false);
+		std::string destination;
+		std::cout << "Enter the destination (without extension): ";
+		std::cin >> destination;
+		std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		try
+		{
+			const size_t tileCount = DeepZoomExporter().exportFile(filename, destination);
+			std::cout << tileCount << " tiles written to " << destination << "_files\n";
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "Export failed: " << e.what() << "\n";
+		}
+		waitForKey();
+	}
+
     void exitProgram()
 	{
+		std::cout << imageCache().getStatistics() << "\n";
+		std::cout << BufferPool::instance().getStatistics() << "\n";
+		printStats();
 		std::cout << "Exiting program...\n";
 		exit(0);
 	}
 
-	void save(const BMPImage& image)
+	void save(BMPImage& image)
 	{
+		if (image.getBitCount() == BMPImage::GRAY_SCALE_BIT_SIZE)
+		{
+			std::vector<std::string> options = {
+				"Compress the pixels (run length encoding) ?",
+				"No",
+				"Yes",
+			};
+			image.setCompressed(selectOption(options) == 2);
+			system(CLEAR_SCREEN);
+		}
         std::string filename;
         std::cout << "Enter the filename: ";
         std::cin >> filename;
         filename = "Images/" + filename;
-		image.save(filename.c_str());
+		image.save(filename.c_str(), true);
 		std::cout << "Image saved successfully\n";
 	}
 
 
+	// Lookup tables that lose no value are kept by the history as the table and its inverse
+	ImageHistory::Result adjustColors(ImageHistory& history)
+	{
+		std::vector<std::string> options = {
+			"Which adjustment ?",
+			"Brightness",
+			"Contrast",
+			"Gamma",
+			"Invert colors",
+			"Grayscale",
+			"Equalize histogram",
+			"Auto levels",
+		};
+		int choice = selectOption(options);
+		system(CLEAR_SCREEN);
+		if (choice == 1)
+		{
+			int offset;
+			std::cout << "Enter the brightness offset (-255 to 255): ";
+			std::cin >> offset;
+			return history.applyLUT(ColorLUT().brightness(static_cast<int16_t>(offset)));
+		}
+		else if (choice == 2)
+		{
+			float factor;
+			std::cout << "Enter the contrast factor: ";
+			std::cin >> factor;
+			return history.applyLUT(ColorLUT().contrast(factor));
+		}
+		else if (choice == 3)
+		{
+			float gamma;
+			std::cout << "Enter the gamma: ";
+			std::cin >> gamma;
+			return history.applyLUT(ColorLUT().gamma(gamma));
+		}
+		else if (choice == 4)
+		{
+			return history.applyLUT(ColorLUT().invert());
+		}
+		else if (choice == 5)
+		{
+			return history.applyLUT(ColorLUT().grayscale());
+		}
+		else if (choice == 6)
+		{
+			return history.apply([](BMPImage& image) { image.equalizeHistogram(); });
+		}
+		else if (choice == 7)
+		{
+			return history.apply([](BMPImage& image) { image.autoLevels(); });
+		}
+		return ImageHistory::Result::UNCHANGED;
+	}
+
+	ImageHistory::Result reduceColors(ImageHistory& history)
+	{
+		int colorCount;
+		std::cout << "Enter the number of colors (2 to 256): ";
+		std::cin >> colorCount;
+		std::vector<std::string> options = {
+			"Which dithering ?",
+			"None",
+			"Ordered",
+			"Floyd-Steinberg",
+		};
+		int choice = selectOption(options);
+		ColorQuantizer::Dithering dithering = ColorQuantizer::Dithering::NONE;
+		if (choice == 2)
+		{
+			dithering = ColorQuantizer::Dithering::ORDERED;
+		}
+		else if (choice == 3)
+		{
+			dithering = ColorQuantizer::Dithering::FLOYD_STEINBERG;
+		}
+		return history.apply([colorCount, dithering](BMPImage& image) { image.quantize(static_cast<uint16_t>(colorCount), dithering); });
+	}
+
+	ImageHistory::Result changeColorDepth(ImageHistory& history)
+	{
+		std::vector<std::string> options = {
+			"Which color depth ?",
+			"32 bits (alpha)",
+			"24 bits (true color)",
+			"8 bits (grayscale)",
+			"1 bit (monochrome)",
+		};
+		const uint16_t bitCounts[] = {0, BMPImage::DEEP_COLOR_BIT_SIZE, BMPImage::TRUE_COLOR_BIT_SIZE,
+			BMPImage::GRAY_SCALE_BIT_SIZE, BMPImage::MONOCHROME_BIT_SIZE};
+		int choice = selectOption(options);
+		if (choice > 0)
+		{
+			const uint16_t bitCount = bitCounts[choice];
+			return history.apply([bitCount](BMPImage& image) { image.convertTo(bitCount); });
+		}
+		return ImageHistory::Result::UNCHANGED;
+	}
+
+	ImageHistory::Result overlayImage(ImageHistory& history)
+	{
+		BMPImage overlay = openImage();
+		int x, y;
+		std::cout << "Enter the column of the overlay: ";
+		std::cin >> x;
+		std::cout << "Enter the row of the overlay: ";
+		std::cin >> y;
+		std::vector<std::string> options = {
+			"Which blending ?",
+			"Over",
+			"Multiply",
+			"Screen",
+			"Additive",
+		};
+		const Blender::Mode modes[] = {Blender::Mode::OVER, Blender::Mode::OVER, Blender::Mode::MULTIPLY,
+			Blender::Mode::SCREEN, Blender::Mode::ADDITIVE};
+		int choice = selectOption(options);
+		const Blender::Mode mode = modes[choice];
+		return history.apply([&overlay, x, y, mode](BMPImage& image) { image.composite(overlay, x, y, mode); });
+	}
+
 	void manipulate_image(BMPImage& image)
 	{
 		std::vector<std::string> options = {
             "What to do ?",
 			"Apply a factor to the size",
 			"Manual Resize",
+			"Adjust colors",
+			"Reduce colors",
+			"Change color depth",
+			"Overlay an image",
+			"Rotate a quarter turn",
+			"Undo",
+			"Redo",
 			"Save",
 			"Return to menu",
 		};
         bool saved = false;
+        // Every change goes through the history, which keeps the changed tiles or the inverse of the operation
+        ImageHistory history(image);
         while (true)
         {
 			int choice = selectOption(options);
             system(CLEAR_SCREEN);
+			ImageHistory::Result result = ImageHistory::Result::UNCHANGED;
             if (choice == 1)
             {
 				float factor;
 				std::cout << "Enter the factor: ";
 				std::cin >> factor;
-				image.multiplySize(factor);
+				result = history.apply([factor](BMPImage& changed) { changed.multiplySize(factor); });
 			}
 			else if (choice == 2)
 			{
@@ -252,14 +455,66 @@ namespace
 				std::cin >> width;
 				std::cout << "Enter the new height: ";
 				std::cin >> height;
-				image.resize(width, height);
+				result = history.apply([width, height](BMPImage& changed) { changed.resize(width, height); });
 			}
 			else if (choice == 3)
+			{
+				result = adjustColors(history);
+			}
+			else if (choice == 4)
+			{
+				result = reduceColors(history);
+			}
+			else if (choice == 5)
+			{
+				result = changeColorDepth(history);
+			}
+			else if (choice == 6)
+			{
+				result = overlayImage(history);
+			}
+			else if (choice == 7)
+			{
+				result = history.apply([](BMPImage& changed) { changed.rotate90(true); }, [](BMPImage& changed) { changed.rotate90(false); });
+			}
+			else if (choice == 8)
+			{
+				if (history.undo())
+				{
+					saved = false;
+				}
+				else
+				{
+					std::cout << "Nothing to undo\n";
+				}
+			}
+			else if (choice == 9)
+			{
+				if (history.redo())
+				{
+					saved = false;
+				}
+				else
+				{
+					std::cout << "Nothing to redo\n";
+				}
+			}
+			else if (choice == 10)
 			{
 				save(image);
 				saved = true;
             }
-			if (choice == 4)
+			// Warnings repeated for many pixels are written once per operation
+			Log::flush();
+			if (result == ImageHistory::Result::TOO_LARGE)
+			{
+				std::cout << "This change is too large for the undo history, the previous changes can not be undone anymore\n";
+			}
+			if (result != ImageHistory::Result::UNCHANGED)
+			{
+				saved = false;
+			}
+			if (choice == 11)
 			{
                 if (!saved)
                 {
@@ -306,7 +561,190 @@ namespace
 }
 
 
-int main() {
+namespace
+{
+    ImageServer* runningServer = nullptr;
+
+    void stopServer(int)
+    {
+        runningServer->stop();
+    }
+
+    // Server mode, for scripts: ImageProject [--results directory] --server [socket path]
+    int runServer(const std::string& socketPath, const std::string& resultCacheDirectory)
+    {
+        try
+        {
+            // The result cache directory is created and listed by the constructor
+            ImageServer server(socketPath, std::thread::hardware_concurrency(), ImageCache::DEFAULT_CAPACITY,
+                ImageServer::DEFAULT_REQUEST_MEMORY_LIMIT, resultCacheDirectory);
+            runningServer = &server;
+            std::signal(SIGINT, stopServer);
+            std::signal(SIGTERM, stopServer);
+            std::cout << "Listening on " << socketPath << "\n";
+            server.run();
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            runningServer = nullptr;
+            std::cout << server.getStatistics() << "\n" << server.getCacheStatistics() << "\n";
+            if (server.hasResultCache())
+            {
+                std::cout << server.getResultCacheStatistics() << "\n";
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+            runningServer = nullptr;
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        std::cout << BufferPool::instance().getStatistics() << "\n";
+        return 0;
+    }
+}
+
+namespace
+{
+    // Batch mode: ImageProject --batch <input directory> <output directory> "<operations>"
+    // Every image of the input directory goes through the operations into a file of the same name in the output directory
+    int runBatch(const std::string& inputDirectory, const std::string& outputDirectory, const std::string& operations)
+    {
+        try
+        {
+            const OperationChain chain(operations);
+            std::filesystem::create_directories(outputDirectory);
+            ImageIndex index(inputDirectory);
+            index.refresh();
+            std::vector<ImagePipeline::Job> jobs;
+            for (const ImageIndex::Entry& entry : index.getEntries())
+            {
+                if (entry.info.bitCount != 0)
+                {
+                    jobs.push_back({inputDirectory + "/" + entry.name, outputDirectory + "/" + entry.name});
+                }
+            }
+            const ImagePipeline pipeline([&chain](BMPImage& image) { chain.apply(image); });
+            const ImagePipeline::Statistics statistics = pipeline.run(jobs, [](const ImagePipeline::Result& result)
+            {
+                if (result.succeeded)
+                {
+                    std::cout << result.input << " -> " << result.output << "\n";
+                }
+                else
+                {
+                    std::cerr << result.input << ": " << result.error << "\n";
+                }
+            });
+            std::cout << statistics << "\n";
+            return statistics.failureCount == 0 ? 0 : 1;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    // Duplicates mode: ImageProject --duplicates <directory> [max distance] [dct|difference]
+    // Lists the pairs of images of the directory and its subdirectories whose perceptual hashes are within the distance
+    int runDuplicates(const std::string& directory, const uint32_t maxDistance, const PerceptualHash::Kind kind)
+    {
+        try
+        {
+            DuplicateFinder finder(kind);
+            finder.addDirectory(directory);
+            for (const DuplicateFinder::Pair& pair : finder.findPairs(maxDistance))
+            {
+                std::cout << pair.distance << "\t" << pair.first << "\t" << pair.second << "\n";
+            }
+            std::cout << finder.getStatistics() << "\n";
+            return 0;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> arguments(argv + 1, argv + argc);
+    const auto stats = std::find_if(arguments.begin(), arguments.end(),
+        [](const std::string& argument) { return argument == "--stats" || argument == "--stats=json"; });
+    if (stats != arguments.end())
+    {
+        statsOutput = *stats == "--stats=json" ? StatsOutput::JSON : StatsOutput::SUMMARY;
+        arguments.erase(stats);
+    }
+    // Directory of the results memoized by the server
+    std::string resultCacheDirectory;
+    const auto results = std::find(arguments.begin(), arguments.end(), "--results");
+    if (results != arguments.end() && results + 1 != arguments.end())
+    {
+        resultCacheDirectory = *(results + 1);
+        arguments.erase(results, results + 2);
+    }
+    if (!arguments.empty() && arguments[0] == "--batch")
+    {
+        if (arguments.size() != 4)
+        {
+            std::cerr << "Usage: ImageProject --batch <input directory> <output directory> \"<operations>\"\n";
+            return 1;
+        }
+        const int result = runBatch(arguments[1], arguments[2], arguments[3]);
+        printStats();
+        return result;
+    }
+    if (!arguments.empty() && arguments[0] == "--duplicates")
+    {
+        uint32_t maxDistance = DuplicateFinder::DEFAULT_MAX_DISTANCE;
+        PerceptualHash::Kind kind = PerceptualHash::Kind::DCT;
+        try
+        {
+            if (arguments.size() < 2 || arguments.size() > 4)
+            {
+                throw std::invalid_argument("Wrong number of arguments");
+            }
+            if (arguments.size() > 2)
+            {
+                maxDistance = static_cast<uint32_t>(std::stoul(arguments[2]));
+            }
+            if (arguments.size() > 3)
+            {
+                kind = PerceptualHash::kindOf(arguments[3]);
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "Usage: ImageProject --duplicates <directory> [max distance] [dct|difference]\n";
+            return 1;
+        }
+        const int result = runDuplicates(arguments[1], maxDistance, kind);
+        printStats();
+        return result;
+    }
+    if (!arguments.empty() && arguments[0] == "--server")
+    {
+        const int result = runServer(arguments.size() > 1 ? arguments[1] : ImageServer::DEFAULT_SOCKET_PATH, resultCacheDirectory);
+        printStats();
+        return result;
+    }
+    // The interactive program reports the progress of the operations on the standard output
+    Log::setLevel(Log::Level::INFO);
+    Log::setSink([](const Log::Level level, const std::string& message)
+    {
+        if (level == Log::Level::INFO)
+        {
+            std::cout << message << "\n";
+        }
+        else
+        {
+            std::cerr << Log::nameOf(level) << ": " << message << "\n";
+        }
+    });
 	displayLogo();
     waitForKey();
 
@@ -315,6 +753,7 @@ int main() {
         "Welcome to this BMP Image Manipulation Program",
 		"Open Existing Image",
 		"Generate New Image",
+		"Export Deep Zoom Tiles",
 		"Exit",
 	};
     BMPImage currentImage;
@@ -330,6 +769,9 @@ int main() {
 			manipulate_image(currentImage);
         }
         else if (choice == 3) {
+            exportTiles();
+        }
+        else if (choice == 4) {
             exitProgram();
         }
 	}